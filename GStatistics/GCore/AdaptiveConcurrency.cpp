@@ -0,0 +1,134 @@
+﻿#include "AdaptiveConcurrency.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    const double kTolerance = 2.0;          // рост времени ответа до 2x минимума не считается очередью
+    const double kSmoothing = 0.2;          // доля нового значения лимита
+    const double kMinGradient = 0.5;        // снижение по задержке - не больше чем вдвое за замер
+    const int kMinRttWindow = 500;          // замеров до сброса минимального времени ответа
+    const int kBatchPerSlot = 4;            // запросов в пачке на слот: слот не простаивает до следующей пачки
+}
+
+AdaptiveConcurrency::AdaptiveConcurrency() : max_limit(64), enabled(false) {
+    InitializeCriticalSection(&cs);
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    frequency = freq.QuadPart;
+}
+
+AdaptiveConcurrency::~AdaptiveConcurrency() {
+    DeleteCriticalSection(&cs);
+}
+
+void AdaptiveConcurrency::SetEnabled(bool value) {
+    EnterCriticalSection(&cs);
+    enabled = value;
+    LeaveCriticalSection(&cs);
+}
+
+bool AdaptiveConcurrency::IsEnabled() const {
+    EnterCriticalSection(&cs);
+    bool value = enabled;
+    LeaveCriticalSection(&cs);
+    return value;
+}
+
+void AdaptiveConcurrency::SetMaxLimit(int value) {
+    EnterCriticalSection(&cs);
+    max_limit = std::max(1, value);
+    for (std::map<std::wstring, HostState>::iterator it = hosts.begin(); it != hosts.end(); ++it)
+        it->second.limit = std::min(it->second.limit, (double)max_limit);
+    LeaveCriticalSection(&cs);
+}
+
+AdaptiveConcurrency::HostState& AdaptiveConcurrency::State(const std::wstring& host) {
+    std::map<std::wstring, HostState>::iterator it = hosts.find(host);
+    if (it == hosts.end()) {
+        HostState state = { (double)std::min((int)kInitialLimit, max_limit), 0, 0, 0, 0, 0, 0, 0, 0 };
+        it = hosts.insert(std::make_pair(host, state)).first;
+    }
+    return it->second;
+}
+
+int AdaptiveConcurrency::GetLimit(const std::wstring& host) {
+    EnterCriticalSection(&cs);
+    int limit = (int)State(host).limit;
+    LeaveCriticalSection(&cs);
+    return std::max(1, limit);
+}
+
+void AdaptiveConcurrency::Record(const std::wstring& host, bool success, int http_status, long long rtt_us) {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    EnterCriticalSection(&cs);
+    HostState& state = State(host);
+
+    if (success) {
+        state.successes++;
+
+        double sample = (double)std::max(1LL, rtt_us);
+        state.rtt_us = state.rtt_us > 0 ? state.rtt_us * 0.8 + sample * 0.2 : sample;
+        state.min_rtt_us = state.min_rtt_us > 0 ? std::min(state.min_rtt_us, sample) : sample;
+        if (++state.samples >= kMinRttWindow) {
+            state.min_rtt_us = state.rtt_us;
+            state.samples = 0;
+        }
+
+        double gradient = std::max(kMinGradient, std::min(1.0, kTolerance * state.min_rtt_us / state.rtt_us));
+        double wanted = state.limit * gradient + std::sqrt(state.limit);
+        state.limit = state.limit * (1.0 - kSmoothing) + wanted * kSmoothing;
+    }
+    else {
+        state.failures++;
+
+        // Ошибки клиента (кроме 408 и 429) не говорят о перегрузке сервера
+        bool overload = http_status == 0 || http_status == 408 || http_status == 429 || http_status >= 500;
+        if (overload) {
+            state.overloads++;
+
+            long long window = (long long)(std::max(state.rtt_us, 1000.0) * frequency / 1000000.0);
+            if (now.QuadPart - state.last_decrease >= window) {
+                state.limit /= 2;
+                state.decreases++;
+                state.last_decrease = now.QuadPart;
+            }
+        }
+    }
+
+    state.limit = std::max(1.0, std::min(state.limit, (double)max_limit));
+    LeaveCriticalSection(&cs);
+}
+
+int AdaptiveConcurrency::SuggestBatchSize(int min_size, int max_size) const {
+    EnterCriticalSection(&cs);
+    long long slots = 0;
+    for (std::map<std::wstring, HostState>::const_iterator it = hosts.begin(); it != hosts.end(); ++it)
+        slots += (long long)it->second.limit;
+    LeaveCriticalSection(&cs);
+
+    long long size = std::max(1LL, slots) * kBatchPerSlot;
+    return (int)std::max((long long)min_size, std::min((long long)max_size, size));
+}
+
+void AdaptiveConcurrency::GetStats(std::vector<HostConcurrencyStats>& stats) const {
+    stats.clear();
+
+    EnterCriticalSection(&cs);
+    for (std::map<std::wstring, HostState>::const_iterator it = hosts.begin(); it != hosts.end(); ++it) {
+        const HostState& state = it->second;
+        HostConcurrencyStats item;
+        item.host = it->first;
+        item.limit = std::max(1, (int)state.limit);
+        item.rtt_us = (long long)state.rtt_us;
+        item.min_rtt_us = (long long)state.min_rtt_us;
+        item.successes = state.successes;
+        item.failures = state.failures;
+        item.overloads = state.overloads;
+        item.decreases = state.decreases;
+        stats.push_back(item);
+    }
+    LeaveCriticalSection(&cs);
+}
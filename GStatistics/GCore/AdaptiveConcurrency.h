@@ -0,0 +1,108 @@
+﻿#pragma once
+#ifndef ADAPTIVE_CONCURRENCY_H
+#define ADAPTIVE_CONCURRENCY_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <windows.h>
+
+/**
+ * @struct HostConcurrencyStats
+ * @brief Состояние регулятора одновременных отправок одного хоста
+ */
+struct HostConcurrencyStats {
+    std::wstring host;
+    int limit;                      ///< Текущий лимит отправок в полете
+    long long rtt_us;               ///< Сглаженное время ответа, мкс
+    long long min_rtt_us;           ///< Время ответа без очереди на сервере (минимум за окно), мкс
+    long long successes;
+    long long failures;             ///< Все неудачные отправки
+    long long overloads;            ///< Неудачи перегрузки: нет ответа, 429, 5xx
+    long long decreases;            ///< Сколько раз лимит уменьшался вдвое
+};
+
+/**
+ * @class AdaptiveConcurrency
+ * @brief Лимит одновременных отправок по хостам, подстраиваемый по времени ответа и ошибкам
+ * @details Рост лимита определяется градиентом задержки: пока время ответа близко
+ *          к минимальному, к лимиту добавляется запас sqrt(limit) и лимит растет;
+ *          когда время ответа растет (на сервере копится очередь), лимит
+ *          пропорционально снижается. Ошибка перегрузки уменьшает лимит вдвое, но
+ *          не чаще раза за время ответа: все запросы, которые были в полете, видят
+ *          одну и ту же перегрузку. Минимальное время ответа периодически
+ *          сбрасывается к текущему, чтобы следовать за изменением сети и сервера.
+ */
+class AdaptiveConcurrency {
+public:
+    static const int kInitialLimit = 4;     ///< Лимит нового хоста
+
+    AdaptiveConcurrency();
+    ~AdaptiveConcurrency();
+
+    /**
+     * @brief Включает или отключает регулирование (лимиты хостов сохраняются)
+     */
+    void SetEnabled(bool enabled);
+
+    bool IsEnabled() const;
+
+    /**
+     * @brief Задает верхнюю границу лимита хоста
+     * @param max_limit Граница (>= 1), обычно лимит отправок на хост диспетчера
+     */
+    void SetMaxLimit(int max_limit);
+
+    /**
+     * @brief Текущий лимит хоста
+     */
+    int GetLimit(const std::wstring& host);
+
+    /**
+     * @brief Учитывает завершенную отправку
+     * @param host Хост
+     * @param success Отправка успешна
+     * @param http_status HTTP статус (0 - ответ не получен)
+     * @param rtt_us Время отправки, мкс
+     */
+    void Record(const std::wstring& host, bool success, int http_status, long long rtt_us);
+
+    /**
+     * @brief Размер пачки, при котором все разрешенные слоты заняты
+     * @param min_size Минимальный размер
+     * @param max_size Максимальный размер
+     * @return Сумма лимитов хостов с запасом, в пределах min_size..max_size
+     */
+    int SuggestBatchSize(int min_size, int max_size) const;
+
+    /**
+     * @brief Состояние всех хостов, по алфавиту
+     */
+    void GetStats(std::vector<HostConcurrencyStats>& stats) const;
+
+private:
+    struct HostState {
+        double limit;
+        double rtt_us;
+        double min_rtt_us;
+        long long last_decrease;    ///< Время последнего уменьшения вдвое (счетчик QPC)
+        int samples;                ///< Замеров с последнего сброса минимума
+        long long successes;
+        long long failures;
+        long long overloads;
+        long long decreases;
+    };
+
+    mutable CRITICAL_SECTION cs;
+    std::map<std::wstring, HostState> hosts;
+    int max_limit;
+    bool enabled;
+    long long frequency;
+
+    HostState& State(const std::wstring& host);
+
+    AdaptiveConcurrency(const AdaptiveConcurrency&);
+    AdaptiveConcurrency& operator=(const AdaptiveConcurrency&);
+};
+
+#endif
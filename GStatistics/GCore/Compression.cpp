@@ -0,0 +1,85 @@
+﻿#include "Compression.h"
+#include <compressapi.h>
+#include <cstring>
+
+#pragma comment(lib, "cabinet.lib")
+
+namespace {
+
+const char kMagic[4] = { 'G', 'C', 'Z', '1' };
+const size_t kHeaderSize = sizeof(kMagic) + sizeof(UINT32);
+
+// Создание компрессора дорогое, поэтому держим по одному экземпляру на поток
+struct CodecHandles {
+    COMPRESSOR_HANDLE compressor = nullptr;
+    DECOMPRESSOR_HANDLE decompressor = nullptr;
+
+    ~CodecHandles() {
+        if (compressor) CloseCompressor(compressor);
+        if (decompressor) CloseDecompressor(decompressor);
+    }
+};
+
+thread_local CodecHandles t_codec;
+
+COMPRESSOR_HANDLE GetCompressor() {
+    if (!t_codec.compressor)
+        CreateCompressor(COMPRESS_ALGORITHM_XPRESS_HUFF | COMPRESS_RAW, NULL, &t_codec.compressor);
+    return t_codec.compressor;
+}
+
+DECOMPRESSOR_HANDLE GetDecompressor() {
+    if (!t_codec.decompressor)
+        CreateDecompressor(COMPRESS_ALGORITHM_XPRESS_HUFF | COMPRESS_RAW, NULL, &t_codec.decompressor);
+    return t_codec.decompressor;
+}
+
+} // namespace
+
+bool IsCompressedBody(const void* data, size_t size) {
+    return data && size >= kHeaderSize && memcmp(data, kMagic, sizeof(kMagic)) == 0;
+}
+
+bool CompressBody(const std::string& input, std::string& output) {
+    if (input.empty() || input.size() > 0xFFFFFFFFu) return false;
+
+    COMPRESSOR_HANDLE compressor = GetCompressor();
+    if (!compressor) return false;
+
+    // Результат больше исходника не нужен: такое тело храним как есть
+    std::string buffer(kHeaderSize + input.size(), '\0');
+    SIZE_T compressed_size = 0;
+    if (!Compress(compressor, input.data(), input.size(),
+        &buffer[kHeaderSize], input.size(), &compressed_size)) {
+        return false;
+    }
+
+    UINT32 original_size = (UINT32)input.size();
+    memcpy(&buffer[0], kMagic, sizeof(kMagic));
+    memcpy(&buffer[sizeof(kMagic)], &original_size, sizeof(original_size));
+    buffer.resize(kHeaderSize + compressed_size);
+
+    output.swap(buffer);
+    return true;
+}
+
+bool DecompressBody(const void* data, size_t size, std::string& output) {
+    if (!IsCompressedBody(data, size)) return false;
+
+    DECOMPRESSOR_HANDLE decompressor = GetDecompressor();
+    if (!decompressor) return false;
+
+    const char* bytes = static_cast<const char*>(data);
+    UINT32 original_size = 0;
+    memcpy(&original_size, bytes + sizeof(kMagic), sizeof(original_size));
+
+    std::string buffer(original_size, '\0');
+    SIZE_T decompressed_size = 0;
+    if (!Decompress(decompressor, bytes + kHeaderSize, size - kHeaderSize,
+        &buffer[0], buffer.size(), &decompressed_size) || decompressed_size != original_size) {
+        return false;
+    }
+
+    output.swap(buffer);
+    return true;
+}
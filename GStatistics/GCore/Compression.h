@@ -0,0 +1,41 @@
+﻿#pragma once
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <string>
+#include <windows.h>
+
+/**
+ * @file Compression.h
+ * @brief Сжатие тел запросов и ответов для хранения в базе данных
+ * @details Используется Windows Compression API (XPRESS + Huffman) в raw-режиме.
+ *          Сжатый блок начинается с сигнатуры "GCZ1" и исходного размера,
+ *          что позволяет при чтении отличить его от обычного текста.
+ */
+
+/**
+ * @brief Проверяет, является ли блок данных результатом CompressBody
+ * @param data Указатель на данные
+ * @param size Размер данных в байтах
+ * @return true если блок начинается с сигнатуры сжатых данных
+ */
+bool IsCompressedBody(const void* data, size_t size);
+
+/**
+ * @brief Сжимает тело запроса или ответа
+ * @param input Исходные данные (UTF-8)
+ * @param output Сжатый блок с заголовком
+ * @return true если сжатие выполнено и результат меньше исходных данных
+ */
+bool CompressBody(const std::string& input, std::string& output);
+
+/**
+ * @brief Распаковывает блок, созданный CompressBody
+ * @param data Указатель на сжатый блок
+ * @param size Размер сжатого блока в байтах
+ * @param output Распакованные данные (UTF-8)
+ * @return true при успешной распаковке, false при повреждённых данных
+ */
+bool DecompressBody(const void* data, size_t size, std::string& output);
+
+#endif
@@ -1,5 +1,5 @@
 #include "EventManager.h"
-#include "Utilities.h" //   
+#include "Utilities.h" // для функций конвертации
 
 EventCallback EventManager::m_callback = nullptr;
 
@@ -1,4 +1,4 @@
-// GCore.h -  
+// GCore.h - отдельный файл
 #pragma once
 #ifndef GCORE_H
 #define GCORE_H
@@ -10,188 +10,647 @@ extern "C" {
 #endif
 
 	//-----------------------------------------------------------------------------
-	//    
+	// Основные функции отправки запросов
 	//-----------------------------------------------------------------------------
 
 	/**
-	 * @brief  HTTP POST    
-	 * @param serverUrl URL     (UTF-16)
-	 * @param jsonBody JSON   (UTF-16)
-	 * @return 0  , 1  
+	 * @brief Отправляет HTTP POST запрос без ожидания ответа
+	 * @param serverUrl URL сервера для отправки запроса (UTF-16)
+	 * @param jsonBody JSON тело запроса (UTF-16)
+	 * @return 0 при успехе, 1 при ошибке
 	 */
 	__declspec(dllexport) int __stdcall SendHttpRequest(const wchar_t* serverUrl, const wchar_t* jsonBody);
 
 	/**
-	 * @brief  HTTP POST     
-	 * @param serverUrl URL     (UTF-16)
-	 * @param jsonBody JSON   (UTF-16)
-	 * @return      (UTF-16)    
+	 * @brief Отправляет HTTP POST запрос и возвращает ответ сервера
+	 * @param serverUrl URL сервера для отправки запроса (UTF-16)
+	 * @param jsonBody JSON тело запроса (UTF-16)
+	 * @return Ответ сервера в виде строки (UTF-16) или сообщение об ошибке
 	 */
 	__declspec(dllexport) const wchar_t* __stdcall SendHttpRequestResponse(const wchar_t* serverUrl, const wchar_t* jsonBody);
 
 	/**
-	 * @brief  :  HTTP POST    
-	 * @param serverUrl URL  (UTF-16)
-	 * @param jsonBody JSON   (UTF-16)
-	 * @param useSendEvent     EventManager
-	 * @param useQueueEvent     
-	 * @return 0  , 1  
+	 * @brief Расширенная версия: Отправляет HTTP POST запрос без ожидания ответа
+	 * @param serverUrl URL сервера (UTF-16)
+	 * @param jsonBody JSON тело запроса (UTF-16)
+	 * @param useSendEvent Управлять отправкой события через EventManager
+	 * @param useQueueEvent Управлять добавлением события в очередь
+	 * @return 0 при успехе, 1 при ошибке
 	 */
 	__declspec(dllexport) int __stdcall SendHttpRequestEx(const wchar_t* serverUrl, const wchar_t* jsonBody, bool useSendEvent, bool useQueueEvent);
 
 	/**
-	 * @brief  :  HTTP POST     
-	 * @param serverUrl URL  (UTF-16)
-	 * @param jsonBody JSON   (UTF-16)
-	 * @param useSendEvent     EventManager
-	 * @param useQueueEvent     
-	 * @return      (UTF-16)    
+	 * @brief Расширенная версия: Отправляет HTTP POST запрос и возвращает ответ сервера
+	 * @param serverUrl URL сервера (UTF-16)
+	 * @param jsonBody JSON тело запроса (UTF-16)
+	 * @param useSendEvent Управлять отправкой события через EventManager
+	 * @param useQueueEvent Управлять добавлением события в очередь
+	 * @return Ответ сервера в виде строки (UTF-16) или сообщение об ошибке
 	 */
 	__declspec(dllexport) const wchar_t* __stdcall SendHttpRequestResponseEx(const wchar_t* serverUrl, const wchar_t* jsonBody, bool useSendEvent, bool useQueueEvent);
 
 
 	//-----------------------------------------------------------------------------
-	//     
+	// Функции работы с очередью запросов
 	//-----------------------------------------------------------------------------
 
 	/**
-	 * @brief       
-	 * @param serverUrl URL     (UTF-16)
-	 * @param jsonBody JSON   (UTF-16)
-	 * @param expectResponse      (true -  )
-	 * @return 0     , 1  
+	 * @brief Добавляет запрос в очередь для последующей отправки
+	 * @param serverUrl URL сервера для отправки запроса (UTF-16)
+	 * @param jsonBody JSON тело запроса (UTF-16)
+	 * @param expectResponse Флаг ожидания ответа от сервера (true - ждем ответ)
+	 * @return 0 при успешном добавлении в очередь, 1 при ошибке, 2 - очередь переполнена
+	 *         (SetHttpQueueBackpressure), запрос не добавлен
 	 */
 	__declspec(dllexport) int __stdcall SendHttpRequestQueue(const wchar_t* serverUrl, const wchar_t* jsonBody, bool expectResponse);
 
 	/**
-	 * @brief     
-	 * @return 0    , 1  
+	 * @brief Добавляет запрос в очередь с ключом объединения
+	 * @param serverUrl URL сервера для отправки запроса (UTF-16)
+	 * @param jsonBody JSON тело запроса (UTF-16)
+	 * @param expectResponse Флаг ожидания ответа от сервера
+	 * @param coalesceKey Ключ объединения (например, AccountID); NULL или пустая строка - как SendHttpRequestQueue
+	 * @return 0 при успешном добавлении, 1 при ошибке, 2 - очередь переполнена
+	 * @details Ожидающий запрос на тот же URL с тем же ключом заменяется новым и
+	 *          отправляется только последнее значение. Новый запрос занимает место
+	 *          в очереди самого старого замененного. Журнал (SetHttpQueueBackend(1))
+	 *          запросы не объединяет.
+	 */
+	__declspec(dllexport) int __stdcall SendHttpRequestQueueKey(const wchar_t* serverUrl, const wchar_t* jsonBody, bool expectResponse, const wchar_t* coalesceKey);
+
+	/**
+	 * @brief Запускает фоновую обработку очереди запросов
+	 * @return 0 при успешном запуске, 1 при ошибке
+	 * @details Проход выполняется в отдельном потоке. Пока проход идет, новый вызов
+	 *          не создает поток: идущий проход по окончании выполняется еще раз и
+	 *          забирает запросы, добавленные во время него.
 	 */
 	__declspec(dllexport) int __stdcall ProcessHttpQueue();
 
 	/**
-	 * @brief         
-	 * @param serverUrl URL     (UTF-16)
-	 * @param jsonBody JSON     (UTF-16)
-	 * @return       (UTF-16)
+	 * @brief Получает ответ из базы данных и удаляет соответствующие записи
+	 * @param serverUrl URL сервера для поиска ответа (UTF-16)
+	 * @param jsonBody JSON тело запроса для поиска (UTF-16)
+	 * @return Найденный ответ или сообщение об ошибке (UTF-16)
 	 */
 	__declspec(dllexport) const wchar_t* __stdcall GetHttpResponse(const wchar_t* serverUrl, const wchar_t* jsonBody);
 
 	/**
-	 * @brief  :       
-	 * @param serverUrl URL  (UTF-16)
-	 * @param jsonBody JSON   (UTF-16)
-	 * @param expectResponse   
-	 * @param useSendEvent     EventManager
-	 * @param useQueueEvent     
-	 * @return 0  , 1  
+	 * @brief Расширенная версия: Добавляет запрос в очередь для последующей отправки
+	 * @param serverUrl URL сервера (UTF-16)
+	 * @param jsonBody JSON тело запроса (UTF-16)
+	 * @param expectResponse Флаг ожидания ответа
+	 * @param useSendEvent Управлять отправкой события через EventManager
+	 * @param useQueueEvent Управлять добавлением события в очередь
+	 * @return 0 при успехе, 1 при ошибке, 2 - очередь переполнена
 	 */
 	__declspec(dllexport) int __stdcall SendHttpRequestQueueEx(const wchar_t* serverUrl, const wchar_t* jsonBody, bool expectResponse, bool useSendEvent, bool useQueueEvent);
 
 	/**
-	 * @brief  :     
-	 * @param useSendEvent     EventManager
-	 * @param useQueueEvent     
-	 * @return 0    , 1  
+	 * @brief Расширенная версия: Запускает фоновую обработку очереди запросов
+	 * @param useSendEvent Управлять отправкой события через EventManager
+	 * @param useQueueEvent Управлять добавлением события в очередь
+	 * @return 0 при успешном запуске, 1 при ошибке
 	 */
 	__declspec(dllexport) int __stdcall ProcessHttpQueueEx(bool useSendEvent, bool useQueueEvent);
 
 	/**
-	 * @brief  :         
-	 * @param serverUrl URL  (UTF-16)
-	 * @param jsonBody JSON   (UTF-16)
-	 * @param useSendEvent     EventManager
-	 * @param useQueueEvent     
-	 * @return       (UTF-16)
+	 * @brief Расширенная версия: Получает ответ из базы данных и удаляет соответствующие записи
+	 * @param serverUrl URL сервера (UTF-16)
+	 * @param jsonBody JSON тело запроса (UTF-16)
+	 * @param useSendEvent Управлять отправкой события через EventManager
+	 * @param useQueueEvent Управлять добавлением события в очередь
+	 * @return Найденный ответ или сообщение об ошибке (UTF-16)
 	 */
 	__declspec(dllexport) const wchar_t* __stdcall GetHttpResponseEx(const wchar_t* serverUrl, const wchar_t* jsonBody, bool useSendEvent, bool useQueueEvent);
 
 
 	//-----------------------------------------------------------------------------
-	//    
+	// Функции управления базой данных
 	//-----------------------------------------------------------------------------
 
 	/**
-	 * @brief      
-	 * @param hoursOld      
-	 * @param cleanResponses     (true)    (false)
-	 * @return   
+	 * @brief Очищает старые записи из базы данных
+	 * @param hoursOld Возраст записей в часах для удаления
+	 * @param cleanResponses Флаг очистки таблицы ответов (true) или только очереди (false)
+	 * @return Количество удаленных записей
 	 */
 	__declspec(dllexport) int __stdcall CleanOldHttpItems(int hoursOld, bool cleanResponses);
 
 	/**
-	 * @brief       
-	 * @param hoursOld      
-	 * @param checkResponses     (true)    (false)
-	 * @return   
+	 * @brief Возвращает количество старых записей в базе данных
+	 * @param hoursOld Возраст записей в часах для проверки
+	 * @param checkResponses Флаг проверки таблицы ответов (true) или только очереди (false)
+	 * @return Количество найденных записей
 	 */
 	__declspec(dllexport) int __stdcall GetOldHttpItemsCount(int hoursOld, bool checkResponses);
 
 	/**
-	 * @brief  :      
-	 * @param hoursOld    
-	 * @param cleanResponses true -   , false -  
-	 * @param useSendEvent     EventManager
-	 * @param useQueueEvent     
-	 * @return   
+	 * @brief Расширенная версия: Очищает старые записи из базы данных
+	 * @param hoursOld Возраст записей в часах
+	 * @param cleanResponses true - чистить таблицу ответов, false - только очередь
+	 * @param useSendEvent Управлять отправкой события через EventManager
+	 * @param useQueueEvent Управлять добавлением события в очередь
+	 * @return Количество удаленных записей
 	 */
 	__declspec(dllexport) int __stdcall CleanOldHttpItemsEx(int hoursOld, bool cleanResponses, bool useSendEvent, bool useQueueEvent);
 
 	/**
-	 * @brief  :       
-	 * @param hoursOld    
-	 * @param checkResponses true -   , false -  
-	 * @param useSendEvent     EventManager
-	 * @param useQueueEvent     
-	 * @return   
+	 * @brief Расширенная версия: Возвращает количество старых записей в базе данных
+	 * @param hoursOld Возраст записей в часах
+	 * @param checkResponses true - проверять таблицу ответов, false - только очередь
+	 * @param useSendEvent Управлять отправкой события через EventManager
+	 * @param useQueueEvent Управлять добавлением события в очередь
+	 * @return Количество найденных записей
 	 */
 	__declspec(dllexport) int __stdcall GetOldHttpItemsCountEx(int hoursOld, bool checkResponses, bool useSendEvent, bool useQueueEvent);
 
+	/**
+	 * @brief Возвращает текущее количество записей без обращения к базе данных
+	 * @param responses true - таблица ответов, false - очередь запросов
+	 * @return Количество записей
+	 */
+	__declspec(dllexport) int __stdcall GetHttpQueueDepth(bool responses);
+
+	/**
+	 * @brief Заполняет гистограмму возраста записей по часам
+	 * @param responses true - таблица ответов, false - очередь запросов
+	 * @param counts Массив: counts[i] - количество записей возрастом i часов, последний элемент - все более старые
+	 * @param maxBuckets Размер массива counts
+	 * @return Общее количество записей
+	 */
+	__declspec(dllexport) int __stdcall GetHttpQueueAgeHistogram(bool responses, int* counts, int maxBuckets);
+
+	/**
+	 * @brief Включает сжатие тел запросов и ответов при сохранении в базу данных
+	 * @param enabled true - сжимать новые записи, false - сохранять как текст
+	 * @param minBodySize Тела короче этого размера (байт UTF-8) не сжимаются
+	 * @return 0 при успехе
+	 */
+	__declspec(dllexport) int __stdcall SetHttpStorageCompression(bool enabled, int minBodySize);
+
+	/**
+	 * @brief Задает параметры страниц и кэша базы данных
+	 * @param mmapSize PRAGMA mmap_size в байтах (0 - без отображения в память, < 0 - по умолчанию)
+	 * @param cacheSizeKb Кэш страниц на соединение в КБ (<= 0 - по умолчанию, около 2 МБ)
+	 * @param pageSize Размер страницы в байтах, степень двойки от 512 до 65536 (<= 0 - не менять)
+	 * @param tempStore 1 - временные данные в файле, 2 - в памяти (<= 0 - по умолчанию)
+	 * @return 0 при успехе, 1 при ошибке
+	 * @details Смена размера страницы перестраивает базу через VACUUM, поэтому
+	 *          вызывайте ее при старте, пока очередь не обрабатывается
+	 */
+	__declspec(dllexport) int __stdcall SetHttpStorageOptions(long long mmapSize, int cacheSizeKb, int pageSize, int tempStore);
+
+	/**
+	 * @brief Выбирает отдельную базу данных для экземпляра терминала
+	 * @param instanceName Имя экземпляра: база c:\gcore\data_<имя>.db (в имени остаются
+	 *                     латиница, цифры, '_' и '-'); NULL или "" - общая база c:\gcore\data.db
+	 * @return 0 при успехе, 1 при ошибке
+	 * @details Несколько терминалов могут работать и с общей базой: при блокировке
+	 *          другим процессом запись ждет с нарастающей паузой до 5 секунд. Отдельная
+	 *          база убирает это ожидание. Вызывайте в OnInit до добавления запросов:
+	 *          записи прежней базы остаются в ней
+	 */
+	__declspec(dllexport) int __stdcall SetHttpStorageInstance(const wchar_t* instanceName);
+
+	/**
+	 * @brief Выбирает хранилище очереди запросов
+	 * @param backend 0 - таблица SQLite (по умолчанию), 1 - сегментированный журнал в c:\gcore\log
+	 * @return 0 при успехе, 1 при ошибке или если очередь уже используется
+	 * @details Вызывается при старте, до добавления запросов. После первого
+	 *          добавления или обработки очереди, запуска StartQueueWorkers,
+	 *          DrainHttpQueue или SetHttpQueueWriteBehind хранилище не меняется.
+	 *          Запросы, оставшиеся в другом хранилище с прошлых запусков, в нем и
+	 *          остаются. Ответы сервера всегда хранятся в SQLite.
+	 */
+	__declspec(dllexport) int __stdcall SetHttpQueueBackend(int backend);
+
+	/**
+	 * @brief Включает отбрасывание повторяющихся запросов
+	 * @param enabled true - запрос не добавляется, если в очереди SQLite уже ждет
+	 *                запрос с тем же URL и телом
+	 * @return 0 при успехе
+	 */
+	__declspec(dllexport) int __stdcall SetHttpQueueDeduplication(bool enabled);
+
+	/**
+	 * @brief Добавляет запрос с ожиданием ответа и временем хранения ответа
+	 * @param serverUrl URL сервера
+	 * @param jsonBody Тело JSON запроса
+	 * @param responseTtlSeconds Сколько секунд хранить ответ (<= 0 - по настройке адреса)
+	 * @return 0 при успехе, 1 при ошибке, 2 - очередь переполнена
+	 * @details Просроченный ответ не возвращается GetHttpResponse и удаляется в фоне
+	 */
+	__declspec(dllexport) int __stdcall SendHttpRequestQueueTtl(const wchar_t* serverUrl, const wchar_t* jsonBody, int responseTtlSeconds);
+
+	/**
+	 * @brief Добавляет запрос в очередь со сроком доставки
+	 * @param serverUrl URL сервера
+	 * @param jsonBody Тело запроса в формате JSON
+	 * @param expectResponse Флаг ожидания ответа
+	 * @param deadlineSeconds Срок доставки от текущего момента, секунд (> 0)
+	 * @return 0 при успехе, 1 при ошибке, 2 - очередь переполнена
+	 * @details Обработчики очереди отправляют запросы со сроком первыми, по возрастанию
+	 *          срока (EDF). Запрос с истекшим сроком удаляется при выборке без отправки
+	 *          (событие REQUEST_EXPIRED). Срок хранится только в очереди SQLite.
+	 */
+	__declspec(dllexport) int __stdcall SendHttpRequestQueueDeadline(const wchar_t* serverUrl, const wchar_t* jsonBody, bool expectResponse, int deadlineSeconds);
+
+	/**
+	 * @brief Добавляет запрос в очередь с отложенной отправкой
+	 * @param serverUrl URL сервера
+	 * @param jsonBody Тело запроса в формате JSON
+	 * @param expectResponse Флаг ожидания ответа
+	 * @param delayMs Через сколько миллисекунд отправить запрос (0 - сразу)
+	 * @return 0 при успехе, 1 при ошибке, 2 - очередь переполнена
+	 * @details До срока запрос не выбирается обработчиками очереди. Постоянные
+	 *          обработчики (StartQueueWorkers) просыпаются к сроку без опроса базы.
+	 *          Время отправки хранится только в очереди SQLite.
+	 */
+	__declspec(dllexport) int __stdcall SendHttpRequestQueueDelayed(const wchar_t* serverUrl, const wchar_t* jsonBody, bool expectResponse, int delayMs);
+
+	/**
+	 * @brief Задает время хранения ответов сервера
+	 * @param serverUrl URL сервера; NULL или "" - для всех адресов без своей настройки
+	 * @param ttlSeconds Секунд (<= 0 - без ограничения)
+	 * @return 0 при успехе
+	 * @details Действует на ответы, полученные после вызова
+	 */
+	__declspec(dllexport) int __stdcall SetHttpResponseTtl(const wchar_t* serverUrl, int ttlSeconds);
+
+	/**
+	 * @brief Ограничивает количество хранимых ответов
+	 * @param maxResponses Предел (<= 0 - без ограничения); сверх него в фоне удаляются
+	 *                     ответы, к которым дольше всего не обращались
+	 * @return 0 при успехе
+	 */
+	__declspec(dllexport) int __stdcall SetHttpResponseLimit(int maxResponses);
+
+	/**
+	 * @brief Задает лимит попыток отправки запроса из очереди
+	 * @param maxAttempts Количество неудачных попыток, после которого запрос переносится
+	 *                    в таблицу http_dead_letters (<= 0 - без лимита, по умолчанию)
+	 * @return 0 при успехе
+	 * @details При включенном лимите ответ 4xx (кроме 408 и 429) переносит запрос сразу.
+	 *          Попытки считаются только в очереди SQLite
+	 */
+	__declspec(dllexport) int __stdcall SetHttpQueueMaxAttempts(int maxAttempts);
+
+	/**
+	 * @brief Задает паузу перед повтором неудачной отправки запроса из очереди
+	 * @param baseMs Пауза после первой неудачи, мс (<= 0 - повтор при следующем проходе, по умолчанию)
+	 * @param maxMs Предел паузы, мс; пауза удваивается с каждой попыткой
+	 * @return 0 при успехе
+	 * @details Запрос не выбирается до окончания паузы, остальные запросы очереди
+	 *          отправляются без задержки. Паузы хранятся только в очереди SQLite
+	 */
+	__declspec(dllexport) int __stdcall SetHttpRetryBackoff(int baseMs, int maxMs);
+
+	/**
+	 * @brief Возвращает состояние расписания отложенных запросов
+	 * @param values Массив: 0 - запросов в расписании, 1 - ближайший срок (мс от начала
+	 *               эпохи Unix, -1 - расписание пусто), 2 - наступило сроков,
+	 *               3 - загружено из базы при запуске обработчиков
+	 * @param maxValues Размер массива
+	 * @return Количество заполненных значений (при values == NULL - количество полей)
+	 */
+	__declspec(dllexport) int __stdcall GetHttpRetryScheduleStats(long long* values, int maxValues);
+
+	/**
+	 * @brief Возвращает недоставленные запросы в очередь
+	 * @param httpStatus Только запросы с этим HTTP статусом (0 - все, -1 - сервер не ответил)
+	 * @param maxItems Максимальное количество запросов (<= 0 - все)
+	 * @return Количество возвращенных запросов
+	 */
+	__declspec(dllexport) int __stdcall ReplayHttpDeadLetters(int httpStatus, int maxItems);
+
+	/**
+	 * @brief Удаляет недоставленные запросы
+	 * @param httpStatus Только запросы с этим HTTP статусом (0 - все, -1 - сервер не ответил)
+	 * @param hoursOld Только перенесенные раньше указанного количества часов назад (0 - все)
+	 * @return Количество удаленных запросов
+	 */
+	__declspec(dllexport) int __stdcall PurgeHttpDeadLetters(int httpStatus, int hoursOld);
+
+	/**
+	 * @brief Возвращает количество недоставленных запросов
+	 */
+	__declspec(dllexport) int __stdcall GetHttpDeadLetterCount();
+
+	/**
+	 * @brief Включает буферизацию очереди запросов в памяти
+	 * @param enabled true - SendHttpRequestQueue кладет запрос в буфер и сразу возвращает управление,
+	 *                false - синхронная запись в хранилище (буфер сохраняется перед отключением)
+	 * @param flushIntervalMs Интервал сохранения буфера в хранилище, мс (<= 0 - 1000).
+	 *                        Это максимальное окно потерь при аварийном завершении процесса
+	 * @param capacity Емкость буфера в запросах (<= 0 - 4096), учитывается при первом включении.
+	 *                 При заполненном буфере запрос записывается синхронно
+	 * @return 0 при успехе, 1 при ошибке запуска потока записи
+	 * @details Буфер, не сохраненный ShutdownGCore или FlushHttpQueue, сохраняется при
+	 *          выгрузке DLL без потока записи и пула, не дольше 2 секунд
+	 */
+	__declspec(dllexport) int __stdcall SetHttpQueueWriteBehind(bool enabled, int flushIntervalMs, int capacity);
+
+	/**
+	 * @brief Немедленно сохраняет буфер очереди в хранилище
+	 * @return Количество сохраненных запросов
+	 * @details Вызывается в OnDeinit: при завершении процесса буфер не сохраняется автоматически
+	 */
+	__declspec(dllexport) int __stdcall FlushHttpQueue();
+
+	/**
+	 * @brief Запускает постоянные обработчики очереди
+	 * @param workerCount Количество потоков (1-16); при другом количестве обработчики перезапускаются
+	 * @return 0 при успехе, 1 при ошибке запуска потоков
+	 * @details Обработчики спят до добавления запроса в очередь и начинают отправку сразу,
+	 *          без вызова ProcessHttpQueue из таймера. Каждый запрос отправляет только один
+	 *          обработчик. Если все запросы пачки не отправлены, обработчик повторяет попытку
+	 *          с нарастающей паузой (до 30 с). Запросы других процессов, использующих ту же
+	 *          базу, подхватываются не позже чем через секунду. Отложенные запросы
+	 *          (SendHttpRequestQueueDelayed, SetHttpRetryBackoff) загружаются из базы в
+	 *          расписание в памяти, и обработчики просыпаются к ближайшему сроку.
+	 */
+	__declspec(dllexport) int __stdcall StartQueueWorkers(int workerCount);
+
+	/**
+	 * @brief Останавливает постоянные обработчики очереди
+	 * @return 0
+	 * @details Ждет завершения отправки текущих запросов. Вызывается в OnDeinit.
+	 */
+	__declspec(dllexport) int __stdcall StopQueueWorkers();
+
+	/**
+	 * @brief Задает лимит частоты отправки запросов из очереди на хост
+	 * @param host Имя хоста без схемы и порта (например, "api.site.ru"); NULL или пустая
+	 *             строка - лимит для всех хостов без собственной настройки
+	 * @param requestsPerSecond Запросов в секунду (<= 0 - без ограничения)
+	 * @param burst Запросов, которые можно отправить подряд без паузы (< 1 - 1)
+	 * @return 0
+	 * @details По умолчанию 10 запросов в секунду без пачек, как прежняя пауза 100 мс
+	 *          между запросами. Ожидание выполняется только при исчерпании лимита,
+	 *          на таймере высокого разрешения. Обработчики StartQueueWorkers делят
+	 *          лимит хоста между собой.
+	 */
+	__declspec(dllexport) int __stdcall SetHttpRateLimit(const wchar_t* host, double requestsPerSecond, int burst);
+
+	/**
+	 * @brief Запускает непрерывный разбор очереди в фоновом потоке
+	 * @return 0 при успешном запуске (или если разбор уже идет), 1 при ошибке
+	 * @details В отличие от ProcessHttpQueue (одна пачка из 50 запросов) поток проходит
+	 *          всю очередь страницами по возрастанию id и читает следующую страницу,
+	 *          пока отправляется текущая. Размер пачки (10-500) подстраивается так,
+	 *          чтобы отправка пачки занимала около 0,5 с. Проход заканчивается в конце
+	 *          очереди или после пачки, в которой не отправлен ни один запрос; каждый
+	 *          запрос за проход отправляется не больше одного раза. По завершении
+	 *          генерируется событие QUEUE_DRAIN_COMPLETE.
+	 */
+	__declspec(dllexport) int __stdcall DrainHttpQueue();
+
+	/**
+	 * @brief Останавливает непрерывный разбор очереди и ждет завершения потока
+	 * @return 0
+	 */
+	__declspec(dllexport) int __stdcall StopHttpQueueDrain();
+
+	/**
+	 * @brief Задает число одновременных отправок из очереди
+	 * @param maxInFlight Запросов в полете одновременно (1-64; 1 - по одному, как раньше)
+	 * @param maxPerHost Запросов в полете на один хост (<= 0 - без отдельного лимита)
+	 * @return 0 при успехе, 1 если не удалось запустить потоки отправки
+	 * @details Обработчики очереди (ProcessHttpQueue, StartQueueWorkers, DrainHttpQueue)
+	 *          раздают запросы пачки общему пулу потоков отправки и не ждут ответа на
+	 *          каждый запрос по очереди. Лимиты общие для всех обработчиков. Подтвержденные
+	 *          запросы удаляются из базы пачками по 100 в одной транзакции.
+	 */
+	__declspec(dllexport) int __stdcall SetHttpQueueConcurrency(int maxInFlight, int maxPerHost);
+
+	/**
+	 * @brief Включает подстройку лимита одновременных отправок на хост
+	 * @param enabled true - лимит подстраивается, false - постоянный maxPerHost
+	 * @return 0
+	 * @details Действует при SetHttpQueueConcurrency больше 1. Лимит хоста начинается
+	 *          с 4 и не превышает maxPerHost: растет, пока время ответа не больше
+	 *          двух минимальных, снижается пропорционально росту времени ответа и
+	 *          вдвое при ошибке перегрузки (нет ответа, 408, 429, 5xx). Размер пачки
+	 *          StartQueueWorkers следует за суммой лимитов хостов.
+	 */
+	__declspec(dllexport) int __stdcall SetHttpAdaptiveConcurrency(bool enabled);
+
+	/**
+	 * @brief Возвращает состояние подстройки лимита для хоста
+	 * @param index Номер хоста (по алфавиту); вне диапазона - только количество хостов
+	 * @param host Буфер для имени хоста (может быть NULL)
+	 * @param hostSize Размер буфера в символах
+	 * @param values Массив для значений: лимит, время ответа (мкс), минимальное время
+	 *        ответа (мкс), успешных отправок, неудачных, из них перегрузок, уменьшений лимита
+	 * @param maxValues Размер массива
+	 * @return Количество хостов
+	 */
+	__declspec(dllexport) int __stdcall GetHttpConcurrencyStats(int index, wchar_t* host, int hostSize, long long* values, int maxValues);
+
+	/**
+	 * @brief Задает объединение запросов очереди на один адрес в один POST
+	 * @param serverUrl Адрес сервера (NULL или "" - для адресов без собственной настройки)
+	 * @param format 0 - по одному (по умолчанию), 1 - JSON-массив, 2 - NDJSON
+	 * @param maxItems Запросов в одном POST (<= 0 - 100)
+	 * @param maxBytes Размер общего тела, байт (<= 0 - 256 КБ)
+	 * @return 0 при успехе, 1 при неизвестном формате
+	 * @details Сервер должен принимать общее тело: массив тел или тело на строку
+	 *          (Content-Type: application/x-ndjson). Ответ на POST, в котором есть
+	 *          запросы с ожиданием ответа, должен быть массивом (строками) в том же
+	 *          порядке: каждый элемент сохраняется в http_responses для своего запроса.
+	 *          Неудачная отправка засчитывается каждому запросу группы.
+	 */
+	__declspec(dllexport) int __stdcall SetHttpQueueBatching(const wchar_t* serverUrl, int format, int maxItems, int maxBytes);
+
+	/**
+	 * @brief Возвращает объем, занимаемый телами записей в базе данных
+	 * @param responses true - таблица ответов, false - очередь запросов
+	 * @return Объем в байтах с учетом сжатия
+	 */
+	__declspec(dllexport) long long __stdcall GetHttpStorageBytes(bool responses);
+
+	/**
+	 * @brief Возвращает счетчики конкуренции за базу данных
+	 * @param values Массив значений: 0 - команд записи, 1 - транзакций записи,
+	 *               2 - суммарное время команд записи с ожиданием (мкс), 3 - максимум (мкс),
+	 *               4 - максимальная длина очереди записи, 5 - текущая длина очереди записи,
+	 *               6 - чтений, 7 - суммарное ожидание соединения для чтения (мкс),
+	 *               8 - максимум (мкс), 9 - открыто соединений для чтения,
+	 *               10 - заменено запросов с ключом, 11 - отброшено повторяющихся запросов,
+	 *               12 - пауз в ожидании блокировки базы другим процессом,
+	 *               13 - удалено просроченных ответов, 14 - вытеснено ответов сверх предела,
+	 *               15 - доставлено запросов в срок, 16 - доставлено после срока,
+	 *               17 - удалено запросов с истекшим сроком без отправки
+	 * @param maxValues Размер массива values
+	 * @param reset true - обнулить накопленные счетчики после чтения
+	 * @return Количество заполненных значений (при values = NULL - общее количество счетчиков)
+	 */
+	__declspec(dllexport) int __stdcall GetHttpStorageStats(long long* values, int maxValues, bool reset);
+
+	/**
+	 * @brief Выгружает очередь запросов в сжатый файл NDJSON
+	 * @param filePath Путь к файлу (существующий перезаписывается)
+	 * @param includeResponses true - выгрузить также сохраненные ответы
+	 * @return Количество выгруженных записей или -1 при ошибке
+	 * @details Очередь не изменяется. Выгружается очередь SQLite; буфер в памяти
+	 *          предварительно сохраняется в нее
+	 */
+	__declspec(dllexport) long long __stdcall ExportHttpQueue(const wchar_t* filePath, bool includeResponses);
+
+	/**
+	 * @brief Загружает в очередь файл, созданный ExportHttpQueue
+	 * @param filePath Путь к файлу выгрузки
+	 * @return Количество загруженных записей или -1 при ошибке
+	 * @details Записи добавляются транзакциями по 5000 с исходным временем постановки в очередь
+	 */
+	__declspec(dllexport) long long __stdcall ImportHttpQueue(const wchar_t* filePath);
+
+	/**
+	 * @brief Ограничивает рост очереди запросов
+	 * @param policy Что делать при переполнении: 0 - не ограничивать, 1 - отклонять новые
+	 *               запросы, 2 - удалять самые старые, 3 - удалять старые запросы без
+	 *               ожидания ответа, затем любые старые, 4 - ждать разбора очереди
+	 * @param highItems Верхняя граница по количеству запросов (0 - не ограничивать)
+	 * @param lowItems Нижняя граница (<= 0 - 90% верхней)
+	 * @param highMb Верхняя граница по объему тел, МБ (0 - не ограничивать)
+	 * @param lowMb Нижняя граница по объему (<= 0 - 90% верхней)
+	 * @param blockTimeoutMs Сколько ждать при политике 4, мс
+	 * @return 0 при успехе, 1 при неизвестной политике
+	 * @details Ограничение включается на верхней границе и действует, пока очередь не
+	 *          опустится до нижней. Отклоненный запрос возвращает 2.
+	 */
+	__declspec(dllexport) int __stdcall SetHttpQueueBackpressure(int policy, int highItems, int lowItems, int highMb, int lowMb, int blockTimeoutMs);
+
+	/**
+	 * @brief Возвращает состояние ограничения очереди
+	 * @param values Массив: 0 - ограничение действует (0/1), 1 - глубина очереди,
+	 *               2 - оценка объема тел, байт, 3 - отклонено, 4 - удалено старых,
+	 *               5 - добавлений с ожиданием, 6 - из них по таймауту
+	 * @param maxValues Размер массива
+	 * @return Количество заполненных значений (при values == NULL - количество полей)
+	 */
+	__declspec(dllexport) int __stdcall GetHttpBackpressureStats(long long* values, int maxValues);
+
+	/**
+	 * @brief Настраивает общий пул потоков фоновой работы
+	 * @param threads Количество потоков (<= 0 - процессоров минус один, не меньше одного)
+	 * @param affinityMask Маска процессоров потоков (0 - все процессоры процесса)
+	 * @param priority Приоритет потоков (THREAD_PRIORITY_*, по умолчанию ниже обычного)
+	 * @return 0 при успехе, 1 при недопустимом приоритете или ошибке запуска потоков
+	 * @details Пул выполняет сжатие и хеширование тел больших пачек перед записью в
+	 *          базу, разбор и сохранение ответов на отправленные запросы и порции
+	 *          фоновой очистки. Перезапуск дожидается задач, уже поставленных в пул. ShutdownGCore
+	 *          останавливает потоки пула до следующей задачи.
+	 */
+	__declspec(dllexport) int __stdcall SetWorkPoolOptions(int threads, long long affinityMask, int priority);
+
+	/**
+	 * @brief Возвращает счетчики общего пула потоков
+	 * @param values Массив: 0 - потоков, 1 - поставлено задач, 2 - выполнено потоками пула,
+	 *               3 - из них взято из очереди другого потока, 4 - выполнено в вызывающем потоке
+	 * @param maxValues Размер массива
+	 * @return Количество заполненных значений (при values == NULL - количество полей)
+	 */
+	__declspec(dllexport) int __stdcall GetWorkPoolStats(long long* values, int maxValues);
+
+	/**
+	 * @brief Запускает фоновую очистку базы данных
+	 * @param maxAgeHours Удалять записи старше указанного количества часов (<= 0 - 24 часа)
+	 * @param maxSizeMb Лимит размера базы в мегабайтах (<= 0 - 100 МБ)
+	 * @param intervalSeconds Интервал между проходами очистки (<= 0 - 60 секунд)
+	 * @return 0 при успешном запуске или обновлении параметров, 1 при ошибке
+	 */
+	__declspec(dllexport) int __stdcall StartHttpRetention(int maxAgeHours, int maxSizeMb, int intervalSeconds);
+
+	/**
+	 * @brief Останавливает фоновую очистку базы данных и дожидается завершения потока
+	 * @return 0
+	 */
+	__declspec(dllexport) int __stdcall StopHttpRetention();
+
+	/**
+	 * @brief Переводит существующую базу в режим auto_vacuum=INCREMENTAL
+	 * @return 0, если режим включен, 1 при ошибке
+	 * @details Новая база создается в этом режиме сразу. Существующая перестраивается
+	 *          полным VACUUM: очередь блокируется на время перестроения, а на диске
+	 *          нужно место под копию базы, поэтому вызывайте в OnInit и только явно -
+	 *          фоновая очистка режим не меняет
+	 */
+	__declspec(dllexport) int __stdcall EnableHttpIncrementalVacuum();
+
+	/**
+	 * @brief Останавливает фоновые потоки библиотеки с ограничением по времени
+	 * @param timeoutMs Сколько ждать потоки, мс. По истечении запросы в полете
+	 *                  прерываются (остаются в очереди) и потоки ждут еще 0,5 с
+	 * @return 0, если все потоки остановлены, 1, если часть потоков еще работает
+	 * @details Буфер запросов в памяти сохраняется в хранилище и отключается. Если все
+	 *          потоки остановлены, останавливаются и пул, диспетчер одновременных
+	 *          отправок и поток записи (запускаются снова при использовании).
+	 *          Вызывается в OnDeinit: каждый поток держит ссылку на DLL, и FreeLibrary
+	 *          выгружает ее только после выхода всех потоков. После возврата библиотека снова доступна,
+	 *          в том числе при результате 1.
+	 */
+	__declspec(dllexport) int __stdcall ShutdownGCore(int timeoutMs);
+
 
 	//-----------------------------------------------------------------------------
-	//  callback-
+	// Функции callback-событий
 	//-----------------------------------------------------------------------------
 
 	/**
-	 * @brief  callback-     DLL
-	 * @param event_type   (UTF-16)
-	 * @param data   (UTF-16)
+	 * @brief Тип callback-функции для получения событий от DLL
+	 * @param event_type Тип события (UTF-16)
+	 * @param data Данные события (UTF-16)
 	 */
 	typedef void(__stdcall* EventCallback)(const wchar_t* event_type, const wchar_t* data);
 
 	/**
-	 * @brief  callback-     DLL
-	 * @param callback   callback-
+	 * @brief Устанавливает callback-функцию для получения событий от DLL
+	 * @param callback Указатель на callback-функцию
 	 */
 	__declspec(dllexport) void __stdcall SetEventCallback(EventCallback callback);
 
 
 	//-----------------------------------------------------------------------------
-	//     
+	// Функции для работы с событиями
 	//-----------------------------------------------------------------------------
 
 	/**
-	 * @brief   ,     
-	 * @return    
+	 * @brief Возвращает количество событий, ожидающих обработки в очереди событий
+	 * @return Количество событий в очереди (включая события, которые еще дописываются)
+	 * @details Очередь ограничена 16384 событиями: при заполненной очереди новые события
+	 *          отбрасываются, их количество возвращает GetEventQueueStats.
 	 */
 	__declspec(dllexport) int __stdcall GetPendingEventCount();
 
 	/**
-	 * @brief      
-	 * @param eventType      (UTF-16)
-	 * @param typeSize     
-	 * @param eventData      (UTF-16)
-	 * @param dataSize     
-	 * @return 1    , 0   
+	 * @brief Извлекает следующее событие из очереди событий
+	 * @param eventType Буфер для записи типа события (UTF-16)
+	 * @param typeSize Размер буфера для типа события
+	 * @param eventData Буфер для записи данных события (UTF-16)
+	 * @param dataSize Размер буфера для данных события
+	 * @return 1 если событие успешно извлечено, 0 если очередь пуста
+	 * @details Добавление события не захватывает блокировок, поэтому событие, которое
+	 *          другой поток еще дописывает, задерживает следующие за ним до следующего вызова.
 	 */
 	__declspec(dllexport) int __stdcall GetNextEvent(wchar_t* eventType, int typeSize, wchar_t* eventData, int dataSize);
 
 	/**
-	 * @brief    
-	 * @return 1   
+	 * @brief Очищает всю очередь событий
+	 * @return 1 при успешной очистке
 	 */
 	__declspec(dllexport) int __stdcall ClearEvents();
 
+	/**
+	 * @brief Возвращает счетчики очереди событий
+	 * @param values Массив: 0 - событий в очереди, 1 - емкость очереди,
+	 *               2 - добавлено с запуска, 3 - отброшено из-за заполненной очереди
+	 * @param maxValues Размер массива
+	 * @return Количество заполненных значений (при values == NULL - количество полей)
+	 */
+	__declspec(dllexport) int __stdcall GetEventQueueStats(long long* values, int maxValues);
+
 #ifdef __cplusplus
 }
 #endif
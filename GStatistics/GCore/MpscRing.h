@@ -0,0 +1,133 @@
+﻿#pragma once
+#ifndef MPSC_RING_H
+#define MPSC_RING_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @file MpscRing.h
+ * @brief Ограниченный кольцевой буфер без блокировок: много писателей, один читатель
+ */
+
+/**
+ * @class MpscRing
+ * @brief Кольцевой буфер фиксированной емкости с номерами последовательности в ячейках
+ * @details Писатели резервируют ячейку через compare_exchange на позиции записи и
+ *          публикуют значение записью номера последовательности, поэтому добавление
+ *          не захватывает блокировок и не ждет читателя. Если буфер заполнен,
+ *          TryPush сразу возвращает false. TryPop может вызывать только один поток
+ *          одновременно (несколько читателей должны сериализоваться снаружи).
+ * @tparam T Тип элемента (копируемый или перемещаемый, с конструктором по умолчанию)
+ */
+template <typename T>
+class MpscRing {
+public:
+    /**
+     * @brief Создает буфер
+     * @param capacity Емкость, округляется вверх до степени двойки (минимум 2)
+     */
+    explicit MpscRing(size_t capacity) : mask(0), enqueue_pos(0), dequeue_pos(0) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+
+        cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        mask = size - 1;
+    }
+
+    /**
+     * @brief Добавляет элемент
+     * @return false, если буфер заполнен
+     */
+    bool TryPush(const T& value) {
+        T copy(value);
+        return TryPush(std::move(copy));
+    }
+
+    /**
+     * @brief Добавляет элемент перемещением
+     * @return false, если буфер заполнен (value при этом не изменяется)
+     */
+    bool TryPush(T&& value) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+
+        for (;;) {
+            cell = &cells[pos & mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->value = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Извлекает самый старый опубликованный элемент (только один читатель)
+     * @return false, если буфер пуст или ближайший элемент еще не дописан
+     */
+    bool TryPop(T& value) {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        Cell& cell = cells[pos & mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+
+        if ((intptr_t)sequence - (intptr_t)(pos + 1) < 0) return false;
+
+        value = std::move(cell.value);
+        cell.value = T(); // освобождаем память элемента сразу, а не при следующей записи
+        cell.sequence.store(pos + mask + 1, std::memory_order_release);
+        dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * @brief Приблизительное количество элементов (точное, если писатели не активны)
+     */
+    size_t Size() const {
+        size_t tail = enqueue_pos.load(std::memory_order_relaxed);
+        size_t head = dequeue_pos.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    /**
+     * @brief Емкость буфера
+     */
+    size_t Capacity() const { return mask + 1; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+
+    // Позиции писателей и читателя разнесены по разным строкам кэша
+    char pad0[64];
+    std::atomic<size_t> enqueue_pos;
+    char pad1[64];
+    std::atomic<size_t> dequeue_pos;
+    char pad2[64];
+
+    MpscRing(const MpscRing&);
+    MpscRing& operator=(const MpscRing&);
+};
+
+#endif
@@ -0,0 +1,394 @@
+﻿#include "QueueArchive.h"
+#include "Compression.h"
+#include <cstring>
+#include <cstdlib>
+
+namespace {
+
+const char kArchiveSignature[8] = { 'G', 'C', 'Q', 'A', 'R', 'C', 'H', '1' };
+
+// Блок больше этого размера считается повреждением, а не выделяется в памяти
+const DWORD kMaxBlockSize = 256 * 1024 * 1024;
+
+void AppendJsonString(std::string& out, const std::string& value) {
+    static const char hex[] = "0123456789abcdef";
+
+    out += '"';
+    for (size_t i = 0; i < value.size(); ++i) {
+        unsigned char c = (unsigned char)value[i];
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (c < 0x20) {
+                out += "\\u00";
+                out += hex[c >> 4];
+                out += hex[c & 0x0F];
+            }
+            else {
+                out += (char)c; // UTF-8 переносится без изменений
+            }
+        }
+    }
+    out += '"';
+}
+
+void AppendUtf8(std::string& out, unsigned long code) {
+    if (code < 0x80) {
+        out += (char)code;
+    }
+    else if (code < 0x800) {
+        out += (char)(0xC0 | (code >> 6));
+        out += (char)(0x80 | (code & 0x3F));
+    }
+    else if (code < 0x10000) {
+        out += (char)(0xE0 | (code >> 12));
+        out += (char)(0x80 | ((code >> 6) & 0x3F));
+        out += (char)(0x80 | (code & 0x3F));
+    }
+    else {
+        out += (char)(0xF0 | (code >> 18));
+        out += (char)(0x80 | ((code >> 12) & 0x3F));
+        out += (char)(0x80 | ((code >> 6) & 0x3F));
+        out += (char)(0x80 | (code & 0x3F));
+    }
+}
+
+/// Разбор одной строки NDJSON: плоский объект со строками, целыми числами и true/false/null
+class LineParser {
+public:
+    LineParser(const char* begin, const char* end) : p(begin), end(end) {}
+
+    bool Parse(ArchiveRecord& record) {
+        record.type = -1;
+        record.url.clear();
+        record.body.clear();
+        record.response.clear();
+        record.coalesce_key.clear();
+        record.has_coalesce_key = false;
+        record.expect_response = false;
+        record.timestamp = 0;
+        record.response_ttl = 0;
+        record.deadline = 0;
+        record.attempts = 0;
+        record.next_attempt_ms = 0;
+        record.expires_at = 0;
+        record.last_access = 0;
+
+        SkipSpaces();
+        if (!Consume('{')) return false;
+
+        std::string key, text;
+        SkipSpaces();
+        if (Consume('}')) return false;
+
+        for (;;) {
+            SkipSpaces();
+            if (!ReadString(key)) return false;
+            SkipSpaces();
+            if (!Consume(':')) return false;
+            SkipSpaces();
+
+            if (p < end && *p == '"') {
+                std::string* target = &text;
+                if (key == "url") target = &record.url;
+                else if (key == "body" || key == "request") target = &record.body;
+                else if (key == "response") target = &record.response;
+                else if (key == "coalesce_key") { target = &record.coalesce_key; record.has_coalesce_key = true; }
+
+                if (!ReadString(*target)) return false;
+
+                if (key == "type") {
+                    if (text == "request") record.type = ARCHIVE_REQUEST;
+                    else if (text == "response") record.type = ARCHIVE_RESPONSE;
+                }
+            }
+            else {
+                const char* start = p;
+                while (p < end && *p != ',' && *p != '}' && *p != ' ') ++p;
+                std::string literal(start, p);
+
+                if (key == "timestamp") record.timestamp = strtoll(literal.c_str(), nullptr, 10);
+                else if (key == "expect_response") record.expect_response = literal == "true";
+                else if (key == "response_ttl") record.response_ttl = atoi(literal.c_str());
+                else if (key == "deadline") record.deadline = strtoll(literal.c_str(), nullptr, 10);
+                else if (key == "attempts") record.attempts = atoi(literal.c_str());
+                else if (key == "next_attempt_ms") record.next_attempt_ms = strtoll(literal.c_str(), nullptr, 10);
+                else if (key == "expires_at") record.expires_at = strtoll(literal.c_str(), nullptr, 10);
+                else if (key == "last_access") record.last_access = strtoll(literal.c_str(), nullptr, 10);
+            }
+
+            SkipSpaces();
+            if (Consume('}')) break;
+            if (!Consume(',')) return false;
+        }
+
+        return record.type != -1;
+    }
+
+private:
+    const char* p;
+    const char* end;
+
+    void SkipSpaces() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+    }
+
+    bool Consume(char c) {
+        if (p < end && *p == c) { ++p; return true; }
+        return false;
+    }
+
+    bool ReadHex4(unsigned long& code) {
+        if (end - p < 4) return false;
+        code = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = *p++;
+            code <<= 4;
+            if (c >= '0' && c <= '9') code |= c - '0';
+            else if (c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+            else return false;
+        }
+        return true;
+    }
+
+    bool ReadString(std::string& out) {
+        out.clear();
+        if (!Consume('"')) return false;
+
+        while (p < end) {
+            // Участок без экранирования копируется целиком
+            const char* start = p;
+            while (p < end && *p != '"' && *p != '\\') ++p;
+            out.append(start, p);
+            if (p >= end) return false;
+
+            if (*p++ == '"') return true;
+            if (p >= end) return false;
+
+            char c = *p++;
+            switch (c) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                unsigned long code;
+                if (!ReadHex4(code)) return false;
+                // Суррогатная пара
+                if (code >= 0xD800 && code <= 0xDBFF && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                    p += 2;
+                    unsigned long low;
+                    if (!ReadHex4(low)) return false;
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                AppendUtf8(out, code);
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+        return false;
+    }
+};
+
+} // namespace
+
+QueueArchiveWriter::QueueArchiveWriter()
+    : file(INVALID_HANDLE_VALUE), file_bytes(0), text_bytes(0), failed(false) {
+}
+
+QueueArchiveWriter::~QueueArchiveWriter() {
+    Close();
+}
+
+bool QueueArchiveWriter::Open(const std::wstring& path) {
+    Close();
+
+    file = CreateFileW(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    block.clear();
+    block.reserve(kBlockSize + 4096);
+    file_bytes = 0;
+    text_bytes = 0;
+    failed = false;
+
+    return WriteRaw(kArchiveSignature, sizeof(kArchiveSignature));
+}
+
+bool QueueArchiveWriter::Write(const ArchiveRecord& record) {
+    if (file == INVALID_HANDLE_VALUE || failed) return false;
+
+    size_t line_start = block.size();
+
+    if (record.type == ARCHIVE_RESPONSE) {
+        block += "{\"type\":\"response\",\"url\":";
+        AppendJsonString(block, record.url);
+        block += ",\"request\":";
+        AppendJsonString(block, record.body);
+        block += ",\"response\":";
+        AppendJsonString(block, record.response);
+    }
+    else {
+        block += "{\"type\":\"request\",\"url\":";
+        AppendJsonString(block, record.url);
+        block += ",\"body\":";
+        AppendJsonString(block, record.body);
+        block += record.expect_response ? ",\"expect_response\":true" : ",\"expect_response\":false";
+    }
+
+    block += ",\"timestamp\":";
+    block += std::to_string(record.timestamp);
+
+    if (record.type == ARCHIVE_REQUEST && record.has_coalesce_key) {
+        block += ",\"coalesce_key\":";
+        AppendJsonString(block, record.coalesce_key);
+    }
+    if (record.type == ARCHIVE_REQUEST) {
+        if (record.response_ttl > 0) {
+            block += ",\"response_ttl\":";
+            block += std::to_string(record.response_ttl);
+        }
+        if (record.deadline > 0) {
+            block += ",\"deadline\":";
+            block += std::to_string(record.deadline);
+        }
+        if (record.attempts > 0) {
+            block += ",\"attempts\":";
+            block += std::to_string(record.attempts);
+        }
+        if (record.next_attempt_ms > 0) {
+            block += ",\"next_attempt_ms\":";
+            block += std::to_string(record.next_attempt_ms);
+        }
+    }
+    if (record.type == ARCHIVE_RESPONSE) {
+        if (record.expires_at > 0) {
+            block += ",\"expires_at\":";
+            block += std::to_string(record.expires_at);
+        }
+        block += ",\"last_access\":";
+        block += std::to_string(record.last_access);
+    }
+    block += "}\n";
+
+    text_bytes += block.size() - line_start;
+
+    return block.size() < kBlockSize || FlushBlock();
+}
+
+bool QueueArchiveWriter::Close() {
+    if (file == INVALID_HANDLE_VALUE) return !failed;
+
+    bool result = FlushBlock();
+    CloseHandle(file);
+    file = INVALID_HANDLE_VALUE;
+
+    // Блок больше kBlockSize (одна длинная строка) не держим до следующей выгрузки
+    if (block.capacity() > kBlockSize * 2) std::string().swap(block);
+
+    return result && !failed;
+}
+
+bool QueueArchiveWriter::FlushBlock() {
+    if (block.empty()) return !failed;
+
+    const std::string& data = CompressBody(block, compressed) ? compressed : block;
+    DWORD size = (DWORD)data.size();
+
+    bool result = WriteRaw(&size, sizeof(size)) && WriteRaw(data.data(), size);
+    block.clear();
+
+    return result;
+}
+
+bool QueueArchiveWriter::WriteRaw(const void* data, DWORD size) {
+    DWORD written = 0;
+    if (!WriteFile(file, data, size, &written, NULL) || written != size) {
+        failed = true;
+        return false;
+    }
+    file_bytes += written;
+    return true;
+}
+
+QueueArchiveReader::QueueArchiveReader() : file(INVALID_HANDLE_VALUE), position(0) {
+}
+
+QueueArchiveReader::~QueueArchiveReader() {
+    Close();
+}
+
+bool QueueArchiveReader::Open(const std::wstring& path) {
+    Close();
+
+    file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    char signature[sizeof(kArchiveSignature)];
+    DWORD read = 0;
+    if (!ReadFile(file, signature, sizeof(signature), &read, NULL) || read != sizeof(signature) ||
+        memcmp(signature, kArchiveSignature, sizeof(signature)) != 0) {
+        Close();
+        return false;
+    }
+
+    block.clear();
+    position = 0;
+    return true;
+}
+
+int QueueArchiveReader::Read(ArchiveRecord& record) {
+    if (file == INVALID_HANDLE_VALUE) return -1;
+
+    while (position >= block.size()) {
+        int loaded = LoadBlock();
+        if (loaded <= 0) return loaded;
+    }
+
+    // Блок всегда содержит целые строки
+    size_t line_end = block.find('\n', position);
+    if (line_end == std::string::npos) return -1;
+
+    LineParser parser(block.data() + position, block.data() + line_end);
+    position = line_end + 1;
+
+    return parser.Parse(record) ? 1 : -1;
+}
+
+void QueueArchiveReader::Close() {
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+    }
+}
+
+int QueueArchiveReader::LoadBlock() {
+    DWORD size = 0, read = 0;
+    if (!ReadFile(file, &size, sizeof(size), &read, NULL)) return -1;
+    if (read == 0) return 0;
+    if (read != sizeof(size) || size == 0 || size > kMaxBlockSize) return -1;
+
+    packed.resize(size);
+    if (!ReadFile(file, &packed[0], size, &read, NULL) || read != size) return -1;
+
+    if (IsCompressedBody(packed.data(), packed.size())) {
+        if (!DecompressBody(packed.data(), packed.size(), block)) return -1;
+    }
+    else {
+        block.swap(packed);
+    }
+
+    position = 0;
+    return 1;
+}
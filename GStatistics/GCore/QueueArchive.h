@@ -0,0 +1,147 @@
+﻿#pragma once
+#ifndef QUEUE_ARCHIVE_H
+#define QUEUE_ARCHIVE_H
+
+#include <string>
+#include <windows.h>
+
+/**
+ * @file QueueArchive.h
+ * @brief Файл выгрузки очереди: NDJSON, сжатый блоками
+ * @details Файл начинается с сигнатуры "GCQARCH1", за которой идут блоки: длина
+ *          (4 байта) и данные. Данные блока - результат CompressBody над целыми
+ *          строками NDJSON или сами строки, если сжатие не уменьшило блок. Блоки
+ *          сжимаются независимо, поэтому запись и чтение держат в памяти только
+ *          один блок (kBlockSize, или одну строку, если она длиннее блока).
+ *
+ *          Строка запроса:
+ *          {"type":"request","url":"...","body":"...","expect_response":true,"timestamp":1700000000,"coalesce_key":"...","response_ttl":3600,
+ *           "deadline":1700000600,"attempts":2,"next_attempt_ms":1700000030000}
+ *          Строка ответа:
+ *          {"type":"response","url":"...","request":"...","response":"...","timestamp":1700000000,"expires_at":1700003600,"last_access":1700000100}
+ *          Тела хранятся как строки JSON; поля coalesce_key, response_ttl, deadline, attempts,
+ *          next_attempt_ms и expires_at есть только у записей, где они заданы.
+ */
+
+/// Тип записи выгрузки
+enum ArchiveRecordType {
+    ARCHIVE_REQUEST = 0,    ///< Запрос из http_queue
+    ARCHIVE_RESPONSE = 1    ///< Ответ из http_responses
+};
+
+/**
+ * @brief Запись выгрузки (все строки в UTF-8)
+ */
+struct ArchiveRecord {
+    int type;                   ///< ArchiveRecordType
+    std::string url;
+    std::string body;           ///< Тело запроса (для ответа - тело исходного запроса)
+    std::string response;       ///< Тело ответа (только ARCHIVE_RESPONSE)
+    std::string coalesce_key;   ///< Ключ объединения (только ARCHIVE_REQUEST)
+    bool has_coalesce_key;
+    bool expect_response;
+    long long timestamp;
+    int response_ttl;           ///< Срок хранения ответа на запрос, с (только ARCHIVE_REQUEST, 0 - общий)
+    long long deadline;         ///< Срок доставки запроса (только ARCHIVE_REQUEST, 0 - без срока)
+    int attempts;               ///< Неудачных попыток отправки (только ARCHIVE_REQUEST)
+    long long next_attempt_ms;  ///< Время следующей попытки, мс (только ARCHIVE_REQUEST, 0 - сразу)
+    long long expires_at;       ///< Время истечения ответа (только ARCHIVE_RESPONSE, 0 - без срока)
+    long long last_access;      ///< Последнее чтение ответа (только ARCHIVE_RESPONSE, 0 - timestamp)
+};
+
+/**
+ * @class QueueArchiveWriter
+ * @brief Последовательная запись файла выгрузки
+ */
+class QueueArchiveWriter {
+public:
+    static const size_t kBlockSize = 1024 * 1024;   ///< Строк NDJSON на один сжимаемый блок, байт
+
+    QueueArchiveWriter();
+
+    /**
+     * @brief Дописывает неполный блок и закрывает файл, если Close не вызывался
+     */
+    ~QueueArchiveWriter();
+
+    /**
+     * @brief Создает файл (существующий перезаписывается)
+     * @param path Путь к файлу
+     * @return false, если файл не удалось создать
+     */
+    bool Open(const std::wstring& path);
+
+    /**
+     * @brief Добавляет запись
+     * @return false при ошибке записи на диск
+     */
+    bool Write(const ArchiveRecord& record);
+
+    /**
+     * @brief Дописывает последний блок и закрывает файл
+     * @return false, если последний блок не удалось записать
+     */
+    bool Close();
+
+    /**
+     * @brief Байт записано в файл (сжатых)
+     */
+    long long GetFileBytes() const { return file_bytes; }
+
+    /**
+     * @brief Байт строк NDJSON до сжатия
+     */
+    long long GetTextBytes() const { return text_bytes; }
+
+private:
+    HANDLE file;
+    std::string block;          ///< Строки текущего блока
+    std::string compressed;     ///< Буфер сжатия, переиспользуется между блоками
+    long long file_bytes;
+    long long text_bytes;
+    bool failed;
+
+    bool FlushBlock();
+    bool WriteRaw(const void* data, DWORD size);
+
+    QueueArchiveWriter(const QueueArchiveWriter&);
+    QueueArchiveWriter& operator=(const QueueArchiveWriter&);
+};
+
+/**
+ * @class QueueArchiveReader
+ * @brief Последовательное чтение файла выгрузки
+ */
+class QueueArchiveReader {
+public:
+    QueueArchiveReader();
+    ~QueueArchiveReader();
+
+    /**
+     * @brief Открывает файл и проверяет сигнатуру
+     * @return false, если файл не открыт или не является выгрузкой очереди
+     */
+    bool Open(const std::wstring& path);
+
+    /**
+     * @brief Читает следующую запись
+     * @param record Заполняется прочитанной записью
+     * @return 1 - запись прочитана, 0 - конец файла, -1 - файл поврежден
+     */
+    int Read(ArchiveRecord& record);
+
+    void Close();
+
+private:
+    HANDLE file;
+    std::string block;          ///< Распакованные строки текущего блока
+    std::string packed;         ///< Данные блока из файла, переиспользуется
+    size_t position;            ///< Начало следующей строки в block
+
+    int LoadBlock();
+
+    QueueArchiveReader(const QueueArchiveReader&);
+    QueueArchiveReader& operator=(const QueueArchiveReader&);
+};
+
+#endif
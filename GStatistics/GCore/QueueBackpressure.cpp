@@ -0,0 +1,158 @@
+﻿#include "QueueBackpressure.h"
+#include <algorithm>
+
+namespace {
+    const DWORD kBlockPollMs = 100;         // очередь уменьшается и без Notify (очистка, другие процессы)
+    const double kAverageWeight = 0.01;     // доля нового тела в среднем размере
+    const long long kMaxDropPerAdmit = 1000; // удаление за одно добавление: остальное - следующими добавлениями
+
+    long long LowWatermark(long long high, long long low) {
+        return low > 0 && low <= high ? low : high - high / 10;
+    }
+}
+
+QueueBackpressure::QueueBackpressure()
+    : policy(BACKPRESSURE_NONE), high_items(0), low_items(0), high_bytes(0), low_bytes(0), block_timeout_ms(0),
+      overloaded(false), average_body(0), last_depth(0), rejected(0), dropped(0), dropping(0), blocked(0), block_timeouts(0) {
+    InitializeCriticalSection(&cs);
+    InitializeConditionVariable(&drained_cv);
+}
+
+QueueBackpressure::~QueueBackpressure() {
+    DeleteCriticalSection(&cs);
+}
+
+void QueueBackpressure::Configure(int value, long long max_items, long long min_items, long long max_bytes,
+                                  long long min_bytes, DWORD timeout_ms, long long depth, long long bytes) {
+    EnterCriticalSection(&cs);
+    policy = value >= BACKPRESSURE_REJECT && value <= BACKPRESSURE_BLOCK ? value : BACKPRESSURE_NONE;
+    high_items = std::max(0LL, max_items);
+    low_items = LowWatermark(high_items, min_items);
+    high_bytes = std::max(0LL, max_bytes);
+    low_bytes = LowWatermark(high_bytes, min_bytes);
+    block_timeout_ms = timeout_ms;
+
+    if (depth > 0 && bytes > 0)
+        average_body = (double)bytes / depth;
+    overloaded = false;
+    Update(depth);
+
+    // Ожидающие пересчитают границы по новой настройке
+    WakeAllConditionVariable(&drained_cv);
+    LeaveCriticalSection(&cs);
+}
+
+int QueueBackpressure::GetPolicy() const {
+    EnterCriticalSection(&cs);
+    int value = policy;
+    LeaveCriticalSection(&cs);
+    return value;
+}
+
+bool QueueBackpressure::Update(long long depth) {
+    last_depth = depth;
+    if (policy == BACKPRESSURE_NONE) {
+        overloaded = false;
+        return false;
+    }
+
+    double bytes = depth * average_body;
+    if (!overloaded)
+        overloaded = (high_items > 0 && depth >= high_items) || (high_bytes > 0 && bytes >= high_bytes);
+    else
+        overloaded = (high_items > 0 && depth > low_items) || (high_bytes > 0 && bytes > low_bytes);
+    return overloaded;
+}
+
+long long QueueBackpressure::Excess(long long depth) const {
+    long long excess = 0;
+    if (high_items > 0)
+        excess = depth - low_items;
+    if (high_bytes > 0 && average_body > 0)
+        excess = std::max(excess, (long long)((depth * average_body - low_bytes) / average_body) + 1);
+    return std::max(1LL, excess);
+}
+
+bool QueueBackpressure::Admit(size_t body_size, const DepthFunction& depth, const DropFunction& drop) {
+    EnterCriticalSection(&cs);
+    if (policy == BACKPRESSURE_NONE) {
+        LeaveCriticalSection(&cs);
+        return true;
+    }
+
+    average_body = average_body > 0 ? average_body * (1 - kAverageWeight) + body_size * kAverageWeight : (double)body_size;
+
+    bool admitted = true;
+    long long to_drop = 0;
+    bool lowest_priority = false;
+    if (Update(depth())) {
+        switch (policy) {
+        case BACKPRESSURE_REJECT:
+            admitted = false;
+            break;
+
+        case BACKPRESSURE_DROP_OLDEST:
+        case BACKPRESSURE_DROP_LOWEST_PRIORITY: {
+            // Здесь только решается, сколько удалить: то, что уже удаляют одновременные
+            // добавления, не повторяется. Новый запрос принимается, даже если удалить было нечего
+            to_drop = std::min(Excess(last_depth), kMaxDropPerAdmit) - dropping;
+            if (to_drop > 0) {
+                dropping += to_drop;
+                lowest_priority = policy == BACKPRESSURE_DROP_LOWEST_PRIORITY;
+            }
+            break;
+        }
+
+        case BACKPRESSURE_BLOCK: {
+            blocked++;
+            ULONGLONG deadline = GetTickCount64() + block_timeout_ms;
+            for (;;) {
+                ULONGLONG now = GetTickCount64();
+                if (now >= deadline) {
+                    admitted = false;
+                    block_timeouts++;
+                    break;
+                }
+                SleepConditionVariableCS(&drained_cv, &cs, (DWORD)std::min<ULONGLONG>(deadline - now, kBlockPollMs));
+                if (policy != BACKPRESSURE_BLOCK || !Update(depth()))
+                    break;
+            }
+            break;
+        }
+        }
+    }
+
+    if (!admitted)
+        rejected++;
+    LeaveCriticalSection(&cs);
+
+    // Удаление пишет в базу и генерирует события, поэтому идет без блокировки
+    if (to_drop > 0) {
+        int removed = drop((int)to_drop, lowest_priority);
+        long long current = depth();
+
+        EnterCriticalSection(&cs);
+        dropping -= to_drop;
+        dropped += removed;
+        Update(current);
+        LeaveCriticalSection(&cs);
+    }
+
+    return admitted;
+}
+
+void QueueBackpressure::Notify() {
+    WakeAllConditionVariable(&drained_cv);
+}
+
+void QueueBackpressure::GetStats(BackpressureStats& stats) const {
+    EnterCriticalSection(&cs);
+    stats.overloaded = overloaded;
+    stats.depth = last_depth;
+    stats.bytes = (long long)(last_depth * average_body);
+    stats.rejected = rejected;
+    stats.dropped = dropped;
+    stats.blocked = blocked;
+    stats.block_timeouts = block_timeouts;
+    LeaveCriticalSection(&cs);
+}
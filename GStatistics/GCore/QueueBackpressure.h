@@ -0,0 +1,124 @@
+﻿#pragma once
+#ifndef QUEUE_BACKPRESSURE_H
+#define QUEUE_BACKPRESSURE_H
+
+#include <functional>
+#include <windows.h>
+
+/**
+ * @file QueueBackpressure.h
+ * @brief Ограничение роста очереди запросов
+ */
+
+/**
+ * @enum BackpressurePolicy
+ * @brief Что делать с новым запросом, когда очередь выше верхней границы
+ */
+enum BackpressurePolicy {
+    BACKPRESSURE_NONE = 0,                  ///< Очередь не ограничена (по умолчанию)
+    BACKPRESSURE_REJECT = 1,                ///< Новый запрос отклоняется
+    BACKPRESSURE_DROP_OLDEST = 2,           ///< Удаляются самые старые запросы
+    BACKPRESSURE_DROP_LOWEST_PRIORITY = 3,  ///< Удаляются старые запросы без ожидания ответа, затем любые старые
+    BACKPRESSURE_BLOCK = 4                  ///< Добавление ждет разбора очереди с таймаутом
+};
+
+/**
+ * @struct BackpressureStats
+ * @brief Состояние и счетчики ограничения очереди
+ */
+struct BackpressureStats {
+    bool overloaded;                ///< Очередь выше верхней границы и еще не опустилась до нижней
+    long long depth;                ///< Запросов в очереди при последней проверке
+    long long bytes;                ///< Оценка объема тел в очереди, байт
+    long long rejected;             ///< Отклонено запросов (в том числе по таймауту ожидания)
+    long long dropped;              ///< Удалено старых запросов
+    long long blocked;              ///< Добавлений, которые ждали разбора очереди
+    long long block_timeouts;       ///< Из них не дождались
+};
+
+/**
+ * @class QueueBackpressure
+ * @brief Верхняя и нижняя границы очереди по количеству запросов и объему
+ * @details Ограничение включается, когда очередь достигает верхней границы, и
+ *          выключается, только когда она опускается до нижней: без этого разрыва
+ *          каждый разобранный запрос сразу освобождал бы место для нового, и
+ *          очередь держалась бы на границе. Объем оценивается как глубина очереди,
+ *          умноженная на средний размер тела: точная сумма потребовала бы чтения
+ *          всей таблицы на каждое добавление.
+ */
+class QueueBackpressure {
+public:
+    /// Возвращает количество запросов в очереди
+    typedef std::function<long long()> DepthFunction;
+    /// Удаляет count запросов; lowest_priority - сначала запросы без ожидания ответа
+    typedef std::function<int(int count, bool lowest_priority)> DropFunction;
+
+    QueueBackpressure();
+    ~QueueBackpressure();
+
+    /**
+     * @brief Задает политику и границы
+     * @param policy BackpressurePolicy
+     * @param high_items Верхняя граница по запросам (0 - не ограничивать)
+     * @param low_items Нижняя граница (<= 0 или больше верхней - 90% верхней)
+     * @param high_bytes Верхняя граница по объему тел, байт (0 - не ограничивать)
+     * @param low_bytes Нижняя граница по объему (<= 0 или больше верхней - 90% верхней)
+     * @param block_timeout_ms Ожидание для BACKPRESSURE_BLOCK, мс
+     * @param depth Текущая глубина очереди
+     * @param bytes Текущий объем тел, байт: задает начальный средний размер тела
+     */
+    void Configure(int policy, long long high_items, long long low_items, long long high_bytes, long long low_bytes,
+                   DWORD block_timeout_ms, long long depth, long long bytes);
+
+    int GetPolicy() const;
+
+    /**
+     * @brief Решает, принять ли новый запрос
+     * @param body_size Размер тела нового запроса, байт
+     * @param depth Возвращает глубину очереди
+     * @param drop Удаление запросов для политик вытеснения
+     * @return true - запрос можно добавить, false - запрос отклонен
+     * @details Для BACKPRESSURE_BLOCK ждет, пока очередь не опустится до нижней
+     *          границы, но не дольше таймаута; ожидание прерывается Notify. drop
+     *          вызывается без блокировки: одновременные добавления не ждут удаления
+     *          и не удаляют повторно то, что уже удаляется.
+     */
+    bool Admit(size_t body_size, const DepthFunction& depth, const DropFunction& drop);
+
+    /**
+     * @brief Будит ожидающие добавления: очередь уменьшилась
+     */
+    void Notify();
+
+    void GetStats(BackpressureStats& stats) const;
+
+private:
+    mutable CRITICAL_SECTION cs;
+    CONDITION_VARIABLE drained_cv;
+
+    int policy;
+    long long high_items;
+    long long low_items;
+    long long high_bytes;
+    long long low_bytes;
+    DWORD block_timeout_ms;
+
+    bool overloaded;
+    double average_body;            ///< Средний размер тела, байт
+    long long last_depth;
+    long long rejected;
+    long long dropped;
+    long long dropping;             ///< Удаляется сейчас одновременными добавлениями
+    long long blocked;
+    long long block_timeouts;
+
+    // Пересчитывает состояние границ по глубине очереди; вызывается под cs
+    bool Update(long long depth);
+    // Сколько запросов удалить, чтобы опуститься до нижних границ
+    long long Excess(long long depth) const;
+
+    QueueBackpressure(const QueueBackpressure&);
+    QueueBackpressure& operator=(const QueueBackpressure&);
+};
+
+#endif
@@ -0,0 +1,96 @@
+﻿#include "QueueBatch.h"
+#include "QueueStorage.h"
+#include "Utilities.h"
+
+EndpointTable& EndpointTable::Instance() {
+    static EndpointTable table;
+    return table;
+}
+
+EndpointTable::EndpointTable() {
+    InitializeCriticalSection(&cs);
+}
+
+EndpointTable::~EndpointTable() {
+    DeleteCriticalSection(&cs);
+}
+
+int EndpointTable::Intern(const char* url_utf8, size_t size) {
+    std::string key(url_utf8, size);
+
+    EnterCriticalSection(&cs);
+    std::map<std::string, int>::const_iterator found = by_utf8.find(key);
+    if (found != by_utf8.end()) {
+        int endpoint = found->second;
+        LeaveCriticalSection(&cs);
+        return endpoint;
+    }
+
+    int endpoint = (int)urls.size();
+    urls.push_back(Utf8ToWide(key.c_str()));
+    by_utf8[key] = endpoint;
+    LeaveCriticalSection(&cs);
+
+    return endpoint;
+}
+
+int EndpointTable::Intern(const std::wstring& url) {
+    std::string url_utf8 = WideToUtf8(url.c_str());
+    return Intern(url_utf8.data(), url_utf8.size());
+}
+
+const std::wstring& EndpointTable::Url(int endpoint) const {
+    EnterCriticalSection(&cs);
+    const std::wstring& url = endpoint >= 0 && endpoint < (int)urls.size() ? urls[endpoint] : empty;
+    LeaveCriticalSection(&cs);
+    return url;
+}
+
+size_t EndpointTable::Size() const {
+    EnterCriticalSection(&cs);
+    size_t size = urls.size();
+    LeaveCriticalSection(&cs);
+    return size;
+}
+
+void QueueBatch::Clear() {
+    items.clear();
+    arena.clear();
+}
+
+void QueueBatch::Add(int id, int endpoint, const char* body, size_t body_size, bool expect_response, time_t timestamp,
+                     int response_ttl, time_t deadline) {
+    QueueItemView item;
+    item.id = id;
+    item.endpoint = endpoint;
+    item.body_offset = arena.size();
+    item.body_size = body_size;
+    item.expect_response = expect_response;
+    item.timestamp = timestamp;
+    item.response_ttl = response_ttl;
+    item.deadline = deadline;
+
+    // Тело хранится с завершающим нулем, чтобы его можно было передать как C-строку
+    arena.insert(arena.end(), body, body + body_size);
+    arena.push_back('\0');
+    items.push_back(item);
+}
+
+void QueueBatch::Add(const QueueItem& item) {
+    Add(item.id, EndpointTable::Instance().Intern(item.server_url), item.json_body.data(), item.json_body.size(),
+        item.expect_response, item.timestamp, item.response_ttl, item.deadline);
+}
+
+QueueItem QueueBatch::ToItem(size_t index) const {
+    const QueueItemView& view = items[index];
+
+    QueueItem item;
+    item.id = view.id;
+    item.server_url = EndpointTable::Instance().Url(view.endpoint);
+    item.json_body.assign(Body(view), view.body_size);
+    item.expect_response = view.expect_response;
+    item.timestamp = view.timestamp;
+    item.response_ttl = view.response_ttl;
+    item.deadline = view.deadline;
+    return item;
+}
@@ -0,0 +1,136 @@
+﻿#pragma once
+#ifndef QUEUE_BATCH_H
+#define QUEUE_BATCH_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <ctime>
+#include <windows.h>
+
+struct QueueItem;
+
+/**
+ * @file QueueBatch.h
+ * @brief Пачка запросов очереди без владеющих строк на каждый элемент
+ */
+
+/**
+ * @class EndpointTable
+ * @brief Таблица URL серверов: каждый адрес хранится один раз в UTF-8 и UTF-16
+ * @details Запросы очереди отправляются на несколько адресов, поэтому пачка хранит
+ *          только номер адреса. Номера не переиспользуются и действительны до
+ *          выгрузки DLL; строки не перемещаются, ссылки на них можно хранить.
+ */
+class EndpointTable {
+public:
+    /**
+     * @brief Общая таблица процесса
+     */
+    static EndpointTable& Instance();
+
+    /**
+     * @brief Возвращает номер адреса, добавляя его при первом обращении
+     * @param url_utf8 URL в UTF-8
+     * @param size Длина URL в байтах
+     */
+    int Intern(const char* url_utf8, size_t size);
+
+    /**
+     * @brief То же для URL в UTF-16
+     */
+    int Intern(const std::wstring& url);
+
+    /**
+     * @brief URL в UTF-16 для WinHTTP (пустая строка для неизвестного номера)
+     */
+    const std::wstring& Url(int endpoint) const;
+
+    /**
+     * @brief Количество адресов в таблице
+     */
+    size_t Size() const;
+
+private:
+    EndpointTable();
+    ~EndpointTable();
+
+    mutable CRITICAL_SECTION cs;
+    std::map<std::string, int> by_utf8;
+    std::deque<std::wstring> urls;          ///< deque не перемещает элементы при добавлении
+    std::wstring empty;
+
+    EndpointTable(const EndpointTable&);
+    EndpointTable& operator=(const EndpointTable&);
+};
+
+/**
+ * @struct QueueItemView
+ * @brief Элемент пачки: тело лежит в буфере пачки, адрес - в EndpointTable
+ */
+struct QueueItemView {
+    int id;                         ///< Идентификатор записи в хранилище (0 - запрос из буфера в памяти)
+    int endpoint;                   ///< Номер адреса в EndpointTable
+    size_t body_offset;             ///< Смещение тела (UTF-8) в буфере пачки
+    size_t body_size;               ///< Длина тела в байтах
+    bool expect_response;           ///< Флаг ожидания ответа от сервера
+    time_t timestamp;               ///< Временная метка создания записи
+    int response_ttl;               ///< Время хранения ответа, секунд (0 - по настройке адреса)
+    time_t deadline;                ///< Срок доставки (0 - без срока)
+};
+
+/**
+ * @class QueueBatch
+ * @brief Пачка запросов с общим буфером для тел
+ * @details Тела всех запросов копируются из хранилища один раз в общий буфер,
+ *          который не освобождается между пачками (Clear сохраняет емкость).
+ *          Элементы хранят смещения, поэтому рост буфера их не портит;
+ *          указатели из Body действительны до следующего Add или Clear.
+ */
+class QueueBatch {
+public:
+    /**
+     * @brief Очищает пачку, сохраняя выделенную память
+     */
+    void Clear();
+
+    /**
+     * @brief Добавляет запрос, копируя тело в буфер пачки
+     * @param id Идентификатор записи
+     * @param endpoint Номер адреса в EndpointTable
+     * @param body Тело запроса (UTF-8)
+     * @param body_size Длина тела в байтах
+     * @param expect_response Флаг ожидания ответа
+     * @param timestamp Время создания записи
+     * @param response_ttl Время хранения ответа, секунд (0 - по настройке адреса)
+     * @param deadline Срок доставки (0 - без срока)
+     */
+    void Add(int id, int endpoint, const char* body, size_t body_size, bool expect_response, time_t timestamp,
+             int response_ttl = 0, time_t deadline = 0);
+
+    /**
+     * @brief Добавляет запрос из QueueItem (для хранилищ без собственной выборки пачкой)
+     */
+    void Add(const QueueItem& item);
+
+    size_t Size() const { return items.size(); }
+    bool Empty() const { return items.empty(); }
+    const QueueItemView& operator[](size_t index) const { return items[index]; }
+
+    /**
+     * @brief Указатель на тело элемента в буфере пачки
+     */
+    const char* Body(const QueueItemView& item) const { return arena.empty() ? "" : &arena[item.body_offset]; }
+
+    /**
+     * @brief Копирует элемент в QueueItem (для повторного сохранения в хранилище)
+     */
+    QueueItem ToItem(size_t index) const;
+
+private:
+    std::vector<QueueItemView> items;
+    std::vector<char> arena;
+};
+
+#endif
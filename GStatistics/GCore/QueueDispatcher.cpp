@@ -0,0 +1,247 @@
+﻿#include "QueueDispatcher.h"
+#include "RateLimiter.h"
+#include "Utilities.h"
+#include <algorithm>
+
+QueueDispatcher::QueueDispatcher() : in_flight(0), max_in_flight(1), max_per_host(1), running(0), adaptive(NULL),
+                                     stopping(false) {
+    InitializeCriticalSection(&cs);
+    InitializeCriticalSection(&config_cs);
+    InitializeConditionVariable(&job_cv);
+    InitializeConditionVariable(&done_cv);
+}
+
+QueueDispatcher::~QueueDispatcher() {
+    StopThreads();
+    DeleteCriticalSection(&config_cs);
+    DeleteCriticalSection(&cs);
+}
+
+bool QueueDispatcher::Configure(int max_total, int max_host) {
+    max_total = std::max(1, std::min(max_total, (int)kMaxInFlight));
+    max_host = max_host <= 0 ? max_total : std::min(max_host, max_total);
+
+    EnterCriticalSection(&config_cs);
+    int pool_size = max_total > 1 ? max_total : 0;
+    bool created = true;
+    if ((int)threads.size() != pool_size) {
+        StopThreads();
+        created = StartThreads(pool_size);
+    }
+
+    EnterCriticalSection(&cs);
+    max_in_flight = created ? max_total : 1;
+    max_per_host = created ? max_host : 1;
+    if (adaptive) adaptive->SetMaxLimit(max_per_host);
+    LeaveCriticalSection(&cs);
+    LeaveCriticalSection(&config_cs);
+    return created;
+}
+
+bool QueueDispatcher::StartThreads(int count) {
+    for (int i = 0; i < count; ++i) {
+        EnterCriticalSection(&cs);
+        running++;
+        LeaveCriticalSection(&cs);
+
+        HANDLE thread = CreateModuleThread(ThreadProc, this, 0, NULL);
+        if (!thread) {
+            EnterCriticalSection(&cs);
+            running--;
+            LeaveCriticalSection(&cs);
+            StopThreads();
+            return false;
+        }
+        threads.push_back(thread);
+    }
+    return true;
+}
+
+void QueueDispatcher::Stop() {
+    EnterCriticalSection(&config_cs);
+    StopThreads();
+    LeaveCriticalSection(&config_cs);
+}
+
+void QueueDispatcher::StopThreads() {
+    if (threads.empty()) return;
+
+    EnterCriticalSection(&cs);
+    stopping = true;
+    WakeAllConditionVariable(&job_cv);
+    LeaveCriticalSection(&cs);
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+    threads.clear();
+
+    EnterCriticalSection(&cs);
+    stopping = false;
+    LeaveCriticalSection(&cs);
+}
+
+int QueueDispatcher::GetMaxInFlight() const {
+    EnterCriticalSection(&cs);
+    int value = max_in_flight;
+    LeaveCriticalSection(&cs);
+    return value;
+}
+
+void QueueDispatcher::SetAdaptive(AdaptiveConcurrency* controller) {
+    EnterCriticalSection(&cs);
+    adaptive = controller;
+    if (adaptive) adaptive->SetMaxLimit(max_per_host);
+    LeaveCriticalSection(&cs);
+}
+
+int QueueDispatcher::Dispatch(const QueueBatch& batch, const SendFunction& send, const AcquireFunction& acquire,
+                              const CompleteFunction& on_complete, std::vector<char>& dispatched) {
+    dispatched.assign(batch.Size(), 0);
+
+    // Пул, остановленный Stop, запускается заново; если потоки не создались,
+    // отправка идет в вызывающем потоке. max_in_flight меняется только под config_cs
+    EnterCriticalSection(&config_cs);
+    if (threads.empty() && max_in_flight > 1)
+        StartThreads(max_in_flight);
+    LeaveCriticalSection(&config_cs);
+
+    // Хост каждого запроса: адресов в пачке обычно несколько, разбираем каждый один раз
+    std::map<int, std::wstring> endpoint_hosts;
+    std::vector<const std::wstring*> hosts(batch.Size());
+    for (size_t i = 0; i < batch.Size(); ++i) {
+        int endpoint = batch[i].endpoint;
+        std::map<int, std::wstring>::iterator it = endpoint_hosts.find(endpoint);
+        if (it == endpoint_hosts.end())
+            it = endpoint_hosts.insert(std::make_pair(endpoint, HostRateLimiter::HostOf(EndpointTable::Instance().Url(endpoint)))).first;
+        hosts[i] = &it->second;
+    }
+
+    std::vector<size_t> waiting;
+    for (size_t i = 0; i < batch.Size(); ++i) waiting.push_back(i);
+
+    DispatchCall call;
+    call.in_flight = 0;
+    std::vector<Completion> done;
+    int attempted = 0;
+    bool stopped = false;
+
+    EnterCriticalSection(&cs);
+    while ((!stopped && !waiting.empty()) || call.in_flight > 0 || !call.done.empty()) {
+        // Результаты обрабатываются без блокировки: обработчик пишет в хранилище
+        if (!call.done.empty()) {
+            done.swap(call.done);
+            LeaveCriticalSection(&cs);
+            for (size_t i = 0; i < done.size(); ++i)
+                on_complete(done[i].index, done[i].success, done[i].failure);
+            done.clear();
+            EnterCriticalSection(&cs);
+            continue;
+        }
+
+        bool progress = false;
+        bool adapt = adaptive && adaptive->IsEnabled();
+        for (size_t w = 0; !stopped && w < waiting.size() && in_flight < max_in_flight; ) {
+            size_t index = waiting[w];
+            std::map<std::wstring, int>::iterator host = host_in_flight.insert(std::make_pair(*hosts[index], 0)).first;
+            int host_limit = adapt ? std::min(max_per_host, adaptive->GetLimit(host->first)) : max_per_host;
+            if (host->second >= host_limit) {
+                ++w;
+                continue;
+            }
+
+            // Слот занимается до ожидания лимита частоты, чтобы его не заняли другие вызовы
+            in_flight++;
+            host->second++;
+            LeaveCriticalSection(&cs);
+            bool allowed = acquire(index);
+            EnterCriticalSection(&cs);
+
+            if (!allowed) {
+                in_flight--;
+                host->second--;
+                WakeAllConditionVariable(&done_cv);
+                stopped = true;
+                break;
+            }
+
+            Job job = { &batch, index, &send, &call, host };
+            call.in_flight++;
+            if (running > 0) {
+                jobs.push_back(job);
+                WakeConditionVariable(&job_cv);
+            }
+            else {
+                // Пула нет (лимит 1 или пул пересоздается): отправка в вызывающем потоке
+                LeaveCriticalSection(&cs);
+                Execute(job);
+                EnterCriticalSection(&cs);
+            }
+
+            dispatched[index] = 1;
+            attempted++;
+            waiting.erase(waiting.begin() + w);
+            progress = true;
+        }
+
+        if (!progress && call.done.empty() && (call.in_flight > 0 || (!stopped && !waiting.empty())))
+            SleepConditionVariableCS(&done_cv, &cs, INFINITE);
+    }
+    LeaveCriticalSection(&cs);
+
+    return attempted;
+}
+
+DWORD WINAPI QueueDispatcher::ThreadProc(LPVOID param) {
+    static_cast<QueueDispatcher*>(param)->Run();
+    return 0;
+}
+
+void QueueDispatcher::Run() {
+    EnterCriticalSection(&cs);
+    for (;;) {
+        while (jobs.empty() && !stopping)
+            SleepConditionVariableCS(&job_cv, &cs, INFINITE);
+        if (jobs.empty()) break;
+
+        Job job = jobs.front();
+        jobs.pop_front();
+        LeaveCriticalSection(&cs);
+        Execute(job);
+        EnterCriticalSection(&cs);
+    }
+    // Задачи раздаются в пул, только пока running > 0, поэтому после выхода
+    // последнего потока ни одна задача не останется в jobs
+    running--;
+    LeaveCriticalSection(&cs);
+}
+
+void QueueDispatcher::Execute(const Job& job) {
+    Completion completion;
+    completion.index = job.index;
+    completion.failure.http_status = 0;
+    completion.failure.elapsed_ms = 0;
+
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t0);
+    completion.success = (*job.send)(*job.batch, job.index, &completion.failure);
+    QueryPerformanceCounter(&t1);
+
+    // Ключи host_in_flight не меняются и не удаляются, читать хост можно без блокировки
+    EnterCriticalSection(&cs);
+    AdaptiveConcurrency* controller = adaptive;
+    LeaveCriticalSection(&cs);
+    if (controller && controller->IsEnabled())
+        controller->Record(job.host->first, completion.success, completion.failure.http_status,
+                           (t1.QuadPart - t0.QuadPart) * 1000000 / freq.QuadPart);
+
+    EnterCriticalSection(&cs);
+    in_flight--;
+    job.host->second--;
+    job.call->done.push_back(completion);
+    job.call->in_flight--;
+    WakeAllConditionVariable(&done_cv);
+    LeaveCriticalSection(&cs);
+}
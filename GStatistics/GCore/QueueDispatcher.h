@@ -0,0 +1,130 @@
+﻿#pragma once
+#ifndef QUEUE_DISPATCHER_H
+#define QUEUE_DISPATCHER_H
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include <windows.h>
+#include "QueueStorage.h"
+#include "AdaptiveConcurrency.h"
+
+/**
+ * @class QueueDispatcher
+ * @brief Одновременная отправка запросов пачки с лимитами на все отправки и на хост
+ * @details Отправка выполняется пулом потоков, вызывающий поток только раздает
+ *          запросы и обрабатывает результаты. Поэтому даже один обработчик очереди
+ *          держит в полете до max_total запросов, и задержка сервера не
+ *          складывается по запросам пачки. Лимиты общие для всех вызовов Dispatch:
+ *          несколько обработчиков делят одни и те же потоки и слоты.
+ */
+class QueueDispatcher {
+public:
+    static const int kMaxInFlight = 64;    ///< Верхняя граница max_total
+
+    /// Отправка одного запроса пачки (вызывается в потоке пула)
+    typedef std::function<bool(const QueueBatch& batch, size_t index, SendFailure* failure)> SendFunction;
+    /// Разрешение на отправку (лимит частоты); false - остановка раздачи
+    typedef std::function<bool(size_t index)> AcquireFunction;
+    /// Результат отправки (вызывается в потоке, вызвавшем Dispatch)
+    typedef std::function<void(size_t index, bool success, const SendFailure& failure)> CompleteFunction;
+
+    QueueDispatcher();
+
+    /**
+     * @brief Дожидается отправок в полете и останавливает пул
+     */
+    ~QueueDispatcher();
+
+    /**
+     * @brief Задает лимиты и пересоздает пул при изменении его размера
+     * @param max_total Одновременных отправок всего (1..kMaxInFlight; 1 - без пула)
+     * @param max_host Одновременных отправок на один хост (<= 0 - как max_total)
+     * @return false, если не удалось создать потоки пула (лимит сбрасывается в 1)
+     * @details Можно вызывать во время Dispatch: пока пул пересоздается, запросы
+     *          отправляются в вызывающем Dispatch потоке
+     */
+    bool Configure(int max_total, int max_host);
+
+    /**
+     * @brief Дожидается отправок пула и останавливает его потоки
+     * @details Лимиты сохраняются: следующий Dispatch запускает пул заново
+     */
+    void Stop();
+
+    /**
+     * @brief Лимит одновременных отправок (1 - отправка в вызывающем потоке)
+     */
+    int GetMaxInFlight() const;
+
+    /**
+     * @brief Подключает регулятор лимитов хостов
+     * @param controller Регулятор (NULL - только постоянный лимит на хост); должен
+     *        существовать, пока существует диспетчер
+     * @details Пока регулятор включен, лимит хоста - меньшее из его лимита и max_host;
+     *          каждая отправка пула сообщает ему время ответа и результат.
+     */
+    void SetAdaptive(AdaptiveConcurrency* controller);
+
+    /**
+     * @brief Отправляет запросы пачки и ждет завершения всех начатых отправок
+     * @param batch Пачка
+     * @param send Отправка одного запроса
+     * @param acquire Вызывается перед передачей запроса в пул
+     * @param on_complete Вызывается для каждого результата по мере завершения
+     * @param dispatched Заполняется флагами: 1 - запрос передан на отправку
+     * @return Количество переданных на отправку запросов (меньше размера пачки при остановке)
+     * @details Запросы раздаются по порядку; запрос хоста, исчерпавшего свой лимит,
+     *          пропускается, пока не освободится слот этого хоста.
+     */
+    int Dispatch(const QueueBatch& batch, const SendFunction& send, const AcquireFunction& acquire,
+                 const CompleteFunction& on_complete, std::vector<char>& dispatched);
+
+private:
+    struct Completion {
+        size_t index;
+        bool success;
+        SendFailure failure;
+    };
+
+    /// Состояние одного вызова Dispatch
+    struct DispatchCall {
+        std::vector<Completion> done;
+        int in_flight;
+    };
+
+    struct Job {
+        const QueueBatch* batch;
+        size_t index;
+        const SendFunction* send;
+        DispatchCall* call;
+        std::map<std::wstring, int>::iterator host;
+    };
+
+    mutable CRITICAL_SECTION cs;
+    CRITICAL_SECTION config_cs;             ///< Последовательные вызовы Configure
+    CONDITION_VARIABLE job_cv;              ///< Появилась отправка для пула
+    CONDITION_VARIABLE done_cv;             ///< Отправка завершена, освободился слот
+    std::deque<Job> jobs;
+    std::vector<HANDLE> threads;
+    std::map<std::wstring, int> host_in_flight;    ///< Записи не удаляются: итераторы хранятся в Job
+    int in_flight;
+    int max_in_flight;
+    int max_per_host;
+    int running;                            ///< Потоков пула, принимающих задачи
+    AdaptiveConcurrency* adaptive;
+    bool stopping;
+
+    static DWORD WINAPI ThreadProc(LPVOID param);
+    void Run();
+    void Execute(const Job& job);
+    bool StartThreads(int count);
+    void StopThreads();
+
+    QueueDispatcher(const QueueDispatcher&);
+    QueueDispatcher& operator=(const QueueDispatcher&);
+};
+
+#endif
@@ -0,0 +1,186 @@
+﻿#include "QueueEnvelope.h"
+#include <algorithm>
+
+EnvelopeSettings::EnvelopeSettings() : enabled(false) {
+    InitializeCriticalSection(&cs);
+}
+
+EnvelopeSettings::~EnvelopeSettings() {
+    DeleteCriticalSection(&cs);
+}
+
+void EnvelopeSettings::Set(const std::wstring& server_url, int format, int max_items, int max_bytes) {
+    Limits value;
+    value.format = format == ENVELOPE_JSON_ARRAY || format == ENVELOPE_NDJSON ? format : ENVELOPE_NONE;
+    value.max_items = max_items > 0 ? max_items : kDefaultMaxItems;
+    value.max_bytes = (size_t)(max_bytes > 0 ? max_bytes : kDefaultMaxBytes);
+
+    EnterCriticalSection(&cs);
+    if (value.format == ENVELOPE_NONE && !server_url.empty())
+        limits.erase(server_url);
+    else
+        limits[server_url] = value;
+
+    enabled = false;
+    for (std::map<std::wstring, Limits>::const_iterator it = limits.begin(); it != limits.end(); ++it)
+        enabled = enabled || it->second.format != ENVELOPE_NONE;
+    LeaveCriticalSection(&cs);
+}
+
+EnvelopeSettings::Limits EnvelopeSettings::Find(const std::wstring& server_url) const {
+    std::map<std::wstring, Limits>::const_iterator it = limits.find(server_url);
+    if (it == limits.end()) it = limits.find(std::wstring());
+    if (it != limits.end()) return it->second;
+
+    Limits none = { ENVELOPE_NONE, 1, 0 };
+    return none;
+}
+
+bool EnvelopeSettings::Group(const QueueBatch& batch, std::vector<EnvelopeGroup>& groups) const {
+    groups.clear();
+
+    EnterCriticalSection(&cs);
+    if (!enabled) {
+        LeaveCriticalSection(&cs);
+        return false;
+    }
+
+    // Настройка и открытая группа по номеру адреса: адресов в пачке обычно несколько
+    std::map<int, Limits> endpoint_limits;
+    std::map<int, size_t> open_group;
+    std::vector<size_t> group_bytes;
+    bool combined = false;
+
+    for (size_t i = 0; i < batch.Size(); ++i) {
+        const QueueItemView& item = batch[i];
+        std::map<int, Limits>::iterator found = endpoint_limits.find(item.endpoint);
+        if (found == endpoint_limits.end())
+            found = endpoint_limits.insert(std::make_pair(item.endpoint, Find(EndpointTable::Instance().Url(item.endpoint)))).first;
+        const Limits& limit = found->second;
+
+        // Разделитель и скобки массива учитываются с запасом: по байту на запрос и 2 на группу
+        size_t item_bytes = item.body_size + 1;
+        if (limit.format == ENVELOPE_NONE || item_bytes + 2 > limit.max_bytes) {
+            EnvelopeGroup single = { ENVELOPE_NONE, std::vector<size_t>(1, i) };
+            groups.push_back(single);
+            group_bytes.push_back(item_bytes);
+            continue;
+        }
+
+        std::map<int, size_t>::iterator open = open_group.find(item.endpoint);
+        if (open != open_group.end()) {
+            EnvelopeGroup& group = groups[open->second];
+            if ((int)group.members.size() < limit.max_items && group_bytes[open->second] + item_bytes <= limit.max_bytes) {
+                group.members.push_back(i);
+                group_bytes[open->second] += item_bytes;
+                combined = true;
+                continue;
+            }
+        }
+
+        EnvelopeGroup group = { limit.format, std::vector<size_t>(1, i) };
+        open_group[item.endpoint] = groups.size();
+        groups.push_back(group);
+        group_bytes.push_back(item_bytes + 2);
+    }
+    LeaveCriticalSection(&cs);
+
+    return combined;
+}
+
+void BuildEnvelope(int format, const QueueBatch& batch, const std::vector<size_t>& members, std::string& body) {
+    size_t total = 2;
+    for (size_t m = 0; m < members.size(); ++m)
+        total += batch[members[m]].body_size + 1;
+
+    body.clear();
+    body.reserve(total);
+
+    if (format == ENVELOPE_JSON_ARRAY) {
+        body += '[';
+        for (size_t m = 0; m < members.size(); ++m) {
+            const QueueItemView& item = batch[members[m]];
+            if (m > 0) body += ',';
+            body.append(batch.Body(item), item.body_size);
+        }
+        body += ']';
+        return;
+    }
+
+    for (size_t m = 0; m < members.size(); ++m) {
+        const QueueItemView& item = batch[members[m]];
+        size_t start = body.size();
+        body.append(batch.Body(item), item.body_size);
+        std::replace(body.begin() + start, body.end(), '\r', ' ');
+        std::replace(body.begin() + start, body.end(), '\n', ' ');
+        body += '\n';
+    }
+}
+
+static bool IsJsonSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Элементы JSON-массива верхнего уровня без полного разбора: учитываются только
+// вложенность скобок и строки, этого достаточно, чтобы найти запятые между элементами
+static bool SplitJsonArray(const std::string& response, std::vector<std::string>& parts) {
+    size_t pos = 0;
+    while (pos < response.size() && IsJsonSpace(response[pos])) ++pos;
+    if (pos >= response.size() || response[pos] != '[') return false;
+    ++pos;
+
+    int depth = 0;
+    bool in_string = false;
+    size_t start = pos;
+    for (; pos < response.size(); ++pos) {
+        char c = response[pos];
+        if (in_string) {
+            if (c == '\\') ++pos;
+            else if (c == '"') in_string = false;
+            continue;
+        }
+
+        if (c == '"') in_string = true;
+        else if (c == '[' || c == '{') depth++;
+        else if ((c == ']' || c == '}') && depth > 0) depth--;
+        else if ((c == ',' || c == ']') && depth == 0) {
+            size_t first = start, last = pos;
+            while (first < last && IsJsonSpace(response[first])) ++first;
+            while (last > first && IsJsonSpace(response[last - 1])) --last;
+
+            if (first == last) {
+                // Пустой элемент допустим только в пустом массиве "[]"
+                if (c == ',' || !parts.empty()) return false;
+            }
+            else {
+                parts.push_back(response.substr(first, last - first));
+            }
+
+            if (c == ']') return true;
+            start = pos + 1;
+        }
+    }
+    return false;
+}
+
+bool SplitEnvelopeResponse(int format, const std::string& response, size_t count, std::vector<std::string>& parts) {
+    parts.clear();
+
+    if (format == ENVELOPE_JSON_ARRAY) {
+        if (!SplitJsonArray(response, parts)) return false;
+    }
+    else {
+        size_t start = 0;
+        while (start < response.size()) {
+            size_t end = response.find('\n', start);
+            if (end == std::string::npos) end = response.size();
+
+            size_t last = end;
+            if (last > start && response[last - 1] == '\r') --last;
+            if (last > start) parts.push_back(response.substr(start, last - start));
+            start = end + 1;
+        }
+    }
+
+    return parts.size() == count;
+}
@@ -0,0 +1,107 @@
+﻿#pragma once
+#ifndef QUEUE_ENVELOPE_H
+#define QUEUE_ENVELOPE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <windows.h>
+#include "QueueBatch.h"
+
+/**
+ * @file QueueEnvelope.h
+ * @brief Объединение запросов очереди на один адрес в один POST
+ */
+
+/**
+ * @enum EnvelopeFormat
+ * @brief Формат общего тела запроса
+ */
+enum EnvelopeFormat {
+    ENVELOPE_NONE = 0,              ///< Каждый запрос отправляется отдельно (по умолчанию)
+    ENVELOPE_JSON_ARRAY = 1,        ///< JSON-массив тел; ответ - массив той же длины
+    ENVELOPE_NDJSON = 2             ///< Тело на строку; ответ - строка на запрос
+};
+
+/**
+ * @struct EnvelopeGroup
+ * @brief Запросы пачки, которые отправляются одним POST
+ */
+struct EnvelopeGroup {
+    int format;                     ///< EnvelopeFormat (ENVELOPE_NONE для одиночного запроса)
+    std::vector<size_t> members;    ///< Индексы запросов в пачке, по порядку
+};
+
+/**
+ * @class EnvelopeSettings
+ * @brief Формат и лимиты объединения по адресам
+ * @details Объединять запросы можно только для сервера, который принимает
+ *          общее тело, поэтому настройка задается по адресу; пустой адрес
+ *          задает настройку для остальных адресов.
+ */
+class EnvelopeSettings {
+public:
+    static const int kDefaultMaxItems = 100;
+    static const int kDefaultMaxBytes = 256 * 1024;
+
+    EnvelopeSettings();
+    ~EnvelopeSettings();
+
+    /**
+     * @brief Задает объединение для адреса
+     * @param server_url Адрес ("" - для адресов без собственной настройки)
+     * @param format EnvelopeFormat (ENVELOPE_NONE - отключить)
+     * @param max_items Запросов в одном POST (<= 0 - kDefaultMaxItems)
+     * @param max_bytes Размер общего тела, байт (<= 0 - kDefaultMaxBytes)
+     */
+    void Set(const std::wstring& server_url, int format, int max_items, int max_bytes);
+
+    /**
+     * @brief Разбивает пачку на группы для отправки
+     * @param batch Пачка
+     * @param groups Заполняется группами; запросы без объединения - группы из одного запроса
+     * @return false, если объединять нечего (каждая группа из одного запроса)
+     * @details Запросы группируются по адресу в порядке пачки. Запрос, тело которого
+     *          само больше max_bytes, отправляется отдельно.
+     */
+    bool Group(const QueueBatch& batch, std::vector<EnvelopeGroup>& groups) const;
+
+private:
+    struct Limits {
+        int format;
+        int max_items;
+        size_t max_bytes;
+    };
+
+    mutable CRITICAL_SECTION cs;
+    std::map<std::wstring, Limits> limits;     ///< По адресу, "" - по умолчанию
+    bool enabled;                              ///< Хотя бы один адрес объединяется
+
+    Limits Find(const std::wstring& server_url) const;
+
+    EnvelopeSettings(const EnvelopeSettings&);
+    EnvelopeSettings& operator=(const EnvelopeSettings&);
+};
+
+/**
+ * @brief Собирает общее тело из тел запросов группы
+ * @param format ENVELOPE_JSON_ARRAY или ENVELOPE_NDJSON
+ * @param batch Пачка
+ * @param members Индексы запросов
+ * @param body Получает общее тело
+ * @details Для NDJSON переводы строк в теле заменяются пробелами: в JSON они
+ *          допустимы только как пробельные символы вне строк.
+ */
+void BuildEnvelope(int format, const QueueBatch& batch, const std::vector<size_t>& members, std::string& body);
+
+/**
+ * @brief Разбивает ответ на общее тело на ответы по запросам
+ * @param format ENVELOPE_JSON_ARRAY или ENVELOPE_NDJSON
+ * @param response Ответ сервера
+ * @param count Ожидаемое количество ответов
+ * @param parts Получает ответы по порядку запросов
+ * @return false, если ответ не разбирается или число ответов не равно count
+ */
+bool SplitEnvelopeResponse(int format, const std::string& response, size_t count, std::vector<std::string>& parts);
+
+#endif
@@ -0,0 +1,96 @@
+﻿#include "QueuePipeline.h"
+#include "Utilities.h"
+#include <algorithm>
+
+Prefetcher::Prefetcher()
+    : thread(NULL), start_event(NULL), done_event(NULL), pending(false), stopping(false), task_us(0) {
+}
+
+Prefetcher::~Prefetcher() {
+    if (pending) Wait();
+
+    if (thread) {
+        stopping = true;
+        SetEvent(start_event);
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
+    if (start_event) CloseHandle(start_event);
+    if (done_event) CloseHandle(done_event);
+}
+
+bool Prefetcher::Start() {
+    if (thread) return true;
+
+    start_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    done_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (start_event && done_event) {
+        thread = CreateModuleThread(ThreadProc, this, 0, NULL);
+    }
+    return thread != NULL;
+}
+
+void Prefetcher::Begin(const Task& next) {
+    task = next;
+    pending = true;
+
+    if (thread) {
+        SetEvent(start_event);
+    }
+    else {
+        Execute();
+    }
+}
+
+long long Prefetcher::Wait() {
+    if (!pending) return 0;
+
+    if (thread) WaitForSingleObject(done_event, INFINITE);
+    pending = false;
+    task = Task();
+    return task_us;
+}
+
+DWORD WINAPI Prefetcher::ThreadProc(LPVOID param) {
+    static_cast<Prefetcher*>(param)->Run();
+    return 0;
+}
+
+void Prefetcher::Run() {
+    for (;;) {
+        WaitForSingleObject(start_event, INFINITE);
+        if (stopping) break;
+
+        Execute();
+        SetEvent(done_event);
+    }
+}
+
+void Prefetcher::Execute() {
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t0);
+
+    task();
+
+    QueryPerformanceCounter(&t1);
+    task_us = (t1.QuadPart - t0.QuadPart) * 1000000 / freq.QuadPart;
+}
+
+AdaptiveBatchSize::AdaptiveBatchSize(int min_size, int max_size, int target_ms)
+    : min_size(std::max(1, min_size)), max_size(std::max(min_size, max_size)), target_us(target_ms * 1000.0),
+      item_us(0), size(std::max(1, min_size)) {
+}
+
+void AdaptiveBatchSize::Record(int items, long long elapsed_us) {
+    if (items <= 0) return;
+
+    double sample = (double)elapsed_us / items;
+    item_us = item_us > 0 ? item_us * 0.7 + sample * 0.3 : sample;
+
+    // Рост не больше чем вдвое за пачку: одна быстрая пачка не должна сразу
+    // раздувать размер, если сервер отвечает неровно
+    double wanted = item_us > 0 ? target_us / item_us : max_size;
+    int next = (int)std::min(wanted, (double)size * 2);
+    size = std::max(min_size, std::min(max_size, next));
+}
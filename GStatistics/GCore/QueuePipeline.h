@@ -0,0 +1,112 @@
+﻿#pragma once
+#ifndef QUEUE_PIPELINE_H
+#define QUEUE_PIPELINE_H
+
+#include <functional>
+#include <windows.h>
+
+/**
+ * @file QueuePipeline.h
+ * @brief Конвейер разбора очереди: предвыборка следующей пачки и размер пачки по задержке
+ */
+
+/**
+ * @class Prefetcher
+ * @brief Выполняет одну задачу выборки во вспомогательном потоке
+ * @details Пока отправляется текущая пачка, следующая читается из хранилища в
+ *          отдельном потоке, поэтому чтение базы и отправка по сети идут
+ *          одновременно, а не по очереди. Одновременно выполняется не больше
+ *          одной задачи. Если поток не удалось запустить, задача выполняется
+ *          синхронно в Begin.
+ */
+class Prefetcher {
+public:
+    typedef std::function<void()> Task;
+
+    Prefetcher();
+
+    /**
+     * @brief Дожидается текущей задачи и останавливает поток
+     */
+    ~Prefetcher();
+
+    /**
+     * @brief Запускает вспомогательный поток
+     * @return false, если поток не создан (задачи будут выполняться синхронно)
+     */
+    bool Start();
+
+    /**
+     * @brief Начинает выполнение задачи
+     * @param task Задача; результат она сохраняет сама, до Wait его читать нельзя
+     * @details Предыдущая задача должна быть завершена вызовом Wait
+     */
+    void Begin(const Task& task);
+
+    /**
+     * @brief Ждет завершения задачи, начатой Begin
+     * @return Длительность задачи, мкс
+     */
+    long long Wait();
+
+private:
+    HANDLE thread;
+    HANDLE start_event;         ///< Новая задача или остановка
+    HANDLE done_event;          ///< Задача выполнена
+    Task task;
+    bool pending;               ///< Begin вызван, Wait еще нет
+    bool stopping;
+    long long task_us;
+
+    static DWORD WINAPI ThreadProc(LPVOID param);
+    void Run();
+    void Execute();
+
+    Prefetcher(const Prefetcher&);
+    Prefetcher& operator=(const Prefetcher&);
+};
+
+/**
+ * @class AdaptiveBatchSize
+ * @brief Размер пачки, при котором ее отправка занимает заданное время
+ * @details Среднее время отправки одного запроса сглаживается (EWMA). Медленный
+ *          сервер или лимит частоты уменьшают пачку: запросы не держатся в захвате
+ *          подолгу, а остановка и новые запросы учитываются быстрее. Быстрый
+ *          сервер увеличивает пачку, и чтение базы на каждую пачку обходится
+ *          дешевле на запрос.
+ */
+class AdaptiveBatchSize {
+public:
+    /**
+     * @param min_size Минимальный размер пачки
+     * @param max_size Максимальный размер пачки
+     * @param target_ms Желаемая длительность отправки пачки, мс
+     */
+    AdaptiveBatchSize(int min_size, int max_size, int target_ms);
+
+    /**
+     * @brief Текущий размер пачки
+     */
+    int Get() const { return size; }
+
+    /**
+     * @brief Учитывает отправленную пачку
+     * @param items Количество отправленных запросов (0 - не учитывается)
+     * @param elapsed_us Длительность отправки, мкс
+     */
+    void Record(int items, long long elapsed_us);
+
+    /**
+     * @brief Сглаженное время отправки одного запроса, мкс (0 - еще не измерено)
+     */
+    double GetItemUs() const { return item_us; }
+
+private:
+    int min_size;
+    int max_size;
+    double target_us;
+    double item_us;
+    int size;
+};
+
+#endif
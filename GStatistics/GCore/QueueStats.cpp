@@ -0,0 +1,110 @@
+﻿#include "QueueStats.h"
+
+QueueStats::QueueStats() {
+    InitializeCriticalSection(&cs);
+    totals[QUEUE_TABLE_REQUESTS] = 0;
+    totals[QUEUE_TABLE_RESPONSES] = 0;
+}
+
+QueueStats::~QueueStats() {
+    DeleteCriticalSection(&cs);
+}
+
+void QueueStats::Reset() {
+    EnterCriticalSection(&cs);
+    for (int table = 0; table < QUEUE_TABLE_COUNT; ++table) {
+        buckets[table].clear();
+        totals[table] = 0;
+    }
+    LeaveCriticalSection(&cs);
+}
+
+void QueueStats::Add(int table, time_t timestamp, long long delta) {
+    if (table < 0 || table >= QUEUE_TABLE_COUNT) return;
+
+    long long bucket = (long long)timestamp / kBucketSeconds;
+
+    EnterCriticalSection(&cs);
+    long long& count = buckets[table][bucket];
+    count += delta;
+    totals[table] += delta;
+    if (count <= 0) {
+        buckets[table].erase(bucket);
+    }
+    if (totals[table] < 0) {
+        totals[table] = 0;
+    }
+    LeaveCriticalSection(&cs);
+}
+
+void QueueStats::SetBucket(int table, long long bucket, long long count) {
+    if (table < 0 || table >= QUEUE_TABLE_COUNT) return;
+
+    EnterCriticalSection(&cs);
+    std::map<long long, long long>::iterator it = buckets[table].find(bucket);
+    if (it != buckets[table].end()) {
+        totals[table] -= it->second;
+        buckets[table].erase(it);
+    }
+    if (count > 0) {
+        buckets[table][bucket] = count;
+        totals[table] += count;
+    }
+    LeaveCriticalSection(&cs);
+}
+
+long long QueueStats::GetTotal(int table) {
+    if (table < 0 || table >= QUEUE_TABLE_COUNT) return 0;
+
+    EnterCriticalSection(&cs);
+    long long total = totals[table];
+    LeaveCriticalSection(&cs);
+    return total;
+}
+
+long long QueueStats::GetOlderThan(int table, time_t cutoff_time, long long* boundary) {
+    if (boundary) *boundary = 0;
+    if (table < 0 || table >= QUEUE_TABLE_COUNT) return 0;
+
+    long long cutoff_bucket = (long long)cutoff_time / kBucketSeconds;
+    long long count = 0;
+
+    // Корзин не больше, чем часов в окне хранения, поэтому проход короткий
+    EnterCriticalSection(&cs);
+    const std::map<long long, long long>& table_buckets = buckets[table];
+    for (std::map<long long, long long>::const_iterator it = table_buckets.begin();
+        it != table_buckets.end() && it->first <= cutoff_bucket; ++it) {
+        if (it->first < cutoff_bucket)
+            count += it->second;
+        else if (boundary)
+            *boundary = it->second;
+    }
+    LeaveCriticalSection(&cs);
+
+    return count;
+}
+
+long long QueueStats::GetAgeHistogram(int table, time_t now, int* counts, int max_buckets) {
+    if (table < 0 || table >= QUEUE_TABLE_COUNT) return 0;
+
+    if (counts) {
+        for (int i = 0; i < max_buckets; ++i) counts[i] = 0;
+    }
+
+    long long now_bucket = (long long)now / kBucketSeconds;
+
+    EnterCriticalSection(&cs);
+    long long total = totals[table];
+    if (counts && max_buckets > 0) {
+        const std::map<long long, long long>& table_buckets = buckets[table];
+        for (std::map<long long, long long>::const_iterator it = table_buckets.begin(); it != table_buckets.end(); ++it) {
+            long long age = now_bucket - it->first;
+            if (age < 0) age = 0;
+            int index = age >= max_buckets ? max_buckets - 1 : (int)age;
+            counts[index] += (int)it->second;
+        }
+    }
+    LeaveCriticalSection(&cs);
+
+    return total;
+}
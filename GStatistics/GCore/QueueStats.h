@@ -0,0 +1,95 @@
+﻿#pragma once
+#ifndef QUEUE_STATS_H
+#define QUEUE_STATS_H
+
+#include <map>
+#include <ctime>
+#include <windows.h>
+
+/**
+ * @file QueueStats.h
+ * @brief Счетчики глубины и возраста записей очереди и ответов
+ */
+
+/**
+ * @enum QueueTable
+ * @brief Таблица, к которой относится счетчик
+ */
+enum QueueTable {
+    QUEUE_TABLE_REQUESTS = 0,       ///< http_queue
+    QUEUE_TABLE_RESPONSES = 1,      ///< http_responses
+    QUEUE_TABLE_COUNT = 2
+};
+
+/**
+ * @class QueueStats
+ * @brief Количество записей по часовым корзинам времени создания
+ * @details Обновляется при каждой вставке и удалении, поэтому глубина очереди
+ *          доступна за O(1), а количество записей старше N часов - без обращения
+ *          к базе данных. Копия счетчиков хранится в таблице queue_stats и
+ *          поддерживается триггерами SQLite.
+ */
+class QueueStats {
+public:
+    static const int kBucketSeconds = 3600; ///< Ширина корзины (1 час)
+
+    QueueStats();
+    ~QueueStats();
+
+    /**
+     * @brief Сбрасывает все счетчики
+     */
+    void Reset();
+
+    /**
+     * @brief Изменяет счетчик корзины, в которую попадает timestamp
+     * @param table Таблица (QueueTable)
+     * @param timestamp Время создания записи
+     * @param delta +1 при вставке, -1 при удалении
+     */
+    void Add(int table, time_t timestamp, long long delta);
+
+    /**
+     * @brief Устанавливает значение корзины (загрузка из queue_stats)
+     * @param table Таблица (QueueTable)
+     * @param bucket Номер корзины (timestamp / kBucketSeconds)
+     * @param count Количество записей
+     */
+    void SetBucket(int table, long long bucket, long long count);
+
+    /**
+     * @brief Возвращает общее количество записей
+     * @param table Таблица (QueueTable)
+     */
+    long long GetTotal(int table);
+
+    /**
+     * @brief Возвращает количество записей в корзинах целиком раньше cutoff_time
+     * @param table Таблица (QueueTable)
+     * @param cutoff_time Граница по времени
+     * @param boundary Если не NULL - количество записей в корзине, содержащей
+     *        cutoff_time. Часть из них старше cutoff_time; точное число
+     *        вызывающий досчитывает сам по записям этой корзины
+     */
+    long long GetOlderThan(int table, time_t cutoff_time, long long* boundary = NULL);
+
+    /**
+     * @brief Заполняет гистограмму возраста записей по часам
+     * @param table Таблица (QueueTable)
+     * @param now Текущее время
+     * @param counts Массив: counts[i] - записи возрастом i часов, последний элемент - все более старые
+     * @param max_buckets Размер массива counts
+     * @return Общее количество записей
+     */
+    long long GetAgeHistogram(int table, time_t now, int* counts, int max_buckets);
+
+private:
+    CRITICAL_SECTION cs;
+    std::map<long long, long long> buckets[QUEUE_TABLE_COUNT]; ///< корзина -> количество
+    long long totals[QUEUE_TABLE_COUNT];
+
+    QueueStats(const QueueStats&);
+    QueueStats& operator=(const QueueStats&);
+};
+
+#endif
@@ -0,0 +1,230 @@
+﻿#pragma once
+#ifndef QUEUE_STORAGE_H
+#define QUEUE_STORAGE_H
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <climits>
+#include <algorithm>
+#include "QueueBatch.h"
+
+/**
+ * @file QueueStorage.h
+ * @brief Общий интерфейс хранилищ очереди HTTP запросов
+ */
+
+/**
+ * @struct QueueItem
+ * @brief Структура представляет элемент очереди HTTP запросов
+ */
+struct QueueItem {
+    int id;                         ///< Уникальный идентификатор записи в хранилище
+    std::wstring server_url;        ///< URL сервера для отправки запроса (UTF-16)
+    std::string json_body;          ///< Тело JSON запроса (UTF-8)
+    bool expect_response;           ///< Флаг ожидания ответа от сервера
+    time_t timestamp;               ///< Временная метка создания записи
+    int response_ttl = 0;           ///< Время хранения ответа, секунд (0 - по настройке адреса)
+    time_t deadline = 0;            ///< Срок доставки: позже запрос не отправляется (0 - без срока)
+    long long next_attempt_ms = 0;  ///< Не отправлять раньше, мс от начала эпохи Unix (0 - сразу)
+};
+
+/**
+ * @struct SendFailure
+ * @brief Результат неудачной попытки отправки запроса
+ */
+struct SendFailure {
+    int http_status;                ///< HTTP статус ответа (0 - ответ не получен)
+    std::string error;              ///< Текст ошибки (UTF-8)
+    long long elapsed_ms;           ///< Длительность попытки, мс
+};
+
+/**
+ * @enum QueueBackend
+ * @brief Доступные реализации хранилища очереди
+ */
+enum QueueBackend {
+    QUEUE_BACKEND_SQLITE = 0,       ///< Таблица http_queue в SQLite (по умолчанию)
+    QUEUE_BACKEND_SEGMENT_LOG = 1   ///< Сегментированный журнал с отображением в память
+};
+
+/**
+ * @class QueueStorage
+ * @brief Хранилище очереди запросов: добавление, выборка и подтверждение отправки
+ * @details Ответы сервера всегда хранятся в SQLite (SQLiteQueue), через этот
+ *          интерфейс проходят только запросы, ожидающие отправки.
+ */
+class QueueStorage {
+public:
+    virtual ~QueueStorage() {}
+
+    /**
+     * @brief Добавляет HTTP запрос в очередь
+     * @param server_url URL сервера (UTF-16)
+     * @param json_body Тело JSON запроса (UTF-8)
+     * @param expect_response Флаг ожидания ответа от сервера
+     * @return true при успешном добавлении, false при ошибке
+     */
+    virtual bool AddToQueue(const std::wstring& server_url, const std::string& json_body, bool expect_response) = 0;
+
+    /**
+     * @brief Добавляет пачку запросов, сохраняя их время создания
+     * @param items Запросы (поле id не используется)
+     * @return Количество сохраненных запросов: при ошибке сохранены только запросы
+     *         пачки до нее, поэтому повторять нужно запросы, начиная с этого номера
+     * @details Реализация по умолчанию добавляет запросы по одному до первой ошибки
+     */
+    virtual int AddToQueueBatch(const std::vector<QueueItem>& items) {
+        int added = 0;
+        for (size_t i = 0; i < items.size(); ++i) {
+            if (!AddToQueue(items[i].server_url, items[i].json_body, items[i].expect_response)) break;
+            added++;
+        }
+        return added;
+    }
+
+    /**
+     * @brief Добавляет запрос с ключом объединения
+     * @param server_url URL сервера (UTF-16)
+     * @param json_body Тело JSON запроса (UTF-8)
+     * @param expect_response Флаг ожидания ответа от сервера
+     * @param coalesce_key Ключ (UTF-8): ожидающий запрос на тот же URL с тем же ключом заменяется новым
+     * @return true при успешном добавлении или замене, false при ошибке
+     * @details Реализация по умолчанию не объединяет запросы и просто добавляет новый
+     */
+    virtual bool AddToQueueCoalesced(const std::wstring& server_url, const std::string& json_body, bool expect_response,
+                                     const std::string& coalesce_key) {
+        (void)coalesce_key;
+        return AddToQueue(server_url, json_body, expect_response);
+    }
+
+    /**
+     * @brief Возвращает неотправленные запросы в порядке отправки
+     * @param limit Максимальное количество записей
+     * @return Список элементов очереди
+     * @details Запросы со сроком доставки идут первыми, по возрастанию срока (EDF),
+     *          затем самые старые запросы без срока
+     */
+    virtual std::vector<QueueItem> GetPendingItems(int limit = 100) = 0;
+
+    /**
+     * @brief Заполняет пачку неотправленными запросами в порядке GetPendingItems
+     * @param batch Пачка (очищается перед заполнением, память переиспользуется)
+     * @param limit Максимальное количество записей
+     * @return Количество запросов в пачке
+     * @details Реализация по умолчанию копирует результат GetPendingItems
+     */
+    virtual int GetPendingBatch(QueueBatch& batch, int limit) {
+        batch.Clear();
+        std::vector<QueueItem> items = GetPendingItems(limit);
+        for (size_t i = 0; i < items.size(); ++i) {
+            batch.Add(items[i]);
+        }
+        return (int)batch.Size();
+    }
+
+    /**
+     * @brief Заполняет пачку запросами с идентификатором больше after_id
+     * @param batch Пачка (очищается перед заполнением, память переиспользуется)
+     * @param after_id Последний идентификатор предыдущей пачки (0 - с начала очереди)
+     * @param limit Максимальное количество записей
+     * @return Количество запросов в пачке
+     * @details Постраничный обход очереди по возрастанию id: каждый запрос
+     *          выбирается за проход один раз, даже если его отправка не удалась.
+     *          Реализация по умолчанию фильтрует результат GetPendingItems.
+     */
+    virtual int GetPendingBatchAfter(QueueBatch& batch, int after_id, int limit) {
+        batch.Clear();
+        std::vector<QueueItem> items = GetPendingItems(INT_MAX);
+        std::sort(items.begin(), items.end(), [](const QueueItem& a, const QueueItem& b) { return a.id < b.id; });
+        for (size_t i = 0; i < items.size() && (int)batch.Size() < limit; ++i) {
+            if (items[i].id > after_id) batch.Add(items[i]);
+        }
+        return (int)batch.Size();
+    }
+
+    /**
+     * @brief Удаляет (подтверждает) отправленный запрос
+     * @param id Идентификатор записи
+     * @return true при успехе, false при ошибке
+     */
+    virtual bool RemoveFromQueue(int id) = 0;
+
+    /**
+     * @brief Удаляет (подтверждает) несколько отправленных запросов
+     * @param ids Идентификаторы записей
+     * @return Количество удаленных записей
+     * @details Реализация по умолчанию удаляет записи по одной
+     */
+    virtual int RemoveFromQueueBatch(const std::vector<int>& ids) {
+        int removed = 0;
+        for (size_t i = 0; i < ids.size(); ++i) {
+            if (RemoveFromQueue(ids[i])) removed++;
+        }
+        return removed;
+    }
+
+    /**
+     * @brief Удаляет самые старые запросы (вытеснение при переполнении очереди)
+     * @param count Сколько запросов удалить
+     * @param without_response_only true - только запросы, ответ на которые не ожидается
+     * @return Количество удаленных записей
+     * @details Реализация по умолчанию выбирает запросы через GetPendingItems
+     */
+    virtual int DropOldestQueueItems(int count, bool without_response_only) {
+        if (count <= 0) return 0;
+
+        // Запросы с ожиданием ответа пропускаются, поэтому выбираем с запасом
+        std::vector<QueueItem> items = GetPendingItems(without_response_only ? count * 4 : count);
+        std::vector<int> ids;
+        for (size_t i = 0; i < items.size() && (int)ids.size() < count; ++i) {
+            if (!without_response_only || !items[i].expect_response)
+                ids.push_back(items[i].id);
+        }
+        return RemoveFromQueueBatch(ids);
+    }
+
+    /**
+     * @brief Учитывает неудачную попытку отправки запроса
+     * @param id Идентификатор записи
+     * @param failure Результат попытки
+     * @param max_attempts Максимум попыток (0 - без ограничения)
+     * @param permanent true - ошибка не исправится повтором (запрос переносится сразу)
+     * @return 1 - запрос перенесен в недоставленные, 0 - остался в очереди, -1 - ошибка
+     * @details Реализация по умолчанию не считает попытки: запрос остается в очереди
+     */
+    virtual int RecordSendFailure(int id, const SendFailure& failure, int max_attempts, bool permanent) {
+        (void)id; (void)failure; (void)max_attempts; (void)permanent;
+        return 0;
+    }
+
+    /**
+     * @brief Удаляет запросы старше указанного возраста
+     * @param hours_old Возраст записей в часах
+     * @return Количество удаленных записей
+     */
+    virtual int CleanOldQueueItems(int hours_old) = 0;
+
+    /**
+     * @brief Возвращает количество запросов старше указанного возраста
+     * @param hours_old Возраст записей в часах
+     * @return Количество записей
+     */
+    virtual int GetOldQueueItemsCount(int hours_old) = 0;
+
+    /**
+     * @brief Возвращает количество запросов в очереди
+     * @return Количество записей
+     */
+    virtual long long GetQueueDepth() = 0;
+
+    /**
+     * @brief Заполняет гистограмму возраста запросов по часам
+     * @param counts Массив: counts[i] - запросы возрастом i часов, последний элемент - все более старые
+     * @param max_buckets Размер массива counts
+     * @return Количество запросов в очереди
+     */
+    virtual long long GetQueueAgeHistogram(int* counts, int max_buckets) = 0;
+};
+
+#endif
@@ -0,0 +1,159 @@
+﻿#include "RateLimiter.h"
+#include <algorithm>
+#include <cwctype>
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+HostRateLimiter::HostRateLimiter()
+    : default_rate(kDefaultRate), default_burst(kDefaultBurst), waits(0), wait_us(0) {
+    InitializeCriticalSection(&cs);
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    frequency = freq.QuadPart;
+}
+
+HostRateLimiter::~HostRateLimiter() {
+    DeleteCriticalSection(&cs);
+}
+
+std::wstring HostRateLimiter::HostOf(const std::wstring& url) {
+    size_t start = url.find(L"://");
+    start = start == std::wstring::npos ? 0 : start + 3;
+
+    size_t end = url.find_first_of(L"/?#", start);
+    if (end == std::wstring::npos) end = url.size();
+
+    // Учетные данные в URL (user:pass@host) к хосту не относятся
+    size_t at = url.rfind(L'@', end);
+    if (at != std::wstring::npos && at >= start) start = at + 1;
+
+    // Адрес IPv6 в квадратных скобках ([::1]:8080) сам содержит двоеточия: порт ищется после ']'
+    size_t port_from = start;
+    if (start < end && url[start] == L'[') {
+        size_t bracket = url.find(L']', start);
+        if (bracket != std::wstring::npos && bracket < end) port_from = bracket + 1;
+    }
+
+    size_t port = url.find(L':', port_from);
+    if (port != std::wstring::npos && port < end) end = port;
+
+    std::wstring host = url.substr(start, end - start);
+    for (size_t i = 0; i < host.size(); ++i)
+        host[i] = (wchar_t)towlower(host[i]);
+    return host;
+}
+
+void HostRateLimiter::SetLimit(const std::wstring& host, double rate, int burst) {
+    double capacity = burst < 1 ? 1.0 : (double)burst;
+    std::wstring key = HostOf(host);
+
+    EnterCriticalSection(&cs);
+    if (key.empty()) {
+        default_rate = rate;
+        default_burst = capacity;
+
+        // Хосты без собственной настройки переходят на новый лимит
+        for (std::map<std::wstring, Bucket>::iterator it = buckets.begin(); it != buckets.end(); ++it) {
+            if (it->second.custom) continue;
+            it->second.rate = rate;
+            it->second.burst = capacity;
+            it->second.tokens = std::min(it->second.tokens, capacity);
+        }
+    }
+    else {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+
+        std::map<std::wstring, Bucket>::iterator it = buckets.find(key);
+        if (it == buckets.end()) {
+            Bucket bucket = { rate, capacity, capacity, now.QuadPart, true };
+            buckets[key] = bucket;
+        }
+        else {
+            it->second.rate = rate;
+            it->second.burst = capacity;
+            it->second.tokens = std::min(it->second.tokens, capacity);
+            it->second.custom = true;
+        }
+    }
+    LeaveCriticalSection(&cs);
+}
+
+long long HostRateLimiter::Reserve(const std::wstring& url) {
+    std::wstring key = HostOf(url);
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    EnterCriticalSection(&cs);
+    std::map<std::wstring, Bucket>::iterator it = buckets.find(key);
+    if (it == buckets.end()) {
+        Bucket bucket = { default_rate, default_burst, default_burst, now.QuadPart, false };
+        it = buckets.insert(std::make_pair(key, bucket)).first;
+    }
+
+    Bucket& bucket = it->second;
+    long long wait = 0;
+    if (bucket.rate > 0) {
+        double elapsed = (double)(now.QuadPart - bucket.updated) / frequency;
+        bucket.tokens = std::min(bucket.burst, bucket.tokens + elapsed * bucket.rate);
+        bucket.updated = now.QuadPart;
+
+        bucket.tokens -= 1.0;
+        if (bucket.tokens < 0) {
+            wait = (long long)(-bucket.tokens / bucket.rate * 1000000.0);
+            waits++;
+            wait_us += wait;
+        }
+    }
+    LeaveCriticalSection(&cs);
+
+    return wait;
+}
+
+bool HostRateLimiter::Acquire(const std::wstring& url, HANDLE stop) {
+    long long wait = Reserve(url);
+    return wait <= 0 || WaitMicroseconds(wait, stop);
+}
+
+void HostRateLimiter::GetWaitStats(long long& wait_count, long long& wait_total_us) const {
+    EnterCriticalSection(&cs);
+    wait_count = waits;
+    wait_total_us = wait_us;
+    LeaveCriticalSection(&cs);
+}
+
+bool WaitMicroseconds(long long microseconds, HANDLE stop) {
+    if (microseconds <= 0)
+        return !stop || WaitForSingleObject(stop, 0) == WAIT_TIMEOUT;
+
+    HANDLE timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!timer)
+        timer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+
+    if (!timer) {
+        DWORD ms = (DWORD)((microseconds + 999) / 1000);
+        if (stop) return WaitForSingleObject(stop, ms) == WAIT_TIMEOUT;
+        Sleep(ms);
+        return true;
+    }
+
+    // Отрицательное значение - относительное время в интервалах по 100 нс
+    LARGE_INTEGER due;
+    due.QuadPart = -microseconds * 10;
+    SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE);
+
+    bool completed = true;
+    if (stop) {
+        HANDLE handles[2] = { timer, stop };
+        completed = WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0;
+    }
+    else {
+        WaitForSingleObject(timer, INFINITE);
+    }
+
+    CloseHandle(timer);
+    return completed;
+}
@@ -0,0 +1,100 @@
+﻿#pragma once
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <map>
+#include <string>
+#include <windows.h>
+
+/**
+ * @file RateLimiter.h
+ * @brief Ограничение частоты запросов к серверу (token bucket по хосту)
+ */
+
+/**
+ * @class HostRateLimiter
+ * @brief Корзина токенов на каждый хост
+ * @details Корзина пополняется со скоростью rate токенов в секунду до burst.
+ *          Отправка забирает один токен; если токенов нет, запрос резервирует
+ *          будущий токен и ждет его появления. Резервирование выполняется под
+ *          блокировкой, а ожидание - без нее, поэтому несколько обработчиков
+ *          делят лимит хоста и не ждут друг друга дольше необходимого.
+ */
+class HostRateLimiter {
+public:
+    /// Лимит по умолчанию: 10 запросов в секунду без пачек, как прежняя пауза 100 мс
+    static const int kDefaultRate = 10;
+    static const int kDefaultBurst = 1;
+
+    HostRateLimiter();
+    ~HostRateLimiter();
+
+    /**
+     * @brief Задает лимит хоста
+     * @param host Имя хоста без порта (регистр не важен); пустая строка - лимит
+     *             для хостов без собственной настройки
+     * @param rate Запросов в секунду (<= 0 - без ограничения)
+     * @param burst Запросов, которые можно отправить подряд без ожидания (< 1 - 1)
+     */
+    void SetLimit(const std::wstring& host, double rate, int burst);
+
+    /**
+     * @brief Резервирует отправку запроса
+     * @param url URL запроса (UTF-16)
+     * @return Сколько микросекунд нужно подождать перед отправкой (0 - можно сразу)
+     */
+    long long Reserve(const std::wstring& url);
+
+    /**
+     * @brief Резервирует отправку и ждет, пока она разрешена
+     * @param url URL запроса (UTF-16)
+     * @param stop Событие остановки (NULL - ждать без прерывания)
+     * @return false, если ожидание прервано событием stop
+     */
+    bool Acquire(const std::wstring& url, HANDLE stop);
+
+    /**
+     * @brief Количество ожиданий и их суммарная длительность, мкс
+     */
+    void GetWaitStats(long long& wait_count, long long& wait_total_us) const;
+
+    /**
+     * @brief Имя хоста из URL в нижнем регистре, без порта
+     * @details Адрес IPv6 возвращается в квадратных скобках: "http://[::1]:8080/" - "[::1]"
+     */
+    static std::wstring HostOf(const std::wstring& url);
+
+private:
+    struct Bucket {
+        double rate;            ///< Токенов в секунду (<= 0 - без ограничения)
+        double burst;           ///< Емкость корзины
+        double tokens;          ///< Может быть отрицательным: токены уже зарезервированы
+        LONGLONG updated;       ///< Время последнего пополнения (QueryPerformanceCounter)
+        bool custom;            ///< Лимит задан для хоста, а не взят по умолчанию
+    };
+
+    mutable CRITICAL_SECTION cs;
+    std::map<std::wstring, Bucket> buckets;
+    double default_rate;
+    double default_burst;
+    LONGLONG frequency;
+    long long waits;
+    long long wait_us;
+
+    HostRateLimiter(const HostRateLimiter&);
+    HostRateLimiter& operator=(const HostRateLimiter&);
+};
+
+/**
+ * @brief Ждет заданное время на таймере высокого разрешения
+ * @param microseconds Длительность ожидания
+ * @param stop Событие остановки (NULL - ждать без прерывания)
+ * @return false, если ожидание прервано событием stop
+ * @details Sleep округляет ожидание до периода системного таймера (до 15,6 мс),
+ *          поэтому при высоких лимитах используется таймер с флагом
+ *          CREATE_WAITABLE_TIMER_HIGH_RESOLUTION (Windows 10 1803+), а на старых
+ *          системах - обычный ожидаемый таймер.
+ */
+bool WaitMicroseconds(long long microseconds, HANDLE stop);
+
+#endif
@@ -1,19 +1,51 @@
 #include "SQLiteQueue.h"
+#include "Compression.h"
+#include "QueueArchive.h"
+#include "QueueEnvelope.h"
+#include "WorkStealingPool.h"
+#include "TimingWheel.h"
 #include <algorithm>
 #include <ctime>
 #include <sstream>
 #include <iomanip>
 #include <cstdlib>
 #include <string>
-#include <direct.h>   //  _mkdir  Windows
-
+#include <cstring>
+#include <direct.h>   // для _mkdir на Windows
+
+// FNV-1a по телу запроса: по хешу дубликаты ищутся через индекс, а не сравнением тел
+static long long HashBody(const std::string& body) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < body.size(); ++i) {
+        hash ^= (unsigned char)body[i];
+        hash *= 1099511628211ULL;
+    }
+    return (long long)hash;
+}
 
 bool SQLiteQueue::EnsureFolderExists(const std::string& path) {
     if (_mkdir(path.c_str()) == 0 || errno == EEXIST) return true;
     return false;
 }
 
-SQLiteQueue::SQLiteQueue(const std::string& database_path) : db(nullptr) {
+SQLiteQueue::SQLiteQueue(const std::string& database_path, const StorageOptions* options)
+    : db(nullptr), compress_bodies(false), compress_min_size(256), deduplicate(false), work_pool(nullptr),
+      retry_wheel(nullptr), retry_base_ms(0), retry_max_ms(0),
+    writer_thread(NULL), writer_exited(NULL), writer_thread_id(0), writer_stop(false), writer_running(false),
+    reader_pool_size(kDefaultReaderPoolSize), storage_options(options ? *options : DefaultStorageOptions()),
+    storage_options_version(0), busy_waits(0), data_version(0), stats_synced_at(0),
+    max_responses(0), response_expiry(false), expiry_pass_at(0) {
+    InitializeCriticalSection(&write_cs);
+    InitializeCriticalSection(&touch_cs);
+    InitializeCriticalSection(&store_cs);
+    InitializeConditionVariable(&store_cv);
+    InitializeConditionVariable(&write_cv);
+    InitializeConditionVariable(&done_cv);
+    InitializeCriticalSection(&reader_cs);
+    InitializeConditionVariable(&reader_cv);
+    memset(&storage_stats, 0, sizeof(storage_stats));
+    QueryPerformanceFrequency(&qpc_frequency);
+
     if (database_path.empty()) {
         std::string folder = "c:\\gcore";
         if (!folder.empty()) EnsureFolderExists(folder);
@@ -24,7 +56,7 @@ SQLiteQueue::SQLiteQueue(const std::string& database_path) : db(nullptr) {
     }
 
     if (!InitializeDatabase()) {
-        //   
+        // Обработка ошибки инициализации
         if (db) {
             sqlite3_close(db);
             db = nullptr;
@@ -33,11 +65,41 @@ SQLiteQueue::SQLiteQueue(const std::string& database_path) : db(nullptr) {
 }
 
 SQLiteQueue::~SQLiteQueue() {
+    EnterCriticalSection(&write_cs);
+    writer_stop = true;
+    WakeAllConditionVariable(&write_cv);
+    LeaveCriticalSection(&write_cs);
+
+    // Глобальный объект разрушается под loader lock, когда поток не может завершиться,
+    // поэтому ждем не завершения потока, а выхода из WriterLoop (не дольше секунды).
+    // При завершении процесса поток уже остановлен и его дескриптор сигнален
+    if (writer_thread) {
+        HANDLE handles[2] = { writer_exited, writer_thread };
+        WaitForMultipleObjects(2, handles, FALSE, 1000);
+        CloseHandle(writer_thread);
+        CloseHandle(writer_exited);
+    }
+
+    EnterCriticalSection(&write_cs);
+    EnterCriticalSection(&reader_cs);
+    for (size_t i = 0; i < readers.size(); ++i) {
+        sqlite3_close(readers[i]);
+    }
+    readers.clear();
+    free_readers.clear();
+    reader_options.clear();
+    LeaveCriticalSection(&reader_cs);
+
     if (db) {
-        //   pending statements  
         sqlite3_close(db);
         db = nullptr;
     }
+    LeaveCriticalSection(&write_cs);
+
+    DeleteCriticalSection(&reader_cs);
+    DeleteCriticalSection(&touch_cs);
+    DeleteCriticalSection(&store_cs);
+    DeleteCriticalSection(&write_cs);
 }
 
 bool SQLiteQueue::InitializeDatabase() {
@@ -45,18 +107,38 @@ bool SQLiteQueue::InitializeDatabase() {
         return false;
     }
 
-    //     
+    // Базу могут одновременно открыть несколько терминалов: ждем их блокировки, а не отказываем
+    sqlite3_busy_handler(db, BusyHandler, this);
+
+    // Размер страницы новой базы задается до создания первой таблицы и перехода в WAL
+    if (storage_options.page_size > 0) {
+        ExecuteSQL("PRAGMA page_size = " + std::to_string(storage_options.page_size));
+    }
+    ApplyConnectionOptions(db, storage_options);
+
+    // Для новой базы освобожденные страницы возвращаются постепенно (см. IncrementalVacuum)
+    ExecuteSQL("PRAGMA auto_vacuum = INCREMENTAL");
+
+    // WAL: соединения-читатели не ждут поток записи и не блокируют его
+    ExecuteSQL("PRAGMA journal_mode = WAL");
+
+    // Создание таблицы для очереди запросов
     std::string queue_table_sql = R"(
         CREATE TABLE IF NOT EXISTS http_queue (
             id INTEGER PRIMARY KEY AUTOINCREMENT,
             server_url TEXT NOT NULL,
             json_body TEXT NOT NULL,
             expect_response INTEGER NOT NULL,
-            timestamp INTEGER NOT NULL
+            timestamp INTEGER NOT NULL,
+            coalesce_key TEXT,
+            body_hash INTEGER,
+            attempts INTEGER NOT NULL DEFAULT 0,
+            first_attempt INTEGER,
+            last_attempt INTEGER
         )
     )";
 
-    //    
+    // Создание таблицы для ответов
     std::string response_table_sql = R"(
         CREATE TABLE IF NOT EXISTS http_responses (
             id INTEGER PRIMARY KEY AUTOINCREMENT,
@@ -68,307 +150,2171 @@ bool SQLiteQueue::InitializeDatabase() {
         )
     )";
 
-    return ExecuteSQL(queue_table_sql) && ExecuteSQL(response_table_sql);
-}
-
-bool SQLiteQueue::ExecuteSQL(const std::string& sql) {
-    if (!db) return false;
+    // Недоставленные запросы: превысили лимит попыток или получили неисправимую ошибку
+    std::string dead_letter_table_sql = R"(
+        CREATE TABLE IF NOT EXISTS http_dead_letters (
+            id INTEGER PRIMARY KEY AUTOINCREMENT,
+            queue_id INTEGER NOT NULL,
+            server_url TEXT NOT NULL,
+            json_body TEXT NOT NULL,
+            expect_response INTEGER NOT NULL,
+            coalesce_key TEXT,
+            body_hash INTEGER,
+            attempts INTEGER NOT NULL,
+            http_status INTEGER NOT NULL,
+            error TEXT,
+            enqueued INTEGER NOT NULL,
+            first_attempt INTEGER,
+            last_attempt INTEGER,
+            last_elapsed_ms INTEGER,
+            dead_time INTEGER NOT NULL
+        );
+        CREATE INDEX IF NOT EXISTS idx_http_dead_letters_dead_time ON http_dead_letters(dead_time);
+    )";
 
-    char* err_msg = nullptr;
-    int result = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &err_msg);
+    // Индексы по времени для порционной очистки старых записей
+    std::string index_sql = R"(
+        CREATE INDEX IF NOT EXISTS idx_http_queue_timestamp ON http_queue(timestamp);
+        CREATE INDEX IF NOT EXISTS idx_http_responses_timestamp ON http_responses(timestamp);
+        CREATE INDEX IF NOT EXISTS idx_http_queue_coalesce ON http_queue(server_url, coalesce_key) WHERE coalesce_key IS NOT NULL;
+        CREATE INDEX IF NOT EXISTS idx_http_queue_body_hash ON http_queue(body_hash) WHERE body_hash IS NOT NULL;
+        CREATE INDEX IF NOT EXISTS idx_http_queue_deadline ON http_queue(deadline) WHERE deadline IS NOT NULL;
+        CREATE INDEX IF NOT EXISTS idx_http_queue_next_attempt ON http_queue(next_attempt_ms) WHERE next_attempt_ms IS NOT NULL;
+        CREATE INDEX IF NOT EXISTS idx_http_responses_expires ON http_responses(expires_at) WHERE expires_at IS NOT NULL;
+        CREATE INDEX IF NOT EXISTS idx_http_responses_last_access ON http_responses(last_access);
+    )";
 
-    bool success = (result == SQLITE_OK);
+    if (!ExecuteSQL(queue_table_sql) || !ExecuteSQL(response_table_sql) || !ExecuteSQL(dead_letter_table_sql)) {
+        return false;
+    }
 
-    if (err_msg) {
-        sqlite3_free(err_msg);
-        err_msg = nullptr;
+    // Колонки, добавленные в http_queue после создания базы
+    if (!EnsureColumn("http_queue", "coalesce_key", "TEXT") || !EnsureColumn("http_queue", "body_hash", "INTEGER") ||
+        !EnsureColumn("http_queue", "attempts", "INTEGER NOT NULL DEFAULT 0") ||
+        !EnsureColumn("http_queue", "first_attempt", "INTEGER") || !EnsureColumn("http_queue", "last_attempt", "INTEGER") ||
+        !EnsureColumn("http_queue", "response_ttl", "INTEGER") || !EnsureColumn("http_queue", "deadline", "INTEGER") ||
+        !EnsureColumn("http_queue", "next_attempt_ms", "INTEGER") ||
+        !EnsureColumn("http_responses", "expires_at", "INTEGER") || !EnsureColumn("http_responses", "last_access", "INTEGER") ||
+        !ExecuteSQL(index_sql)) {
+        return false;
     }
 
-    return true;
-}
+    // Ответы, сохраненные до появления last_access, вытесняются в порядке получения
+    ExecuteSQL("UPDATE http_responses SET last_access = timestamp WHERE last_access IS NULL");
 
-bool SQLiteQueue::AddToQueue(const std::wstring& server_url, const std::string& json_body, bool expect_response) {
-    if (!db) return false;
+    // Ответы со сроком хранения могли остаться с прошлого запуска
+    response_expiry = max_responses > 0 || !response_ttls.empty() ||
+        QueryInt64("SELECT EXISTS(SELECT 1 FROM http_responses WHERE expires_at IS NOT NULL)") != 0;
 
-    std::string sql = R"(
-        INSERT INTO http_queue (server_url, json_body, expect_response, timestamp)
-        VALUES (?, ?, ?, ?)
-    )";
+    return InitializeStats();
+}
 
+bool SQLiteQueue::EnsureColumn(const char* table, const char* column, const char* definition) {
     sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+    std::string info_sql = std::string("PRAGMA table_info(") + table + ")";
+    if (sqlite3_prepare_v2(db, info_sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
         return false;
     }
 
-    std::string url_utf8 = WideToUtf8(server_url.c_str());
+    bool exists = false;
+    while (!exists && sqlite3_step(stmt) == SQLITE_ROW) {
+        const unsigned char* name = sqlite3_column_text(stmt, 1);
+        exists = name && strcmp(reinterpret_cast<const char*>(name), column) == 0;
+    }
+    sqlite3_finalize(stmt);
 
-    sqlite3_bind_text(stmt, 1, url_utf8.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, json_body.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_int(stmt, 3, expect_response ? 1 : 0);
-    sqlite3_bind_int64(stmt, 4, time(nullptr));
+    if (exists) return true;
 
-    bool result = sqlite3_step(stmt) == SQLITE_DONE;
-    sqlite3_finalize(stmt);
-    stmt = nullptr;
+    std::string alter_sql = std::string("ALTER TABLE ") + table + " ADD COLUMN " + column + " " + definition;
+    return sqlite3_exec(db, alter_sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+}
 
-    return result;
+StorageOptions SQLiteQueue::DefaultStorageOptions() {
+    StorageOptions options;
+    options.mmap_size = -1;
+    options.cache_size_kb = 0;
+    options.page_size = 0;
+    options.temp_store = 0;
+    return options;
 }
 
-std::vector<QueueItem> SQLiteQueue::GetPendingItems(int limit) {
-    std::vector<QueueItem> items;
-    if (!db) return items;
+void SQLiteQueue::ApplyConnectionOptions(sqlite3* conn, const StorageOptions& options) {
+    std::string sql;
 
-    std::string sql = "SELECT id, server_url, json_body, expect_response, timestamp FROM http_queue ORDER BY timestamp ASC LIMIT ?";
+    // Отрицательный cache_size задает размер в КБ, а не в страницах, и не зависит от page_size
+    if (options.mmap_size >= 0) sql += "PRAGMA mmap_size = " + std::to_string(options.mmap_size) + ";";
+    if (options.cache_size_kb > 0) sql += "PRAGMA cache_size = -" + std::to_string(options.cache_size_kb) + ";";
+    if (options.temp_store > 0) sql += "PRAGMA temp_store = " + std::to_string(options.temp_store) + ";";
 
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-        return items;
+    if (!sql.empty()) {
+        sqlite3_exec(conn, sql.c_str(), nullptr, nullptr, nullptr);
     }
+}
 
-    sqlite3_bind_int(stmt, 1, limit);
+bool SQLiteQueue::SetStorageOptions(const StorageOptions& options) {
+    if (!db) return false;
 
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        QueueItem item;
-        item.id = sqlite3_column_int(stmt, 0);
+    EnterCriticalSection(&reader_cs);
+    storage_options = options;
+    storage_options_version++;
+    LeaveCriticalSection(&reader_cs);
 
-        const unsigned char* url = sqlite3_column_text(stmt, 1);
-        if (url) {
-            std::string url_str(reinterpret_cast<const char*>(url));
-            item.server_url = Utf8ToWide(url_str.c_str());
-        }
+    return ExecuteWrite([&]() {
+        ApplyConnectionOptions(db, options);
+
+        if (options.page_size <= 0 || QueryInt64("PRAGMA page_size") == options.page_size) return true;
+
+        // Выйти из WAL можно только единственным соединением: закрываем читателей,
+        // дождавшись текущих чтений. Новые читатели ждут конца перестроения
+        EnterCriticalSection(&reader_cs);
+        CloseReaders();
+
+        // В режиме WAL размер страницы не меняется даже через VACUUM
+        ExecuteSQL("PRAGMA journal_mode = DELETE");
+        ExecuteSQL("PRAGMA page_size = " + std::to_string(options.page_size));
+        ExecuteSQL("VACUUM");
+        ExecuteSQL("PRAGMA journal_mode = WAL");
+        LeaveCriticalSection(&reader_cs);
+
+        return QueryInt64("PRAGMA page_size") == options.page_size;
+    }, false);
+}
+
+void SQLiteQueue::CloseReaders() {
+    while (free_readers.size() < readers.size()) {
+        SleepConditionVariableCS(&reader_cv, &reader_cs, INFINITE);
+    }
+    for (size_t i = 0; i < readers.size(); ++i) {
+        sqlite3_close(readers[i]);
+    }
+    readers.clear();
+    free_readers.clear();
+    reader_options.clear();
+}
+
+bool SQLiteQueue::Reopen(const std::string& database_path) {
+    bool reopened = ExecuteWrite([&]() {
+        EnterCriticalSection(&reader_cs);
+        CloseReaders();
+
+        sqlite3_close(db);
+        db = nullptr;
+        db_path = database_path;
 
-        const unsigned char* body = sqlite3_column_text(stmt, 2);
-        if (body) {
-            item.json_body = reinterpret_cast<const char*>(body);
+        bool opened = InitializeDatabase();
+        if (!opened && db) {
+            sqlite3_close(db);
+            db = nullptr;
         }
+        LeaveCriticalSection(&reader_cs);
+
+        return opened;
+    }, false);
+
+    // Расписание другой базы заменяет расписание прежней
+    if (reopened && retry_wheel)
+        LoadRetrySchedule();
+    return reopened;
+}
+
+std::string SQLiteQueue::GetDatabasePath() {
+    EnterCriticalSection(&reader_cs);
+    std::string path = db_path;
+    LeaveCriticalSection(&reader_cs);
+    return path;
+}
+
+std::string SQLiteQueue::TakeLastError() {
+    EnterCriticalSection(&reader_cs);
+    std::string error;
+    error.swap(last_error);
+    LeaveCriticalSection(&reader_cs);
+    return error;
+}
+
+void SQLiteQueue::GetStorageOptions(StorageOptions& out) {
+    EnterCriticalSection(&reader_cs);
+    out = storage_options;
+    LeaveCriticalSection(&reader_cs);
+
+    ExecuteRead([&](sqlite3* conn) {
+        out.page_size = (int)QueryInt64(conn, "PRAGMA page_size");
+    });
+}
+
+bool SQLiteQueue::InitializeStats() {
+    // INSERT OR REPLACE удаляет старый ответ, поэтому нужны recursive_triggers
+    if (!ExecuteSQL("PRAGMA recursive_triggers = ON")) return false;
+
+    // Проверка, создание счетчиков и заполнение - одна транзакция: другой процесс, открывший
+    // ту же базу, не заполнит их второй раз, а его запросы не попадут в счетчики дважды
+    if (!ExecuteSQL("BEGIN IMMEDIATE")) return false;
+
+    bool stats_existed = QueryInt64("SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'queue_stats'") > 0;
+
+    // Счетчики по часовым корзинам: table_id 0 - http_queue, 1 - http_responses
+    std::string stats_sql = R"(
+        CREATE TABLE IF NOT EXISTS queue_stats (
+            table_id INTEGER NOT NULL,
+            bucket INTEGER NOT NULL,
+            count INTEGER NOT NULL,
+            PRIMARY KEY(table_id, bucket)
+        ) WITHOUT ROWID;
+
+        CREATE TRIGGER IF NOT EXISTS trg_http_queue_stats_insert AFTER INSERT ON http_queue BEGIN
+            INSERT INTO queue_stats (table_id, bucket, count) VALUES (0, NEW.timestamp / 3600, 1)
+            ON CONFLICT(table_id, bucket) DO UPDATE SET count = count + 1;
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS trg_http_queue_stats_delete AFTER DELETE ON http_queue BEGIN
+            UPDATE queue_stats SET count = count - 1 WHERE table_id = 0 AND bucket = OLD.timestamp / 3600;
+            DELETE FROM queue_stats WHERE table_id = 0 AND bucket = OLD.timestamp / 3600 AND count <= 0;
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS trg_http_responses_stats_insert AFTER INSERT ON http_responses BEGIN
+            INSERT INTO queue_stats (table_id, bucket, count) VALUES (1, NEW.timestamp / 3600, 1)
+            ON CONFLICT(table_id, bucket) DO UPDATE SET count = count + 1;
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS trg_http_responses_stats_delete AFTER DELETE ON http_responses BEGIN
+            UPDATE queue_stats SET count = count - 1 WHERE table_id = 1 AND bucket = OLD.timestamp / 3600;
+            DELETE FROM queue_stats WHERE table_id = 1 AND bucket = OLD.timestamp / 3600 AND count <= 0;
+        END;
+    )";
 
-        item.expect_response = sqlite3_column_int(stmt, 3) != 0;
-        item.timestamp = sqlite3_column_int64(stmt, 4);
+    bool created = ExecuteSQL(stats_sql);
 
-        items.push_back(item);
+    // База создана до появления счетчиков: заполняем их один раз по текущим данным
+    if (created && !stats_existed) {
+        created = ExecuteSQL(R"(
+            INSERT INTO queue_stats (table_id, bucket, count)
+                SELECT 0, timestamp / 3600, COUNT(*) FROM http_queue GROUP BY timestamp / 3600;
+            INSERT INTO queue_stats (table_id, bucket, count)
+                SELECT 1, timestamp / 3600, COUNT(*) FROM http_responses GROUP BY timestamp / 3600;
+        )");
     }
 
-    sqlite3_finalize(stmt);
-    return items;
+    if (!created || !ExecuteSQL("COMMIT")) {
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        return false;
+    }
+
+    data_version = QueryInt64("PRAGMA data_version");
+    stats_synced_at = GetTickCount();
+
+    return LoadStats();
 }
 
-bool SQLiteQueue::RemoveFromQueue(int id) {
-    if (!db) return false;
+int SQLiteQueue::BusyHandler(void* context, int attempt) {
+    if (attempt >= kBusyMaxAttempts) return 0;
+
+    SQLiteQueue* queue = static_cast<SQLiteQueue*>(context);
+    InterlockedIncrement64(&queue->busy_waits);
+
+    // 1, 2, 4 ... 64 мс, затем по 100 мс; добавка до половины паузы зависит от процесса и времени
+    DWORD delay = attempt < 7 ? (DWORD)1 << attempt : 100;
+    DWORD jitter = (GetCurrentProcessId() * 2654435761u + GetTickCount() + (DWORD)attempt * 40503u) % (delay / 2 + 1);
+    Sleep(delay + jitter);
+
+    return 1;
+}
+
+void SQLiteQueue::SyncExternalChanges() {
+    long long version = QueryInt64("PRAGMA data_version");
+    if (version != data_version) {
+        data_version = version;
+        LoadStats();
+    }
+    stats_synced_at = GetTickCount();
+}
+
+void SQLiteQueue::RefreshSharedStats() {
+    if (GetTickCount() - stats_synced_at < kSharedStatsInterval) return;
 
-    std::string sql = "DELETE FROM http_queue WHERE id = ?";
+    ExecuteWrite([&]() {
+        SyncExternalChanges();
+        return true;
+    }, false);
+}
+
+bool SQLiteQueue::LoadStats() {
+    if (!db) return false;
 
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT table_id, bucket, count FROM queue_stats", -1, &stmt, nullptr) != SQLITE_OK) {
         return false;
     }
 
-    sqlite3_bind_int(stmt, 1, id);
-    bool result = sqlite3_step(stmt) == SQLITE_DONE;
+    stats.Reset();
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        stats.SetBucket(sqlite3_column_int(stmt, 0), sqlite3_column_int64(stmt, 1), sqlite3_column_int64(stmt, 2));
+    }
     sqlite3_finalize(stmt);
 
-    return result;
+    return true;
+}
+
+int SQLiteQueue::StepDeleteReturning(sqlite3_stmt* stmt, int table) {
+    int deleted_count = 0;
+    int rc;
+
+    // Запрос вида DELETE ... RETURNING timestamp: по каждой строке уменьшаем счетчик
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        stats.Add(table, (time_t)sqlite3_column_int64(stmt, 0), -1);
+        deleted_count++;
+    }
+
+    return rc == SQLITE_DONE ? deleted_count : -1;
+}
+
+long long SQLiteQueue::QueryInt64(const std::string& sql) {
+    return QueryInt64(db, sql);
+}
+
+long long SQLiteQueue::QueryInt64(sqlite3* conn, const std::string& sql) {
+    if (!conn) return 0;
+
+    sqlite3_stmt* stmt = nullptr;
+    long long value = 0;
+
+    if (sqlite3_prepare_v2(conn, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            value = sqlite3_column_int64(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    return value;
 }
 
-bool SQLiteQueue::AddResponse(const std::wstring& server_url, const std::string& request_body, const std::string& response_body) {
+bool SQLiteQueue::ExecuteSQL(const std::string& sql) {
     if (!db) return false;
 
-    std::string sql = R"(
-        INSERT OR REPLACE INTO http_responses (server_url, request_body, response_body, timestamp)
-        VALUES (?, ?, ?, ?)
-    )";
+    char* err_msg = nullptr;
+    int result = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &err_msg);
 
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-        return false;
+    bool success = (result == SQLITE_OK);
+
+    if (err_msg) {
+        // Хранилище не вызывает callback приложения: ошибку сообщает вызывающий код
+        EnterCriticalSection(&reader_cs);
+        last_error = err_msg;
+        LeaveCriticalSection(&reader_cs);
+
+        sqlite3_free(err_msg);
+        err_msg = nullptr;
     }
 
-    std::string url_utf8 = WideToUtf8(server_url.c_str());
+    return success;
+}
 
-    sqlite3_bind_text(stmt, 1, url_utf8.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, request_body.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 3, response_body.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_int64(stmt, 4, time(nullptr));
+DWORD WINAPI SQLiteQueue::WriterThreadProc(LPVOID param) {
+    SQLiteQueue* queue = static_cast<SQLiteQueue*>(param);
+    HANDLE exited = queue->writer_exited;
 
-    bool result = sqlite3_step(stmt) == SQLITE_DONE;
-    sqlite3_finalize(stmt);
+    queue->WriterLoop();
 
-    return result;
+    // После этого объект уже может быть разрушен
+    SetEvent(exited);
+    return 0;
 }
 
-std::string SQLiteQueue::GetResponse(const std::wstring& server_url, const std::string& request_body) {
-    if (!db) return "";
+void SQLiteQueue::WriterLoop() {
+    EnterCriticalSection(&write_cs);
+    writer_thread_id = GetCurrentThreadId();
+
+    // При остановке поток сначала выполняет уже поставленные команды: их вызывающие ждут
+    while (!writer_stop || !write_queue.empty()) {
+        // Просроченные ответы удаляются порциями между группами команд: пока порции
+        // полные, очистка продолжается на следующем круге после очередной группы
+        if (!writer_stop && response_expiry && GetTickCount() - expiry_pass_at >= kExpiryInterval) {
+            LeaveCriticalSection(&write_cs);
+            int removed = RunExpiryChunk();
+            EnterCriticalSection(&write_cs);
+
+            if (removed < kDeleteChunkSize) expiry_pass_at = GetTickCount();
+            else if (write_queue.empty()) continue;
+        }
 
-    std::string sql = "SELECT response_body FROM http_responses WHERE server_url = ? AND request_body = ?";
+        if (write_queue.empty()) {
+            SleepConditionVariableCS(&write_cv, &write_cs, response_expiry ? kExpiryInterval : INFINITE);
+            continue;
+        }
 
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-        return "";
-    }
+        // Все накопившиеся команды выполняются одной транзакцией (group commit).
+        // Команда вне транзакции (VACUUM) выполняется отдельно
+        std::vector<WriteCommand*> group;
+        if (!write_queue.front()->in_transaction) {
+            group.push_back(write_queue.front());
+            write_queue.pop_front();
+        }
+        else {
+            while (!write_queue.empty() && write_queue.front()->in_transaction && (int)group.size() < kMaxWriteGroup) {
+                group.push_back(write_queue.front());
+                write_queue.pop_front();
+            }
+        }
 
-    std::string url_utf8 = WideToUtf8(server_url.c_str());
+        LeaveCriticalSection(&write_cs);
 
-    sqlite3_bind_text(stmt, 1, url_utf8.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, request_body.c_str(), -1, SQLITE_TRANSIENT);
+        RunWriteGroup(group);
 
-    std::string response;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        const unsigned char* resp = sqlite3_column_text(stmt, 0);
-        if (resp) {
-            response = reinterpret_cast<const char*>(resp);
+        EnterCriticalSection(&write_cs);
+        storage_stats.write_groups++;
+        for (size_t i = 0; i < group.size(); ++i) {
+            group[i]->done = true;
         }
+        WakeAllConditionVariable(&done_cv);
     }
 
-    sqlite3_finalize(stmt);
-    return response;
+    writer_running = false;
+    LeaveCriticalSection(&write_cs);
 }
 
-std::string SQLiteQueue::GetAndRemoveResponse(const std::wstring& server_url, const std::string& request_body) {
-    if (!db) return "";
-
-    //     
-    std::string sql = R"(
-        SELECT response_body 
-        FROM http_responses 
-        WHERE server_url = ? AND request_body = ? 
-        ORDER BY timestamp DESC 
-        LIMIT 1
-    )";
+void SQLiteQueue::StopWriter() {
+    EnterCriticalSection(&write_cs);
+    HANDLE thread = writer_thread;
+    HANDLE exited = writer_exited;
+    if (!thread || writer_stop || GetCurrentThreadId() == writer_thread_id) {
+        LeaveCriticalSection(&write_cs);
+        return;
+    }
+    writer_stop = true;
+    WakeAllConditionVariable(&write_cv);
+    LeaveCriticalSection(&write_cs);
+
+    WaitForSingleObject(thread, INFINITE);
+
+    EnterCriticalSection(&write_cs);
+    CloseHandle(thread);
+    CloseHandle(exited);
+    writer_thread = NULL;
+    writer_exited = NULL;
+    writer_thread_id = 0;
+    writer_stop = false;
+    LeaveCriticalSection(&write_cs);
+}
 
-    sqlite3_stmt* stmt = nullptr;
-    std::string response;
+void SQLiteQueue::RunWriteGroup(std::vector<WriteCommand*>& group) {
+    if (group.size() == 1 && !group[0]->in_transaction) {
+        group[0]->result = (*group[0]->command)();
+        return;
+    }
 
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
-        std::string url_utf8 = WideToUtf8(server_url.c_str());
+    bool in_transaction = sqlite3_exec(db, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr) == SQLITE_OK;
+    bool reload_stats = false;
 
-        sqlite3_bind_text(stmt, 1, url_utf8.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(stmt, 2, request_body.c_str(), -1, SQLITE_TRANSIENT);
+    // Другие процессы могли изменить очередь: счетчики должны учесть их записи до наших
+    if (in_transaction) {
+        SyncExternalChanges();
+    }
 
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-            const unsigned char* resp = sqlite3_column_text(stmt, 0);
-            if (resp) {
-                response = reinterpret_cast<const char*>(resp);
+    // Каждая команда в своей точке сохранения: ошибка одной не отменяет остальные
+    for (size_t i = 0; i < group.size(); ++i) {
+        if (in_transaction) sqlite3_exec(db, "SAVEPOINT command", nullptr, nullptr, nullptr);
+
+        bool result = (*group[i]->command)();
+
+        if (in_transaction) {
+            if (!result) {
+                sqlite3_exec(db, "ROLLBACK TO command", nullptr, nullptr, nullptr);
+                reload_stats = true;
             }
+            sqlite3_exec(db, "RELEASE command", nullptr, nullptr, nullptr);
         }
-        sqlite3_finalize(stmt);
-        stmt = nullptr;
+        group[i]->result = result;
     }
 
-    //   ,      
-    if (!response.empty()) {
-        sql = "DELETE FROM http_responses WHERE server_url = ? AND request_body = ?";
-        sqlite3_stmt* delete_stmt = nullptr;
+    if (in_transaction && sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        for (size_t i = 0; i < group.size(); ++i) {
+            group[i]->result = false;
+        }
+        reload_stats = true;
+    }
 
-        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &delete_stmt, nullptr) == SQLITE_OK) {
-            std::string url_utf8 = WideToUtf8(server_url.c_str());
+    // Счетчики в памяти могли учесть отмененные изменения: перечитываем их из queue_stats
+    if (reload_stats) {
+        LoadStats();
+    }
+}
 
-            sqlite3_bind_text(delete_stmt, 1, url_utf8.c_str(), -1, SQLITE_TRANSIENT);
-            sqlite3_bind_text(delete_stmt, 2, request_body.c_str(), -1, SQLITE_TRANSIENT);
+bool SQLiteQueue::ExecuteWrite(const std::function<bool()>& command, bool in_transaction) {
+    // Вызов из самой команды записи выполняется сразу, иначе поток ждал бы сам себя
+    if (GetCurrentThreadId() == writer_thread_id) {
+        return db ? command() : false;
+    }
+
+    LARGE_INTEGER queued_at, finished_at;
+    QueryPerformanceCounter(&queued_at);
+
+    EnterCriticalSection(&write_cs);
+    if (!db) {
+        LeaveCriticalSection(&write_cs);
+        return false;
+    }
 
-            sqlite3_step(delete_stmt);
-            sqlite3_finalize(delete_stmt);
-            delete_stmt = nullptr;
+    if (!writer_thread && !writer_stop) {
+        writer_exited = CreateEvent(NULL, TRUE, FALSE, NULL);
+        writer_thread = writer_exited ? CreateModuleThread(WriterThreadProc, this, 0, NULL) : NULL;
+        writer_running = writer_thread != NULL;
+        if (!writer_thread && writer_exited) {
+            CloseHandle(writer_exited);
+            writer_exited = NULL;
         }
     }
 
-    return response;
+    // Без потока записи команды выполняются в вызывающем потоке под write_cs. Пока
+    // поток останавливается, он еще выполняет команды, и они ставятся ему в очередь:
+    // иначе соединение записи использовали бы два потока сразу
+    if (!writer_running) {
+        bool result = command();
+        LeaveCriticalSection(&write_cs);
+        return result;
+    }
+
+    WriteCommand item = { &command, in_transaction, false, false };
+    write_queue.push_back(&item);
+    if ((long long)write_queue.size() > storage_stats.write_queue_max) {
+        storage_stats.write_queue_max = (long long)write_queue.size();
+    }
+    WakeConditionVariable(&write_cv);
+
+    while (!item.done) {
+        SleepConditionVariableCS(&done_cv, &write_cs, INFINITE);
+    }
+
+    QueryPerformanceCounter(&finished_at);
+    long long wait_us = (finished_at.QuadPart - queued_at.QuadPart) * 1000000 / qpc_frequency.QuadPart;
+    storage_stats.write_commands++;
+    storage_stats.write_wait_us += wait_us;
+    if (wait_us > storage_stats.write_wait_max_us) {
+        storage_stats.write_wait_max_us = wait_us;
+    }
+    LeaveCriticalSection(&write_cs);
+
+    return item.result;
 }
 
-bool SQLiteQueue::RemoveResponse(int id) {
-    if (!db) return false;
+sqlite3* SQLiteQueue::AcquireReader() {
+    LARGE_INTEGER started_at, acquired_at;
+    QueryPerformanceCounter(&started_at);
+
+    EnterCriticalSection(&reader_cs);
+    while (free_readers.empty()) {
+        // Соединения открываются по мере необходимости, не больше reader_pool_size
+        if ((int)readers.size() < reader_pool_size) {
+            sqlite3* conn = nullptr;
+            if (sqlite3_open_v2(db_path.c_str(), &conn, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+                if (conn) sqlite3_close(conn);
+                LeaveCriticalSection(&reader_cs);
+                return nullptr;
+            }
+            sqlite3_busy_handler(conn, BusyHandler, this);
+            reader_options[conn] = -1;
+            readers.push_back(conn);
+            free_readers.push_back(conn);
+            break;
+        }
+        SleepConditionVariableCS(&reader_cv, &reader_cs, INFINITE);
+    }
 
-    std::string sql = "DELETE FROM http_responses WHERE id = ?";
+    sqlite3* conn = free_readers.back();
+    free_readers.pop_back();
 
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-        return false;
+    // Параметры применяются к читателю при первом чтении после их изменения
+    if (reader_options[conn] != storage_options_version) {
+        ApplyConnectionOptions(conn, storage_options);
+        reader_options[conn] = storage_options_version;
     }
 
-    sqlite3_bind_int(stmt, 1, id);
-    bool result = sqlite3_step(stmt) == SQLITE_DONE;
-    sqlite3_finalize(stmt);
+    QueryPerformanceCounter(&acquired_at);
+    long long wait_us = (acquired_at.QuadPart - started_at.QuadPart) * 1000000 / qpc_frequency.QuadPart;
+    storage_stats.read_commands++;
+    storage_stats.read_wait_us += wait_us;
+    if (wait_us > storage_stats.read_wait_max_us) {
+        storage_stats.read_wait_max_us = wait_us;
+    }
+    LeaveCriticalSection(&reader_cs);
 
-    return result;
+    return conn;
 }
 
-int SQLiteQueue::CleanOldItems(int hours_old, bool clean_responses) {
-    time_t cutoff_time = time(nullptr) - (hours_old * 3600);
+void SQLiteQueue::ReleaseReader(sqlite3* conn) {
+    EnterCriticalSection(&reader_cs);
+    free_readers.push_back(conn);
+    WakeAllConditionVariable(&reader_cv);
+    LeaveCriticalSection(&reader_cs);
+}
 
-    std::string sql_queue = "DELETE FROM http_queue WHERE timestamp < ?";
-    std::string sql_responses = "DELETE FROM http_responses WHERE timestamp < ?";
+bool SQLiteQueue::ExecuteRead(const std::function<void(sqlite3*)>& query) {
+    if (!db) return false;
 
-    sqlite3_stmt* stmt = nullptr;
-    int deleted_count = 0;
+    if (GetCurrentThreadId() == writer_thread_id) {
+        query(db);
+        return true;
+    }
 
-    //  
-    if (sqlite3_prepare_v2(db, sql_queue.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
-        sqlite3_bind_int64(stmt, 1, cutoff_time);
-        if (sqlite3_step(stmt) == SQLITE_DONE) {
-            deleted_count += sqlite3_changes(db);
+    sqlite3* conn = AcquireReader();
+    if (!conn) {
+        // Читатель не открылся: читаем через соединение записи
+        return ExecuteWrite([&]() { query(db); return true; });
+    }
+
+    query(conn);
+    ReleaseReader(conn);
+    return true;
+}
+
+long long SQLiteQueue::ExportArchive(const std::wstring& path, bool include_responses) {
+    QueueArchiveWriter writer;
+    if (!writer.Open(path)) return -1;
+
+    long long exported = 0;
+    bool result = false;
+
+    ExecuteRead([&](sqlite3* conn) {
+        // Запросы и ответы из одного снимка базы
+        sqlite3_exec(conn, "BEGIN", nullptr, nullptr, nullptr);
+
+        ArchiveRecord record;
+        sqlite3_stmt* stmt = nullptr;
+        result = sqlite3_prepare_v2(conn, "SELECT server_url, json_body, expect_response, timestamp, coalesce_key, response_ttl, "
+            "deadline, attempts, next_attempt_ms FROM http_queue ORDER BY id", -1, &stmt, nullptr) == SQLITE_OK;
+
+        record.type = ARCHIVE_REQUEST;
+        while (result && sqlite3_step(stmt) == SQLITE_ROW) {
+            const unsigned char* url = sqlite3_column_text(stmt, 0);
+            record.url.assign(url ? reinterpret_cast<const char*>(url) : "");
+            record.body = ReadBody(stmt, 1);
+            record.expect_response = sqlite3_column_int(stmt, 2) != 0;
+            record.timestamp = sqlite3_column_int64(stmt, 3);
+            record.has_coalesce_key = sqlite3_column_type(stmt, 4) != SQLITE_NULL;
+            record.coalesce_key.assign(record.has_coalesce_key ? reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4)) : "");
+            record.response_ttl = sqlite3_column_int(stmt, 5);
+            record.deadline = sqlite3_column_int64(stmt, 6);
+            record.attempts = sqlite3_column_int(stmt, 7);
+            record.next_attempt_ms = sqlite3_column_int64(stmt, 8);
+
+            result = writer.Write(record);
+            exported++;
         }
         sqlite3_finalize(stmt);
-        stmt = nullptr;
-    }
 
-    //  ,  
-    if (clean_responses) {
-        if (sqlite3_prepare_v2(db, sql_responses.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
-            sqlite3_bind_int64(stmt, 1, cutoff_time);
-            if (sqlite3_step(stmt) == SQLITE_DONE) {
-                deleted_count += sqlite3_changes(db);
+        if (result && include_responses) {
+            result = sqlite3_prepare_v2(conn, "SELECT server_url, request_body, response_body, timestamp, expires_at, last_access "
+                "FROM http_responses WHERE expires_at IS NULL OR expires_at > ? ORDER BY id", -1, &stmt, nullptr) == SQLITE_OK;
+            sqlite3_bind_int64(stmt, 1, time(nullptr));
+
+            record.type = ARCHIVE_RESPONSE;
+            record.has_coalesce_key = false;
+            record.expect_response = false;
+            record.response_ttl = 0;
+            record.deadline = 0;
+            record.attempts = 0;
+            record.next_attempt_ms = 0;
+            while (result && sqlite3_step(stmt) == SQLITE_ROW) {
+                const unsigned char* url = sqlite3_column_text(stmt, 0);
+                record.url.assign(url ? reinterpret_cast<const char*>(url) : "");
+                record.body = ReadBody(stmt, 1);
+                record.response = ReadBody(stmt, 2);
+                record.timestamp = sqlite3_column_int64(stmt, 3);
+                record.expires_at = sqlite3_column_int64(stmt, 4);
+                record.last_access = sqlite3_column_int64(stmt, 5);
+
+                result = writer.Write(record);
+                exported++;
             }
             sqlite3_finalize(stmt);
-            stmt = nullptr;
         }
-    }
 
-    return deleted_count;
+        sqlite3_exec(conn, "COMMIT", nullptr, nullptr, nullptr);
+    });
+
+    result = writer.Close() && result;
+    return result ? exported : -1;
 }
 
-int SQLiteQueue::GetOldItemsCount(int hours_old, bool check_responses) {
-    if (!db) return 0;
+long long SQLiteQueue::ImportArchive(const std::wstring& path, int batch_rows) {
+    QueueArchiveReader reader;
+    if (!reader.Open(path)) return -1;
+    if (batch_rows <= 0) batch_rows = kImportBatchRows;
+
+    std::vector<ArchiveRecord> batch;
+    batch.reserve(batch_rows);
+    long long imported = 0;
+    int read_result = 1;
+    bool scheduled = false;
+    bool failed = false;
+
+    while (read_result == 1) {
+        // Пачка ограничена числом записей и объемом тел, а не размером файла
+        batch.clear();
+        size_t batch_bytes = 0;
+        ArchiveRecord record;
+        while ((int)batch.size() < batch_rows && batch_bytes < kImportBatchBytes &&
+            (read_result = reader.Read(record)) == 1) {
+            batch_bytes += record.body.size() + record.response.size();
+            batch.push_back(std::move(record));
+        }
+        if (batch.empty()) break;
+
+        bool saved = ExecuteWrite([&]() {
+            sqlite3_stmt* request_stmt = nullptr;
+            sqlite3_stmt* response_stmt = nullptr;
+            bool result =
+                sqlite3_prepare_v2(db, "INSERT INTO http_queue (server_url, json_body, expect_response, timestamp, coalesce_key, body_hash, "
+                    "response_ttl, deadline, attempts, next_attempt_ms) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)", -1, &request_stmt, nullptr) == SQLITE_OK &&
+                sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO http_responses (server_url, request_body, response_body, timestamp, "
+                    "expires_at, last_access) VALUES (?, ?, ?, ?, ?, ?)", -1, &response_stmt, nullptr) == SQLITE_OK;
+
+            for (size_t i = 0; result && i < batch.size(); ++i) {
+                const ArchiveRecord& item = batch[i];
+                sqlite3_stmt* stmt = item.type == ARCHIVE_RESPONSE ? response_stmt : request_stmt;
+
+                sqlite3_reset(stmt);
+                sqlite3_clear_bindings(stmt);
+                sqlite3_bind_text(stmt, 1, item.url.c_str(), -1, SQLITE_TRANSIENT);
+
+                if (item.type == ARCHIVE_RESPONSE) {
+                    sqlite3_bind_text(stmt, 2, item.body.c_str(), -1, SQLITE_TRANSIENT);
+                    BindBody(stmt, 3, item.response);
+                    sqlite3_bind_int64(stmt, 4, item.timestamp);
+
+                    // Ответ без срока в файле получает срок по текущей настройке для его адреса
+                    long long expires_at = item.expires_at;
+                    int ttl = expires_at > 0 ? 0 : ResolveResponseTtl(item.url, 0);
+                    if (ttl > 0) expires_at = item.timestamp + ttl;
+                    if (expires_at > 0) {
+                        sqlite3_bind_int64(stmt, 5, expires_at);
+                        response_expiry = true;
+                    }
+                    sqlite3_bind_int64(stmt, 6, item.last_access > 0 ? item.last_access : item.timestamp);
+                }
+                else {
+                    BindBody(stmt, 2, item.body);
+                    sqlite3_bind_int(stmt, 3, item.expect_response ? 1 : 0);
+                    sqlite3_bind_int64(stmt, 4, item.timestamp);
+                    if (item.has_coalesce_key)
+                        sqlite3_bind_text(stmt, 5, item.coalesce_key.c_str(), -1, SQLITE_TRANSIENT);
+                    sqlite3_bind_int64(stmt, 6, HashBody(item.body));
+                    if (item.response_ttl > 0)
+                        sqlite3_bind_int(stmt, 7, item.response_ttl);
+                    if (item.deadline > 0)
+                        sqlite3_bind_int64(stmt, 8, item.deadline);
+                    sqlite3_bind_int(stmt, 9, item.attempts);
+                    if (item.next_attempt_ms > 0) {
+                        sqlite3_bind_int64(stmt, 10, item.next_attempt_ms);
+                        scheduled = true;
+                    }
+                }
+
+                result = sqlite3_step(stmt) == SQLITE_DONE;
+            }
+            sqlite3_finalize(request_stmt);
+            sqlite3_finalize(response_stmt);
 
-    time_t cutoff_time = time(nullptr) - (hours_old * 3600);
+            // queue_stats обновлен триггерами, счетчики в памяти перечитываем из него
+            return result && LoadStats();
+        });
 
-    std::string sql;
-    if (check_responses) {
-        sql = "SELECT COUNT(*) FROM http_responses WHERE timestamp < ?";
+        if (!saved) {
+            failed = true;
+            break;
+        }
+        imported += (long long)batch.size();
     }
-    else {
-        sql = "SELECT COUNT(*) FROM http_queue WHERE timestamp < ?";
+
+    // Отложенные запросы из файла попадают в расписание повторов вместе с уже известными
+    if (scheduled && retry_wheel)
+        LoadRetrySchedule();
+
+    return failed || read_result < 0 ? -1 : imported;
+}
+
+void SQLiteQueue::GetStorageStats(StorageStats& out, bool reset) {
+    EnterCriticalSection(&write_cs);
+    EnterCriticalSection(&reader_cs);
+    out = storage_stats;
+    out.write_queue_length = (long long)write_queue.size();
+    out.reader_connections = (long long)readers.size();
+    out.busy_waits = busy_waits;
+    if (reset) {
+        memset(&storage_stats, 0, sizeof(storage_stats));
+        InterlockedExchange64(&busy_waits, 0);
     }
+    LeaveCriticalSection(&reader_cs);
+    LeaveCriticalSection(&write_cs);
+}
 
-    sqlite3_stmt* stmt = nullptr;
-    int count = 0;
+void SQLiteQueue::CountCoalesced(long long coalesced, long long duplicates) {
+    if (coalesced == 0 && duplicates == 0) return;
 
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
-        sqlite3_bind_int64(stmt, 1, cutoff_time);
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-            count = sqlite3_column_int(stmt, 0);
+    EnterCriticalSection(&write_cs);
+    storage_stats.coalesced_requests += coalesced;
+    storage_stats.duplicate_requests += duplicates;
+    LeaveCriticalSection(&write_cs);
+}
+
+void SQLiteQueue::CountDeadlines(long long on_time, long long late, long long expired) {
+    if (on_time == 0 && late == 0 && expired == 0) return;
+
+    EnterCriticalSection(&write_cs);
+    storage_stats.deadline_on_time += on_time;
+    storage_stats.deadline_late += late;
+    storage_stats.deadline_expired += expired;
+    LeaveCriticalSection(&write_cs);
+}
+
+void SQLiteQueue::SetDeduplication(bool enabled) {
+    deduplicate = enabled;
+}
+
+void SQLiteQueue::SetCompression(bool enabled, size_t min_size) {
+    compress_bodies = enabled;
+    compress_min_size = min_size;
+}
+
+void SQLiteQueue::SetWorkPool(WorkStealingPool* pool) {
+    work_pool = pool;
+}
+
+void SQLiteQueue::SetRetryWheel(TimingWheel* wheel) {
+    retry_wheel = wheel;
+    if (wheel)
+        LoadRetrySchedule();
+}
+
+void SQLiteQueue::LoadRetrySchedule() {
+    std::vector<std::pair<int, long long>> items;
+
+    ExecuteRead([&](sqlite3* conn) {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(conn, "SELECT id, next_attempt_ms FROM http_queue WHERE next_attempt_ms > ?",
+                               -1, &stmt, nullptr) != SQLITE_OK) {
+            return;
         }
+
+        sqlite3_bind_int64(stmt, 1, TimingWheel::NowMs());
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+            items.push_back(std::make_pair(sqlite3_column_int(stmt, 0), sqlite3_column_int64(stmt, 1)));
+
         sqlite3_finalize(stmt);
-        stmt = nullptr;
-    }
+    });
 
-    return count;
+    retry_wheel->Load(items);
 }
 
-bool SQLiteQueue::ProcessQueueItem(const QueueItem& item) {
-    std::string body_utf8 = item.json_body;
-    std::wstring url_wide = item.server_url;
+void SQLiteQueue::SetRetryBackoff(int base_ms, int max_ms) {
+    retry_base_ms = std::max(0, base_ms);
+    retry_max_ms = std::max(retry_base_ms, max_ms);
+}
 
-    if (item.expect_response) {
-        std::string response = SendRequestInternalResponse(url_wide, body_utf8);
-        if (response.find("ERROR:") != 0) { //  
-            AddResponse(url_wide, body_utf8, response);
-            return true;
-        }
+bool SQLiteQueue::EncodeBody(const std::string& body, std::string& stored) const {
+    return compress_bodies && body.size() >= compress_min_size && CompressBody(body, stored);
+}
+
+void SQLiteQueue::BindBody(sqlite3_stmt* stmt, int index, const std::string& body) {
+    std::string compressed;
+    if (EncodeBody(body, compressed)) {
+        sqlite3_bind_blob(stmt, index, compressed.data(), (int)compressed.size(), SQLITE_TRANSIENT);
     }
     else {
-        int result = SendRequestInternal(url_wide, body_utf8);
-        if (result == 0) { //  
-            return true;
+        sqlite3_bind_text(stmt, index, body.c_str(), -1, SQLITE_TRANSIENT);
+    }
+}
+
+std::string SQLiteQueue::ReadBody(sqlite3_stmt* stmt, int column) {
+    std::string body;
+
+    if (sqlite3_column_type(stmt, column) == SQLITE_BLOB) {
+        const void* data = sqlite3_column_blob(stmt, column);
+        int size = sqlite3_column_bytes(stmt, column);
+        if (!DecompressBody(data, size, body) && data) {
+            body.assign(static_cast<const char*>(data), size);
         }
+        return body;
+    }
+
+    const unsigned char* text = sqlite3_column_text(stmt, column);
+    if (text) {
+        body.assign(reinterpret_cast<const char*>(text), sqlite3_column_bytes(stmt, column));
+    }
+    return body;
+}
+
+long long SQLiteQueue::GetStoredBytes(bool responses) {
+    std::string sql = responses ?
+        "SELECT COALESCE(SUM(LENGTH(CAST(response_body AS BLOB))), 0) FROM http_responses" :
+        "SELECT COALESCE(SUM(LENGTH(CAST(json_body AS BLOB))), 0) FROM http_queue";
+
+    long long bytes = 0;
+    ExecuteRead([&](sqlite3* conn) {
+        bytes = QueryInt64(conn, sql);
+    });
+
+    return bytes;
+}
+
+bool SQLiteQueue::AddToQueue(const std::wstring& server_url, const std::string& json_body, bool expect_response) {
+    // Тело сжимается до команды записи, чтобы поток записи не держал транзакцию
+    std::string url_utf8 = WideToUtf8(server_url.c_str());
+    long long body_hash = HashBody(json_body);
+    std::string encoded;
+    bool compressed = EncodeBody(json_body, encoded);
+
+    return ExecuteWrite([&]() {
+
+        if (deduplicate && IsPendingDuplicate(url_utf8, body_hash, json_body)) {
+            CountCoalesced(0, 1);
+            return true;
+        }
+
+        std::string sql = R"(
+            INSERT INTO http_queue (server_url, json_body, expect_response, timestamp, body_hash)
+            VALUES (?, ?, ?, ?, ?)
+        )";
+
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+
+        time_t now = time(nullptr);
+
+        sqlite3_bind_text(stmt, 1, url_utf8.c_str(), -1, SQLITE_TRANSIENT);
+        if (compressed)
+            sqlite3_bind_blob(stmt, 2, encoded.data(), (int)encoded.size(), SQLITE_STATIC);
+        else
+            sqlite3_bind_text(stmt, 2, json_body.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 3, expect_response ? 1 : 0);
+        sqlite3_bind_int64(stmt, 4, now);
+        sqlite3_bind_int64(stmt, 5, body_hash);
+
+        bool result = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_finalize(stmt);
+        stmt = nullptr;
+
+        if (result) {
+            stats.Add(QUEUE_TABLE_REQUESTS, now, 1);
+        }
+
+        return result;
+    });
+}
+
+int SQLiteQueue::AddToQueueBatch(const std::vector<QueueItem>& items) {
+    if (items.empty()) return 0;
+
+    // Адреса, хеши и сжатые тела готовятся до команды записи: поток записи держит
+    // транзакцию только на время вставки. Большая пачка готовится в пуле потоков
+    std::vector<std::string> urls(items.size());
+    std::vector<long long> hashes(items.size());
+    std::vector<std::string> encoded(items.size());
+    std::vector<char> compressed(items.size());
+    auto encode = [&](size_t i) {
+        urls[i] = WideToUtf8(items[i].server_url.c_str());
+        hashes[i] = HashBody(items[i].json_body);
+        compressed[i] = EncodeBody(items[i].json_body, encoded[i]) ? 1 : 0;
+    };
+
+    WorkStealingPool* pool = work_pool;
+    if (pool && items.size() >= kParallelEncodeMin) {
+        pool->ParallelFor(items.size(), encode, 16);
+    }
+    else {
+        for (size_t i = 0; i < items.size(); ++i) encode(i);
+    }
+
+    // Отложенные запросы попадают в расписание только после фиксации пачки
+    std::vector<std::pair<int, long long>> scheduled;
+
+    // Команда записи выполняется в транзакции потока записи: пачка сохраняется целиком или не сохраняется
+    bool saved = ExecuteWrite([&]() {
+        scheduled.clear();
+        std::string sql = R"(
+            INSERT INTO http_queue (server_url, json_body, expect_response, timestamp, body_hash, response_ttl, deadline,
+                next_attempt_ms)
+            VALUES (?, ?, ?, ?, ?, ?, ?, ?)
+        )";
+
+        sqlite3_stmt* stmt = nullptr;
+        bool result = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK;
+        std::vector<bool> inserted(items.size(), false);
+        long long duplicates = 0;
+
+        // Одна подготовленная команда на всю пачку
+        for (size_t i = 0; result && i < items.size(); ++i) {
+            // Дубликаты ищутся и среди уже вставленных запросов этой же пачки
+            if (deduplicate && IsPendingDuplicate(urls[i], hashes[i], items[i].json_body)) {
+                duplicates++;
+                continue;
+            }
+
+            sqlite3_reset(stmt);
+            sqlite3_bind_text(stmt, 1, urls[i].c_str(), -1, SQLITE_TRANSIENT);
+            if (compressed[i])
+                sqlite3_bind_blob(stmt, 2, encoded[i].data(), (int)encoded[i].size(), SQLITE_STATIC);
+            else
+                sqlite3_bind_text(stmt, 2, items[i].json_body.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int(stmt, 3, items[i].expect_response ? 1 : 0);
+            sqlite3_bind_int64(stmt, 4, items[i].timestamp);
+            sqlite3_bind_int64(stmt, 5, hashes[i]);
+            if (items[i].response_ttl > 0)
+                sqlite3_bind_int(stmt, 6, items[i].response_ttl);
+            else
+                sqlite3_bind_null(stmt, 6);
+            if (items[i].deadline > 0)
+                sqlite3_bind_int64(stmt, 7, items[i].deadline);
+            else
+                sqlite3_bind_null(stmt, 7);
+            if (items[i].next_attempt_ms > 0)
+                sqlite3_bind_int64(stmt, 8, items[i].next_attempt_ms);
+            else
+                sqlite3_bind_null(stmt, 8);
+
+            result = sqlite3_step(stmt) == SQLITE_DONE;
+            inserted[i] = result;
+            if (result && items[i].next_attempt_ms > 0)
+                scheduled.push_back(std::make_pair((int)sqlite3_last_insert_rowid(db), items[i].next_attempt_ms));
+        }
+        sqlite3_finalize(stmt);
+
+        if (result) {
+            for (size_t i = 0; i < items.size(); ++i) {
+                if (inserted[i]) stats.Add(QUEUE_TABLE_REQUESTS, items[i].timestamp, 1);
+            }
+            CountCoalesced(0, duplicates);
+        }
+
+        return result;
+    });
+
+    TimingWheel* wheel = retry_wheel;
+    if (saved && wheel) {
+        for (size_t i = 0; i < scheduled.size(); ++i)
+            wheel->Schedule(scheduled[i].first, scheduled[i].second);
+    }
+
+    return saved ? (int)items.size() : 0;
+}
+
+int SQLiteQueue::SaveBatchDirect(const std::vector<QueueItem>& items, DWORD timeout_ms) {
+    if (items.empty() || db_path.empty()) return 0;
+
+    // Отдельное соединение: поток записи и пул могут быть уже остановлены, а ждать их
+    // здесь нельзя. Блокировку базы другим процессом ждем не дольше timeout_ms
+    sqlite3* conn = nullptr;
+    if (sqlite3_open_v2(db_path.c_str(), &conn, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+        if (conn) sqlite3_close(conn);
+        return 0;
+    }
+    sqlite3_busy_timeout(conn, (int)timeout_ms);
+
+    sqlite3_stmt* stmt = nullptr;
+    bool result = sqlite3_exec(conn, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr) == SQLITE_OK;
+    if (result) {
+        result = sqlite3_prepare_v2(conn, "INSERT INTO http_queue (server_url, json_body, expect_response, timestamp, body_hash, "
+            "response_ttl, deadline, next_attempt_ms) VALUES (?, ?, ?, ?, ?, ?, ?, ?)", -1, &stmt, nullptr) == SQLITE_OK;
+
+        for (size_t i = 0; result && i < items.size(); ++i) {
+            const QueueItem& item = items[i];
+            std::string url_utf8 = WideToUtf8(item.server_url.c_str());
+            std::string encoded;
+
+            sqlite3_reset(stmt);
+            sqlite3_clear_bindings(stmt);
+            sqlite3_bind_text(stmt, 1, url_utf8.c_str(), -1, SQLITE_TRANSIENT);
+            if (EncodeBody(item.json_body, encoded))
+                sqlite3_bind_blob(stmt, 2, encoded.data(), (int)encoded.size(), SQLITE_TRANSIENT);
+            else
+                sqlite3_bind_text(stmt, 2, item.json_body.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int(stmt, 3, item.expect_response ? 1 : 0);
+            sqlite3_bind_int64(stmt, 4, item.timestamp);
+            sqlite3_bind_int64(stmt, 5, HashBody(item.json_body));
+            if (item.response_ttl > 0)
+                sqlite3_bind_int(stmt, 6, item.response_ttl);
+            if (item.deadline > 0)
+                sqlite3_bind_int64(stmt, 7, item.deadline);
+            if (item.next_attempt_ms > 0)
+                sqlite3_bind_int64(stmt, 8, item.next_attempt_ms);
+
+            result = sqlite3_step(stmt) == SQLITE_DONE;
+        }
+        sqlite3_finalize(stmt);
+
+        result = result && sqlite3_exec(conn, "COMMIT", nullptr, nullptr, nullptr) == SQLITE_OK;
+        if (!result)
+            sqlite3_exec(conn, "ROLLBACK", nullptr, nullptr, nullptr);
+    }
+    sqlite3_close(conn);
+
+    // Счетчики в памяти не обновляются: копию в queue_stats ведут триггеры базы
+    return result ? (int)items.size() : 0;
+}
+
+bool SQLiteQueue::IsPendingDuplicate(const std::string& url_utf8, long long body_hash, const std::string& json_body) {
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT json_body FROM http_queue WHERE body_hash = ? AND server_url = ?", -1, &stmt, nullptr) != SQLITE_OK) {
+        return false;
+    }
+
+    sqlite3_bind_int64(stmt, 1, body_hash);
+    sqlite3_bind_text(stmt, 2, url_utf8.c_str(), -1, SQLITE_TRANSIENT);
+
+    bool found = false;
+    while (!found && sqlite3_step(stmt) == SQLITE_ROW) {
+        found = ReadBody(stmt, 0) == json_body;
+    }
+    sqlite3_finalize(stmt);
+
+    return found;
+}
+
+bool SQLiteQueue::AddToQueueCoalesced(const std::wstring& server_url, const std::string& json_body, bool expect_response,
+                                      const std::string& coalesce_key) {
+    if (coalesce_key.empty()) {
+        return AddToQueue(server_url, json_body, expect_response);
+    }
+
+    return ExecuteWrite([&]() {
+        std::string url_utf8 = WideToUtf8(server_url.c_str());
+        long long body_hash = HashBody(json_body);
+
+        if (deduplicate && IsPendingDuplicate(url_utf8, body_hash, json_body)) {
+            CountCoalesced(0, 1);
+            return true;
+        }
+
+        // Удаляем ожидающие запросы с тем же ключом, запоминая самое раннее время
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(db, "DELETE FROM http_queue WHERE server_url = ? AND coalesce_key = ? RETURNING timestamp",
+                               -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+
+        sqlite3_bind_text(stmt, 1, url_utf8.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, coalesce_key.c_str(), -1, SQLITE_TRANSIENT);
+
+        time_t timestamp = time(nullptr);
+        long long replaced = 0;
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            time_t old_timestamp = (time_t)sqlite3_column_int64(stmt, 0);
+            stats.Add(QUEUE_TABLE_REQUESTS, old_timestamp, -1);
+            timestamp = std::min(timestamp, old_timestamp);
+            replaced++;
+        }
+        sqlite3_finalize(stmt);
+
+        if (rc != SQLITE_DONE) return false;
+
+        std::string sql = R"(
+            INSERT INTO http_queue (server_url, json_body, expect_response, timestamp, coalesce_key, body_hash)
+            VALUES (?, ?, ?, ?, ?, ?)
+        )";
+
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+
+        sqlite3_bind_text(stmt, 1, url_utf8.c_str(), -1, SQLITE_TRANSIENT);
+        BindBody(stmt, 2, json_body);
+        sqlite3_bind_int(stmt, 3, expect_response ? 1 : 0);
+        sqlite3_bind_int64(stmt, 4, timestamp);
+        sqlite3_bind_text(stmt, 5, coalesce_key.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 6, body_hash);
+
+        bool result = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_finalize(stmt);
+
+        if (result) {
+            stats.Add(QUEUE_TABLE_REQUESTS, timestamp, 1);
+            CountCoalesced(replaced, 0);
+        }
+
+        return result;
+    });
+}
+
+int SQLiteQueue::RecordSendFailure(int id, const SendFailure& failure, int max_attempts, bool permanent) {
+    int outcome = 0;
+    long long next_attempt_ms = 0;
+    int base_ms = retry_base_ms;
+    int max_ms = retry_max_ms;
+
+    bool result = ExecuteWrite([&]() {
+        time_t now = time(nullptr);
+        outcome = 0;
+        next_attempt_ms = 0;
+
+        // Пауза перед повтором удваивается с каждой попыткой (в SET attempts - прежнее значение)
+        sqlite3_stmt* stmt = nullptr;
+        std::string sql = R"(
+            UPDATE http_queue SET attempts = attempts + 1, first_attempt = COALESCE(first_attempt, ?1), last_attempt = ?1,
+                next_attempt_ms = CASE WHEN ?3 > 0 THEN ?4 + MIN(?5, ?3 << MIN(attempts, 20)) END
+            WHERE id = ?2 RETURNING attempts, next_attempt_ms
+        )";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+
+        sqlite3_bind_int64(stmt, 1, now);
+        sqlite3_bind_int(stmt, 2, id);
+        sqlite3_bind_int(stmt, 3, base_ms);
+        sqlite3_bind_int64(stmt, 4, TimingWheel::NowMs());
+        sqlite3_bind_int(stmt, 5, max_ms);
+
+        int rc = sqlite3_step(stmt);
+        int attempts = rc == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : 0;
+        long long retry_at = rc == SQLITE_ROW ? sqlite3_column_int64(stmt, 1) : 0;
+        sqlite3_finalize(stmt);
+
+        // Запрос уже удален (подтвержден, заменен по ключу или очищен)
+        if (rc == SQLITE_DONE) return true;
+        if (rc != SQLITE_ROW) return false;
+
+        if (!permanent && (max_attempts <= 0 || attempts < max_attempts)) {
+            next_attempt_ms = retry_at;
+            return true;
+        }
+
+        sql = R"(
+            INSERT INTO http_dead_letters (queue_id, server_url, json_body, expect_response, coalesce_key, body_hash,
+                attempts, http_status, error, enqueued, first_attempt, last_attempt, last_elapsed_ms, dead_time)
+            SELECT id, server_url, json_body, expect_response, coalesce_key, body_hash,
+                attempts, ?1, ?2, timestamp, first_attempt, last_attempt, ?3, ?4
+            FROM http_queue WHERE id = ?5
+        )";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+
+        sqlite3_bind_int(stmt, 1, failure.http_status);
+        sqlite3_bind_text(stmt, 2, failure.error.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 3, failure.elapsed_ms);
+        sqlite3_bind_int64(stmt, 4, now);
+        sqlite3_bind_int(stmt, 5, id);
+
+        bool moved = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_finalize(stmt);
+        if (!moved) return false;
+
+        if (sqlite3_prepare_v2(db, "DELETE FROM http_queue WHERE id = ? RETURNING timestamp", -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+
+        sqlite3_bind_int(stmt, 1, id);
+        moved = StepDeleteReturning(stmt, QUEUE_TABLE_REQUESTS) > 0;
+        sqlite3_finalize(stmt);
+
+        outcome = moved ? 1 : 0;
+        return moved;
+    });
+
+    TimingWheel* wheel = retry_wheel;
+    if (result && wheel && next_attempt_ms > 0)
+        wheel->Schedule(id, next_attempt_ms);
+
+    return result ? outcome : -1;
+}
+
+int SQLiteQueue::ReplayDeadLetters(int http_status, int max_items) {
+    int replayed = 0;
+
+    // ?1 - фильтр включен, ?2 - статус (-1 означает "ответ не получен", то есть 0)
+    const char* filter = "(?1 = 0 OR http_status = ?2)";
+
+    ExecuteWrite([&]() {
+        replayed = 0;
+        time_t now = time(nullptr);
+
+        // Граница по id, чтобы вставка и удаление затронули одни и те же записи
+        sqlite3_stmt* stmt = nullptr;
+        std::string sql = std::string("SELECT MAX(id) FROM (SELECT id FROM http_dead_letters WHERE ") + filter +
+            " ORDER BY id LIMIT ?3)";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+
+        sqlite3_bind_int(stmt, 1, http_status);
+        sqlite3_bind_int(stmt, 2, http_status < 0 ? 0 : http_status);
+        sqlite3_bind_int(stmt, 3, max_items > 0 ? max_items : -1);
+
+        long long boundary = 0;
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            boundary = sqlite3_column_int64(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+
+        if (boundary == 0) return true;
+
+        // Устаревшие значения с ключом объединения не возвращаются, если ключ уже в очереди
+        sql = std::string(R"(
+            INSERT INTO http_queue (server_url, json_body, expect_response, timestamp, coalesce_key, body_hash)
+            SELECT server_url, json_body, expect_response, ?4, coalesce_key, body_hash FROM http_dead_letters d
+            WHERE d.id <= ?3 AND )") + filter + R"( AND (d.coalesce_key IS NULL OR NOT EXISTS (
+                SELECT 1 FROM http_queue q WHERE q.server_url = d.server_url AND q.coalesce_key = d.coalesce_key))
+            ORDER BY d.id
+            RETURNING timestamp
+        )";
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+
+        sqlite3_bind_int(stmt, 1, http_status);
+        sqlite3_bind_int(stmt, 2, http_status < 0 ? 0 : http_status);
+        sqlite3_bind_int64(stmt, 3, boundary);
+        sqlite3_bind_int64(stmt, 4, now);
+
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            stats.Add(QUEUE_TABLE_REQUESTS, (time_t)sqlite3_column_int64(stmt, 0), 1);
+            replayed++;
+        }
+        sqlite3_finalize(stmt);
+        if (rc != SQLITE_DONE) return false;
+
+        sql = std::string("DELETE FROM http_dead_letters WHERE id <= ?3 AND ") + filter;
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+
+        sqlite3_bind_int(stmt, 1, http_status);
+        sqlite3_bind_int(stmt, 2, http_status < 0 ? 0 : http_status);
+        sqlite3_bind_int64(stmt, 3, boundary);
+
+        bool result = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_finalize(stmt);
+
+        return result;
+    });
+
+    return replayed;
+}
+
+int SQLiteQueue::PurgeDeadLetters(int http_status, int hours_old) {
+    int purged = 0;
+
+    ExecuteWrite([&]() {
+        std::string sql = "DELETE FROM http_dead_letters WHERE (?1 = 0 OR http_status = ?2) AND (?3 = 0 OR dead_time < ?4)";
+
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+
+        sqlite3_bind_int(stmt, 1, http_status);
+        sqlite3_bind_int(stmt, 2, http_status < 0 ? 0 : http_status);
+        sqlite3_bind_int(stmt, 3, hours_old);
+        sqlite3_bind_int64(stmt, 4, time(nullptr) - (time_t)hours_old * 3600);
+
+        bool result = sqlite3_step(stmt) == SQLITE_DONE;
+        purged = result ? sqlite3_changes(db) : 0;
+        sqlite3_finalize(stmt);
+
+        return result;
+    });
+
+    return purged;
+}
+
+long long SQLiteQueue::GetDeadLetterCount() {
+    long long count = 0;
+    ExecuteRead([&](sqlite3* conn) {
+        count = QueryInt64(conn, "SELECT COUNT(*) FROM http_dead_letters");
+    });
+
+    return count;
+}
+
+// Порядок отправки: запросы со сроком по возрастанию срока (EDF), затем без срока по
+// времени добавления. Каждая часть читается по своему индексу, а UNION ALL выдает
+// строки по порядку и останавливается на LIMIT, поэтому вторая часть читается,
+// только когда запросов со сроком меньше LIMIT. Отложенные запросы (next_attempt_ms
+// в будущем) пропускаются до своего времени. ?1 - LIMIT, ?2 - текущее время, мс
+static const char kPendingEdfSql[] =
+    "SELECT * FROM (SELECT id, server_url, json_body, expect_response, timestamp, response_ttl, deadline FROM http_queue "
+    "WHERE deadline IS NOT NULL AND (next_attempt_ms IS NULL OR next_attempt_ms <= ?2) ORDER BY deadline LIMIT ?1) "
+    "UNION ALL "
+    "SELECT * FROM (SELECT id, server_url, json_body, expect_response, timestamp, response_ttl, deadline FROM http_queue "
+    "WHERE deadline IS NULL AND (next_attempt_ms IS NULL OR next_attempt_ms <= ?2) ORDER BY timestamp LIMIT ?1) "
+    "LIMIT ?1";
+
+int SQLiteQueue::GetPendingBatch(QueueBatch& batch, int limit) {
+    return ReadPendingBatch(batch, kPendingEdfSql, -1, limit);
+}
+
+int SQLiteQueue::GetPendingBatchAfter(QueueBatch& batch, int after_id, int limit) {
+    return ReadPendingBatch(batch,
+        "SELECT id, server_url, json_body, expect_response, timestamp, response_ttl, deadline FROM http_queue "
+        "WHERE id > ?3 AND (next_attempt_ms IS NULL OR next_attempt_ms <= ?2) ORDER BY id LIMIT ?1",
+        after_id < 0 ? 0 : after_id, limit);
+}
+
+int SQLiteQueue::ReadPendingBatch(QueueBatch& batch, const char* sql, int after_id, int limit) {
+    batch.Clear();
+
+    ExecuteRead([&](sqlite3* conn) {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(conn, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+            return;
+        }
+
+        sqlite3_bind_int(stmt, 1, limit);
+        sqlite3_bind_int64(stmt, 2, TimingWheel::NowMs());
+        if (after_id >= 0) sqlite3_bind_int(stmt, 3, after_id);
+
+        // Подряд идущие запросы обычно идут на один адрес: сравниваем с предыдущим
+        // и обращаемся к EndpointTable только при смене адреса
+        std::string last_url;
+        int last_endpoint = -1;
+
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const char* url = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+            size_t url_size = (size_t)sqlite3_column_bytes(stmt, 1);
+            if (!url) url = "";
+
+            if (last_endpoint < 0 || last_url.size() != url_size || memcmp(last_url.data(), url, url_size) != 0) {
+                last_url.assign(url, url_size);
+                last_endpoint = EndpointTable::Instance().Intern(url, url_size);
+            }
+
+            int id = sqlite3_column_int(stmt, 0);
+            bool expect_response = sqlite3_column_int(stmt, 3) != 0;
+            time_t timestamp = sqlite3_column_int64(stmt, 4);
+            int response_ttl = sqlite3_column_int(stmt, 5);
+            time_t deadline = sqlite3_column_int64(stmt, 6);
+
+            if (sqlite3_column_type(stmt, 2) == SQLITE_BLOB) {
+                // Сжатое тело распаковывается во временную строку
+                std::string body = ReadBody(stmt, 2);
+                batch.Add(id, last_endpoint, body.data(), body.size(), expect_response, timestamp, response_ttl, deadline);
+            }
+            else {
+                const char* body = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+                batch.Add(id, last_endpoint, body ? body : "", (size_t)sqlite3_column_bytes(stmt, 2), expect_response, timestamp,
+                          response_ttl, deadline);
+            }
+        }
+
+        sqlite3_finalize(stmt);
+    });
+
+    return (int)batch.Size();
+}
+
+std::vector<QueueItem> SQLiteQueue::GetPendingItems(int limit) {
+    std::vector<QueueItem> items;
+
+    ExecuteRead([&](sqlite3* conn) {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(conn, kPendingEdfSql, -1, &stmt, nullptr) != SQLITE_OK) {
+            return;
+        }
+
+        sqlite3_bind_int(stmt, 1, limit);
+        sqlite3_bind_int64(stmt, 2, TimingWheel::NowMs());
+
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            QueueItem item;
+            item.id = sqlite3_column_int(stmt, 0);
+
+            const unsigned char* url = sqlite3_column_text(stmt, 1);
+            if (url) {
+                std::string url_str(reinterpret_cast<const char*>(url));
+                item.server_url = Utf8ToWide(url_str.c_str());
+            }
+
+            item.json_body = ReadBody(stmt, 2);
+
+            item.expect_response = sqlite3_column_int(stmt, 3) != 0;
+            item.timestamp = sqlite3_column_int64(stmt, 4);
+            item.response_ttl = sqlite3_column_int(stmt, 5);
+            item.deadline = sqlite3_column_int64(stmt, 6);
+
+            items.push_back(item);
+        }
+
+        sqlite3_finalize(stmt);
+    });
+
+    return items;
+}
+
+bool SQLiteQueue::RemoveFromQueue(int id) {
+    return ExecuteWrite([&]() {
+        std::string sql = "DELETE FROM http_queue WHERE id = ? RETURNING timestamp";
+
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+
+        sqlite3_bind_int(stmt, 1, id);
+        bool result = StepDeleteReturning(stmt, QUEUE_TABLE_REQUESTS) >= 0;
+        sqlite3_finalize(stmt);
+
+        return result;
+    });
+}
+
+int SQLiteQueue::RemoveFromQueueBatch(const std::vector<int>& ids) {
+    if (ids.empty()) return 0;
+
+    int removed = 0;
+    bool committed = ExecuteWrite([&]() {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, "DELETE FROM http_queue WHERE id = ? RETURNING timestamp", -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+
+        bool result = true;
+        for (size_t i = 0; i < ids.size() && result; ++i) {
+            sqlite3_bind_int(stmt, 1, ids[i]);
+            int deleted = StepDeleteReturning(stmt, QUEUE_TABLE_REQUESTS);
+            if (deleted < 0) result = false;
+            else removed += deleted;
+            sqlite3_reset(stmt);
+        }
+        sqlite3_finalize(stmt);
+        return result;
+    });
+
+    // При ошибке транзакция откатывается целиком, счетчики перечитываются из базы
+    return committed ? removed : 0;
+}
+
+int SQLiteQueue::DropOldestQueueItems(int count, bool without_response_only) {
+    if (!db || count <= 0) return 0;
+
+    // Порядок по id - порядок добавления, выборка идет по первичному ключу
+    std::string sql = std::string("DELETE FROM http_queue WHERE id IN (SELECT id FROM http_queue") +
+        (without_response_only ? " WHERE expect_response = 0" : "") + " ORDER BY id LIMIT ?) RETURNING timestamp";
+
+    int deleted_count = 0;
+    ExecuteWrite([&]() {
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) return false;
+
+        sqlite3_bind_int(stmt, 1, count);
+        deleted_count = StepDeleteReturning(stmt, QUEUE_TABLE_REQUESTS);
+        sqlite3_finalize(stmt);
+        return deleted_count >= 0;
+    });
+
+    // При ошибке транзакция откатывается целиком
+    return deleted_count > 0 ? deleted_count : 0;
+}
+
+bool SQLiteQueue::AddResponse(const std::wstring& server_url, const std::string& request_body, const std::string& response_body,
+                              int ttl_seconds) {
+    // Ответ сжимается в вызывающем потоке (обычно в пуле), а не в потоке записи
+    std::string url_utf8 = WideToUtf8(server_url.c_str());
+    std::string encoded;
+    bool compressed = EncodeBody(response_body, encoded);
+
+    return ExecuteWrite([&]() {
+        std::string sql = R"(
+            INSERT OR REPLACE INTO http_responses (server_url, request_body, response_body, timestamp, expires_at, last_access)
+            VALUES (?1, ?2, ?3, ?4, ?5, ?4)
+        )";
+
+        // Время заменяемого ответа нужно, чтобы уменьшить счетчик его корзины
+        time_t replaced_time = 0;
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, "SELECT timestamp FROM http_responses WHERE server_url = ? AND request_body = ?", -1, &stmt, nullptr) == SQLITE_OK) {
+            sqlite3_bind_text(stmt, 1, url_utf8.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(stmt, 2, request_body.c_str(), -1, SQLITE_TRANSIENT);
+            if (sqlite3_step(stmt) == SQLITE_ROW) {
+                replaced_time = (time_t)sqlite3_column_int64(stmt, 0);
+            }
+            sqlite3_finalize(stmt);
+        }
+
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+
+        time_t now = time(nullptr);
+        int ttl = ResolveResponseTtl(url_utf8, ttl_seconds);
+
+        sqlite3_bind_text(stmt, 1, url_utf8.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, request_body.c_str(), -1, SQLITE_TRANSIENT);
+        if (compressed)
+            sqlite3_bind_blob(stmt, 3, encoded.data(), (int)encoded.size(), SQLITE_STATIC);
+        else
+            sqlite3_bind_text(stmt, 3, response_body.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 4, now);
+        if (ttl > 0) {
+            sqlite3_bind_int64(stmt, 5, now + ttl);
+            response_expiry = true;
+        }
+
+        bool result = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_finalize(stmt);
+
+        if (result) {
+            if (replaced_time != 0) {
+                stats.Add(QUEUE_TABLE_RESPONSES, replaced_time, -1);
+            }
+            stats.Add(QUEUE_TABLE_RESPONSES, now, 1);
+        }
+
+        return result;
+    });
+}
+
+std::string SQLiteQueue::GetResponse(const std::wstring& server_url, const std::string& request_body) {
+    std::string response;
+    WaitStoringResponse(request_body);
+
+    ExecuteRead([&](sqlite3* conn) {
+        // Просроченный ответ не возвращается, даже если фоновая очистка его еще не удалила
+        std::string sql = "SELECT id, response_body FROM http_responses WHERE server_url = ? AND request_body = ? "
+            "AND (expires_at IS NULL OR expires_at > ?)";
+
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(conn, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return;
+        }
+
+        std::string url_utf8 = WideToUtf8(server_url.c_str());
+
+        sqlite3_bind_text(stmt, 1, url_utf8.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, request_body.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 3, time(nullptr));
+
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            response = ReadBody(stmt, 1);
+
+            // Соединение только для чтения: время обращения сохранит поток записи
+            EnterCriticalSection(&touch_cs);
+            if (touched_responses.size() < kMaxPendingTouches) {
+                touched_responses.push_back(sqlite3_column_int(stmt, 0));
+            }
+            LeaveCriticalSection(&touch_cs);
+        }
+
+        sqlite3_finalize(stmt);
+    });
+
+    return response;
+}
+
+std::string SQLiteQueue::GetAndRemoveResponse(const std::wstring& server_url, const std::string& request_body) {
+    std::string response;
+    WaitStoringResponse(request_body);
+
+    // Чтение и удаление - одна команда записи, чтобы ответ не достался двум вызывающим
+    ExecuteWrite([&]() {
+        // Сначала получаем самый свежий ответ
+        std::string sql = R"(
+            SELECT response_body 
+            FROM http_responses 
+            WHERE server_url = ? AND request_body = ? AND (expires_at IS NULL OR expires_at > ?)
+            ORDER BY timestamp DESC 
+            LIMIT 1
+        )";
+
+        sqlite3_stmt* stmt = nullptr;
+
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+            std::string url_utf8 = WideToUtf8(server_url.c_str());
+
+            sqlite3_bind_text(stmt, 1, url_utf8.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(stmt, 2, request_body.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int64(stmt, 3, time(nullptr));
+
+            if (sqlite3_step(stmt) == SQLITE_ROW) {
+                response = ReadBody(stmt, 0);
+            }
+            sqlite3_finalize(stmt);
+            stmt = nullptr;
+        }
+
+        // Если нашли ответ, удаляем ВСЕ записи с такими параметрами
+        if (!response.empty()) {
+            sql = "DELETE FROM http_responses WHERE server_url = ? AND request_body = ? RETURNING timestamp";
+            sqlite3_stmt* delete_stmt = nullptr;
+
+            if (sqlite3_prepare_v2(db, sql.c_str(), -1, &delete_stmt, nullptr) == SQLITE_OK) {
+                std::string url_utf8 = WideToUtf8(server_url.c_str());
+
+                sqlite3_bind_text(delete_stmt, 1, url_utf8.c_str(), -1, SQLITE_TRANSIENT);
+                sqlite3_bind_text(delete_stmt, 2, request_body.c_str(), -1, SQLITE_TRANSIENT);
+
+                StepDeleteReturning(delete_stmt, QUEUE_TABLE_RESPONSES);
+                sqlite3_finalize(delete_stmt);
+                delete_stmt = nullptr;
+            }
+        }
+
+        return true;
+    });
+
+    return response;
+}
+
+int SQLiteQueue::ResolveResponseTtl(const std::string& url_utf8, int ttl_seconds) const {
+    if (ttl_seconds > 0) return ttl_seconds;
+
+    std::map<std::string, int>::const_iterator it = response_ttls.find(url_utf8);
+    if (it == response_ttls.end()) it = response_ttls.find(std::string());
+
+    return it != response_ttls.end() ? it->second : 0;
+}
+
+void SQLiteQueue::SetResponseTtl(const std::wstring& server_url, int ttl_seconds) {
+    std::string url_utf8 = WideToUtf8(server_url.c_str());
+
+    ExecuteWrite([&]() {
+        if (ttl_seconds > 0) {
+            response_ttls[url_utf8] = ttl_seconds;
+            response_expiry = true;
+        }
+        else {
+            response_ttls.erase(url_utf8);
+        }
+        return true;
+    }, false);
+}
+
+void SQLiteQueue::SetResponseLimit(long long max_count) {
+    ExecuteWrite([&]() {
+        max_responses = max_count > 0 ? max_count : 0;
+        if (max_responses > 0) response_expiry = true;
+        return true;
+    }, false);
+}
+
+int SQLiteQueue::ExpireResponsesChunk(int chunk_size) {
+    time_t now = time(nullptr);
+    sqlite3_stmt* stmt = nullptr;
+
+    // Время обращения к прочитанным ответам
+    std::vector<int> touched;
+    EnterCriticalSection(&touch_cs);
+    touched.swap(touched_responses);
+    LeaveCriticalSection(&touch_cs);
+
+    if (!touched.empty() && sqlite3_prepare_v2(db, "UPDATE http_responses SET last_access = ? WHERE id = ?", -1, &stmt, nullptr) == SQLITE_OK) {
+        for (size_t i = 0; i < touched.size(); ++i) {
+            sqlite3_reset(stmt);
+            sqlite3_bind_int64(stmt, 1, now);
+            sqlite3_bind_int(stmt, 2, touched[i]);
+            sqlite3_step(stmt);
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    int expired = 0, evicted = 0;
+
+    // Просроченные ответы по частичному индексу expires_at
+    if (sqlite3_prepare_v2(db, "DELETE FROM http_responses WHERE id IN (SELECT id FROM http_responses "
+        "WHERE expires_at <= ? ORDER BY expires_at LIMIT ?) RETURNING timestamp", -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, now);
+        sqlite3_bind_int(stmt, 2, chunk_size);
+        expired = std::max(StepDeleteReturning(stmt, QUEUE_TABLE_RESPONSES), 0);
+        sqlite3_finalize(stmt);
+    }
+
+    // Сверх предела удаляются ответы, к которым дольше всего не обращались
+    long long excess = max_responses > 0 ? stats.GetTotal(QUEUE_TABLE_RESPONSES) - max_responses : 0;
+    if (excess > 0 && sqlite3_prepare_v2(db, "DELETE FROM http_responses WHERE id IN (SELECT id FROM http_responses "
+        "ORDER BY last_access LIMIT ?) RETURNING timestamp", -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, std::min(excess, (long long)chunk_size));
+        evicted = std::max(StepDeleteReturning(stmt, QUEUE_TABLE_RESPONSES), 0);
+        sqlite3_finalize(stmt);
+    }
+
+    if (expired > 0 || evicted > 0) {
+        EnterCriticalSection(&write_cs);
+        storage_stats.expired_responses += expired;
+        storage_stats.evicted_responses += evicted;
+        LeaveCriticalSection(&write_cs);
+    }
+
+    return expired + evicted;
+}
+
+int SQLiteQueue::RunExpiryChunk() {
+    if (!db || sqlite3_exec(db, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr) != SQLITE_OK) return 0;
+
+    SyncExternalChanges();
+    int removed = ExpireResponsesChunk(kDeleteChunkSize);
+
+    if (sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        LoadStats();
+        return 0;
+    }
+
+    return removed;
+}
+
+int SQLiteQueue::ExpireResponses() {
+    int total = 0;
+    int removed = 0;
+
+    do {
+        removed = 0;
+        ExecuteWrite([&]() { removed = ExpireResponsesChunk(kDeleteChunkSize); return true; });
+        total += removed;
+    } while (removed >= kDeleteChunkSize);
+
+    return total;
+}
+
+bool SQLiteQueue::RemoveResponse(int id) {
+    return ExecuteWrite([&]() {
+        std::string sql = "DELETE FROM http_responses WHERE id = ? RETURNING timestamp";
+
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            return false;
+        }
+
+        sqlite3_bind_int(stmt, 1, id);
+        bool result = StepDeleteReturning(stmt, QUEUE_TABLE_RESPONSES) >= 0;
+        sqlite3_finalize(stmt);
+
+        return result;
+    });
+}
+
+int SQLiteQueue::DeleteOldestChunk(const char* table, time_t cutoff_time, int chunk_size) {
+    if (!db) return 0;
+
+    // Удаляем ограниченную порцию, чтобы не держать блокировку записи надолго
+    std::string sql = std::string("DELETE FROM ") + table + " WHERE id IN (SELECT id FROM " + table +
+        " WHERE timestamp < ? ORDER BY timestamp LIMIT ?) RETURNING timestamp";
+    int table_id = strcmp(table, "http_responses") == 0 ? QUEUE_TABLE_RESPONSES : QUEUE_TABLE_REQUESTS;
+
+    sqlite3_stmt* stmt = nullptr;
+    int deleted_count = 0;
+
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, cutoff_time);
+        sqlite3_bind_int(stmt, 2, chunk_size);
+        deleted_count = StepDeleteReturning(stmt, table_id);
+        if (deleted_count < 0) deleted_count = 0;
+        sqlite3_finalize(stmt);
+    }
+
+    return deleted_count;
+}
+
+int SQLiteQueue::CleanOldItemsChunk(int hours_old, bool clean_responses, int chunk_size) {
+    time_t cutoff_time = time(nullptr) - (hours_old * 3600);
+    int deleted_count = 0;
+
+    ExecuteWrite([&]() {
+        deleted_count = DeleteOldestChunk("http_queue", cutoff_time, chunk_size);
+        if (clean_responses) {
+            deleted_count += DeleteOldestChunk("http_responses", cutoff_time, chunk_size);
+        }
+        return true;
+    });
+
+    return deleted_count;
+}
+
+int SQLiteQueue::CleanOldItems(int hours_old, bool clean_responses) {
+    if (!db) return 0;
+
+    time_t cutoff_time = time(nullptr) - (hours_old * 3600);
+    int deleted_count = 0;
+    int deleted = 0;
+
+    // Каждая порция - отдельная команда записи, между ними успевают выполниться другие
+    // Очищаем очередь
+    do {
+        deleted = 0;
+        ExecuteWrite([&]() { deleted = DeleteOldestChunk("http_queue", cutoff_time, kDeleteChunkSize); return true; });
+        deleted_count += deleted;
+    } while (deleted == kDeleteChunkSize);
+
+    // Очищаем ответы, если нужно
+    if (clean_responses) {
+        do {
+            deleted = 0;
+            ExecuteWrite([&]() { deleted = DeleteOldestChunk("http_responses", cutoff_time, kDeleteChunkSize); return true; });
+            deleted_count += deleted;
+        } while (deleted == kDeleteChunkSize);
+    }
+
+    return deleted_count;
+}
+
+long long SQLiteQueue::GetDatabaseSize(bool used_only) {
+    long long size = 0;
+    ExecuteRead([&](sqlite3* conn) {
+        size = DatabaseSize(conn, used_only);
+    });
+    return size;
+}
+
+long long SQLiteQueue::DatabaseSize(sqlite3* conn, bool used_only) {
+    long long page_size = QueryInt64(conn, "PRAGMA page_size");
+    long long pages = QueryInt64(conn, "PRAGMA page_count");
+    if (used_only) {
+        pages -= QueryInt64(conn, "PRAGMA freelist_count");
+    }
+    return pages * page_size;
+}
+
+int SQLiteQueue::TrimToSize(long long max_bytes, int chunk_size, int max_chunks) {
+    if (!db || max_bytes <= 0) return 0;
+
+    int deleted_count = 0;
+
+    ExecuteWrite([&]() {
+        for (int i = 0; i < max_chunks && DatabaseSize(db, true) > max_bytes; ++i) {
+            long long oldest_queue = QueryInt64("SELECT COALESCE(MIN(timestamp), 0) FROM http_queue");
+            long long oldest_response = QueryInt64("SELECT COALESCE(MIN(timestamp), 0) FROM http_responses");
+            if (oldest_queue == 0 && oldest_response == 0) break;
+
+            // Удаляем порцию из таблицы, где лежат самые старые записи
+            bool from_responses = oldest_queue == 0 || (oldest_response != 0 && oldest_response <= oldest_queue);
+            const char* table = from_responses ? "http_responses" : "http_queue";
+            time_t cutoff_time = (time_t)(from_responses ? oldest_response : oldest_queue) + 3600;
+
+            int deleted = DeleteOldestChunk(table, cutoff_time, chunk_size);
+            if (deleted == 0) break;
+            deleted_count += deleted;
+        }
+        return true;
+    });
+
+    return deleted_count;
+}
+
+bool SQLiteQueue::EnableIncrementalVacuum() {
+    if (!db) return false;
+
+    // 2 = INCREMENTAL. Для существующей базы режим меняется только через VACUUM,
+    // который нельзя выполнить внутри транзакции
+    return ExecuteWrite([&]() {
+        if (QueryInt64("PRAGMA auto_vacuum") == 2) return true;
+
+        ExecuteSQL("PRAGMA auto_vacuum = INCREMENTAL");
+        ExecuteSQL("VACUUM");
+
+        return QueryInt64("PRAGMA auto_vacuum") == 2;
+    }, false);
+}
+
+int SQLiteQueue::IncrementalVacuum(int max_pages) {
+    if (!db) return 0;
+
+    int freed = 0;
+
+    ExecuteWrite([&]() {
+        long long before = QueryInt64("PRAGMA freelist_count");
+        if (before == 0) return true;
+
+        ExecuteSQL("PRAGMA incremental_vacuum(" + std::to_string(max_pages) + ")");
+
+        freed = (int)(before - QueryInt64("PRAGMA freelist_count"));
+        return true;
+    });
+
+    return freed;
+}
+
+int SQLiteQueue::GetOldItemsCount(int hours_old, bool check_responses) {
+    if (!db) return 0;
+
+    RefreshSharedStats();
+
+    time_t cutoff_time = time(nullptr) - (hours_old * 3600);
+
+    // Целые часовые корзины берутся из счетчиков; корзина, в которую попадает
+    // cutoff_time, досчитывается по индексу timestamp, чтобы результат совпадал
+    // с тем, что удалит CleanOldItems (timestamp < cutoff_time)
+    long long boundary = 0;
+    long long count = stats.GetOlderThan(check_responses ? QUEUE_TABLE_RESPONSES : QUEUE_TABLE_REQUESTS,
+        cutoff_time, &boundary);
+    if (boundary == 0) return (int)count;
+
+    long long bucket_start = (long long)cutoff_time / QueueStats::kBucketSeconds * QueueStats::kBucketSeconds;
+    std::string sql = std::string("SELECT COUNT(*) FROM ") + (check_responses ? "http_responses" : "http_queue") +
+        " WHERE timestamp >= ? AND timestamp < ?";
+
+    ExecuteRead([&](sqlite3* conn) {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(conn, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) return;
+
+        sqlite3_bind_int64(stmt, 1, bucket_start);
+        sqlite3_bind_int64(stmt, 2, (sqlite3_int64)cutoff_time);
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+            count += sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+    });
+
+    return (int)count;
+}
+
+long long SQLiteQueue::GetItemsCount(bool check_responses) {
+    RefreshSharedStats();
+    return stats.GetTotal(check_responses ? QUEUE_TABLE_RESPONSES : QUEUE_TABLE_REQUESTS);
+}
+
+long long SQLiteQueue::GetAgeHistogram(bool check_responses, int* counts, int max_buckets) {
+    RefreshSharedStats();
+    return stats.GetAgeHistogram(check_responses ? QUEUE_TABLE_RESPONSES : QUEUE_TABLE_REQUESTS,
+        time(nullptr), counts, max_buckets);
+}
+
+bool SQLiteQueue::ProcessQueueItem(const QueueItem& item, SendFailure* failure) {
+    return SendQueuedRequest(item.server_url, item.json_body.data(), item.json_body.size(), item.expect_response,
+                             item.response_ttl, failure);
+}
+
+bool SQLiteQueue::ProcessQueueItem(const QueueBatch& batch, size_t index, SendFailure* failure) {
+    const QueueItemView& item = batch[index];
+    return SendQueuedRequest(EndpointTable::Instance().Url(item.endpoint), batch.Body(item), item.body_size,
+                             item.expect_response, item.response_ttl, failure);
+}
+
+bool SQLiteQueue::ProcessEnvelope(const QueueBatch& batch, const std::vector<size_t>& members, int format,
+                                  SendFailure* failure) {
+    const std::wstring& url_wide = EndpointTable::Instance().Url(batch[members[0]].endpoint);
+    const wchar_t* content_type = format == ENVELOPE_NDJSON ? L"application/x-ndjson" : NULL;
+
+    std::string body;
+    BuildEnvelope(format, batch, members, body);
+
+    bool expect_response = false;
+    for (size_t m = 0; m < members.size(); ++m)
+        expect_response = expect_response || batch[members[m]].expect_response;
+
+    DWORD status_code = 0;
+    DWORD started = GetTickCount();
+    std::string error;
+
+    if (expect_response) {
+        std::string response = SendRequestInternalResponse(url_wide, body.data(), body.size(), &status_code, content_type);
+        if (response.find("ERROR:") != 0) {
+            std::shared_ptr<ResponseJob> job = std::make_shared<ResponseJob>();
+            job->server_url = url_wide;
+            job->format = format;
+            job->count = members.size();
+            job->response.swap(response);
+            for (size_t m = 0; m < members.size(); ++m) {
+                const QueueItemView& item = batch[members[m]];
+                if (!item.expect_response) continue;
+                job->positions.push_back(m);
+                job->requests.push_back(std::string(batch.Body(item), item.body_size));
+                job->ttls.push_back(item.response_ttl);
+            }
+            StoreResponses(job);
+            return true;
+        }
+        error = response.substr(0, 1024);
+    }
+    else {
+        if (SendRequestInternal(url_wide, body.data(), body.size(), &status_code, content_type) == 0)
+            return true;
+        error = status_code ? "ERROR: HTTP " + std::to_string(status_code) : "ERROR: No response";
+    }
+
+    if (failure) {
+        failure->http_status = (int)status_code;
+        failure->error = error;
+        failure->elapsed_ms = (long long)(GetTickCount() - started);
     }
 
     return false;
-}
\ No newline at end of file
+}
+
+bool SQLiteQueue::SendQueuedRequest(const std::wstring& url_wide, const char* body, size_t body_size, bool expect_response,
+                                    int response_ttl, SendFailure* failure) {
+    DWORD status_code = 0;
+    DWORD started = GetTickCount();
+    std::string error;
+
+    if (expect_response) {
+        std::string response = SendRequestInternalResponse(url_wide, body, body_size, &status_code);
+        if (response.find("ERROR:") != 0) { // Успешный ответ
+            std::shared_ptr<ResponseJob> job = std::make_shared<ResponseJob>();
+            job->server_url = url_wide;
+            job->format = -1;
+            job->count = 1;
+            job->response.swap(response);
+            job->positions.push_back(0);
+            job->requests.push_back(std::string(body, body_size));
+            job->ttls.push_back(response_ttl);
+            StoreResponses(job);
+            return true;
+        }
+        error = response.substr(0, 1024);
+    }
+    else {
+        int result = SendRequestInternal(url_wide, body, body_size, &status_code);
+        if (result == 0) { // Успешная отправка
+            return true;
+        }
+        error = status_code ? "ERROR: HTTP " + std::to_string(status_code) : "ERROR: No response";
+    }
+
+    if (failure) {
+        failure->http_status = (int)status_code;
+        failure->error = error;
+        failure->elapsed_ms = (long long)(GetTickCount() - started);
+    }
+
+    return false;
+}
+
+void SQLiteQueue::StoreResponses(const std::shared_ptr<ResponseJob>& job) {
+    WorkStealingPool* pool = work_pool;
+    if (!pool) {
+        SaveResponses(*job);
+        return;
+    }
+
+    // Пока задача не выполнена, чтение ответа на эти запросы ее ждет
+    EnterCriticalSection(&store_cs);
+    for (size_t i = 0; i < job->requests.size(); ++i)
+        storing_responses[HashBody(job->requests[i])]++;
+    LeaveCriticalSection(&store_cs);
+
+    pool->Submit([this, job]() {
+        SaveResponses(*job);
+
+        EnterCriticalSection(&store_cs);
+        for (size_t i = 0; i < job->requests.size(); ++i) {
+            std::map<long long, int>::iterator it = storing_responses.find(HashBody(job->requests[i]));
+            if (it != storing_responses.end() && --it->second == 0)
+                storing_responses.erase(it);
+        }
+        LeaveCriticalSection(&store_cs);
+        WakeAllConditionVariable(&store_cv);
+    });
+}
+
+void SQLiteQueue::SaveResponses(const ResponseJob& job) {
+    // Если число ответов не совпало с числом запросов, каждому сохраняется весь ответ
+    std::vector<std::string> parts;
+    bool split = job.format >= 0 && SplitEnvelopeResponse(job.format, job.response, job.count, parts);
+
+    for (size_t i = 0; i < job.requests.size(); ++i) {
+        AddResponse(job.server_url, job.requests[i], split ? parts[job.positions[i]] : job.response, job.ttls[i]);
+    }
+}
+
+void SQLiteQueue::WaitStoringResponse(const std::string& request_body) {
+    long long hash = HashBody(request_body);
+    DWORD started = GetTickCount();
+
+    EnterCriticalSection(&store_cs);
+    while (storing_responses.count(hash) > 0) {
+        DWORD elapsed = GetTickCount() - started;
+        if (elapsed >= kResponseStoreWaitMs ||
+            !SleepConditionVariableCS(&store_cv, &store_cs, kResponseStoreWaitMs - elapsed))
+            break;
+    }
+    LeaveCriticalSection(&store_cs);
+}
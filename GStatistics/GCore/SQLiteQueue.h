@@ -4,150 +4,853 @@
 
 #include <string>
 #include <vector>
+#include <deque>
+#include <map>
+#include <functional>
+#include <memory>
 #include "sqlite3.h"
 #include <windows.h>
 #include "Utilities.h"
+#include "QueueStats.h"
+#include "QueueStorage.h"
+
+class WorkStealingPool;
+class TimingWheel;
 
 /**
- * @struct QueueItem
- * @brief     HTTP 
+ * @struct ResponseItem
+ * @brief Структура представляет элемент ответа от сервера
  */
-struct QueueItem {
-    int id;                         ///<      
-    std::wstring server_url;        ///< URL     (UTF-16)
-    std::string json_body;          ///<  JSON  (UTF-8)
-    bool expect_response;           ///<     
-    time_t timestamp;               ///<    
+struct ResponseItem {
+    int id;                         ///< Уникальный идентификатор ответа в базе данных
+    std::wstring server_url;        ///< URL сервера, от которого получен ответ (UTF-16)
+    std::string request_body;       ///< Тело оригинального запроса (UTF-8)
+    std::string response_body;      ///< Тело ответа от сервера (UTF-8)
+    time_t timestamp;               ///< Временная метка получения ответа
 };
 
 /**
- * @struct ResponseItem
- * @brief      
+ * @struct StorageStats
+ * @brief Счетчики конкуренции за базу данных
  */
-struct ResponseItem {
-    int id;                         ///<      
-    std::wstring server_url;        ///< URL ,     (UTF-16)
-    std::string request_body;       ///<    (UTF-8)
-    std::string response_body;      ///<     (UTF-8)
-    time_t timestamp;               ///<    
+struct StorageStats {
+    long long write_commands;       ///< Выполнено команд записи
+    long long write_groups;         ///< Выполнено транзакций (несколько команд на одну транзакцию)
+    long long write_wait_us;        ///< Суммарное время от постановки команды записи до ее завершения, мкс
+    long long write_wait_max_us;    ///< Максимальное время выполнения команды записи с ожиданием, мкс
+    long long write_queue_max;      ///< Максимальная длина очереди команд записи
+    long long write_queue_length;   ///< Текущая длина очереди команд записи
+    long long read_commands;        ///< Выполнено чтений через пул соединений
+    long long read_wait_us;         ///< Суммарное ожидание свободного соединения для чтения, мкс
+    long long read_wait_max_us;     ///< Максимальное ожидание соединения для чтения, мкс
+    long long reader_connections;   ///< Открыто соединений для чтения
+    long long coalesced_requests;   ///< Ожидающих запросов заменено более новыми с тем же ключом
+    long long duplicate_requests;   ///< Отброшено запросов, совпадающих с ожидающим (URL и тело)
+    long long busy_waits;           ///< Пауз в ожидании блокировки базы другим процессом
+    long long expired_responses;    ///< Удалено ответов с истекшим сроком хранения
+    long long evicted_responses;    ///< Удалено давно не читавшихся ответов сверх предела
+    long long deadline_on_time;     ///< Доставлено запросов со сроком до истечения срока
+    long long deadline_late;        ///< Доставлено запросов со сроком после истечения (срок истек во время отправки)
+    long long deadline_expired;     ///< Удалено запросов с истекшим сроком без отправки
+};
+
+/**
+ * @struct StorageOptions
+ * @brief Параметры страниц и кэша SQLite
+ * @details Отрицательное или нулевое значение оставляет настройку SQLite по умолчанию
+ */
+struct StorageOptions {
+    long long mmap_size;            ///< PRAGMA mmap_size, байт (0 - без отображения в память, < 0 - по умолчанию)
+    int cache_size_kb;              ///< PRAGMA cache_size на соединение, КБ (<= 0 - по умолчанию, около 2 МБ)
+    int page_size;                  ///< PRAGMA page_size, байт: степень двойки от 512 до 65536 (<= 0 - не менять)
+    int temp_store;                 ///< PRAGMA temp_store: 1 - файл, 2 - память (<= 0 - по умолчанию)
 };
 
 /**
  * @class SQLiteQueue
- * @brief     HTTP   SQLite  
- * @details      persistence storage
+ * @brief Класс для управления очередью HTTP запросов в SQLite базе данных
+ * @details Обеспечивает асинхронную обработку запросов с persistence storage.
+ *          Методы можно вызывать из любых потоков. Все изменения выполняет один
+ *          поток записи со своим соединением: команды из разных потоков ставятся
+ *          в очередь, и накопившиеся команды фиксируются одной транзакцией.
+ *          Чтения идут через пул соединений только для чтения; в режиме WAL они
+ *          не ждут поток записи.
  */
-class SQLiteQueue {
+class SQLiteQueue : public QueueStorage {
 private:
-    sqlite3* db;                    ///<     SQLite 
-    std::string db_path;            ///<     
+    /// Команда записи, ожидающая выполнения в потоке записи
+    struct WriteCommand {
+        const std::function<bool()>* command;
+        bool in_transaction;        ///< false - выполнить вне транзакции (VACUUM)
+        bool result;
+        bool done;
+    };
+
+    /// Ответ сервера, который сохраняет пул потоков после отправки
+    struct ResponseJob {
+        std::wstring server_url;
+        int format;                         ///< Формат объединенного запроса (ENVELOPE_*), -1 - одиночный запрос
+        size_t count;                       ///< Запросов в объединенном запросе
+        std::string response;               ///< Ответ сервера
+        std::vector<size_t> positions;      ///< Номера запросов, ожидающих ответа
+        std::vector<std::string> requests;  ///< Тела этих запросов
+        std::vector<int> ttls;              ///< Время хранения их ответов
+    };
+
+    static const int kMaxWriteGroup = 64;           ///< Максимум команд в одной транзакции
+    static const int kDefaultReaderPoolSize = 2;    ///< Соединений для чтения по умолчанию
+    static const int kBusyMaxAttempts = 60;         ///< Пауз при SQLITE_BUSY (около 5 секунд)
+    static const DWORD kSharedStatsInterval = 1000; ///< Как часто сверять счетчики с изменениями других процессов, мс
+    static const int kImportBatchRows = 5000;       ///< Записей выгрузки на одну транзакцию загрузки
+    static const size_t kImportBatchBytes = 16 * 1024 * 1024; ///< Предел объема тел в одной транзакции загрузки
+    static const DWORD kExpiryInterval = 5000;      ///< Как часто поток записи удаляет просроченные ответы, мс
+    static const size_t kMaxPendingTouches = 4096;  ///< Прочитанных ответов, ожидающих обновления last_access
+    static const size_t kParallelEncodeMin = 64;    ///< Пачка, тела которой сжимаются в пуле потоков
+    static const DWORD kResponseStoreWaitMs = 5000; ///< Сколько чтение ответа ждет его сохранения пулом, мс
+
+    sqlite3* db;                    ///< Соединение потока записи
+    std::string db_path;            ///< Путь к файлу базы данных
+    std::string last_error;         ///< Текст последней ошибки ExecuteSQL (под reader_cs)
+    bool compress_bodies;           ///< Сжимать json_body и response_body при записи
+    size_t compress_min_size;       ///< Минимальный размер тела для сжатия (байт)
+    bool deduplicate;               ///< Не добавлять запрос, совпадающий с ожидающим
+    WorkStealingPool* work_pool;    ///< Пул для подготовки пачек и сохранения ответов (NULL - в вызывающем потоке)
+    TimingWheel* retry_wheel;       ///< Расписание отложенных запросов (NULL - не вести)
+    int retry_base_ms;              ///< Пауза перед первым повтором неудачной отправки (0 - повтор сразу)
+    int retry_max_ms;               ///< Предел паузы перед повтором
+
+    QueueStats stats;               ///< Счетчики записей по часовым корзинам
+
+    static const int kDeleteChunkSize = 500; ///< Размер порции при удалении старых записей
+
+    CRITICAL_SECTION write_cs;                  ///< Защищает очередь команд записи
+    CONDITION_VARIABLE write_cv;                ///< Появилась команда записи
+    CONDITION_VARIABLE done_cv;                 ///< Группа команд выполнена
+    std::deque<WriteCommand*> write_queue;
+    HANDLE writer_thread;                       ///< Создается при первой команде записи
+    HANDLE writer_exited;                       ///< Поток записи вышел из WriterLoop
+    DWORD writer_thread_id;
+    bool writer_stop;
+    bool writer_running;                        ///< Поток записи принимает команды (до выхода из WriterLoop)
+
+    CRITICAL_SECTION reader_cs;                 ///< Защищает пул соединений для чтения
+    CONDITION_VARIABLE reader_cv;               ///< Освободилось соединение для чтения
+    std::vector<sqlite3*> readers;              ///< Все открытые соединения для чтения
+    std::vector<sqlite3*> free_readers;         ///< Свободные соединения для чтения
+    int reader_pool_size;
+    std::map<sqlite3*, int> reader_options;     ///< Версия параметров, примененных к соединению
+
+    StorageOptions storage_options;             ///< Защищены reader_cs
+    int storage_options_version;
+
+    StorageStats storage_stats;
+    LARGE_INTEGER qpc_frequency;
+    volatile LONGLONG busy_waits;               ///< Счетчик busy handler (вызывается без блокировок)
+    long long data_version;                     ///< PRAGMA data_version соединения записи при последней сверке
+    volatile DWORD stats_synced_at;             ///< GetTickCount последней сверки счетчиков
+
+    // Срок хранения ответов; настройки читаются и меняются только в потоке записи
+    std::map<std::string, int> response_ttls;   ///< Секунд по URL (UTF-8), "" - для всех адресов
+    long long max_responses;                    ///< Предел количества ответов (0 - без ограничения)
+    bool response_expiry;                       ///< Есть ответы со сроком или задан предел: нужна фоновая очистка
+    DWORD expiry_pass_at;                       ///< GetTickCount последнего полного прохода очистки
+    CRITICAL_SECTION touch_cs;                  ///< Защищает touched_responses
+    std::vector<int> touched_responses;         ///< id прочитанных ответов для обновления last_access
+    CRITICAL_SECTION store_cs;                  ///< Защищает storing_responses
+    CONDITION_VARIABLE store_cv;                ///< Пул сохранил ответы
+    std::map<long long, int> storing_responses; ///< Хеши тел запросов, ответы на которые сохраняет пул
 
     /**
-     * @brief       
-     * @return true   , false  
+     * @brief Инициализирует базу данных и создает необходимые таблицы
+     * @return true при успешной инициализации, false при ошибке
      */
     bool InitializeDatabase();
 
     /**
-     * @brief  SQL    
-     * @param sql SQL   
-     * @return true   , false  
+     * @brief Создает таблицу queue_stats с триггерами и загружает счетчики в память
+     * @return true при успехе
+     */
+    bool InitializeStats();
+
+    /**
+     * @brief Перечитывает счетчики из таблицы queue_stats
+     * @return true при успехе
+     */
+    bool LoadStats();
+
+    /**
+     * @brief Выполняет DELETE ... RETURNING timestamp и уменьшает счетчики
+     * @param stmt Подготовленный запрос удаления
+     * @param table Таблица (QueueTable)
+     * @return Количество удаленных записей или -1 при ошибке
+     */
+    int StepDeleteReturning(sqlite3_stmt* stmt, int table);
+
+    /**
+     * @brief Выполняет SQL запрос без возвращаемого результата
+     * @param sql SQL запрос для выполнения
+     * @return true при успешном выполнении, false при ошибке
+     * @details Текст ошибки SQLite сохраняется для TakeLastError
      */
     bool ExecuteSQL(const std::string& sql);
 
     bool EnsureFolderExists(const std::string& path);
 
+    /**
+     * @brief Добавляет колонку в таблицу базы, созданной старой версией
+     * @param table Имя таблицы
+     * @param column Имя колонки
+     * @param definition Тип и ограничения колонки для ALTER TABLE
+     * @return true, если колонка есть или добавлена
+     */
+    bool EnsureColumn(const char* table, const char* column, const char* definition);
+
+    /**
+     * @brief Отправляет запрос и при ожидании ответа сохраняет его
+     * @param url_wide URL сервера (UTF-16)
+     * @param body Тело запроса (UTF-8)
+     * @param body_size Длина тела в байтах
+     * @param expect_response Флаг ожидания ответа
+     * @param failure Если не nullptr, при ошибке получает статус, текст ошибки и длительность
+     * @return true при успешной отправке
+     */
+    bool SendQueuedRequest(const std::wstring& url_wide, const char* body, size_t body_size, bool expect_response,
+                           int response_ttl, SendFailure* failure);
+
+    /**
+     * @brief Передает ответ сервера на сохранение пулу потоков
+     * @param job Ответ и запросы, которым он адресован
+     * @details Разбор объединенного ответа, сжатие и запись идут в пуле, а поток
+     *          отправки сразу берет следующий запрос. Без пула ответ сохраняется
+     *          в вызывающем потоке
+     */
+    void StoreResponses(const std::shared_ptr<ResponseJob>& job);
+
+    /**
+     * @brief Разбивает ответ по запросам и сохраняет каждую часть
+     */
+    void SaveResponses(const ResponseJob& job);
+
+    /**
+     * @brief Ждет, пока пул сохранит ответ на запрос с этим телом
+     * @details Ожидание ограничено kResponseStoreWaitMs
+     */
+    void WaitStoringResponse(const std::string& request_body);
+
+    /**
+     * @brief Время хранения нового ответа (вызывается в потоке записи)
+     * @param url_utf8 URL сервера
+     * @param ttl_seconds Время, заданное при постановке запроса в очередь (0 - не задано)
+     * @return Секунд, 0 - без ограничения
+     */
+    int ResolveResponseTtl(const std::string& url_utf8, int ttl_seconds) const;
+
+    /**
+     * @brief Удаляет порцию просроченных и лишних ответов (вызывается в потоке записи в транзакции)
+     * @param chunk_size Максимум удаляемых записей каждого вида
+     * @return Количество удаленных ответов
+     * @details Сначала сохраняет last_access прочитанных ответов, затем удаляет ответы
+     *          с истекшим сроком по индексу expires_at и, если ответов больше max_responses,
+     *          давно не читавшиеся по индексу last_access
+     */
+    int ExpireResponsesChunk(int chunk_size);
+
+    /**
+     * @brief Фоновая порция очистки ответов в отдельной транзакции (вызывается из WriterLoop)
+     * @return Количество удаленных ответов
+     */
+    int RunExpiryChunk();
+
+    /**
+     * @brief Busy handler SQLite: экспоненциальная пауза со случайной добавкой
+     * @param context Указатель на SQLiteQueue
+     * @param attempt Номер повтора, начиная с 0
+     * @return 0 - прекратить ожидание и вернуть SQLITE_BUSY
+     * @details Случайная добавка разводит повторы процессов, одновременно
+     *          упершихся в блокировку, вместо синхронных повторов busy_timeout
+     */
+    static int BusyHandler(void* context, int attempt);
+
+    /**
+     * @brief Перечитывает счетчики, если базу изменило другое соединение (вызывается в потоке записи)
+     * @details PRAGMA data_version меняется только после фиксации чужой транзакции
+     */
+    void SyncExternalChanges();
+
+    /**
+     * @brief Сверяет счетчики не чаще kSharedStatsInterval перед их чтением
+     */
+    void RefreshSharedStats();
+
+    /**
+     * @brief Дожидается окончания чтений и закрывает соединения для чтения (вызывается под reader_cs)
+     */
+    void CloseReaders();
+
+    /**
+     * @brief Заполняет retry_wheel запросами с next_attempt_ms в будущем
+     */
+    void LoadRetrySchedule();
+
+    /**
+     * @brief Применяет параметры кэша и отображения в память к соединению
+     * @param conn Соединение потока записи или читателя
+     * @param options Параметры (page_size здесь не применяется)
+     */
+    static void ApplyConnectionOptions(sqlite3* conn, const StorageOptions& options);
+
+    /**
+     * @brief Проверяет, есть ли в очереди запрос с тем же URL и телом (вызывается в потоке записи)
+     * @param url_utf8 URL сервера (UTF-8)
+     * @param body_hash Хеш тела (HashBody)
+     * @param json_body Тело запроса: при совпадении хеша тела сравниваются целиком
+     * @return true, если такой запрос уже ожидает отправки
+     */
+    bool IsPendingDuplicate(const std::string& url_utf8, long long body_hash, const std::string& json_body);
+
+    /**
+     * @brief Учитывает замененные и отброшенные запросы в StorageStats
+     */
+    void CountCoalesced(long long coalesced, long long duplicates);
+
+    /**
+     * @brief Выполняет запрос, возвращающий одно целое значение
+     * @param sql SQL запрос (например, PRAGMA page_count)
+     * @return Значение первой колонки первой строки или 0
+     */
+    long long QueryInt64(const std::string& sql);
+
+    /**
+     * @brief То же для указанного соединения (потока записи или читателя)
+     */
+    long long QueryInt64(sqlite3* conn, const std::string& sql);
+
+    /**
+     * @brief Размер базы по указанному соединению
+     */
+    long long DatabaseSize(sqlite3* conn, bool used_only);
+
+    /**
+     * @brief Выполняет команду в потоке записи и ждет ее завершения
+     * @param command Функция, работающая с соединением db; false - отменить ее изменения
+     * @param in_transaction false - выполнить вне общей транзакции (для VACUUM)
+     * @return Результат команды; false, если транзакция не зафиксирована
+     * @details Вызов из потока записи выполняется сразу
+     */
+    bool ExecuteWrite(const std::function<bool()>& command, bool in_transaction = true);
+
+    /**
+     * @brief Выполняет чтение на свободном соединении из пула
+     * @param query Функция, получающая соединение для чтения
+     * @return false, если база не открыта
+     */
+    bool ExecuteRead(const std::function<void(sqlite3*)>& query);
+
+    sqlite3* AcquireReader();
+    void ReleaseReader(sqlite3* conn);
+
+    static DWORD WINAPI WriterThreadProc(LPVOID param);
+    void WriterLoop();
+    void RunWriteGroup(std::vector<WriteCommand*>& group);
+
+    /**
+     * @brief Удаляет порцию самых старых записей таблицы
+     * @param table Имя таблицы (http_queue или http_responses)
+     * @param cutoff_time Удаляются записи с timestamp меньше этого значения
+     * @param chunk_size Максимальное количество удаляемых записей
+     * @return Количество удаленных записей
+     */
+    int DeleteOldestChunk(const char* table, time_t cutoff_time, int chunk_size);
+
+    /**
+     * @brief Привязывает тело к параметру запроса, при необходимости сжимая его
+     * @param stmt Подготовленный запрос
+     * @param index Индекс параметра
+     * @param body Тело запроса или ответа (UTF-8)
+     * @details Сжатое тело сохраняется как BLOB, несжатое - как TEXT
+     */
+    void BindBody(sqlite3_stmt* stmt, int index, const std::string& body);
+
+    /**
+     * @brief Готовит тело к записи: сжимает, если оно подходит для сжатия
+     * @param body Тело (UTF-8)
+     * @param stored Получает сжатое тело; не меняется, если тело не сжимается
+     * @return true, если тело сжато
+     * @details Не обращается к базе, поэтому выполняется вне потока записи
+     */
+    bool EncodeBody(const std::string& body, std::string& stored) const;
+
+    /**
+     * @brief Читает тело из колонки результата, распаковывая сжатые данные
+     * @param stmt Выполненный запрос
+     * @param column Индекс колонки
+     * @return Тело в UTF-8 или пустая строка
+     */
+    std::string ReadBody(sqlite3_stmt* stmt, int column);
+
+    /**
+     * @brief Выполняет выборку запросов очереди и копирует строки в пачку
+     * @param batch Пачка (очищается)
+     * @param sql Запрос с колонками id, server_url, json_body, expect_response, timestamp, response_ttl, deadline
+     * @param after_id Значение параметра ?3 или -1, если его нет
+     * @param limit Значение параметра LIMIT (?1); ?2 - текущее время, мс
+     * @return Количество запросов в пачке
+     */
+    int ReadPendingBatch(QueueBatch& batch, const char* sql, int after_id, int limit);
+
 public:
     
     /**
-     * @brief   SQLiteQueue
-     * @param database_path      ( : "http_queue.db")
+     * @brief Конструктор класса SQLiteQueue
+     * @param database_path Путь к файлу базы данных (по умолчанию: "http_queue.db")
+     * @param options Параметры страниц и кэша (nullptr - настройки SQLite по умолчанию).
+     *                page_size применяется, если база создается заново
      */
-    SQLiteQueue(const std::string& database_path = "");
+    SQLiteQueue(const std::string& database_path = "", const StorageOptions* options = nullptr);
 
     /**
-     * @brief   SQLiteQueue
-     * @details     
+     * @brief Закрывает текущую базу и открывает другую
+     * @param database_path Путь к файлу базы данных
+     * @return true, если новая база открыта
+     * @details Выполняется как команда записи после уже поставленных в очередь
+     *          команд. Запросы и ответы остаются в прежней базе
+     */
+    bool Reopen(const std::string& database_path);
+
+    /**
+     * @brief Выполняет поставленные команды записи и останавливает поток записи
+     * @details Дожидается выхода потока, поэтому вызывается не под loader lock.
+     *          Следующая команда записи запускает поток заново
+     */
+    void StopWriter();
+
+    /**
+     * @brief Путь к открытой базе данных
+     */
+    std::string GetDatabasePath();
+
+    /**
+     * @brief Возвращает и сбрасывает текст последней ошибки служебной SQL-команды
+     * @return Текст ошибки SQLite в UTF-8 или пустая строка, если ошибок не было
+     */
+    std::string TakeLastError();
+
+    /**
+     * @brief Возвращает параметры SQLite по умолчанию (ничего не меняют)
+     */
+    static StorageOptions DefaultStorageOptions();
+
+    /**
+     * @brief Меняет параметры страниц и кэша открытой базы
+     * @param options Новые параметры
+     * @return true, если все параметры применены
+     * @details mmap_size, cache_size и temp_store применяются к соединению записи
+     *          сразу, а к читателям - при следующем чтении. Смена page_size
+     *          существующей базы требует VACUUM с временным выходом из WAL и
+     *          блокирует запись на время перестроения
+     */
+    bool SetStorageOptions(const StorageOptions& options);
+
+    /**
+     * @brief Возвращает текущие параметры страниц и кэша
+     * @param out Заполняемая структура; page_size - фактический размер страницы базы
+     */
+    void GetStorageOptions(StorageOptions& out);
+
+    /**
+     * @brief Деструктор класса SQLiteQueue
+     * @details Останавливает поток записи и закрывает соединения с базой данных
      */
     ~SQLiteQueue();
 
     /**
-     * @brief  HTTP      
-     * @param server_url URL    (UTF-16)
-     * @param json_body  JSON  (UTF-8)
-     * @param expect_response     
-     * @return true   , false  
+     * @brief Добавляет HTTP запрос в очередь для последующей обработки
+     * @param server_url URL сервера для отправки (UTF-16)
+     * @param json_body Тело JSON запроса (UTF-8)
+     * @param expect_response Флаг ожидания ответа от сервера
+     * @return true при успешном добавлении, false при ошибке
+     */
+    bool AddToQueue(const std::wstring& server_url, const std::string& json_body, bool expect_response) override;
+
+    /**
+     * @brief Добавляет пачку запросов одной транзакцией
+     * @param items Запросы; timestamp берется из элементов, поле id не используется
+     * @return Количество сохраненных запросов: пачка сохраняется целиком или не
+     *         сохраняется (0, если транзакция отменена)
+     */
+    int AddToQueueBatch(const std::vector<QueueItem>& items) override;
+
+    /**
+     * @brief Сохраняет пачку запросов через отдельное соединение, минуя поток записи и пул
+     * @param items Запросы, как для AddToQueueBatch
+     * @param timeout_ms Сколько ждать блокировку базы другим процессом, мс
+     * @return Количество сохраненных запросов: пачка сохраняется целиком или не сохраняется
+     * @details Для отключения DLL, когда ждать поток записи нельзя. Счетчики
+     *          в памяти не обновляются, расписание повторов не заполняется
+     */
+    int SaveBatchDirect(const std::vector<QueueItem>& items, DWORD timeout_ms);
+
+    /**
+     * @brief Добавляет запрос, заменяя ожидающий запрос с тем же URL и ключом
+     * @param server_url URL сервера (UTF-16)
+     * @param json_body Тело JSON запроса (UTF-8)
+     * @param expect_response Флаг ожидания ответа от сервера
+     * @param coalesce_key Ключ объединения (UTF-8), например AccountID
+     * @return true при успешном добавлении, замене или отбрасывании дубликата
+     * @details Новый запрос получает время самого старого замененного, чтобы частые
+     *          обновления не отодвигали отправку в конец очереди. Запрос с новым id
+     *          отправляется, даже если замененный уже был выбран на отправку
+     */
+    bool AddToQueueCoalesced(const std::wstring& server_url, const std::string& json_body, bool expect_response,
+                             const std::string& coalesce_key) override;
+
+    /**
+     * @brief Включает отбрасывание запросов, совпадающих с ожидающими по URL и телу
+     * @param enabled true - не добавлять дубликаты
+     */
+    void SetDeduplication(bool enabled);
+
+    /**
+     * @brief Возвращает список запросов, ожидающих обработки
+     * @param limit Максимальное количество возвращаемых записей
+     * @return Вектор элементов QueueItem
+     * @details Сначала запросы со сроком по возрастанию срока (частичный индекс по
+     *          deadline), затем запросы без срока по времени добавления
      */
-    bool AddToQueue(const std::wstring& server_url, const std::string& json_body, bool expect_response);
+    std::vector<QueueItem> GetPendingItems(int limit = 100) override;
 
     /**
-     * @brief   ,  
-     * @param limit    
-     * @return   QueueItem
+     * @brief Заполняет пачку запросами без промежуточных строк на каждый элемент
+     * @param batch Пачка (очищается, память переиспользуется)
+     * @param limit Максимальное количество записей
+     * @return Количество запросов в пачке
+     * @details Тела копируются из SQLite прямо в буфер пачки в UTF-8, URL
+     *          переводится в номер адреса EndpointTable без преобразования в UTF-16
      */
-    std::vector<QueueItem> GetPendingItems(int limit = 100);
+    int GetPendingBatch(QueueBatch& batch, int limit) override;
 
     /**
-     * @brief      
-     * @param id    
-     * @return true   , false  
+     * @brief Заполняет пачку запросами с id больше after_id (обход по первичному ключу)
+     * @param batch Пачка (очищается, память переиспользуется)
+     * @param after_id Последний идентификатор предыдущей пачки (0 - с начала очереди)
+     * @param limit Максимальное количество записей
+     * @return Количество запросов в пачке
+     * @details Выборка идет по первичному ключу без сортировки, поэтому стоимость
+     *          страницы не зависит от ее положения в очереди
      */
-    bool RemoveFromQueue(int id);
+    int GetPendingBatchAfter(QueueBatch& batch, int after_id, int limit) override;
 
     /**
-     * @brief       
-     * @param server_url URL  (UTF-16)
-     * @param request_body    (UTF-8)
-     * @param response_body     (UTF-8)
-     * @return true   , false  
+     * @brief Удаляет запрос из очереди по идентификатору
+     * @param id Идентификатор записи для удаления
+     * @return true при успешном удалении, false при ошибке
      */
-    bool AddResponse(const std::wstring& server_url, const std::string& request_body, const std::string& response_body);
+    bool RemoveFromQueue(int id) override;
 
     /**
-     * @brief       URL   
-     * @param server_url URL    (UTF-16)
-     * @param request_body     (UTF-8)
-     * @return        
+     * @brief Удаляет несколько запросов одной транзакцией
+     * @param ids Идентификаторы записей
+     * @return Количество удаленных записей
+     */
+    int RemoveFromQueueBatch(const std::vector<int>& ids) override;
+
+    /**
+     * @brief Удаляет самые старые запросы одной командой
+     * @param count Сколько запросов удалить
+     * @param without_response_only true - только запросы, ответ на которые не ожидается
+     * @return Количество удаленных записей
+     */
+    int DropOldestQueueItems(int count, bool without_response_only) override;
+
+    /**
+     * @brief Добавляет ответ от сервера в базу данных
+     * @param server_url URL сервера (UTF-16)
+     * @param request_body Тело оригинального запроса (UTF-8)
+     * @param response_body Тело ответа от сервера (UTF-8)
+     * @param ttl_seconds Время хранения ответа, секунд (0 - по настройке адреса, SetResponseTtl)
+     * @return true при успешном добавлении, false при ошибке
+     */
+    bool AddResponse(const std::wstring& server_url, const std::string& request_body, const std::string& response_body,
+                     int ttl_seconds = 0);
+
+    /**
+     * @brief Задает время хранения ответов адреса
+     * @param server_url URL сервера (UTF-16); пустая строка - для всех адресов без своей настройки
+     * @param ttl_seconds Секунд; 0 - снять ограничение
+     * @details Применяется к ответам, сохраненным после вызова
+     */
+    void SetResponseTtl(const std::wstring& server_url, int ttl_seconds);
+
+    /**
+     * @brief Ограничивает количество хранимых ответов
+     * @param max_count Предел (0 - без ограничения); сверх него удаляются давно не читавшиеся ответы
+     */
+    void SetResponseLimit(long long max_count);
+
+    /**
+     * @brief Немедленно удаляет просроченные и лишние ответы
+     * @return Количество удаленных ответов
+     * @details Обычно это делает поток записи раз в kExpiryInterval; просроченные
+     *          ответы не возвращаются и до удаления
+     */
+    int ExpireResponses();
+
+    /**
+     * @brief Получает ответ из базы данных по URL и телу запроса
+     * @param server_url URL сервера для поиска (UTF-16)
+     * @param request_body Тело запроса для поиска (UTF-8)
+     * @return Ответ сервера или пустая строка если не найден
      */
     std::string GetResponse(const std::wstring& server_url, const std::string& request_body);
 
     /**
-     * @brief         matching 
-     * @param server_url URL    (UTF-16)
-     * @param request_body     (UTF-8)
-     * @return        
+     * @brief Получает ответ из базы данных и удаляет все matching записи
+     * @param server_url URL сервера для поиска (UTF-16)
+     * @param request_body Тело запроса для поиска (UTF-8)
+     * @return Ответ сервера или пустая строка если не найден
      */
     std::string GetAndRemoveResponse(const std::wstring& server_url, const std::string& request_body);
 
     /**
-     * @brief       
-     * @param id    
-     * @return true   , false  
+     * @brief Удаляет ответ из базы данных по идентификатору
+     * @param id Идентификатор ответа для удаления
+     * @return true при успешном удалении, false при ошибке
      */
     bool RemoveResponse(int id);
 
     /**
-     * @brief      
-     * @param hours_old      
-     * @param clean_responses     (true)    (false)
-     * @return   
+     * @brief Очищает старые записи из базы данных
+     * @param hours_old Возраст записей в часах для удаления
+     * @param clean_responses Флаг очистки таблицы ответов (true) или только очереди (false)
+     * @return Количество удаленных записей
      */
     int CleanOldItems(int hours_old, bool clean_responses);
 
     /**
-     * @brief       
-     * @param hours_old      
-     * @param check_responses     (true)    (false)
-     * @return   
+     * @brief Удаляет одну порцию старых записей из каждой таблицы
+     * @param hours_old Возраст записей в часах для удаления
+     * @param clean_responses Флаг очистки таблицы ответов
+     * @param chunk_size Размер порции
+     * @return Количество удаленных записей
+     * @details Используется фоновой очисткой, которая делает паузы между порциями
+     */
+    int CleanOldItemsChunk(int hours_old, bool clean_responses, int chunk_size);
+
+    /**
+     * @brief Возвращает размер базы данных
+     * @param used_only true - без учета свободных страниц
+     * @return Размер в байтах
+     */
+    long long GetDatabaseSize(bool used_only);
+
+    /**
+     * @brief Удаляет самые старые записи, пока база не уложится в лимит
+     * @param max_bytes Лимит занятого места в байтах
+     * @param chunk_size Размер порции удаления
+     * @param max_chunks Максимальное количество порций за вызов
+     * @return Количество удаленных записей
+     */
+    int TrimToSize(long long max_bytes, int chunk_size, int max_chunks);
+
+    /**
+     * @brief Переводит базу в режим auto_vacuum=INCREMENTAL
+     * @return true если режим включен
+     * @details Новая база создается в этом режиме (InitializeDatabase). Существующая
+     *          перестраивается полным VACUUM, который блокирует запись на все время
+     *          перестроения, поэтому вызывается только явно (EnableHttpIncrementalVacuum)
+     */
+    bool EnableIncrementalVacuum();
+
+    /**
+     * @brief Возвращает свободные страницы файловой системе
+     * @param max_pages Максимальное количество страниц за вызов
+     * @return Количество освобожденных страниц
+     */
+    int IncrementalVacuum(int max_pages);
+
+    /**
+     * @brief Возвращает количество старых записей в базе данных
+     * @param hours_old Возраст записей в часах для проверки
+     * @param check_responses Флаг проверки таблицы ответов (true) или только очереди (false)
+     * @return Количество найденных записей
+     * @details Берется из счетчиков в памяти с точностью до часа: записи из часа,
+     *          на который приходится граница, учитываются целиком
      */
     int GetOldItemsCount(int hours_old, bool check_responses);
 
     /**
-     * @brief    ( HTTP )
-     * @param item    
-     * @return true   , false  
+     * @brief Возвращает общее количество записей за O(1)
+     * @param check_responses true - таблица ответов, false - очередь
+     * @return Количество записей
+     */
+    long long GetItemsCount(bool check_responses);
+
+    /**
+     * @brief Заполняет гистограмму возраста записей по часам
+     * @param check_responses true - таблица ответов, false - очередь
+     * @param counts Массив: counts[i] - записи возрастом i часов, последний элемент - все более старые
+     * @param max_buckets Размер массива counts
+     * @return Общее количество записей
+     */
+    long long GetAgeHistogram(bool check_responses, int* counts, int max_buckets);
+
+    // Реализация QueueStorage: операции только над таблицей http_queue
+    int CleanOldQueueItems(int hours_old) override { return CleanOldItems(hours_old, false); }
+    int GetOldQueueItemsCount(int hours_old) override { return GetOldItemsCount(hours_old, false); }
+    long long GetQueueDepth() override { return GetItemsCount(false); }
+    long long GetQueueAgeHistogram(int* counts, int max_buckets) override { return GetAgeHistogram(false, counts, max_buckets); }
+
+    /**
+     * @brief Включает или отключает сжатие хранимых тел запросов и ответов
+     * @param enabled true - сжимать новые записи
+     * @param min_size Тела короче этого размера (байт) сохраняются без сжатия
+     * @details Уже сохраненные записи читаются корректно в любом режиме
+     */
+    void SetCompression(bool enabled, size_t min_size);
+
+    /**
+     * @brief Задает пул потоков для подготовки пачек к записи и сохранения ответов
+     * @param pool Пул (NULL - все в вызывающем потоке)
+     * @details Тела пачки AddToQueueBatch от kParallelEncodeMin запросов сжимаются
+     *          параллельно до передачи пачки потоку записи. Ответы на отправленные
+     *          запросы разбираются и сохраняются задачами пула; GetResponse ждет
+     *          ответ, который пул еще сохраняет
+     */
+    void SetWorkPool(WorkStealingPool* pool);
+
+    /**
+     * @brief Задает расписание отложенных запросов и заполняет его из базы
+     * @param wheel Расписание (NULL - не вести)
+     * @details В расписание попадают запросы с next_attempt_ms в будущем: загруженные
+     *          из базы здесь и при Reopen, добавленные с отложенной отправкой и
+     *          отложенные RecordSendFailure. Запись в расписание идет после фиксации
+     *          транзакции
+     */
+    void SetRetryWheel(TimingWheel* wheel);
+
+    /**
+     * @brief Задает паузу перед повтором неудачной отправки
+     * @param base_ms Пауза после первой неудачи, мс (0 - запрос повторяется при следующем проходе)
+     * @param max_ms Предел паузы, мс
+     * @details Пауза удваивается с каждой попыткой. До ее окончания запрос не выбирается
+     *          GetPendingBatch, GetPendingBatchAfter и GetPendingItems
+     */
+    void SetRetryBackoff(int base_ms, int max_ms);
+
+    /**
+     * @brief Возвращает суммарный объем хранимых тел
+     * @param responses true - таблица ответов, false - очередь запросов
+     * @return Объем в байтах (с учетом сжатия)
+     */
+    long long GetStoredBytes(bool responses);
+
+    /**
+     * @brief Выгружает ожидающие запросы и сохраненные ответы в файл (QueueArchive.h)
+     * @param path Путь к файлу выгрузки
+     * @param include_responses true - выгрузить также http_responses
+     * @return Количество выгруженных записей или -1 при ошибке
+     * @details Записи читаются одним курсором на соединении для чтения и сразу пишутся
+     *          в файл, поэтому память не зависит от размера очереди, а запись в
+     *          очередь не ждет выгрузку. Очередь не изменяется
+     */
+    long long ExportArchive(const std::wstring& path, bool include_responses);
+
+    /**
+     * @brief Загружает записи из файла выгрузки
+     * @param path Путь к файлу выгрузки
+     * @param batch_rows Записей на одну транзакцию записи
+     * @return Количество загруженных записей или -1, если файл не открыт или поврежден
+     * @details Запросы добавляются с исходным временем постановки в очередь, сроком
+     *          доставки, числом попыток и временем следующей попытки; отложенные
+     *          запросы попадают в расписание повторов (SetRetryWheel). Ответы
+     *          заменяют сохраненные ответы на тот же запрос и сохраняют срок хранения
+     *          и время последнего чтения; ответ без срока получает срок по текущей
+     *          настройке SetResponseTtl, отсчитанный от времени ответа. При повреждении
+     *          файла уже загруженные транзакции остаются в базе
+     */
+    long long ImportArchive(const std::wstring& path, int batch_rows = kImportBatchRows);
+
+    /**
+     * @brief Возвращает счетчики конкуренции за базу данных
+     * @param out Заполняемая структура
+     * @param reset true - обнулить накопленные счетчики после чтения
+     */
+    void GetStorageStats(StorageStats& out, bool reset);
+
+    /**
+     * @brief Учитывает доставку запросов со сроком
+     * @param on_time Доставлено до истечения срока
+     * @param late Доставлено после истечения срока
+     * @param expired Удалено без отправки
+     */
+    void CountDeadlines(long long on_time, long long late, long long expired);
+
+    /**
+     * @brief Учитывает неудачную попытку и переносит запрос в http_dead_letters
+     * @param id Идентификатор записи в http_queue
+     * @param failure Результат попытки (статус, ошибка, длительность)
+     * @param max_attempts Максимум попыток (0 - без ограничения)
+     * @param permanent true - перенести сразу, независимо от числа попыток
+     * @return 1 - запрос перенесен, 0 - остался в очереди, -1 - ошибка
+     * @details Запрос, оставшийся в очереди, откладывается по SetRetryBackoff
+     */
+    int RecordSendFailure(int id, const SendFailure& failure, int max_attempts, bool permanent) override;
+
+    /**
+     * @brief Возвращает недоставленные запросы в очередь
+     * @param http_status Только запросы с этим статусом последней попытки (0 - все, -1 - без ответа сервера)
+     * @param max_items Максимальное количество запросов (<= 0 - все)
+     * @return Количество запросов, возвращенных в очередь
+     * @details Счетчик попыток сбрасывается, время в очереди - время возврата.
+     *          Запрос с ключом объединения не возвращается, если в очереди уже
+     *          есть более новый запрос с тем же ключом
+     */
+    int ReplayDeadLetters(int http_status, int max_items);
+
+    /**
+     * @brief Удаляет недоставленные запросы
+     * @param http_status Только запросы с этим статусом последней попытки (0 - все, -1 - без ответа сервера)
+     * @param hours_old Только перенесенные больше указанного количества часов назад (0 - все)
+     * @return Количество удаленных запросов
+     */
+    int PurgeDeadLetters(int http_status, int hours_old);
+
+    /**
+     * @brief Возвращает количество недоставленных запросов
+     */
+    long long GetDeadLetterCount();
+
+    /**
+     * @brief Обрабатывает элемент очереди (отправляет HTTP запрос)
+     * @param item Элемент очереди для обработки
+     * @param failure Если не nullptr, при ошибке получает статус, текст ошибки и длительность
+     * @return true при успешной отправке, false при ошибке
+     */
+    bool ProcessQueueItem(const QueueItem& item, SendFailure* failure = nullptr);
+
+    /**
+     * @brief Отправляет запрос из пачки без копирования тела
+     * @param batch Пачка
+     * @param index Индекс запроса в пачке
+     * @param failure Если не nullptr, при ошибке получает статус, текст ошибки и длительность
+     * @return true при успешной отправке, false при ошибке
+     */
+    bool ProcessQueueItem(const QueueBatch& batch, size_t index, SendFailure* failure = nullptr);
+
+    /**
+     * @brief Отправляет несколько запросов пачки на один адрес одним POST
+     * @param batch Пачка
+     * @param members Индексы запросов (адрес у всех один)
+     * @param format Формат общего тела (EnvelopeFormat)
+     * @param failure Если не nullptr, при ошибке получает статус, текст ошибки и длительность
+     * @return true при успешной отправке, false при ошибке (не отправлен ни один запрос)
+     * @details Если хотя бы один запрос ждет ответа, ответ разбивается по запросам и
+     *          сохраняется отдельной записью для каждого такого запроса. Если число
+     *          ответов не совпало с числом запросов, каждому сохраняется весь ответ:
+     *          сервер запросы уже принял, и повторная отправка продублировала бы статистику.
      */
-    bool ProcessQueueItem(const QueueItem& item);
+    bool ProcessEnvelope(const QueueBatch& batch, const std::vector<size_t>& members, int format,
+                         SendFailure* failure = nullptr);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,555 @@
+﻿#include "SegmentLogQueue.h"
+#include "Utilities.h"
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+namespace {
+
+// Заголовок записи: длина полезной нагрузки и CRC32 полезной нагрузки.
+// Длина пишется последней, поэтому незавершенная запись выглядит как конец журнала.
+const DWORD kRecordHeaderSize = 8;
+
+// Полезная нагрузка: id (4), timestamp (8), флаги (1), длина URL (4), URL, тело
+const DWORD kPayloadFixedSize = 4 + 8 + 1 + 4;
+
+// consumer.acks переписывается, когда в нем накопилось столько записей и больше половины
+// из них уже покрыты позицией потребителя
+const DWORD kAckCompactMin = 1024;
+
+UINT32 g_crcTable[256];
+bool g_crcTableReady = false;
+
+UINT32 Crc32(const char* data, size_t size) {
+    if (!g_crcTableReady) {
+        for (UINT32 i = 0; i < 256; ++i) {
+            UINT32 c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            g_crcTable[i] = c;
+        }
+        g_crcTableReady = true;
+    }
+
+    UINT32 crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i)
+        crc = g_crcTable[(crc ^ (BYTE)data[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+std::string SegmentFileName(int base_id) {
+    char name[32];
+    sprintf_s(name, sizeof(name), "segment_%010d.log", base_id);
+    return name;
+}
+
+} // namespace
+
+SegmentLogQueue::SegmentLogQueue(const std::string& directory_path, DWORD segment_size_bytes)
+    : directory(directory_path.empty() ? "c:\\gcore\\log" : directory_path),
+    segment_size(segment_size_bytes), is_open(false), next_id(1), committed_id(0),
+    offset_file(INVALID_HANDLE_VALUE), ack_file(INVALID_HANDLE_VALUE), ack_records(0) {
+    InitializeCriticalSection(&cs);
+    is_open = Open();
+}
+
+SegmentLogQueue::~SegmentLogQueue() {
+    Close();
+    DeleteCriticalSection(&cs);
+}
+
+bool SegmentLogQueue::Open() {
+    // Родительский каталог (c:\gcore для пути по умолчанию) и сам каталог журнала
+    size_t separator = directory.find_last_of('\\');
+    if (separator != std::string::npos && separator > 0)
+        CreateDirectoryA(directory.substr(0, separator).c_str(), NULL);
+    CreateDirectoryA(directory.c_str(), NULL);
+
+    if (!LoadOffset() || !LoadAcks()) return false;
+    next_id = committed_id + 1;
+
+    // Имена сегментов содержат base_id с ведущими нулями, поэтому map сразу упорядочен
+    WIN32_FIND_DATAA find_data;
+    HANDLE find = FindFirstFileA((directory + "\\segment_*.log").c_str(), &find_data);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            int base_id = 0;
+            if (sscanf_s(find_data.cFileName, "segment_%d.log", &base_id) != 1) continue;
+
+            Segment segment = {};
+            segment.path = directory + "\\" + find_data.cFileName;
+            segment.file = INVALID_HANDLE_VALUE;
+            segment.base_id = base_id;
+            segment.last_id = base_id - 1;
+            segments[base_id] = segment;
+        } while (FindNextFileA(find, &find_data));
+        FindClose(find);
+    }
+
+    for (std::map<int, Segment>::iterator it = segments.begin(); it != segments.end(); ++it) {
+        if (!MapSegment(it->second)) continue;
+        RecoverSegment(it->second);
+        next_id = std::max(next_id, it->second.last_id + 1);
+        UnmapSegment(it->second);
+    }
+
+    // Подтверждения не по порядку могли закрыть начало очереди: позиция сдвигается сразу
+    AdvanceCommitted();
+    DropConsumedSegments();
+
+    if (segments.empty() || segments.rbegin()->second.last_id + 1 != next_id) {
+        return StartNewSegment();
+    }
+
+    return MapSegment(segments.rbegin()->second);
+}
+
+void SegmentLogQueue::Close() {
+    EnterCriticalSection(&cs);
+    for (std::map<int, Segment>::iterator it = segments.begin(); it != segments.end(); ++it) {
+        UnmapSegment(it->second);
+    }
+    segments.clear();
+    pending.clear();
+
+    if (offset_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(offset_file);
+        offset_file = INVALID_HANDLE_VALUE;
+    }
+    if (ack_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(ack_file);
+        ack_file = INVALID_HANDLE_VALUE;
+    }
+    acked.clear();
+    is_open = false;
+    LeaveCriticalSection(&cs);
+}
+
+bool SegmentLogQueue::MapSegment(Segment& segment) {
+    if (segment.view) return true;
+
+    segment.file = CreateFileA(segment.path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+        NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (segment.file == INVALID_HANDLE_VALUE) return false;
+
+    // Новый файл увеличивается до размера сегмента и заполняется нулями
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(segment.file, &file_size);
+    segment.size = std::max((DWORD)file_size.QuadPart, segment_size);
+
+    segment.mapping = CreateFileMappingA(segment.file, NULL, PAGE_READWRITE, 0, segment.size, NULL);
+    if (segment.mapping) {
+        segment.view = static_cast<char*>(MapViewOfFile(segment.mapping, FILE_MAP_ALL_ACCESS, 0, 0, segment.size));
+    }
+
+    if (!segment.view) {
+        UnmapSegment(segment);
+        return false;
+    }
+
+    return true;
+}
+
+void SegmentLogQueue::UnmapSegment(Segment& segment) {
+    if (segment.view) {
+        UnmapViewOfFile(segment.view);
+        segment.view = nullptr;
+    }
+    if (segment.mapping) {
+        CloseHandle(segment.mapping);
+        segment.mapping = NULL;
+    }
+    if (segment.file != INVALID_HANDLE_VALUE) {
+        CloseHandle(segment.file);
+        segment.file = INVALID_HANDLE_VALUE;
+    }
+}
+
+void SegmentLogQueue::RecoverSegment(Segment& segment) {
+    DWORD offset = 0;
+
+    // Читаем записи до первой пустой или поврежденной
+    while (offset + kRecordHeaderSize + kPayloadFixedSize <= segment.size) {
+        UINT32 length = 0, crc = 0;
+        memcpy(&length, segment.view + offset, sizeof(length));
+        memcpy(&crc, segment.view + offset + 4, sizeof(crc));
+
+        if (length < kPayloadFixedSize || length > segment.size - offset - kRecordHeaderSize) break;
+
+        const char* payload = segment.view + offset + kRecordHeaderSize;
+        if (Crc32(payload, length) != crc) break;
+
+        INT32 id = 0;
+        INT64 timestamp = 0;
+        memcpy(&id, payload, sizeof(id));
+        memcpy(&timestamp, payload + 4, sizeof(timestamp));
+
+        segment.last_id = id;
+        if (id > committed_id && acked.find(id) == acked.end()) {
+            PendingRecord record = { segment.base_id, offset, (time_t)timestamp };
+            pending[id] = record;
+            stats.Add(QUEUE_TABLE_REQUESTS, (time_t)timestamp, 1);
+        }
+
+        offset += kRecordHeaderSize + length;
+    }
+
+    segment.write_pos = offset;
+}
+
+bool SegmentLogQueue::StartNewSegment() {
+    if (!segments.empty()) {
+        // Предыдущий активный сегмент больше не пишется: освобождаем адресное пространство
+        UnmapSegment(segments.rbegin()->second);
+    }
+
+    Segment segment = {};
+    segment.path = directory + "\\" + SegmentFileName(next_id);
+    segment.file = INVALID_HANDLE_VALUE;
+    segment.base_id = next_id;
+    segment.last_id = next_id - 1;
+
+    if (!MapSegment(segment)) return false;
+
+    segments[segment.base_id] = segment;
+    return true;
+}
+
+bool SegmentLogQueue::ReadRecord(const Segment& segment, DWORD offset, QueueItem& item) const {
+    if (!segment.view || offset + kRecordHeaderSize > segment.size) return false;
+
+    UINT32 length = 0;
+    memcpy(&length, segment.view + offset, sizeof(length));
+    if (length < kPayloadFixedSize || length > segment.size - offset - kRecordHeaderSize) return false;
+
+    const char* payload = segment.view + offset + kRecordHeaderSize;
+    INT32 id = 0;
+    INT64 timestamp = 0;
+    UINT32 url_length = 0;
+    memcpy(&id, payload, sizeof(id));
+    memcpy(&timestamp, payload + 4, sizeof(timestamp));
+    memcpy(&url_length, payload + 13, sizeof(url_length));
+    if (url_length > length - kPayloadFixedSize) return false;
+
+    std::string url_utf8(payload + kPayloadFixedSize, url_length);
+
+    item.id = id;
+    item.timestamp = (time_t)timestamp;
+    item.expect_response = payload[12] != 0;
+    item.server_url = Utf8ToWide(url_utf8.c_str());
+    item.json_body.assign(payload + kPayloadFixedSize + url_length, length - kPayloadFixedSize - url_length);
+    return true;
+}
+
+bool SegmentLogQueue::AddToQueue(const std::wstring& server_url, const std::string& json_body, bool expect_response) {
+    EnterCriticalSection(&cs);
+    bool result = AppendRecord(server_url, json_body, expect_response, time(nullptr));
+    LeaveCriticalSection(&cs);
+
+    return result;
+}
+
+int SegmentLogQueue::AddToQueueBatch(const std::vector<QueueItem>& items) {
+    int added = 0;
+
+    EnterCriticalSection(&cs);
+    // Записи после ошибки не добавляются: сохраненной остается начальная часть пачки
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (!AppendRecord(items[i].server_url, items[i].json_body, items[i].expect_response, items[i].timestamp)) break;
+        added++;
+    }
+    LeaveCriticalSection(&cs);
+
+    return added;
+}
+
+int SegmentLogQueue::TryAddToQueueBatch(const std::vector<QueueItem>& items) {
+    int added = 0;
+
+    if (!TryEnterCriticalSection(&cs)) return 0;
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (!AppendRecord(items[i].server_url, items[i].json_body, items[i].expect_response, items[i].timestamp)) break;
+        added++;
+    }
+    LeaveCriticalSection(&cs);
+
+    return added;
+}
+
+bool SegmentLogQueue::AppendRecord(const std::wstring& server_url, const std::string& json_body, bool expect_response, time_t record_time) {
+    std::string url_utf8 = WideToUtf8(server_url.c_str());
+    size_t payload_size = kPayloadFixedSize + url_utf8.size() + json_body.size();
+    if (!is_open || payload_size + kRecordHeaderSize > segment_size) return false;
+
+    Segment* active = &segments.rbegin()->second;
+    if (!active->view || active->write_pos + kRecordHeaderSize + payload_size > active->size) {
+        if (!StartNewSegment()) return false;
+        active = &segments.rbegin()->second;
+    }
+
+    INT32 id = next_id;
+    INT64 timestamp = (INT64)record_time;
+    UINT32 url_length = (UINT32)url_utf8.size();
+    UINT32 length = (UINT32)payload_size;
+
+    char* header = active->view + active->write_pos;
+    char* payload = header + kRecordHeaderSize;
+    memcpy(payload, &id, sizeof(id));
+    memcpy(payload + 4, &timestamp, sizeof(timestamp));
+    payload[12] = expect_response ? 1 : 0;
+    memcpy(payload + 13, &url_length, sizeof(url_length));
+    memcpy(payload + kPayloadFixedSize, url_utf8.data(), url_utf8.size());
+    memcpy(payload + kPayloadFixedSize + url_length, json_body.data(), json_body.size());
+
+    UINT32 crc = Crc32(payload, payload_size);
+    memcpy(header + 4, &crc, sizeof(crc));
+    MemoryBarrier();
+    memcpy(header, &length, sizeof(length));
+
+    PendingRecord record = { active->base_id, active->write_pos, (time_t)timestamp };
+    pending[id] = record;
+    active->write_pos += kRecordHeaderSize + length;
+    active->last_id = id;
+    next_id++;
+
+    stats.Add(QUEUE_TABLE_REQUESTS, (time_t)timestamp, 1);
+    return true;
+}
+
+std::vector<QueueItem> SegmentLogQueue::GetPendingItems(int limit) {
+    // Записи журнала идут по возрастанию id, это и есть порядок постановки
+    return ReadPending(0, limit);
+}
+
+int SegmentLogQueue::GetPendingBatchAfter(QueueBatch& batch, int after_id, int limit) {
+    batch.Clear();
+    std::vector<QueueItem> items = ReadPending(after_id, limit);
+    for (size_t i = 0; i < items.size(); ++i) {
+        batch.Add(items[i]);
+    }
+    return (int)batch.Size();
+}
+
+std::vector<QueueItem> SegmentLogQueue::ReadPending(int after_id, int limit) {
+    std::vector<QueueItem> items;
+
+    EnterCriticalSection(&cs);
+    int active_base = segments.empty() ? 0 : segments.rbegin()->first;
+
+    for (std::map<int, PendingRecord>::const_iterator it = pending.upper_bound(after_id);
+        it != pending.end() && (int)items.size() < limit; ++it) {
+        std::map<int, Segment>::iterator segment = segments.find(it->second.segment);
+        if (segment == segments.end() || !MapSegment(segment->second)) continue;
+
+        QueueItem item;
+        if (ReadRecord(segment->second, it->second.offset, item)) {
+            items.push_back(item);
+        }
+    }
+
+    // Старые сегменты отображаются только на время чтения
+    for (std::map<int, Segment>::iterator it = segments.begin(); it != segments.end(); ++it) {
+        if (it->first != active_base) UnmapSegment(it->second);
+    }
+    LeaveCriticalSection(&cs);
+
+    return items;
+}
+
+bool SegmentLogQueue::RemoveFromQueue(int id) {
+    EnterCriticalSection(&cs);
+    std::map<int, PendingRecord>::iterator it = pending.find(id);
+    bool found = it != pending.end();
+    if (found) {
+        stats.Add(QUEUE_TABLE_REQUESTS, it->second.timestamp, -1);
+        pending.erase(it);
+        CommitRemoved(std::vector<int>(1, id));
+    }
+    LeaveCriticalSection(&cs);
+
+    return found;
+}
+
+int SegmentLogQueue::CleanOldQueueItems(int hours_old) {
+    time_t cutoff_time = time(nullptr) - (hours_old * 3600);
+    std::vector<int> removed;
+
+    EnterCriticalSection(&cs);
+    std::map<int, PendingRecord>::iterator it = pending.begin();
+    while (it != pending.end()) {
+        if (it->second.timestamp < cutoff_time) {
+            stats.Add(QUEUE_TABLE_REQUESTS, it->second.timestamp, -1);
+            removed.push_back(it->first);
+            it = pending.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    if (!removed.empty())
+        CommitRemoved(removed);
+    LeaveCriticalSection(&cs);
+
+    return (int)removed.size();
+}
+
+int SegmentLogQueue::GetOldQueueItemsCount(int hours_old) {
+    time_t cutoff_time = time(nullptr) - (hours_old * 3600);
+
+    // Корзина, в которую попадает cutoff_time, досчитывается по записям в памяти
+    long long boundary = 0;
+    long long count = stats.GetOlderThan(QUEUE_TABLE_REQUESTS, cutoff_time, &boundary);
+    if (boundary == 0) return (int)count;
+
+    time_t bucket_start = (time_t)((long long)cutoff_time / QueueStats::kBucketSeconds * QueueStats::kBucketSeconds);
+    EnterCriticalSection(&cs);
+    for (std::map<int, PendingRecord>::const_iterator it = pending.begin(); it != pending.end(); ++it) {
+        if (it->second.timestamp >= bucket_start && it->second.timestamp < cutoff_time)
+            ++count;
+    }
+    LeaveCriticalSection(&cs);
+
+    return (int)count;
+}
+
+long long SegmentLogQueue::GetQueueDepth() {
+    return stats.GetTotal(QUEUE_TABLE_REQUESTS);
+}
+
+long long SegmentLogQueue::GetQueueAgeHistogram(int* counts, int max_buckets) {
+    return stats.GetAgeHistogram(QUEUE_TABLE_REQUESTS, time(nullptr), counts, max_buckets);
+}
+
+void SegmentLogQueue::AdvanceCommitted() {
+    int committed = pending.empty() ? next_id - 1 : pending.begin()->first - 1;
+    if (committed <= committed_id) return;
+
+    committed_id = committed;
+    SaveOffset();
+    acked.erase(acked.begin(), acked.upper_bound(committed_id));
+
+    // Позиция сохранена раньше, поэтому покрытые ею подтверждения можно удалить из файла
+    if (ack_records >= kAckCompactMin && acked.size() * 2 < ack_records)
+        CompactAcks();
+}
+
+void SegmentLogQueue::CommitRemoved(const std::vector<int>& ids) {
+    AdvanceCommitted();
+
+    // Подтверждения выше позиции потребителя иначе потерялись бы при перезапуске
+    std::vector<int> out_of_order;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (ids[i] > committed_id && acked.insert(ids[i]).second)
+            out_of_order.push_back(ids[i]);
+    }
+    if (!out_of_order.empty())
+        AppendAcks(out_of_order);
+
+    DropConsumedSegments();
+}
+
+void SegmentLogQueue::DropConsumedSegments() {
+    if (segments.empty()) return;
+
+    int active_base = segments.rbegin()->first;
+    std::map<int, Segment>::iterator it = segments.begin();
+
+    // Сегмент удаляется целиком, когда в нем не осталось неподтвержденных записей: запрос,
+    // который не удается отправить, не держит следующие за ним сегменты
+    while (it != segments.end() && it->first != active_base) {
+        const Segment& segment = it->second;
+        std::map<int, PendingRecord>::const_iterator first = pending.lower_bound(segment.base_id);
+        bool consumed = segment.last_id <= committed_id ||
+            (segment.last_id >= segment.base_id && (first == pending.end() || first->first > segment.last_id));
+
+        if (!consumed) {
+            ++it;
+            continue;
+        }
+
+        UnmapSegment(it->second);
+        DeleteFileA(it->second.path.c_str());
+        it = segments.erase(it);
+    }
+}
+
+bool SegmentLogQueue::LoadOffset() {
+    std::string path = directory + "\\consumer.offset";
+    offset_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+        NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (offset_file == INVALID_HANDLE_VALUE) return false;
+
+    INT32 value = 0;
+    DWORD read = 0;
+    if (ReadFile(offset_file, &value, sizeof(value), &read, NULL) && read == sizeof(value)) {
+        committed_id = value;
+    }
+
+    return true;
+}
+
+bool SegmentLogQueue::LoadAcks() {
+    std::string path = directory + "\\consumer.acks";
+    ack_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+        NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (ack_file == INVALID_HANDLE_VALUE) return false;
+
+    // Незавершенная последняя запись (сбой во время дописывания) не учитывается
+    INT32 values[1024];
+    DWORD read = 0;
+    while (ReadFile(ack_file, values, sizeof(values), &read, NULL) && read >= sizeof(INT32)) {
+        DWORD count = read / sizeof(INT32);
+        for (DWORD i = 0; i < count; ++i) {
+            if (values[i] > committed_id) acked.insert(values[i]);
+        }
+        ack_records += count;
+        if (read % sizeof(INT32) != 0) break;
+    }
+
+    return true;
+}
+
+bool SegmentLogQueue::AppendAcks(const std::vector<int>& ids) {
+    if (ack_file == INVALID_HANDLE_VALUE) return false;
+
+    // Запись выравнивается по размеру id: хвост от прерванной записи перезаписывается
+    LARGE_INTEGER position = {};
+    position.QuadPart = (LONGLONG)ack_records * sizeof(INT32);
+    DWORD size = (DWORD)(ids.size() * sizeof(INT32));
+    DWORD written = 0;
+
+    std::vector<INT32> values(ids.begin(), ids.end());
+    bool result = SetFilePointerEx(ack_file, position, NULL, FILE_BEGIN) &&
+        WriteFile(ack_file, values.data(), size, &written, NULL) && written == size;
+    if (result) ack_records += (DWORD)ids.size();
+    return result;
+}
+
+void SegmentLogQueue::CompactAcks() {
+    if (ack_file == INVALID_HANDLE_VALUE) return;
+
+    // Сбой посреди перезаписи оставляет в файле только действительные подтверждения:
+    // новые записи ложатся поверх старых, а старые либо покрыты позицией, либо еще нужны
+    std::vector<INT32> values(acked.begin(), acked.end());
+    DWORD size = (DWORD)(values.size() * sizeof(INT32));
+    DWORD written = 0;
+    LARGE_INTEGER zero = {};
+
+    if (SetFilePointerEx(ack_file, zero, NULL, FILE_BEGIN) &&
+        (size == 0 || (WriteFile(ack_file, values.data(), size, &written, NULL) && written == size)) &&
+        SetEndOfFile(ack_file)) {
+        ack_records = (DWORD)values.size();
+    }
+}
+
+bool SegmentLogQueue::SaveOffset() {
+    if (offset_file == INVALID_HANDLE_VALUE) return false;
+
+    // 4 байта в начале файла перезаписываются атомарно в пределах сектора
+    LARGE_INTEGER zero = {};
+    INT32 value = committed_id;
+    DWORD written = 0;
+
+    return SetFilePointerEx(offset_file, zero, NULL, FILE_BEGIN) &&
+        WriteFile(offset_file, &value, sizeof(value), &written, NULL) && written == sizeof(value);
+}
@@ -0,0 +1,119 @@
+﻿#pragma once
+#ifndef SEGMENT_LOG_QUEUE_H
+#define SEGMENT_LOG_QUEUE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <windows.h>
+#include "QueueStorage.h"
+#include "QueueStats.h"
+
+/**
+ * @class SegmentLogQueue
+ * @brief Очередь запросов в виде журнала из сегментов, отображаемых в память
+ * @details Запросы дописываются в конец текущего сегмента записями с CRC32.
+ *          Подтвержденные запросы не удаляются по одному: позиция потребителя
+ *          (максимальный id, до которого все подтверждено) сохраняется в файл
+ *          consumer.offset, а подтверждения не по порядку (id выше позиции) -
+ *          дописываются в consumer.acks и учитываются при восстановлении. Сегмент
+ *          удаляется целиком, когда в нем не осталось неподтвержденных записей.
+ *          После сбоя журнал читается до первой поврежденной записи.
+ */
+class SegmentLogQueue : public QueueStorage {
+public:
+    static const DWORD kDefaultSegmentSize = 4 * 1024 * 1024; ///< Размер сегмента по умолчанию
+
+    /**
+     * @brief Открывает или создает журнал
+     * @param directory Каталог сегментов (по умолчанию c:\gcore\log)
+     * @param segment_size Размер одного сегмента в байтах
+     */
+    SegmentLogQueue(const std::string& directory = "", DWORD segment_size = kDefaultSegmentSize);
+
+    /**
+     * @brief Закрывает сегменты и файл позиции потребителя
+     */
+    ~SegmentLogQueue();
+
+    /**
+     * @brief Проверяет, удалось ли открыть журнал
+     */
+    bool IsOpen() const { return is_open; }
+
+    /**
+     * @brief Как AddToQueueBatch, но не ждет, если журнал занят другим потоком
+     * @return Количество сохраненных запросов (0, если журнал занят)
+     * @details Для отключения DLL: блокировку мог оставить поток, завершенный
+     *          вместе с процессом
+     */
+    int TryAddToQueueBatch(const std::vector<QueueItem>& items);
+
+    bool AddToQueue(const std::wstring& server_url, const std::string& json_body, bool expect_response) override;
+    int AddToQueueBatch(const std::vector<QueueItem>& items) override;
+    std::vector<QueueItem> GetPendingItems(int limit = 100) override;
+    int GetPendingBatchAfter(QueueBatch& batch, int after_id, int limit) override;
+    bool RemoveFromQueue(int id) override;
+    int CleanOldQueueItems(int hours_old) override;
+    int GetOldQueueItemsCount(int hours_old) override;
+    long long GetQueueDepth() override;
+    long long GetQueueAgeHistogram(int* counts, int max_buckets) override;
+
+private:
+    /// Сегмент журнала: файл фиксированного размера, заполняемый с начала
+    struct Segment {
+        std::string path;
+        HANDLE file;
+        HANDLE mapping;
+        char* view;                 ///< nullptr, если сегмент сейчас не отображен
+        DWORD size;                 ///< Размер файла сегмента
+        DWORD write_pos;            ///< Смещение первого свободного байта
+        int base_id;                ///< id, с которого начинается сегмент (входит в имя файла)
+        int last_id;                ///< id последней записи (base_id - 1, если сегмент пуст)
+    };
+
+    /// Положение неподтвержденной записи в журнале
+    struct PendingRecord {
+        int segment;                ///< base_id сегмента
+        DWORD offset;               ///< Смещение заголовка записи
+        time_t timestamp;
+    };
+
+    CRITICAL_SECTION cs;
+    std::string directory;
+    DWORD segment_size;
+    bool is_open;
+    std::map<int, Segment> segments;            ///< Сегменты по base_id, последний - активный
+    std::map<int, PendingRecord> pending;       ///< Неподтвержденные записи по id
+    int next_id;
+    int committed_id;                           ///< Все записи с id <= committed_id подтверждены
+    HANDLE offset_file;                         ///< Открытый файл consumer.offset
+    std::set<int> acked;                        ///< Подтвержденные записи с id > committed_id
+    HANDLE ack_file;                            ///< Открытый файл consumer.acks
+    DWORD ack_records;                          ///< Записей в consumer.acks, включая устаревшие
+    QueueStats stats;
+
+    bool Open();
+    void Close();
+    bool MapSegment(Segment& segment);
+    void UnmapSegment(Segment& segment);
+    void RecoverSegment(Segment& segment);
+    bool StartNewSegment();
+    bool AppendRecord(const std::wstring& server_url, const std::string& json_body, bool expect_response, time_t record_time);
+    bool ReadRecord(const Segment& segment, DWORD offset, QueueItem& item) const;
+    std::vector<QueueItem> ReadPending(int after_id, int limit);
+    void AdvanceCommitted();
+    void CommitRemoved(const std::vector<int>& ids);
+    void DropConsumedSegments();
+    bool SaveOffset();
+    bool LoadOffset();
+    bool LoadAcks();
+    bool AppendAcks(const std::vector<int>& ids);
+    void CompactAcks();
+
+    SegmentLogQueue(const SegmentLogQueue&);
+    SegmentLogQueue& operator=(const SegmentLogQueue&);
+};
+
+#endif
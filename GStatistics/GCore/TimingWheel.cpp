@@ -0,0 +1,207 @@
+﻿#include "TimingWheel.h"
+#include <algorithm>
+#include <climits>
+
+namespace {
+    // Разница между эпохой FILETIME (1601) и эпохой Unix в интервалах по 100 нс
+    const long long kUnixEpochFileTime = 116444736000000000LL;
+
+    long long ToTick(long long ms) {
+        // Округление вверх: срок не наступает раньше заданного времени
+        return (ms + TimingWheel::kTickMs - 1) / TimingWheel::kTickMs;
+    }
+}
+
+TimingWheel::TimingWheel() : wake_event(NULL), count(0), expired(0), loaded(0) {
+    InitializeCriticalSection(&cs);
+    for (int level = 0; level < kLevels; ++level)
+        occupied[level] = 0;
+    current_tick = NowMs() / kTickMs;
+}
+
+TimingWheel::~TimingWheel() {
+    DeleteCriticalSection(&cs);
+}
+
+long long TimingWheel::NowMs() {
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    ULARGE_INTEGER value;
+    value.LowPart = ft.dwLowDateTime;
+    value.HighPart = ft.dwHighDateTime;
+    return ((long long)value.QuadPart - kUnixEpochFileTime) / 10000;
+}
+
+void TimingWheel::SetWakeEvent(HANDLE event) {
+    EnterCriticalSection(&cs);
+    wake_event = event;
+    LeaveCriticalSection(&cs);
+}
+
+void TimingWheel::Insert(const Entry& entry, long long first_tick) {
+    long long due = std::max(entry.due_tick, first_tick);
+    long long delta = due - current_tick;
+
+    int level = 0;
+    while (level < kLevels - 1 && delta >= (1LL << (kSlotBits * (level + 1))))
+        level++;
+
+    // Сроки дальше последнего уровня ждут в его последней ячейке и раскладываются заново при обороте
+    long long slot_tick = std::min(due, current_tick + (1LL << (kSlotBits * kLevels)) - 1);
+    int index = (int)((slot_tick >> (kSlotBits * level)) & (kSlots - 1));
+
+    slots[level][index].push_back(entry);
+    occupied[level] |= 1ULL << index;
+}
+
+void TimingWheel::Cascade(int level) {
+    int index = (int)((current_tick >> (kSlotBits * level)) & (kSlots - 1));
+    if (!(occupied[level] & (1ULL << index)))
+        return;
+
+    std::vector<Entry> entries;
+    entries.swap(slots[level][index]);
+    occupied[level] &= ~(1ULL << index);
+
+    // Срок на текущем шаге попадает в ячейку нижнего уровня, которую Tick разбирает следом
+    for (size_t i = 0; i < entries.size(); ++i)
+        Insert(entries[i], current_tick);
+}
+
+int TimingWheel::Tick() {
+    ++current_tick;
+
+    // Оборот уровня: ячейка следующего уровня раскладывается по нижним
+    for (int level = 1; level < kLevels; ++level) {
+        if (current_tick & ((1LL << (kSlotBits * level)) - 1))
+            break;
+        Cascade(level);
+    }
+
+    int index = (int)(current_tick & (kSlots - 1));
+    if (!(occupied[0] & (1ULL << index)))
+        return 0;
+
+    std::vector<Entry> entries;
+    entries.swap(slots[0][index]);
+    occupied[0] &= ~(1ULL << index);
+
+    int fired = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].due_tick <= current_tick)
+            fired++;
+        else
+            Insert(entries[i], current_tick + 1);
+    }
+
+    count -= fired;
+    expired += fired;
+    return fired;
+}
+
+void TimingWheel::Schedule(int id, long long due_ms) {
+    Entry entry = { id, ToTick(due_ms) };
+
+    EnterCriticalSection(&cs);
+    long long next = NextDueTick();
+    // Прошедший срок наступает на следующем шаге
+    Insert(entry, current_tick + 1);
+    count++;
+
+    // Обработчик спит до прежнего ближайшего срока: будим, если новый срок раньше
+    if (wake_event && (next < 0 || std::max(entry.due_tick, current_tick + 1) < next))
+        SetEvent(wake_event);
+    LeaveCriticalSection(&cs);
+}
+
+void TimingWheel::Load(const std::vector<std::pair<int, long long>>& items) {
+    EnterCriticalSection(&cs);
+    for (int level = 0; level < kLevels; ++level) {
+        for (int index = 0; index < kSlots; ++index)
+            std::vector<Entry>().swap(slots[level][index]);
+        occupied[level] = 0;
+    }
+    current_tick = NowMs() / kTickMs;
+
+    for (size_t i = 0; i < items.size(); ++i) {
+        Entry entry = { items[i].first, ToTick(items[i].second) };
+        Insert(entry, current_tick + 1);
+    }
+    count = (long long)items.size();
+    loaded = count;
+
+    if (wake_event)
+        SetEvent(wake_event);
+    LeaveCriticalSection(&cs);
+}
+
+int TimingWheel::Advance(long long now_ms) {
+    long long target = now_ms / kTickMs;
+    int fired = 0;
+
+    EnterCriticalSection(&cs);
+    while (current_tick < target) {
+        if (count == 0) {
+            current_tick = target;
+            break;
+        }
+
+        // Нижний уровень пуст: до его оборота разбирать нечего
+        long long wrap = current_tick | (kSlots - 1);
+        if (occupied[0] == 0 && wrap > current_tick) {
+            current_tick = std::min(target, wrap);
+            continue;
+        }
+
+        fired += Tick();
+    }
+    LeaveCriticalSection(&cs);
+
+    return fired;
+}
+
+long long TimingWheel::NextDueTick() const {
+    if (count == 0)
+        return -1;
+
+    // Для верхних уровней - шаг, на котором ячейка будет разложена по нижним:
+    // он не позже сроков ее запросов. Поиск по 64 битам маски уровня
+    long long best = LLONG_MAX;
+    for (int level = 0; level < kLevels; ++level) {
+        if (!occupied[level])
+            continue;
+
+        int shift = kSlotBits * level;
+        long long base = current_tick >> shift;
+        int start = (int)(base & (kSlots - 1));
+        for (int n = 1; n <= kSlots; ++n) {
+            if (occupied[level] & (1ULL << ((start + n) & (kSlots - 1)))) {
+                best = std::min(best, (base + n) << shift);
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+DWORD TimingWheel::GetWaitMs(long long now_ms, DWORD max_wait_ms) const {
+    EnterCriticalSection(&cs);
+    long long next = NextDueTick();
+    LeaveCriticalSection(&cs);
+
+    if (next < 0)
+        return max_wait_ms;
+
+    long long wait = next * kTickMs - now_ms;
+    return (DWORD)std::max(0LL, std::min(wait, (long long)max_wait_ms));
+}
+
+void TimingWheel::GetStats(TimingWheelStats& stats) const {
+    EnterCriticalSection(&cs);
+    long long next = NextDueTick();
+    stats.scheduled = count;
+    stats.next_due_ms = next < 0 ? -1 : next * kTickMs;
+    stats.expired = expired;
+    stats.loaded = loaded;
+    LeaveCriticalSection(&cs);
+}
@@ -0,0 +1,116 @@
+﻿#pragma once
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+#include <vector>
+#include <windows.h>
+
+/**
+ * @file TimingWheel.h
+ * @brief Расписание отложенных запросов очереди в памяти
+ */
+
+/**
+ * @struct TimingWheelStats
+ * @brief Состояние расписания
+ */
+struct TimingWheelStats {
+    long long scheduled;            ///< Запросов в расписании
+    long long next_due_ms;          ///< Ближайший срок (мс от начала эпохи Unix), -1 - расписание пусто
+    long long expired;              ///< Сроков наступило с запуска
+    long long loaded;               ///< Загружено из базы при последнем восстановлении
+};
+
+/**
+ * @class TimingWheel
+ * @brief Иерархическое колесо таймеров по времени следующей попытки
+ * @details Четыре уровня по 64 ячейки: ячейка нижнего уровня - один шаг (10 мс),
+ *          ячейка следующего уровня - 64 ячейки предыдущего, всего около 46 часов;
+ *          более поздние сроки ждут в последней ячейке. Добавление кладет запрос
+ *          в ячейку по его сроку, продвижение на шаг разбирает одну ячейку нижнего
+ *          уровня, а при обороте уровня раскладывает ячейку следующего уровня по
+ *          нижним. Занятые ячейки отмечены в битовой маске уровня, поэтому
+ *          ближайший срок находится без обхода запросов.
+ *
+ *          Колесо только будит обработчики: запрос, удаленный из очереди до
+ *          своего срока, из колеса не удаляется, и его срок дает один лишний
+ *          проход по очереди.
+ */
+class TimingWheel {
+public:
+    static const int kSlotBits = 6;
+    static const int kSlots = 1 << kSlotBits;
+    static const int kLevels = 4;
+    static const int kTickMs = 10;
+
+    TimingWheel();
+    ~TimingWheel();
+
+    /**
+     * @brief Задает событие, которое устанавливается, когда новый срок раньше прежнего ближайшего
+     * @param event Событие (NULL - не сигнализировать)
+     */
+    void SetWakeEvent(HANDLE event);
+
+    /**
+     * @brief Добавляет запрос в расписание
+     * @param id Идентификатор запроса
+     * @param due_ms Срок, мс от начала эпохи Unix (прошедший срок наступает при следующем Advance)
+     */
+    void Schedule(int id, long long due_ms);
+
+    /**
+     * @brief Заменяет расписание запросами из базы
+     * @param items Пары (идентификатор, срок в мс)
+     */
+    void Load(const std::vector<std::pair<int, long long>>& items);
+
+    /**
+     * @brief Продвигает колесо до текущего времени
+     * @return Количество наступивших сроков
+     */
+    int Advance(long long now_ms);
+
+    /**
+     * @brief Сколько ждать до ближайшего срока
+     * @param now_ms Текущее время, мс
+     * @param max_wait_ms Ожидание при пустом расписании и верхняя граница
+     * @details Для сроков на верхних уровнях возвращает время до оборота нижнего
+     *          уровня: после Advance срок уточняется
+     */
+    DWORD GetWaitMs(long long now_ms, DWORD max_wait_ms) const;
+
+    void GetStats(TimingWheelStats& stats) const;
+
+    /**
+     * @brief Текущее время, мс от начала эпохи Unix
+     */
+    static long long NowMs();
+
+private:
+    struct Entry {
+        int id;
+        long long due_tick;
+    };
+
+    mutable CRITICAL_SECTION cs;
+    HANDLE wake_event;
+
+    std::vector<Entry> slots[kLevels][kSlots];
+    unsigned long long occupied[kLevels];   ///< Бит ячейки - в ней есть запросы
+    long long current_tick;                 ///< Последний разобранный шаг
+    long long count;
+    long long expired;
+    long long loaded;
+
+    // Вызываются под cs
+    void Insert(const Entry& entry, long long first_tick);
+    void Cascade(int level);
+    int Tick();
+    long long NextDueTick() const;
+
+    TimingWheel(const TimingWheel&);
+    TimingWheel& operator=(const TimingWheel&);
+};
+
+#endif
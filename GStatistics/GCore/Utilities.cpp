@@ -1,9 +1,121 @@
 ﻿#include "Utilities.h"
 #include <winhttp.h>
+#include <set>
 #include <vector>
 
 #pragma comment(lib, "winhttp.lib")
 
+// Запросы, которые сейчас отправляются. Запрос закрывает только поток-владелец:
+// после закрытия из другого потока владелец продолжал бы вызывать WinHTTP с
+// закрытым описателем, значение которого уже может принадлежать другому запросу.
+// Отмена сокращает таймауты запроса, и его следующая операция завершается ошибкой;
+// описатель жив, пока запрос в списке, так как владелец удаляет его до закрытия
+namespace {
+    const int kCancelledTimeoutMs = 1;
+
+    struct ActiveRequests {
+        CRITICAL_SECTION cs;
+        std::set<HINTERNET> requests;
+        bool cancelled;
+        long generation;    ///< Увеличивается при каждой отмене
+
+        ActiveRequests() : cancelled(false), generation(0) { InitializeCriticalSection(&cs); }
+        ~ActiveRequests() { DeleteCriticalSection(&cs); }
+    };
+
+    ActiveRequests g_active;
+}
+
+// false, если отправка отменена: запрос закрыт и отправлять его нельзя.
+// generation - номер отмены, по которому ReleaseRequest узнает о прерывании,
+// даже если к концу запроса отправку уже снова разрешили
+static bool RegisterRequest(HINTERNET hRequest, long& generation)
+{
+    EnterCriticalSection(&g_active.cs);
+    bool allowed = !g_active.cancelled;
+    if (allowed) g_active.requests.insert(hRequest);
+    generation = g_active.generation;
+    LeaveCriticalSection(&g_active.cs);
+
+    if (!allowed) WinHttpCloseHandle(hRequest);
+    return allowed;
+}
+
+// Удаляет запрос из списка и закрывает его; false, если запрос был прерван:
+// ответ, полученный после отмены, не считается доставкой
+static bool ReleaseRequest(HINTERNET hRequest, long generation)
+{
+    EnterCriticalSection(&g_active.cs);
+    g_active.requests.erase(hRequest);
+    bool completed = g_active.generation == generation;
+    LeaveCriticalSection(&g_active.cs);
+
+    WinHttpCloseHandle(hRequest);
+    return completed;
+}
+
+int CancelHttpRequests(bool cancelled)
+{
+    EnterCriticalSection(&g_active.cs);
+    g_active.cancelled = cancelled;
+    int interrupted = 0;
+    if (cancelled) {
+        g_active.generation++;
+        for (std::set<HINTERNET>::iterator it = g_active.requests.begin(); it != g_active.requests.end(); ++it)
+            WinHttpSetTimeouts(*it, kCancelledTimeoutMs, kCancelledTimeoutMs, kCancelledTimeoutMs, kCancelledTimeoutMs);
+        interrupted = (int)g_active.requests.size();
+    }
+    LeaveCriticalSection(&g_active.cs);
+    return interrupted;
+}
+
+namespace {
+    struct ModuleThreadStart {
+        LPTHREAD_START_ROUTINE proc;
+        LPVOID param;
+        HMODULE module;     ///< Ссылка на модуль, взятая при запуске потока (NULL - не взята)
+    };
+
+    DWORD WINAPI ModuleThreadProc(LPVOID lpParam)
+    {
+        ModuleThreadStart start = *static_cast<ModuleThreadStart*>(lpParam);
+        delete static_cast<ModuleThreadStart*>(lpParam);
+
+        DWORD result = start.proc(start.param);
+        // Последняя ссылка выгружает DLL: возвращаться в ее код после FreeLibrary нельзя
+        if (start.module)
+            FreeLibraryAndExitThread(start.module, result);
+        return result;
+    }
+}
+
+HANDLE CreateModuleThread(LPTHREAD_START_ROUTINE proc, LPVOID param, DWORD flags, DWORD* threadId)
+{
+    ModuleThreadStart* start = new ModuleThreadStart();
+    start->proc = proc;
+    start->param = param;
+    // Модуль, содержащий этот код: GCore.dll, а в тестере - сам exe
+    if (!GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS,
+                            reinterpret_cast<LPCWSTR>(&ModuleThreadProc), &start->module))
+        start->module = NULL;
+
+    HANDLE thread = CreateThread(NULL, 0, ModuleThreadProc, start, flags, threadId);
+    if (!thread) {
+        if (start->module)
+            FreeLibrary(start->module);
+        delete start;
+    }
+    return thread;
+}
+
+int GetActiveHttpRequestCount()
+{
+    EnterCriticalSection(&g_active.cs);
+    int count = (int)g_active.requests.size();
+    LeaveCriticalSection(&g_active.cs);
+    return count;
+}
+
 // Конвертация UTF-16 → UTF-8
 std::string WideToUtf8(const wchar_t* wstr)
 {
@@ -27,8 +139,16 @@ std::wstring Utf8ToWide(const char* str)
 }
 
 // Внутренний POST через WinHTTP
-int SendRequestInternal(const std::wstring& serverUrl, const std::string& jsonBody)
+int SendRequestInternal(const std::wstring& serverUrl, const std::string& jsonBody, DWORD* statusCodeOut)
+{
+    return SendRequestInternal(serverUrl, jsonBody.data(), jsonBody.size(), statusCodeOut);
+}
+
+int SendRequestInternal(const std::wstring& serverUrl, const char* jsonBody, size_t jsonSize, DWORD* statusCodeOut,
+                        const wchar_t* contentType)
 {
+    if (statusCodeOut) *statusCodeOut = 0;
+
     URL_COMPONENTS urlComp{};
     urlComp.dwStructSize = sizeof(urlComp);
 
@@ -51,30 +171,41 @@ int SendRequestInternal(const std::wstring& serverUrl, const std::string& jsonBo
 
     HINTERNET hRequest = WinHttpOpenRequest(hConnect, L"POST", urlComp.lpszUrlPath, NULL, NULL, NULL, flags);
     if (!hRequest) { WinHttpCloseHandle(hConnect); WinHttpCloseHandle(hSession); return 1; }
+    long generation = 0;
+    if (!RegisterRequest(hRequest, generation)) { WinHttpCloseHandle(hConnect); WinHttpCloseHandle(hSession); return 1; }
 
-    LPCWSTR headers = L"Content-Type: application/json\r\n";
+    std::wstring headers = std::wstring(L"Content-Type: ") + (contentType ? contentType : L"application/json") + L"\r\n";
 
-    BOOL sent = WinHttpSendRequest(hRequest, headers, -1,
-        (LPVOID)jsonBody.c_str(), (DWORD)jsonBody.size(), (DWORD)jsonBody.size(), 0);
+    BOOL sent = WinHttpSendRequest(hRequest, headers.c_str(), -1,
+        (LPVOID)jsonBody, (DWORD)jsonSize, (DWORD)jsonSize, 0);
 
     if (!sent || !WinHttpReceiveResponse(hRequest, NULL)) {
-        WinHttpCloseHandle(hRequest); WinHttpCloseHandle(hConnect); WinHttpCloseHandle(hSession);
+        ReleaseRequest(hRequest, generation); WinHttpCloseHandle(hConnect); WinHttpCloseHandle(hSession);
         return 1;
     }
 
     DWORD statusCode = 0;
     DWORD size = sizeof(statusCode);
     WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER, NULL, &statusCode, &size, NULL);
+    if (statusCodeOut) *statusCodeOut = statusCode;
 
-    WinHttpCloseHandle(hRequest);
+    bool completed = ReleaseRequest(hRequest, generation);
     WinHttpCloseHandle(hConnect);
     WinHttpCloseHandle(hSession);
 
-    return (statusCode == 200) ? 0 : 1;
+    return (completed && statusCode == 200) ? 0 : 1;
+}
+
+std::string SendRequestInternalResponse(const std::wstring& serverUrl, const std::string& jsonBody, DWORD* statusCodeOut)
+{
+    return SendRequestInternalResponse(serverUrl, jsonBody.data(), jsonBody.size(), statusCodeOut);
 }
 
-std::string SendRequestInternalResponse(const std::wstring& serverUrl, const std::string& jsonBody)
+std::string SendRequestInternalResponse(const std::wstring& serverUrl, const char* jsonBody, size_t jsonSize, DWORD* statusCodeOut,
+                                       const wchar_t* contentType)
 {
+    if (statusCodeOut) *statusCodeOut = 0;
+
     URL_COMPONENTS urlComp{};
     urlComp.dwStructSize = sizeof(urlComp);
 
@@ -97,25 +228,28 @@ std::string SendRequestInternalResponse(const std::wstring& serverUrl, const std
 
     HINTERNET hRequest = WinHttpOpenRequest(hConnect, L"POST", urlComp.lpszUrlPath, NULL, NULL, NULL, flags);
     if (!hRequest) { WinHttpCloseHandle(hConnect); WinHttpCloseHandle(hSession); return "ERROR: Failed to create request"; }
+    long generation = 0;
+    if (!RegisterRequest(hRequest, generation)) { WinHttpCloseHandle(hConnect); WinHttpCloseHandle(hSession); return "ERROR: Request cancelled"; }
 
-    LPCWSTR headers = L"Content-Type: application/json\r\n";
+    std::wstring headers = std::wstring(L"Content-Type: ") + (contentType ? contentType : L"application/json") + L"\r\n";
 
-    BOOL sent = WinHttpSendRequest(hRequest, headers, -1,
-        (LPVOID)jsonBody.c_str(), (DWORD)jsonBody.size(), (DWORD)jsonBody.size(), 0);
+    BOOL sent = WinHttpSendRequest(hRequest, headers.c_str(), -1,
+        (LPVOID)jsonBody, (DWORD)jsonSize, (DWORD)jsonSize, 0);
 
     if (!sent) {
-        WinHttpCloseHandle(hRequest); WinHttpCloseHandle(hConnect); WinHttpCloseHandle(hSession);
+        ReleaseRequest(hRequest, generation); WinHttpCloseHandle(hConnect); WinHttpCloseHandle(hSession);
         return "ERROR: Failed to send request";
     }
 
     if (!WinHttpReceiveResponse(hRequest, NULL)) {
-        WinHttpCloseHandle(hRequest); WinHttpCloseHandle(hConnect); WinHttpCloseHandle(hSession);
+        ReleaseRequest(hRequest, generation); WinHttpCloseHandle(hConnect); WinHttpCloseHandle(hSession);
         return "ERROR: Failed to receive response";
     }
 
     DWORD statusCode = 0;
     DWORD size = sizeof(statusCode);
     WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER, NULL, &statusCode, &size, NULL);
+    if (statusCodeOut) *statusCodeOut = statusCode;
 
     std::string response;
     DWORD bytesAvailable = 0;
@@ -142,10 +276,14 @@ std::string SendRequestInternalResponse(const std::wstring& serverUrl, const std
 
     } while (bytesAvailable > 0);
 
-    WinHttpCloseHandle(hRequest);
+    bool completed = ReleaseRequest(hRequest, generation);
     WinHttpCloseHandle(hConnect);
     WinHttpCloseHandle(hSession);
 
+    if (!completed) {
+        return "ERROR: Request cancelled";
+    }
+
     if (statusCode != 200) {
         return "ERROR: HTTP " + std::to_string(statusCode) + " - " + response;
     }
@@ -28,16 +28,60 @@ std::wstring Utf8ToWide(const char* str);
  * @brief Отправляет HTTP POST запрос (внутренняя реализация)
  * @param serverUrl URL сервера в UTF-16
  * @param jsonBody Тело запроса в UTF-8
+ * @param statusCode Если не NULL, получает HTTP статус (0, если ответ не получен)
  * @return 0 при успехе, 1 при ошибке
  */
-int SendRequestInternal(const std::wstring& serverUrl, const std::string& jsonBody);
+int SendRequestInternal(const std::wstring& serverUrl, const std::string& jsonBody, DWORD* statusCode = NULL);
 
 /**
  * @brief Отправляет HTTP POST запрос и возвращает ответ (внутренняя реализация)
  * @param serverUrl URL сервера в UTF-16
  * @param jsonBody Тело запроса в UTF-8
+ * @param statusCode Если не NULL, получает HTTP статус (0, если ответ не получен)
  * @return Ответ сервера в UTF-8 или сообщение об ошибке
  */
-std::string SendRequestInternalResponse(const std::wstring& serverUrl, const std::string& jsonBody);
+std::string SendRequestInternalResponse(const std::wstring& serverUrl, const std::string& jsonBody, DWORD* statusCode = NULL);
+
+/**
+ * @brief То же, что SendRequestInternal, для тела без копирования в std::string
+ * @param serverUrl URL сервера в UTF-16
+ * @param jsonBody Тело запроса в UTF-8
+ * @param jsonSize Длина тела в байтах
+ * @param statusCode Если не NULL, получает HTTP статус (0, если ответ не получен)
+ * @param contentType Тип тела (NULL - application/json)
+ * @return 0 при успехе, 1 при ошибке
+ */
+int SendRequestInternal(const std::wstring& serverUrl, const char* jsonBody, size_t jsonSize, DWORD* statusCode = NULL,
+                        const wchar_t* contentType = NULL);
+
+/**
+ * @brief То же, что SendRequestInternalResponse, для тела без копирования в std::string
+ */
+std::string SendRequestInternalResponse(const std::wstring& serverUrl, const char* jsonBody, size_t jsonSize, DWORD* statusCode = NULL,
+                                       const wchar_t* contentType = NULL);
+
+/**
+ * @brief Прерывает отправляемые запросы и запрещает новые
+ * @param cancelled true - сократить таймауты запросов в полете до 1 мс, новые отправки
+ *                  сразу завершаются ошибкой; false - снова разрешить отправку
+ * @return Количество прерванных запросов
+ * @details Запросы закрывают потоки, которые их отправляют. Следующая операция
+ *          прерванного запроса завершается ошибкой; операция, которая уже ждет
+ *          сервер, может дождаться своего прежнего таймаута
+ */
+int CancelHttpRequests(bool cancelled);
+
+/**
+ * @brief Количество запросов, которые сейчас отправляются
+ */
+int GetActiveHttpRequestCount();
+
+/**
+ * @brief Запускает поток, который держит ссылку на модуль библиотеки
+ * @details Параметры - как у CreateThread. Ссылка берется до создания потока и
+ *          освобождается FreeLibraryAndExitThread при его выходе, поэтому
+ *          FreeLibrary выгружает DLL только после завершения всех ее потоков
+ */
+HANDLE CreateModuleThread(LPTHREAD_START_ROUTINE proc, LPVOID param, DWORD flags, DWORD* threadId);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,293 @@
+﻿#include "WorkStealingPool.h"
+#include "Utilities.h"
+#include <algorithm>
+#include <memory>
+
+namespace {
+    // Общее состояние одного вызова ParallelFor. Живет, пока его держит хотя бы одна
+    // задача: задача, начавшая работу после завершения вызова, только проверяет next
+    struct ParallelState {
+        volatile LONG next;
+        volatile LONG remaining;
+        LONG chunks;
+        size_t count;
+        size_t grain;
+        const WorkStealingPool::IndexTask* body;
+        HANDLE done;
+
+        ParallelState() : next(0), remaining(0), chunks(0), count(0), grain(1), body(NULL), done(NULL) {}
+        ~ParallelState() { if (done) CloseHandle(done); }
+    };
+
+    // Обрабатывает порции, пока они есть; возвращает количество обработанных порций
+    long long RunChunks(ParallelState& state) {
+        long long processed = 0;
+        for (;;) {
+            LONG chunk = InterlockedIncrement(&state.next) - 1;
+            if (chunk >= state.chunks) break;
+
+            size_t first = (size_t)chunk * state.grain;
+            size_t last = std::min(state.count, first + state.grain);
+            for (size_t i = first; i < last; ++i)
+                (*state.body)(i);
+
+            processed++;
+            if (InterlockedDecrement(&state.remaining) == 0 && state.done)
+                SetEvent(state.done);
+        }
+        return processed;
+    }
+}
+
+WorkStealingPool::WorkStealingPool()
+    : queued(0), stopping(false), suspended(0), start_threads(0), start_affinity(0), start_priority(THREAD_PRIORITY_NORMAL),
+      submitted(0), executed(0), stolen(0), inline_executed(0) {
+    InitializeCriticalSection(&cs);
+    InitializeCriticalSection(&start_cs);
+    InitializeConditionVariable(&work_cv);
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    Stop();
+    DeleteCriticalSection(&start_cs);
+    DeleteCriticalSection(&cs);
+}
+
+int WorkStealingPool::DefaultThreadCount() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return std::max(1, std::min((int)info.dwNumberOfProcessors - 1, (int)kMaxThreads));
+}
+
+bool WorkStealingPool::Start(int threads, DWORD_PTR affinity_mask, int priority) {
+    start_threads = threads;
+    start_affinity = affinity_mask;
+    start_priority = priority;
+    suspended = 0;
+
+    threads = threads > 0 ? std::min(threads, (int)kMaxThreads) : DefaultThreadCount();
+
+    // Маска ограничивается процессорами, доступными процессу
+    DWORD_PTR process_mask = 0, system_mask = 0;
+    if (affinity_mask && GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+        affinity_mask &= process_mask;
+
+    EnterCriticalSection(&start_cs);
+    Stop();
+
+    // Потоки создаются приостановленными: приоритет и маска задаются до первой задачи,
+    // а список потоков заполнен до того, как потоки начнут похищать задачи друг у друга
+    std::vector<Worker*> created;
+    for (int i = 0; i < threads; ++i) {
+        Worker* worker = new Worker();
+        worker->pool = this;
+        InitializeCriticalSection(&worker->cs);
+        worker->thread = CreateModuleThread(ThreadProc, worker, CREATE_SUSPENDED, &worker->thread_id);
+        if (!worker->thread) {
+            DeleteCriticalSection(&worker->cs);
+            delete worker;
+            break;
+        }
+
+        SetThreadPriority(worker->thread, priority);
+        if (affinity_mask)
+            SetThreadAffinityMask(worker->thread, affinity_mask);
+        created.push_back(worker);
+    }
+
+    EnterCriticalSection(&cs);
+    workers = created;
+    stopping = false;
+    LeaveCriticalSection(&cs);
+
+    for (size_t i = 0; i < created.size(); ++i)
+        ResumeThread(created[i]->thread);
+    LeaveCriticalSection(&start_cs);
+
+    return !created.empty();
+}
+
+void WorkStealingPool::Stop() {
+    EnterCriticalSection(&start_cs);
+
+    EnterCriticalSection(&cs);
+    std::vector<Worker*> stopped = workers;
+    stopping = true;
+    WakeAllConditionVariable(&work_cv);
+    LeaveCriticalSection(&cs);
+
+    // Потоки выходят, когда все очереди пусты
+    for (size_t i = 0; i < stopped.size(); ++i)
+        WaitForSingleObject(stopped[i]->thread, INFINITE);
+
+    EnterCriticalSection(&cs);
+    workers.clear();
+    LeaveCriticalSection(&cs);
+
+    for (size_t i = 0; i < stopped.size(); ++i) {
+        CloseHandle(stopped[i]->thread);
+        DeleteCriticalSection(&stopped[i]->cs);
+        delete stopped[i];
+    }
+    LeaveCriticalSection(&start_cs);
+}
+
+void WorkStealingPool::Suspend() {
+    EnterCriticalSection(&start_cs);
+    Stop();
+    InterlockedExchange(&suspended, 1);
+    LeaveCriticalSection(&start_cs);
+}
+
+void WorkStealingPool::Resume() {
+    if (suspended && InterlockedExchange(&suspended, 0)) {
+        EnterCriticalSection(&start_cs);
+        Start(start_threads, start_affinity, start_priority);
+        LeaveCriticalSection(&start_cs);
+    }
+}
+
+WorkStealingPool::Worker* WorkStealingPool::CurrentWorker() const {
+    DWORD id = GetCurrentThreadId();
+    for (size_t i = 0; i < workers.size(); ++i) {
+        if (workers[i]->thread_id == id) return workers[i];
+    }
+    return NULL;
+}
+
+void WorkStealingPool::Submit(const Task& task) {
+    Resume();
+    InterlockedIncrement64(&submitted);
+
+    EnterCriticalSection(&cs);
+    Worker* self = CurrentWorker();
+
+    // Задачу потока пула примет сам этот поток, даже во время остановки
+    if (workers.empty() || (stopping && !self)) {
+        LeaveCriticalSection(&cs);
+        task();
+        InterlockedIncrement64(&inline_executed);
+        return;
+    }
+
+    if (self) {
+        EnterCriticalSection(&self->cs);
+        self->tasks.push_back(task);
+        LeaveCriticalSection(&self->cs);
+    }
+    else {
+        injected.push_back(task);
+    }
+    InterlockedIncrement(&queued);
+    WakeConditionVariable(&work_cv);
+    LeaveCriticalSection(&cs);
+}
+
+bool WorkStealingPool::TakeTask(Worker* self, Task& task) {
+    // Своя очередь: последняя поставленная задача
+    EnterCriticalSection(&self->cs);
+    bool found = !self->tasks.empty();
+    if (found) {
+        task.swap(self->tasks.back());
+        self->tasks.pop_back();
+    }
+    LeaveCriticalSection(&self->cs);
+
+    if (!found) {
+        EnterCriticalSection(&cs);
+        found = !injected.empty();
+        if (found) {
+            task.swap(injected.front());
+            injected.pop_front();
+        }
+        LeaveCriticalSection(&cs);
+    }
+
+    // Список потоков не меняется, пока потоки работают, его можно читать без блокировки
+    size_t self_index = std::find(workers.begin(), workers.end(), self) - workers.begin();
+    for (size_t n = 1; !found && n < workers.size(); ++n) {
+        Worker* victim = workers[(self_index + n) % workers.size()];
+        EnterCriticalSection(&victim->cs);
+        found = !victim->tasks.empty();
+        if (found) {
+            task.swap(victim->tasks.front());
+            victim->tasks.pop_front();
+        }
+        LeaveCriticalSection(&victim->cs);
+        if (found)
+            InterlockedIncrement64(&stolen);
+    }
+
+    if (found)
+        InterlockedDecrement(&queued);
+    return found;
+}
+
+DWORD WINAPI WorkStealingPool::ThreadProc(LPVOID param) {
+    Worker* worker = static_cast<Worker*>(param);
+    worker->pool->Run(worker);
+    return 0;
+}
+
+void WorkStealingPool::Run(Worker* self) {
+    for (;;) {
+        Task task;
+        if (TakeTask(self, task)) {
+            task();
+            InterlockedIncrement64(&executed);
+            continue;
+        }
+
+        // queued увеличивается под cs до пробуждения, поэтому сигнал не теряется
+        EnterCriticalSection(&cs);
+        while (queued == 0 && !stopping)
+            SleepConditionVariableCS(&work_cv, &cs, INFINITE);
+        bool exit = stopping && queued == 0;
+        LeaveCriticalSection(&cs);
+
+        if (exit) break;
+    }
+}
+
+void WorkStealingPool::ParallelFor(size_t count, const IndexTask& body, size_t grain) {
+    if (count == 0) return;
+    grain = std::max<size_t>(1, grain);
+    Resume();
+
+    std::shared_ptr<ParallelState> state = std::make_shared<ParallelState>();
+    state->count = count;
+    state->grain = grain;
+    state->chunks = (LONG)((count + grain - 1) / grain);
+    state->remaining = state->chunks;
+    state->body = &body;
+
+    int helpers = std::min((int)state->chunks - 1, GetThreadCount());
+    if (helpers > 0)
+        state->done = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (!state->done)
+        helpers = 0;
+
+    for (int i = 0; i < helpers; ++i)
+        Submit([state]() { RunChunks(*state); });
+
+    InterlockedAdd64(&inline_executed, RunChunks(*state));
+
+    // Порции, взятые потоками пула, могут еще выполняться
+    if (state->done && state->remaining > 0)
+        WaitForSingleObject(state->done, INFINITE);
+}
+
+int WorkStealingPool::GetThreadCount() const {
+    EnterCriticalSection(&cs);
+    int count = (int)workers.size();
+    LeaveCriticalSection(&cs);
+    return count;
+}
+
+void WorkStealingPool::GetStats(WorkPoolStats& stats) const {
+    stats.threads = GetThreadCount();
+    stats.submitted = submitted;
+    stats.executed = executed;
+    stats.stolen = stolen;
+    stats.inline_executed = inline_executed;
+}
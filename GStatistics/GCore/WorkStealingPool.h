@@ -0,0 +1,140 @@
+﻿#pragma once
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <deque>
+#include <functional>
+#include <vector>
+#include <windows.h>
+
+/**
+ * @file WorkStealingPool.h
+ * @brief Общий пул потоков для фоновых задач библиотеки
+ */
+
+/**
+ * @struct WorkPoolStats
+ * @brief Счетчики пула
+ */
+struct WorkPoolStats {
+    int threads;                    ///< Потоков в пуле
+    long long submitted;            ///< Поставлено задач
+    long long executed;             ///< Выполнено задач потоками пула
+    long long stolen;               ///< Из них взято из очереди другого потока
+    long long inline_executed;      ///< Выполнено в вызывающем потоке (ParallelFor, пул не запущен)
+};
+
+/**
+ * @class WorkStealingPool
+ * @brief Пул потоков с очередью задач у каждого потока
+ * @details Задача, поставленная из потока пула, попадает в конец его собственной
+ *          очереди, и поток берет задачи оттуда же (LIFO): данные только что
+ *          созданной задачи еще в кэше. Задачи из других потоков попадают в общую
+ *          очередь. Поток без задач забирает самую старую задачу из начала
+ *          очереди другого потока, поэтому одна длинная цепочка задач не
+ *          занимает один поток, пока остальные простаивают. Каждая очередь под
+ *          своей блокировкой: владелец и похитители конкурируют только за одну
+ *          очередь, а не за общую.
+ *
+ *          По умолчанию потоков на один меньше, чем процессоров, с приоритетом
+ *          ниже обычного, чтобы фоновая работа не отнимала процессор у потока
+ *          интерфейса терминала.
+ */
+class WorkStealingPool {
+public:
+    typedef std::function<void()> Task;
+    typedef std::function<void(size_t index)> IndexTask;
+
+    static const int kMaxThreads = 64;
+
+    WorkStealingPool();
+
+    /**
+     * @brief Выполняет оставшиеся задачи и останавливает потоки
+     */
+    ~WorkStealingPool();
+
+    /**
+     * @brief Запускает или перезапускает потоки с новыми параметрами
+     * @param threads Количество потоков (<= 0 - DefaultThreadCount)
+     * @param affinity_mask Процессоры потоков (0 - все процессоры процесса)
+     * @param priority Приоритет потоков (THREAD_PRIORITY_*)
+     * @return false, если не запущен ни один поток (задачи выполняются в Submit)
+     * @details Перезапуск дожидается задач, поставленных до вызова
+     */
+    bool Start(int threads, DWORD_PTR affinity_mask, int priority);
+
+    /**
+     * @brief Выполняет оставшиеся задачи и останавливает потоки
+     */
+    void Stop();
+
+    /**
+     * @brief Выполняет оставшиеся задачи и останавливает потоки до следующей задачи
+     * @details Следующий Submit или ParallelFor запускает потоки с параметрами
+     *          последнего Start
+     */
+    void Suspend();
+
+    /**
+     * @brief Ставит задачу в очередь
+     * @details Если пул не запущен, задача выполняется сразу в вызывающем потоке
+     */
+    void Submit(const Task& task);
+
+    /**
+     * @brief Выполняет body(i) для i от 0 до count - 1 и ждет завершения
+     * @param count Количество элементов
+     * @param body Обработчик элемента; вызывается одновременно из нескольких потоков
+     * @param grain Элементов в одной задаче
+     * @details Вызывающий поток обрабатывает элементы вместе с пулом, поэтому вызов
+     *          из задачи пула не блокирует пул, даже если все потоки заняты.
+     */
+    void ParallelFor(size_t count, const IndexTask& body, size_t grain = 1);
+
+    int GetThreadCount() const;
+
+    void GetStats(WorkPoolStats& stats) const;
+
+    /**
+     * @brief Количество потоков по умолчанию: процессоров минус один, но не меньше одного
+     */
+    static int DefaultThreadCount();
+
+private:
+    struct Worker {
+        WorkStealingPool* pool;
+        HANDLE thread;
+        DWORD thread_id;
+        CRITICAL_SECTION cs;        ///< Защищает tasks
+        std::deque<Task> tasks;     ///< Владелец берет с конца, похитители - с начала
+    };
+
+    mutable CRITICAL_SECTION cs;    ///< Защищает injected, workers, stopping и ожидание
+    CRITICAL_SECTION start_cs;      ///< Сериализует Start и Stop
+    CONDITION_VARIABLE work_cv;
+    std::vector<Worker*> workers;
+    std::deque<Task> injected;      ///< Задачи из потоков вне пула
+    volatile LONG queued;           ///< Задач в очередях, еще не взятых потоками
+    bool stopping;
+    volatile LONG suspended;        ///< Потоки остановлены Suspend и запускаются при следующей задаче
+    int start_threads;              ///< Параметры последнего Start
+    DWORD_PTR start_affinity;
+    int start_priority;
+
+    volatile LONGLONG submitted;
+    volatile LONGLONG executed;
+    volatile LONGLONG stolen;
+    volatile LONGLONG inline_executed;
+
+    static DWORD WINAPI ThreadProc(LPVOID param);
+    void Run(Worker* self);
+    Worker* CurrentWorker() const;
+    bool TakeTask(Worker* self, Task& task);
+    void Resume();
+
+    WorkStealingPool(const WorkStealingPool&);
+    WorkStealingPool& operator=(const WorkStealingPool&);
+};
+
+#endif
@@ -0,0 +1,66 @@
+﻿#include "WriteBehindQueue.h"
+#include <ctime>
+
+WriteBehindQueue::WriteBehindQueue() : ring(nullptr), enabled(false) {
+    InitializeCriticalSection(&consumer_cs);
+}
+
+WriteBehindQueue::~WriteBehindQueue() {
+    delete ring;
+    DeleteCriticalSection(&consumer_cs);
+}
+
+void WriteBehindQueue::Enable(size_t capacity) {
+    EnterCriticalSection(&consumer_cs);
+    if (!ring) {
+        ring = new MpscRing<QueueItem>(capacity > 0 ? capacity : 4096);
+    }
+    LeaveCriticalSection(&consumer_cs);
+
+    enabled.store(true, std::memory_order_release);
+}
+
+void WriteBehindQueue::Disable() {
+    enabled.store(false, std::memory_order_release);
+}
+
+bool WriteBehindQueue::Push(const std::wstring& server_url, const std::string& json_body, bool expect_response) {
+    if (!IsEnabled()) return false;
+
+    QueueItem item;
+    item.id = 0;
+    item.server_url = server_url;
+    item.json_body = json_body;
+    item.expect_response = expect_response;
+    item.timestamp = time(nullptr);
+
+    return ring->TryPush(std::move(item));
+}
+
+int WriteBehindQueue::TakeBatch(std::vector<QueueItem>& batch, int max_items, bool wait_for_lock) {
+    batch.clear();
+    if (!ring || max_items <= 0) return 0;
+
+    if (wait_for_lock) {
+        EnterCriticalSection(&consumer_cs);
+    }
+    else if (!TryEnterCriticalSection(&consumer_cs)) {
+        return 0;
+    }
+
+    QueueItem item;
+    while ((int)batch.size() < max_items && ring->TryPop(item)) {
+        batch.push_back(std::move(item));
+    }
+    LeaveCriticalSection(&consumer_cs);
+
+    return (int)batch.size();
+}
+
+size_t WriteBehindQueue::GetBufferedCount() const {
+    return ring ? ring->Size() : 0;
+}
+
+size_t WriteBehindQueue::GetCapacity() const {
+    return ring ? ring->Capacity() : 0;
+}
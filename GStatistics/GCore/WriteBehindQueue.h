@@ -0,0 +1,80 @@
+﻿#pragma once
+#ifndef WRITE_BEHIND_QUEUE_H
+#define WRITE_BEHIND_QUEUE_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <windows.h>
+#include "QueueStorage.h"
+#include "MpscRing.h"
+
+/**
+ * @class WriteBehindQueue
+ * @brief Буфер запросов в памяти перед записью в хранилище очереди
+ * @details Push только копирует запрос в MpscRing и не обращается к базе данных.
+ *          Запросы забираются пачками (TakeBatch) потоком записи, который сохраняет
+ *          их в хранилище, или обработчиком очереди, который отправляет их сразу
+ *          из памяти. Запросы в буфере теряются при аварийном завершении процесса,
+ *          поэтому окно потерь ограничено интервалом сброса.
+ */
+class WriteBehindQueue {
+public:
+    WriteBehindQueue();
+    ~WriteBehindQueue();
+
+    /**
+     * @brief Включает буфер
+     * @param capacity Емкость буфера; учитывается только при первом включении,
+     *                 так как буфер не пересоздается, пока в него могут писать
+     */
+    void Enable(size_t capacity);
+
+    /**
+     * @brief Отключает прием новых запросов (уже принятые остаются в буфере)
+     */
+    void Disable();
+
+    /**
+     * @brief Проверяет, принимает ли буфер запросы
+     */
+    bool IsEnabled() const { return enabled.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Добавляет запрос в буфер без блокировок
+     * @param server_url URL сервера (UTF-16)
+     * @param json_body Тело JSON запроса (UTF-8)
+     * @param expect_response Флаг ожидания ответа от сервера
+     * @return false, если буфер отключен или заполнен (запрос нужно сохранить синхронно)
+     */
+    bool Push(const std::wstring& server_url, const std::string& json_body, bool expect_response);
+
+    /**
+     * @brief Забирает из буфера самые старые запросы
+     * @param batch Заполняется запросами (id = 0, timestamp - время добавления в буфер)
+     * @param max_items Максимальное количество запросов
+     * @param wait_for_lock false - не ждать, если буфер разбирает другой поток
+     * @return Количество запросов в batch
+     */
+    int TakeBatch(std::vector<QueueItem>& batch, int max_items, bool wait_for_lock = true);
+
+    /**
+     * @brief Количество запросов в буфере
+     */
+    size_t GetBufferedCount() const;
+
+    /**
+     * @brief Емкость буфера (0, если буфер еще не создавался)
+     */
+    size_t GetCapacity() const;
+
+private:
+    MpscRing<QueueItem>* ring;              ///< Создается при первом включении и живет до выгрузки DLL
+    std::atomic<bool> enabled;
+    CRITICAL_SECTION consumer_cs;           ///< Сериализует читателей кольца (поток записи и обработчик очереди)
+
+    WriteBehindQueue(const WriteBehindQueue&);
+    WriteBehindQueue& operator=(const WriteBehindQueue&);
+};
+
+#endif
@@ -6,8 +6,20 @@
 #include <algorithm>
 #include <vector>
 #include <map>
+#include <set>
 #include "Utilities.h"
 #include "SQLiteQueue.h"
+#include "SegmentLogQueue.h"
+#include "WriteBehindQueue.h"
+#include "RateLimiter.h"
+#include "QueuePipeline.h"
+#include "QueueDispatcher.h"
+#include "QueueEnvelope.h"
+#include "AdaptiveConcurrency.h"
+#include "QueueBackpressure.h"
+#include "WorkStealingPool.h"
+#include "TimingWheel.h"
+#include "MpscRing.h"
 #include "EventManager.h"
 #include "GCore.h"
 
@@ -16,9 +28,105 @@
 // Глобальный объект для работы с очередью
 SQLiteQueue g_queue;
 
-// Глобальные переменные для хранения событий
-static std::vector<std::pair<std::wstring, std::wstring>> g_events;
+// Хранилище очереди запросов: SQLite или сегментированный журнал (ответы всегда в g_queue)
+static SegmentLogQueue* g_logQueue = NULL;
+static QueueStorage* g_storage = &g_queue;
+
+// Хранилище выбирается до первого использования очереди: после него запросы и
+// подтверждения остались бы в прежнем хранилище (см. UseStorage)
+static CRITICAL_SECTION g_storageCs;
+static volatile LONG g_storageInUse = 0;
+
+// Буфер запросов в памяти и поток, сохраняющий его в хранилище
+static WriteBehindQueue g_writeBehind;
+static int g_flushIntervalMs = 1000;
+static HANDLE g_flushThread = NULL;
+static HANDLE g_flushStop = NULL;
+static HANDLE g_flushWake = NULL;
+
+// Лимит попыток отправки, после которого запрос переносится в http_dead_letters (0 - без лимита)
+static int g_maxSendAttempts = 0;
+
+// Пауза перед повтором неудачной отправки (SetHttpRetryBackoff, 0 - повтор при следующем проходе)
+static int g_retryBaseMs = 0;
+
+// Сроки отложенных запросов: постоянные обработчики спят до ближайшего срока
+static TimingWheel g_retryWheel;
+
+// Лимит частоты отправки из очереди по хостам (SetHttpRateLimit)
+static HostRateLimiter g_rateLimiter;
+
+// Одновременная отправка запросов пачки (SetHttpQueueConcurrency). Создается при
+// первой настройке и не удаляется: деструктор ждал бы потоки пула под loader lock
+static QueueDispatcher* g_dispatcher = NULL;
+
+// Лимиты одновременных отправок по хостам по времени ответа и ошибкам (SetHttpAdaptiveConcurrency)
+static AdaptiveConcurrency g_adaptive;
+
+// Объединение запросов на один адрес в один POST (SetHttpQueueBatching)
+static EnvelopeSettings g_envelopes;
+
+// Границы очереди и политика при переполнении (SetHttpQueueBackpressure)
+static QueueBackpressure g_backpressure;
+
+// Код возврата добавления в очередь, отклоненного при переполнении
+static const int kQueueRejected = 2;
+
+// Общий пул потоков: подготовка больших пачек к записи.
+// Создается при первом использовании и не удаляется, как g_dispatcher
+static WorkStealingPool* g_workPool = NULL;
+
+// Вызовов ProcessHttpQueue с начала идущего прохода (0 - прохода нет)
+static volatile LONG g_queuePasses = 0;
+
+// Запросы хранилища, которые сейчас отправляет один из обработчиков очереди
+static std::set<int> g_inFlight;
+static CRITICAL_SECTION g_inFlightCs;
+
+// Постоянные обработчики очереди (StartQueueWorkers)
+static std::vector<HANDLE> g_workerThreads;
+static HANDLE g_workerStop = NULL;
+static HANDLE g_workerWake = NULL;
+
+// Непрерывный разбор очереди (DrainHttpQueue)
+static HANDLE g_drainThread = NULL;
+static HANDLE g_drainStop = NULL;
+
+// Очередь событий для GetNextEvent. Писатели добавляют события без блокировок,
+// g_eventsCs сериализует только читателей (у MpscRing один читатель)
+struct QueuedEvent {
+    std::wstring type;
+    std::wstring data;
+};
+static const size_t kEventQueueCapacity = 16384;
+static MpscRing<QueuedEvent>* g_events = NULL;
 static CRITICAL_SECTION g_eventsCs;
+static volatile LONGLONG g_eventsQueued = 0;
+static volatile LONGLONG g_eventsDropped = 0;
+
+// Параметры и состояние фоновой очистки базы
+struct RetentionPolicy {
+    int maxAgeHours;
+    long long maxSizeBytes;
+    int intervalSeconds;
+};
+static RetentionPolicy g_retentionPolicy = { 24, 100LL * 1024 * 1024, 60 };
+static HANDLE g_retentionThread = NULL;
+static HANDLE g_retentionStop = NULL;
+
+// Фоновые потоки библиотеки, включая отсоединенные потоки ProcessHttpQueue.
+// Событие установлено, пока потоков нет: его можно ждать и под loader lock,
+// так как поток сбрасывает счетчик до выхода из кода библиотеки
+static CRITICAL_SECTION g_backgroundCs;
+static int g_backgroundThreads = 0;
+static HANDLE g_backgroundIdle = NULL;
+
+// Остановка разовых обработчиков очереди при завершении (ShutdownGCore)
+static HANDLE g_shutdownStop = NULL;
+
+// Сколько ждать прерванные запросы после истечения таймаута завершения
+static const DWORD kShutdownCancelGraceMs = 500;
+
 
 // -----------------------------------------------------------------------------
 // Инициализация критической секции
@@ -28,14 +136,30 @@ void InitializeEventsSystem()
     InitializeCriticalSection(&g_eventsCs);
 }
 
+// Буфер создается при первом событии: программы, получающие события только через
+// callback, не держат его в памяти. Параллельный первый вызов удаляет свой экземпляр
+static MpscRing<QueuedEvent>* GetEventRing()
+{
+    if (!g_events) {
+        MpscRing<QueuedEvent>* ring = new MpscRing<QueuedEvent>(kEventQueueCapacity);
+        if (InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&g_events), ring, NULL) != NULL)
+            delete ring;
+    }
+    return g_events;
+}
+
 // -----------------------------------------------------------------------------
 // Добавление события в очередь
 // -----------------------------------------------------------------------------
 void AddEventToQueue(const wchar_t* event_type, const wchar_t* data)
 {
-    EnterCriticalSection(&g_eventsCs);
-    g_events.push_back(std::make_pair(event_type, data));
-    LeaveCriticalSection(&g_eventsCs);
+    QueuedEvent event = { event_type, data };
+
+    // Заполненная очередь сохраняет старые события, новое отбрасывается
+    if (GetEventRing()->TryPush(std::move(event)))
+        InterlockedIncrement64(&g_eventsQueued);
+    else
+        InterlockedIncrement64(&g_eventsDropped);
 }
 
 // -----------------------------------------------------------------------------
@@ -54,46 +178,79 @@ inline void HandleEvent(const wchar_t* type, const wchar_t* data, bool useSendEv
 // -----------------------------------------------------------------------------
 extern "C" __declspec(dllexport) int __stdcall GetPendingEventCount()
 {
-    EnterCriticalSection(&g_eventsCs);
-    int count = (int)g_events.size();
-    LeaveCriticalSection(&g_eventsCs);
-    return count;
+    return g_events ? (int)g_events->Size() : 0;
 }
 
 extern "C" __declspec(dllexport) int __stdcall GetNextEvent(wchar_t* eventType, int typeSize, wchar_t* eventData, int dataSize)
 {
+    if (!g_events)
+        return 0;
+
+    QueuedEvent event;
     EnterCriticalSection(&g_eventsCs);
+    bool found = g_events->TryPop(event);
+    LeaveCriticalSection(&g_eventsCs);
 
-    if (g_events.empty())
-    {
-        LeaveCriticalSection(&g_eventsCs);
+    if (!found)
         return 0;
-    }
-
-    auto event = g_events.front();
-    g_events.erase(g_events.begin());
 
     if (eventType && typeSize > 0)
-        wcsncpy_s(eventType, typeSize, event.first.c_str(), _TRUNCATE);
+        wcsncpy_s(eventType, typeSize, event.type.c_str(), _TRUNCATE);
 
     if (eventData && dataSize > 0)
-        wcsncpy_s(eventData, dataSize, event.second.c_str(), _TRUNCATE);
+        wcsncpy_s(eventData, dataSize, event.data.c_str(), _TRUNCATE);
 
-    LeaveCriticalSection(&g_eventsCs);
     return 1;
 }
 
 extern "C" __declspec(dllexport) int __stdcall ClearEvents()
 {
+    if (!g_events)
+        return 1;
+
+    QueuedEvent event;
     EnterCriticalSection(&g_eventsCs);
-    g_events.clear();
+    while (g_events->TryPop(event)) {}
     LeaveCriticalSection(&g_eventsCs);
     return 1;
 }
 
+extern "C" __declspec(dllexport) int __stdcall GetEventQueueStats(long long* values, int maxValues)
+{
+    const long long fields[] = {
+        g_events ? (long long)g_events->Size() : 0,
+        (long long)kEventQueueCapacity,
+        g_eventsQueued,
+        g_eventsDropped
+    };
+    const int fieldCount = sizeof(fields) / sizeof(fields[0]);
+
+    if (!values || maxValues <= 0)
+        return fieldCount;
+
+    int count = std::min(maxValues, fieldCount);
+    for (int i = 0; i < count; ++i)
+        values[i] = fields[i];
+
+    return count;
+}
+
+// -----------------------------------------------------------------------------
+// Ошибки служебных SQL-команд хранилища (создание таблиц, настройка, обслуживание)
+// -----------------------------------------------------------------------------
+static void ReportStorageErrors()
+{
+    std::string error = g_queue.TakeLastError();
+    if (!error.empty())
+        HandleEvent(L"QUEUE_SQL_ERROR", Utf8ToWide(error.c_str()).c_str(), false, false);
+}
+
 extern "C" __declspec(dllexport) void __stdcall SetEventCallback(EventCallback callback)
 {
     EventManager::SetCallback(callback);
+
+    // Ошибки открытия базы при загрузке библиотеки
+    ReportStorageErrors();
 }
 
 // -----------------------------------------------------------------------------
@@ -130,32 +287,317 @@ std::wstring SendRequestInternalSafeResponse(const wchar_t* serverUrlPtr, const
 }
 
 // -----------------------------------------------------------------------------
-// Поток обработки очереди
+// Ошибки клиента 4xx не исправляются повтором, кроме таймаута (408) и лимита (429)
 // -----------------------------------------------------------------------------
-DWORD WINAPI ProcessQueueThread(LPVOID lpParam) {
-    HandleEvent(L"QUEUE_START", L"Начало обработки очереди", false, false);
+static bool IsPermanentFailure(int httpStatus)
+{
+    return httpStatus >= 400 && httpStatus < 500 && httpStatus != 408 && httpStatus != 429;
+}
 
-    std::vector<QueueItem> items = g_queue.GetPendingItems(50);
-    int processed = 0;
-    int successful = 0;
+// -----------------------------------------------------------------------------
+// Хранилище для добавления, выборки и подтверждения запросов. Первый вызов
+// закрепляет выбор: SetHttpQueueBackend после него отказывает
+// -----------------------------------------------------------------------------
+static QueueStorage* UseStorage()
+{
+    if (!g_storageInUse) {
+        EnterCriticalSection(&g_storageCs);
+        g_storageInUse = 1;
+        LeaveCriticalSection(&g_storageCs);
+    }
+    return g_storage;
+}
 
-    std::wstring statusMsg = L"Найдено " + std::to_wstring(items.size()) + L" записей";
-    HandleEvent(L"QUEUE_STATUS", statusMsg.c_str(), false, false);
+// -----------------------------------------------------------------------------
+// Выборка запросов хранилища с захватом: afterId < 0 - в порядке сроков доставки,
+// затем самые старые, иначе следующая страница по id. Запросы с истекшим сроком
+// удаляются без отправки. Возвращает последний просмотренный id
+// -----------------------------------------------------------------------------
+static int FetchAndClaim(QueueStorage* storage, QueueBatch& fetched, QueueBatch& batch, int afterId, int maxItems)
+{
+    std::vector<int> expired;
+    time_t now = time(nullptr);
+    batch.Clear();
+
+    // Запросы, которые отправляют другие обработчики, пропускаем: выбираем с запасом
+    // на их количество. Выборка и захват идут под одной блокировкой, иначе запрос,
+    // подтвержденный между ними другим обработчиком, был бы отправлен повторно
+    EnterCriticalSection(&g_inFlightCs);
+    int limit = maxItems + (int)g_inFlight.size();
+    if (afterId < 0)
+        storage->GetPendingBatch(fetched, limit);
+    else
+        storage->GetPendingBatchAfter(fetched, afterId, limit);
+
+    size_t scanned = 0;
+    for (; scanned < fetched.Size() && (int)batch.Size() < maxItems; ++scanned) {
+        const QueueItemView& item = fetched[scanned];
+        if (g_inFlight.count(item.id))
+            continue;
+        if (item.deadline > 0 && item.deadline < now) {
+            expired.push_back(item.id);
+            continue;
+        }
+        g_inFlight.insert(item.id);
+        batch.Add(item.id, item.endpoint, fetched.Body(item), item.body_size, item.expect_response, item.timestamp,
+                  item.response_ttl, item.deadline);
+    }
+    LeaveCriticalSection(&g_inFlightCs);
+
+    // Удаленные другим обработчиком одновременно не засчитываются дважды
+    if (!expired.empty()) {
+        int removed = storage->RemoveFromQueueBatch(expired);
+        g_queue.CountDeadlines(0, 0, removed);
+        if (removed > 0) {
+            std::wstring message = L"Удалено запросов с истекшим сроком доставки: " + std::to_wstring(removed);
+            HandleEvent(L"REQUEST_EXPIRED", message.c_str(), false, false);
+        }
+    }
+
+    return scanned > 0 ? fetched[scanned - 1].id : afterId;
+}
+
+// -----------------------------------------------------------------------------
+// Снятие захвата с первых count запросов пачки
+// -----------------------------------------------------------------------------
+static void ReleaseClaims(const QueueBatch& batch, size_t count)
+{
+    EnterCriticalSection(&g_inFlightCs);
+    for (size_t i = 0; i < count && i < batch.Size(); ++i)
+        g_inFlight.erase(batch[i].id);
+    LeaveCriticalSection(&g_inFlightCs);
+}
 
-    for (const auto& item : items) {
-        processed++;
-        if (g_queue.ProcessQueueItem(item)) {
+// -----------------------------------------------------------------------------
+// Отправка пачки: подтверждение, учет неудачных попыток и снятие захвата.
+// Первые storedCount запросов взяты из хранилища storage, остальные - из буфера в памяти
+// -----------------------------------------------------------------------------
+static int SendBatch(QueueStorage* storage, const QueueBatch& batch, size_t storedCount, HANDLE stop, int& successful)
+{
+    const size_t confirmBatchSize = 100;
+    std::vector<QueueItem> unsent;
+    std::vector<int> confirmed;
+    long long onTime = 0, late = 0;
+    successful = 0;
+
+    // Подтверждения копятся и удаляются из хранилища одной транзакцией.
+    // До удаления запросы остаются захваченными и повторно не выбираются
+    auto complete = [&](size_t i, bool sent, const SendFailure& failure) {
+        const QueueItemView& item = batch[i];
+        bool fromBuffer = i >= storedCount;
+
+        if (sent) {
             successful++;
-            g_queue.RemoveFromQueue(item.id);
-            std::wstring successMsg = L"Успешно отправлен запрос ID: " + std::to_wstring(item.id);
+            if (item.deadline > 0)
+                (time(nullptr) <= item.deadline ? onTime : late)++;
+            if (!fromBuffer) {
+                confirmed.push_back(item.id);
+                if (confirmed.size() >= confirmBatchSize) {
+                    storage->RemoveFromQueueBatch(confirmed);
+                    g_backpressure.Notify();
+                    confirmed.clear();
+                }
+            }
+            std::wstring successMsg = fromBuffer ?
+                std::wstring(L"Успешно отправлен запрос из буфера") :
+                L"Успешно отправлен запрос ID: " + std::to_wstring(item.id);
             HandleEvent(L"REQUEST_SUCCESS", successMsg.c_str(), false, false);
+            return;
+        }
+
+        if (fromBuffer)
+            unsent.push_back(batch.ToItem(i));
+        std::wstring errorMsg = fromBuffer ?
+            std::wstring(L"Ошибка отправки запроса из буфера") :
+            L"Ошибка отправки запроса ID: " + std::to_wstring(item.id);
+        HandleEvent(L"REQUEST_FAILED", errorMsg.c_str(), false, false);
+
+        // Попытки считаются для лимита и для паузы перед повтором
+        int maxAttempts = g_maxSendAttempts;
+        if (!fromBuffer && (maxAttempts > 0 || g_retryBaseMs > 0) &&
+            storage->RecordSendFailure(item.id, failure, maxAttempts,
+                                       maxAttempts > 0 && IsPermanentFailure(failure.http_status)) == 1) {
+            std::wstring deadMsg = L"Запрос ID: " + std::to_wstring(item.id) + L" перенесен в недоставленные: " +
+                Utf8ToWide(failure.error.c_str());
+            HandleEvent(L"REQUEST_DEAD_LETTER", deadMsg.c_str(), false, false);
+        }
+    };
+
+    // При объединении отправляются группы: units[j] - первый запрос группы j,
+    // по нему выбираются хост для лимитов и адрес; результат группы получает
+    // каждый ее запрос
+    std::vector<EnvelopeGroup> groups;
+    bool enveloped = g_envelopes.Group(batch, groups);
+    QueueBatch envelopeUnits;
+    if (enveloped) {
+        for (size_t j = 0; j < groups.size(); ++j) {
+            const QueueItemView& first = batch[groups[j].members[0]];
+            envelopeUnits.Add(first.id, first.endpoint, "", 0, first.expect_response, first.timestamp);
+        }
+    }
+    const QueueBatch& units = enveloped ? envelopeUnits : batch;
+
+    QueueDispatcher::SendFunction send = [&](const QueueBatch& sendBatch, size_t j, SendFailure* failure) {
+        if (!enveloped)
+            return g_queue.ProcessQueueItem(sendBatch, j, failure);
+        const EnvelopeGroup& group = groups[j];
+        if (group.members.size() == 1)
+            return g_queue.ProcessQueueItem(batch, group.members[0], failure);
+        return g_queue.ProcessEnvelope(batch, group.members, group.format, failure);
+    };
+    auto completeUnit = [&](size_t j, bool sent, const SendFailure& failure) {
+        if (!enveloped) {
+            complete(j, sent, failure);
+            return;
+        }
+        for (size_t m = 0; m < groups[j].members.size(); ++m)
+            complete(groups[j].members[m], sent, failure);
+    };
+    // Остановка во время ожидания лимита: запросы хранилища остаются в нем,
+    // запросы из буфера сохраняются ниже. Общий POST расходует один токен лимита
+    auto acquireUnit = [&](size_t j) {
+        return g_rateLimiter.Acquire(EndpointTable::Instance().Url(units[j].endpoint), stop);
+    };
+
+    std::vector<char> unitDispatched;
+    if (g_dispatcher && g_dispatcher->GetMaxInFlight() > 1) {
+        g_dispatcher->Dispatch(units, send, acquireUnit, completeUnit, unitDispatched);
+    }
+    else {
+        unitDispatched.assign(units.Size(), 0);
+        for (size_t j = 0; j < units.Size() && acquireUnit(j); ++j) {
+            SendFailure failure = { 0, std::string(), 0 };
+            bool sent = send(units, j, &failure);
+            unitDispatched[j] = 1;
+            completeUnit(j, sent, failure);
+        }
+    }
+
+    std::vector<char> dispatched(batch.Size(), 0);
+    int attempted = 0;
+    for (size_t j = 0; j < units.Size(); ++j) {
+        if (!unitDispatched[j]) continue;
+        if (!enveloped) {
+            dispatched[j] = 1;
+            attempted++;
+            continue;
+        }
+        for (size_t m = 0; m < groups[j].members.size(); ++m) {
+            dispatched[groups[j].members[m]] = 1;
+            attempted++;
+        }
+    }
+
+    if (!confirmed.empty()) {
+        storage->RemoveFromQueueBatch(confirmed);
+        g_backpressure.Notify();
+    }
+    g_queue.CountDeadlines(onTime, late, 0);
+
+    // Захват снимается после подтверждения, когда запрос уже удален из хранилища
+    ReleaseClaims(batch, storedCount);
+
+    // Неотправленные запросы из буфера сохраняются для следующей попытки
+    for (size_t i = storedCount; i < batch.Size(); ++i) {
+        if (!dispatched[i])
+            unsent.push_back(batch.ToItem(i));
+    }
+    if (!unsent.empty())
+        storage->AddToQueueBatch(unsent);
+
+    return attempted;
+}
+
+// -----------------------------------------------------------------------------
+// Обработка пачки очереди: самые старые запросы хранилища и буфер в памяти
+// -----------------------------------------------------------------------------
+static int ProcessQueueBatch(int maxItems, HANDLE stop, int& successful)
+{
+    QueueStorage* storage = UseStorage();
+    QueueBatch fetched;
+    QueueBatch batch;
+    successful = 0;
+
+    FetchAndClaim(storage, fetched, batch, -1, maxItems);
+    size_t storedCount = batch.Size();
+
+    // Запросы, еще не сохраненные потоком записи, отправляем прямо из буфера
+    std::vector<QueueItem> buffered;
+    g_writeBehind.TakeBatch(buffered, maxItems - (int)storedCount);
+    for (size_t i = 0; i < buffered.size(); ++i)
+        batch.Add(buffered[i]);
+    buffered.clear();
+
+    if (batch.Empty())
+        return 0;
+
+    std::wstring statusMsg = L"Найдено " + std::to_wstring(batch.Size()) + L" записей";
+    HandleEvent(L"QUEUE_STATUS", statusMsg.c_str(), false, false);
+
+    return SendBatch(storage, batch, storedCount, stop, successful);
+}
+
+// -----------------------------------------------------------------------------
+// Учет фоновых потоков
+// -----------------------------------------------------------------------------
+static void EnterBackgroundWork()
+{
+    EnterCriticalSection(&g_backgroundCs);
+    if (g_backgroundThreads++ == 0 && g_backgroundIdle)
+        ResetEvent(g_backgroundIdle);
+    LeaveCriticalSection(&g_backgroundCs);
+}
+
+static void LeaveBackgroundWork()
+{
+    EnterCriticalSection(&g_backgroundCs);
+    if (--g_backgroundThreads == 0 && g_backgroundIdle)
+        SetEvent(g_backgroundIdle);
+    LeaveCriticalSection(&g_backgroundCs);
+}
+
+static DWORD WINAPI BackgroundThreadProc(LPVOID lpParam) {
+    DWORD result = reinterpret_cast<LPTHREAD_START_ROUTINE>(lpParam)(NULL);
+    LeaveBackgroundWork();
+    return result;
+}
+
+// Запуск фонового потока с учетом: поток считается с момента создания, чтобы
+// завершение не пропустило поток, который еще не начал работу
+static HANDLE StartBackgroundThread(LPTHREAD_START_ROUTINE proc)
+{
+    EnterBackgroundWork();
+    HANDLE thread = CreateModuleThread(BackgroundThreadProc, reinterpret_cast<LPVOID>(proc), 0, NULL);
+    if (!thread)
+        LeaveBackgroundWork();
+    return thread;
+}
+
+// Пул создается один раз; параллельный первый вызов удаляет свой экземпляр
+static WorkStealingPool* GetWorkPool()
+{
+    if (!g_workPool) {
+        WorkStealingPool* pool = new WorkStealingPool();
+        if (InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&g_workPool), pool, NULL) == NULL) {
+            pool->Start(0, 0, THREAD_PRIORITY_BELOW_NORMAL);
+            g_queue.SetWorkPool(pool);
         }
         else {
-            std::wstring errorMsg = L"Ошибка отправки запроса ID: " + std::to_wstring(item.id);
-            HandleEvent(L"REQUEST_FAILED", errorMsg.c_str(), false, false);
+            delete pool;
         }
-        Sleep(100);
     }
+    return g_workPool;
+}
+
+// -----------------------------------------------------------------------------
+// Поток обработки очереди (одна пачка по вызову ProcessHttpQueue)
+// -----------------------------------------------------------------------------
+DWORD WINAPI ProcessQueueThread(LPVOID lpParam) {
+    HandleEvent(L"QUEUE_START", L"Начало обработки очереди", false, false);
+
+    // Прерывается между запросами при завершении; неотправленное остается в очереди
+    int successful = 0;
+    int processed = ProcessQueueBatch(50, g_shutdownStop, successful);
 
     std::wstring completeMsg = L"Обработка завершена. Успешно: " + std::to_wstring(successful) + L", Всего: " + std::to_wstring(processed);
     HandleEvent(L"QUEUE_COMPLETE", completeMsg.c_str(), false, false);
@@ -163,6 +605,354 @@ DWORD WINAPI ProcessQueueThread(LPVOID lpParam) {
     return 0;
 }
 
+// -----------------------------------------------------------------------------
+// Постоянный обработчик очереди: спит до сигнала о новом запросе
+// -----------------------------------------------------------------------------
+DWORD WINAPI QueueWorkerThread(LPVOID lpParam) {
+    const DWORD idlePollMs = 1000;      // запросы могли добавить другие процессы
+    const DWORD maxBackoffMs = 30000;
+    HANDLE handles[2] = { g_workerStop, g_workerWake };
+    DWORD backoffMs = 0;
+
+    for (;;) {
+        // С регулятором пачка растет вместе с лимитами хостов, чтобы слоты не простаивали
+        int batchSize = g_adaptive.IsEnabled() ? g_adaptive.SuggestBatchSize(10, 500) : 50;
+        int successful = 0;
+        int processed = ProcessQueueBatch(batchSize, g_workerStop, successful);
+
+        // Полная пачка: в очереди есть еще запросы, будим следующего обработчика
+        if (processed == batchSize)
+            SetEvent(g_workerWake);
+
+        if (processed > 0 && successful == 0) {
+            // Сервер недоступен: новые запросы не ускоряют повтор, ждем только остановки
+            backoffMs = backoffMs ? std::min(backoffMs * 2, maxBackoffMs) : 1000;
+            if (WaitForSingleObject(g_workerStop, backoffMs) != WAIT_TIMEOUT)
+                break;
+            continue;
+        }
+        backoffMs = 0;
+
+        if (processed > 0)
+            continue;
+
+        // Готовых запросов нет: спим до ближайшего срока отложенного запроса, но не
+        // дольше idlePollMs. Новый более ранний срок будит обработчик через g_workerWake
+        DWORD waitMs = g_retryWheel.GetWaitMs(TimingWheel::NowMs(), idlePollMs);
+        if (WaitForMultipleObjects(2, handles, FALSE, waitMs) == WAIT_OBJECT_0)
+            break;
+        g_retryWheel.Advance(TimingWheel::NowMs());
+    }
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Сигнал постоянным обработчикам о новом запросе в очереди
+// -----------------------------------------------------------------------------
+static void WakeQueueWorkers()
+{
+    if (g_workerWake)
+        SetEvent(g_workerWake);
+}
+
+// -----------------------------------------------------------------------------
+// Добавление запроса: в буфер, если он включен и не заполнен, иначе сразу в хранилище
+// -----------------------------------------------------------------------------
+static bool EnqueueRequest(const std::wstring& serverUrl, const std::string& jsonBodyUtf8, bool expectResponse)
+{
+    if (g_writeBehind.Push(serverUrl, jsonBodyUtf8, expectResponse)) {
+        // Будим поток записи раньше срока, когда буфер заполнен наполовину
+        if (g_flushWake && g_writeBehind.GetBufferedCount() * 2 >= g_writeBehind.GetCapacity())
+            SetEvent(g_flushWake);
+        WakeQueueWorkers();
+        return true;
+    }
+
+    bool result = UseStorage()->AddToQueue(serverUrl, jsonBodyUtf8, expectResponse);
+    if (result)
+        WakeQueueWorkers();
+    return result;
+}
+
+// -----------------------------------------------------------------------------
+// Сохранение содержимого буфера в хранилище пачками
+// -----------------------------------------------------------------------------
+static int FlushWriteBehind(bool waitForLock)
+{
+    const int batchSize = 500;
+    QueueStorage* storage = UseStorage();
+    std::vector<QueueItem> batch;
+    int flushed = 0;
+
+    while (g_writeBehind.TakeBatch(batch, batchSize, waitForLock) > 0) {
+        int added = storage->AddToQueueBatch(batch);
+
+        // Пачка сохранилась не целиком: запросы до ошибки уже в хранилище, остальные
+        // повторяем по одному. Запрос передается целиком, чтобы сохранить время его
+        // постановки в буфер и остальные поля
+        std::vector<QueueItem> single(1);
+        for (size_t i = (size_t)added; i < batch.size(); ++i) {
+            single[0] = batch[i];
+            added += storage->AddToQueueBatch(single);
+        }
+
+        if (added < (int)batch.size()) {
+            std::wstring message = L"Не удалось сохранить запросов из буфера: " + std::to_wstring(batch.size() - added);
+            HandleEvent(L"WRITE_BEHIND_LOST", message.c_str(), false, false);
+        }
+        flushed += added;
+    }
+
+    return flushed;
+}
+
+// -----------------------------------------------------------------------------
+// Сохранение буфера при отключении DLL: под loader lock нельзя ждать поток записи
+// и пул, поэтому SQLite пишется через отдельное соединение, журнал - без ожидания
+// его блокировки. Общее время ограничено kDetachFlushMs
+// -----------------------------------------------------------------------------
+static const DWORD kDetachFlushMs = 2000;
+
+static int FlushWriteBehindOnDetach()
+{
+    const int batchSize = 500;
+    DWORD started = GetTickCount();
+    std::vector<QueueItem> batch;
+    int flushed = 0;
+
+    // Блокировку буфера мог оставить поток, завершенный вместе с процессом
+    while (GetTickCount() - started < kDetachFlushMs && g_writeBehind.TakeBatch(batch, batchSize, false) > 0) {
+        if (g_storage == &g_queue)
+            flushed += g_queue.SaveBatchDirect(batch, kDetachFlushMs - (GetTickCount() - started));
+        else if (g_logQueue)
+            flushed += g_logQueue->TryAddToQueueBatch(batch);
+    }
+
+    return flushed;
+}
+
+// -----------------------------------------------------------------------------
+// Допуск запроса в очередь по границам SetHttpQueueBackpressure
+// -----------------------------------------------------------------------------
+static bool AdmitRequest(size_t bodySize)
+{
+    return g_backpressure.Admit(bodySize,
+        []() {
+            return g_storage->GetQueueDepth() + (long long)g_writeBehind.GetBufferedCount();
+        },
+        [](int count, bool lowestPriority) {
+            // Вызывается без блокировки границ: сохранение, удаление и событие не задерживают
+            // другие добавления. Вытесняются только сохраненные запросы, поэтому буфер
+            // сначала сохраняется
+            if (g_writeBehind.GetBufferedCount() > 0)
+                FlushWriteBehind(true);
+
+            QueueStorage* storage = UseStorage();
+            int removed = lowestPriority ? storage->DropOldestQueueItems(count, true) : 0;
+            if (removed < count)
+                removed += storage->DropOldestQueueItems(count - removed, false);
+
+            if (removed > 0) {
+                std::wstring message = L"Очередь переполнена, удалено старых запросов: " + std::to_wstring(removed);
+                HandleEvent(L"QUEUE_DROPPED", message.c_str(), false, false);
+            }
+            return removed;
+        });
+}
+
+// -----------------------------------------------------------------------------
+// Отключение буфера и остановка потока сохранения
+// -----------------------------------------------------------------------------
+static void StopFlushThread()
+{
+    g_writeBehind.Disable();
+    if (!g_flushThread)
+        return;
+
+    SetEvent(g_flushStop);
+    WaitForSingleObject(g_flushThread, INFINITE);
+    CloseHandle(g_flushThread);
+    CloseHandle(g_flushStop);
+    CloseHandle(g_flushWake);
+    g_flushThread = NULL;
+    g_flushStop = NULL;
+    g_flushWake = NULL;
+}
+
+// -----------------------------------------------------------------------------
+// Поток сохранения буфера запросов
+// -----------------------------------------------------------------------------
+DWORD WINAPI FlushThread(LPVOID lpParam) {
+    HANDLE handles[2] = { g_flushStop, g_flushWake };
+
+    // Интервал сброса ограничивает окно потерь при аварийном завершении
+    while (WaitForMultipleObjects(2, handles, FALSE, g_flushIntervalMs) != WAIT_OBJECT_0) {
+        FlushWriteBehind(true);
+    }
+    FlushWriteBehind(true);
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Поток непрерывного разбора: проход по очереди страницами по id, следующая
+// страница читается, пока отправляется текущая
+// -----------------------------------------------------------------------------
+DWORD WINAPI DrainQueueThread(LPVOID lpParam) {
+    HandleEvent(L"QUEUE_DRAIN_START", L"Начало непрерывного разбора очереди", false, false);
+    QueueStorage* storage = UseStorage();
+
+    // Проход идет только по хранилищу, поэтому буфер в памяти сохраняется заранее
+    FlushWriteBehind(true);
+
+    AdaptiveBatchSize batchSize(10, 500, 500);
+    Prefetcher prefetcher;
+    prefetcher.Start();
+
+    QueueBatch scratch;
+    QueueBatch batches[2];
+    int current = 0;
+    int lastId = 0;
+    size_t scanned = 0;
+
+    LARGE_INTEGER freq, t0, t1, t2;
+    QueryPerformanceFrequency(&freq);
+
+    int size = batchSize.Get();
+    prefetcher.Begin([&]() {
+        lastId = FetchAndClaim(storage, scratch, batches[0], 0, size);
+        scanned = scratch.Size();
+    });
+    prefetcher.Wait();
+
+    long long sent = 0, successful = 0, batchCount = 0, stallUs = 0;
+    std::wstring outcome;
+
+    while (scanned > 0) {
+        QueueBatch& batch = batches[current];
+        QueueBatch& next = batches[1 - current];
+
+        int afterId = lastId;
+        size = batchSize.Get();
+        prefetcher.Begin([&, afterId, size]() {
+            lastId = FetchAndClaim(storage, scratch, next, afterId, size);
+            scanned = scratch.Size();
+        });
+
+        int ok = 0;
+        QueryPerformanceCounter(&t0);
+        int attempted = SendBatch(storage, batch, batch.Size(), g_drainStop, ok);
+        QueryPerformanceCounter(&t1);
+        prefetcher.Wait();
+        QueryPerformanceCounter(&t2);
+
+        batchSize.Record(attempted, (t1.QuadPart - t0.QuadPart) * 1000000 / freq.QuadPart);
+        stallUs += (t2.QuadPart - t1.QuadPart) * 1000000 / freq.QuadPart;
+        sent += attempted;
+        successful += ok;
+        batchCount++;
+
+        if (attempted < (int)batch.Size()) {
+            outcome = L" по остановке";
+        }
+        else if (attempted > 0 && ok == 0) {
+            // Вся пачка не отправлена: сервер недоступен, остаток ждет следующего прохода
+            outcome = L" из-за ошибок отправки";
+        }
+        else {
+            current = 1 - current;
+            continue;
+        }
+
+        ReleaseClaims(next, next.Size());
+        break;
+    }
+
+    std::wstring completeMsg = L"Разбор очереди завершен" + outcome + L". Успешно: " + std::to_wstring(successful) + L", всего: " + std::to_wstring(sent) +
+        L", пачек: " + std::to_wstring(batchCount) + L", размер пачки: " + std::to_wstring(batchSize.Get()) +
+        L", ожидание чтения: " + std::to_wstring(stallUs / 1000) + L" мс";
+    HandleEvent(L"QUEUE_DRAIN_COMPLETE", completeMsg.c_str(), false, false);
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Очистка устаревших запросов в текущем хранилище и ответов в SQLite
+// -----------------------------------------------------------------------------
+static int CleanOldStorageItems(int hoursOld, bool cleanResponses)
+{
+    int result = g_queue.CleanOldItems(hoursOld, cleanResponses);
+    QueueStorage* storage = g_storage;
+    if (storage != &g_queue)
+        result += storage->CleanOldQueueItems(hoursOld);
+    ReportStorageErrors();
+    return result;
+}
+
+// -----------------------------------------------------------------------------
+// Порция фоновой очистки выполняется задачей пула с его приоритетом и
+// процессорами; поток очистки только отмеряет паузы между порциями
+// -----------------------------------------------------------------------------
+static int RunRetentionChunk(const std::function<int()>& chunk)
+{
+    HANDLE done = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (!done)
+        return chunk();
+
+    int result = 0;
+    GetWorkPool()->Submit([&]() {
+        result = chunk();
+        SetEvent(done);
+    });
+    WaitForSingleObject(done, INFINITE);
+    CloseHandle(done);
+    return result;
+}
+
+// -----------------------------------------------------------------------------
+// Поток фоновой очистки базы
+// -----------------------------------------------------------------------------
+DWORD WINAPI RetentionThread(LPVOID lpParam) {
+    const int chunkSize = 200;
+    const DWORD chunkPauseMs = 20;
+
+    do {
+        RetentionPolicy policy = g_retentionPolicy;
+        int deleted = 0;
+        int chunk = 0;
+
+        // Удаление по возрасту небольшими порциями с паузами, чтобы не блокировать запись
+        do {
+            chunk = RunRetentionChunk([&]() { return g_queue.CleanOldItemsChunk(policy.maxAgeHours, true, chunkSize); });
+            deleted += chunk;
+        } while (chunk > 0 && WaitForSingleObject(g_retentionStop, chunkPauseMs) == WAIT_TIMEOUT);
+
+        // Журнал освобождает место удалением целых сегментов
+        QueueStorage* storage = g_storage;
+        if (storage != &g_queue)
+            deleted += RunRetentionChunk([&]() { return storage->CleanOldQueueItems(policy.maxAgeHours); });
+
+        // Ограничение размера: удаляем самые старые записи, пока база не уложится в лимит
+        do {
+            chunk = RunRetentionChunk([&]() { return g_queue.TrimToSize(policy.maxSizeBytes, chunkSize, 1); });
+            deleted += chunk;
+        } while (chunk > 0 && WaitForSingleObject(g_retentionStop, chunkPauseMs) == WAIT_TIMEOUT);
+
+        // Возвращаем освободившиеся страницы постепенно
+        while (RunRetentionChunk([]() { return g_queue.IncrementalVacuum(256); }) > 0 &&
+            WaitForSingleObject(g_retentionStop, chunkPauseMs) == WAIT_TIMEOUT);
+
+        if (deleted > 0) {
+            std::wstring message = L"Фоновая очистка удалила записей: " + std::to_wstring(deleted);
+            HandleEvent(L"RETENTION_PASS", message.c_str(), false, false);
+        }
+        ReportStorageErrors();
+    } while (WaitForSingleObject(g_retentionStop, g_retentionPolicy.intervalSeconds * 1000) == WAIT_TIMEOUT);
+
+    return 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Старые экспортируемые функции (оставлены без изменений)
 ///////////////////////////////////////////////////////////////////////////////
@@ -208,7 +998,12 @@ extern "C" __declspec(dllexport) int __stdcall SendHttpRequestQueue(const wchar_
     std::wstring jsonBodyW(jsonBody, jsonLen);
     std::string jsonBodyUtf8 = WideToUtf8(jsonBodyW.c_str());
 
-    bool result = g_queue.AddToQueue(serverUrlW, jsonBodyUtf8, expectResponse);
+    if (!AdmitRequest(jsonBodyUtf8.size())) {
+        HandleEvent(L"QUEUE_ADD_REJECTED", L"Очередь переполнена, запрос отклонен", false, false);
+        return kQueueRejected;
+    }
+
+    bool result = EnqueueRequest(serverUrlW, jsonBodyUtf8, expectResponse);
 
     if (result) {
         std::wstring message = expectResponse ?
@@ -223,43 +1018,108 @@ extern "C" __declspec(dllexport) int __stdcall SendHttpRequestQueue(const wchar_
     return result ? 0 : 1;
 }
 
-extern "C" __declspec(dllexport) int __stdcall ProcessHttpQueue()
-{
-    HandleEvent(L"PROCESS_QUEUE_START", L"Запуск обработки очереди в фоновом режиме", false, false);
-
-    HANDLE hThread = CreateThread(NULL, 0, ProcessQueueThread, NULL, 0, NULL);
-    if (hThread) {
-        CloseHandle(hThread);
-        HandleEvent(L"PROCESS_QUEUE_SUCCESS", L"Фоновый поток запущен успешно", false, false);
-        return 0;
-    }
-    else {
-        HandleEvent(L"PROCESS_QUEUE_FAILED", L"Ошибка запуска фонового потока", false, false);
-        return 1;
-    }
-}
-
-extern "C" __declspec(dllexport) const wchar_t* __stdcall GetHttpResponse(const wchar_t* serverUrl, const wchar_t* jsonBody)
+extern "C" __declspec(dllexport) int __stdcall SendHttpRequestQueueKey(const wchar_t* serverUrl, const wchar_t* jsonBody, bool expectResponse, const wchar_t* coalesceKey)
 {
+    if (!coalesceKey || !*coalesceKey)
+        return SendHttpRequestQueue(serverUrl, jsonBody, expectResponse);
 
     if (!serverUrl || !jsonBody) {
-        HandleEvent(L"GET_RESPONSE_FAILED", L"Неверные параметры", false, false);
-        return L"ERROR: Invalid parameters";
+        HandleEvent(L"QUEUE_ADD_FAILED", L"Неверные параметры", false, false);
+        return 1;
     }
 
-    static thread_local std::wstring responseBuffer;
-
     size_t urlLen = std::min(wcslen(serverUrl), size_t(2048));
     size_t jsonLen = std::min(wcslen(jsonBody), size_t(8192));
+    size_t keyLen = std::min(wcslen(coalesceKey), size_t(256));
 
     std::wstring serverUrlW(serverUrl, urlLen);
     std::wstring jsonBodyW(jsonBody, jsonLen);
+    std::wstring coalesceKeyW(coalesceKey, keyLen);
     std::string jsonBodyUtf8 = WideToUtf8(jsonBodyW.c_str());
+    std::string coalesceKeyUtf8 = WideToUtf8(coalesceKeyW.c_str());
 
-    std::string response = g_queue.GetAndRemoveResponse(serverUrlW, jsonBodyUtf8);
+    if (!AdmitRequest(jsonBodyUtf8.size())) {
+        HandleEvent(L"QUEUE_ADD_REJECTED", L"Очередь переполнена, запрос отклонен", false, false);
+        return kQueueRejected;
+    }
 
-    if (!response.empty()) {
-        responseBuffer = Utf8ToWide(response.c_str());
+    // Запрос с ключом минует буфер в памяти: замена выполняется в хранилище
+    bool result = UseStorage()->AddToQueueCoalesced(serverUrlW, jsonBodyUtf8, expectResponse, coalesceKeyUtf8);
+
+    if (result) {
+        WakeQueueWorkers();
+        std::wstring message = L"Запрос с ключом " + coalesceKeyW + L" добавлен в очередь";
+        HandleEvent(L"QUEUE_ADD_SUCCESS", message.c_str(), false, false);
+    }
+    else {
+        HandleEvent(L"QUEUE_ADD_FAILED", L"Ошибка добавления в очередь", false, false);
+    }
+
+    return result ? 0 : 1;
+}
+
+// Проход очереди в отдельном потоке: отправка блокируется до таймаута сервера,
+// поэтому в общий пул проходы не ставятся. Вызовы ProcessHttpQueue объединяются:
+// пока идет проход, новый поток не создается, а идущий проход по окончании
+// выполняется еще раз и забирает запросы, добавленные во время него
+static DWORD WINAPI QueuePassThread(LPVOID lpParam) {
+    for (;;) {
+        LONG calls = g_queuePasses;
+        ProcessQueueThread(lpParam);
+        if (InterlockedCompareExchange(&g_queuePasses, 0, calls) == calls)
+            break;
+        InterlockedExchange(&g_queuePasses, 1);
+    }
+    return 0;
+}
+
+static int StartQueuePass()
+{
+    if (InterlockedIncrement(&g_queuePasses) > 1)
+        return 0;
+
+    HANDLE hThread = StartBackgroundThread(QueuePassThread);
+    if (!hThread) {
+        InterlockedExchange(&g_queuePasses, 0);
+        return 1;
+    }
+    CloseHandle(hThread);
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall ProcessHttpQueue()
+{
+    HandleEvent(L"PROCESS_QUEUE_START", L"Запуск обработки очереди в фоновом режиме", false, false);
+
+    int result = StartQueuePass();
+    if (result == 0)
+        HandleEvent(L"PROCESS_QUEUE_SUCCESS", L"Обработка очереди запланирована", false, false);
+    else
+        HandleEvent(L"PROCESS_QUEUE_FAILED", L"Ошибка запуска фонового потока", false, false);
+    return result;
+}
+
+extern "C" __declspec(dllexport) const wchar_t* __stdcall GetHttpResponse(const wchar_t* serverUrl, const wchar_t* jsonBody)
+{
+
+    if (!serverUrl || !jsonBody) {
+        HandleEvent(L"GET_RESPONSE_FAILED", L"Неверные параметры", false, false);
+        return L"ERROR: Invalid parameters";
+    }
+
+    static thread_local std::wstring responseBuffer;
+
+    size_t urlLen = std::min(wcslen(serverUrl), size_t(2048));
+    size_t jsonLen = std::min(wcslen(jsonBody), size_t(8192));
+
+    std::wstring serverUrlW(serverUrl, urlLen);
+    std::wstring jsonBodyW(jsonBody, jsonLen);
+    std::string jsonBodyUtf8 = WideToUtf8(jsonBodyW.c_str());
+
+    std::string response = g_queue.GetAndRemoveResponse(serverUrlW, jsonBodyUtf8);
+
+    if (!response.empty()) {
+        responseBuffer = Utf8ToWide(response.c_str());
         HandleEvent(L"GET_RESPONSE_SUCCESS", L"Ответ успешно получен из базы", false, false);
     }
     else {
@@ -275,7 +1135,7 @@ extern "C" __declspec(dllexport) int __stdcall CleanOldHttpItems(int hoursOld, b
     std::wstring startMsg = L"Начало очистки записей старше " + std::to_wstring(hoursOld) + L" часов";
     HandleEvent(L"CLEAN_START", startMsg.c_str(), false, false);
 
-    int result = g_queue.CleanOldItems(hoursOld, cleanResponses);
+    int result = CleanOldStorageItems(hoursOld, cleanResponses);
 
     std::wstring completeMsg = L"Очистка завершена. Удалено записей: " + std::to_wstring(result);
     HandleEvent(L"CLEAN_COMPLETE", completeMsg.c_str(), false, false);
@@ -285,7 +1145,9 @@ extern "C" __declspec(dllexport) int __stdcall CleanOldHttpItems(int hoursOld, b
 
 extern "C" __declspec(dllexport) int __stdcall GetOldHttpItemsCount(int hoursOld, bool checkResponses)
 {
-    int result = g_queue.GetOldItemsCount(hoursOld, checkResponses);
+    int result = checkResponses ?
+        g_queue.GetOldItemsCount(hoursOld, true) :
+        g_storage->GetOldQueueItemsCount(hoursOld);
 
     std::wstring type = checkResponses ? L"ответов" : L"записей в очереди";
     std::wstring countMsg = L"Найдено " + std::to_wstring(result) + L" " + type + L" старше " + std::to_wstring(hoursOld) + L" часов";
@@ -340,7 +1202,12 @@ extern "C" __declspec(dllexport) int __stdcall SendHttpRequestQueueEx(const wcha
     std::wstring jsonBodyW(jsonBody, jsonLen);
     std::string jsonBodyUtf8 = WideToUtf8(jsonBodyW.c_str());
 
-    bool result = g_queue.AddToQueue(serverUrlW, jsonBodyUtf8, expectResponse);
+    if (!AdmitRequest(jsonBodyUtf8.size())) {
+        HandleEvent(L"QUEUE_ADD_REJECTED", L"Очередь переполнена, запрос отклонен", useSendEvent, useQueueEvent);
+        return kQueueRejected;
+    }
+
+    bool result = EnqueueRequest(serverUrlW, jsonBodyUtf8, expectResponse);
 
     if (result) {
         std::wstring message = expectResponse ?
@@ -359,16 +1226,12 @@ extern "C" __declspec(dllexport) int __stdcall ProcessHttpQueueEx(bool useSendEv
 {
     HandleEvent(L"PROCESS_QUEUE_START", L"Запуск обработки очереди в фоновом режиме", useSendEvent, useQueueEvent);
 
-    HANDLE hThread = CreateThread(NULL, 0, ProcessQueueThread, NULL, 0, NULL);
-    if (hThread) {
-        CloseHandle(hThread);
-        HandleEvent(L"PROCESS_QUEUE_SUCCESS", L"Фоновый поток запущен успешно", useSendEvent, useQueueEvent);
-        return 0;
-    }
-    else {
+    int result = StartQueuePass();
+    if (result == 0)
+        HandleEvent(L"PROCESS_QUEUE_SUCCESS", L"Обработка очереди запланирована", useSendEvent, useQueueEvent);
+    else
         HandleEvent(L"PROCESS_QUEUE_FAILED", L"Ошибка запуска фонового потока", useSendEvent, useQueueEvent);
-        return 1;
-    }
+    return result;
 }
 
 extern "C" __declspec(dllexport) const wchar_t* __stdcall GetHttpResponseEx(const wchar_t* serverUrl, const wchar_t* jsonBody, bool useSendEvent, bool useQueueEvent)
@@ -406,7 +1269,7 @@ extern "C" __declspec(dllexport) int __stdcall CleanOldHttpItemsEx(int hoursOld,
     std::wstring startMsg = L"Начало очистки записей старше " + std::to_wstring(hoursOld) + L" часов";
     HandleEvent(L"CLEAN_START", startMsg.c_str(), useSendEvent, useQueueEvent);
 
-    int result = g_queue.CleanOldItems(hoursOld, cleanResponses);
+    int result = CleanOldStorageItems(hoursOld, cleanResponses);
 
     std::wstring completeMsg = L"Очистка завершена. Удалено записей: " + std::to_wstring(result);
     HandleEvent(L"CLEAN_COMPLETE", completeMsg.c_str(), useSendEvent, useQueueEvent);
@@ -416,7 +1279,9 @@ extern "C" __declspec(dllexport) int __stdcall CleanOldHttpItemsEx(int hoursOld,
 
 extern "C" __declspec(dllexport) int __stdcall GetOldHttpItemsCountEx(int hoursOld, bool checkResponses, bool useSendEvent, bool useQueueEvent)
 {
-    int result = g_queue.GetOldItemsCount(hoursOld, checkResponses);
+    int result = checkResponses ?
+        g_queue.GetOldItemsCount(hoursOld, true) :
+        g_storage->GetOldQueueItemsCount(hoursOld);
 
     std::wstring type = checkResponses ? L"ответов" : L"записей в очереди";
     std::wstring countMsg = L"Найдено " + std::to_wstring(result) + L" " + type + L" старше " + std::to_wstring(hoursOld) + L" часов";
@@ -426,6 +1291,877 @@ extern "C" __declspec(dllexport) int __stdcall GetOldHttpItemsCountEx(int hoursO
     return result;
 }
 
+extern "C" __declspec(dllexport) int __stdcall GetHttpQueueDepth(bool responses)
+{
+    if (responses)
+        return (int)g_queue.GetItemsCount(true);
+
+    return (int)(g_storage->GetQueueDepth() + g_writeBehind.GetBufferedCount());
+}
+
+extern "C" __declspec(dllexport) int __stdcall GetHttpQueueAgeHistogram(bool responses, int* counts, int maxBuckets)
+{
+    if (!counts || maxBuckets <= 0)
+        return GetHttpQueueDepth(responses);
+
+    if (responses)
+        return (int)g_queue.GetAgeHistogram(true, counts, maxBuckets);
+
+    // Запросы в буфере моложе интервала сброса и попадают в первую корзину
+    long long buffered = (long long)g_writeBehind.GetBufferedCount();
+    long long total = g_storage->GetQueueAgeHistogram(counts, maxBuckets);
+    counts[0] += (int)buffered;
+
+    return (int)(total + buffered);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Настройки хранения
+///////////////////////////////////////////////////////////////////////////////
+extern "C" __declspec(dllexport) int __stdcall SetHttpStorageCompression(bool enabled, int minBodySize)
+{
+    g_queue.SetCompression(enabled, minBodySize > 0 ? (size_t)minBodySize : 0);
+    // Большие пачки сжимаются в пуле потоков до передачи потоку записи
+    if (enabled)
+        GetWorkPool();
+
+    std::wstring message = enabled ?
+        L"Сжатие включено для тел от " + std::to_wstring(minBodySize) + L" байт" :
+        L"Сжатие отключено";
+    HandleEvent(L"STORAGE_COMPRESSION", message.c_str(), false, false);
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall SendHttpRequestQueueTtl(const wchar_t* serverUrl, const wchar_t* jsonBody, int responseTtlSeconds)
+{
+    if (!serverUrl || !jsonBody) {
+        HandleEvent(L"QUEUE_ADD_FAILED", L"Неверные параметры", false, false);
+        return 1;
+    }
+
+    size_t urlLen = std::min(wcslen(serverUrl), size_t(2048));
+    size_t jsonLen = std::min(wcslen(jsonBody), size_t(8192));
+
+    std::vector<QueueItem> items(1);
+    items[0].id = 0;
+    items[0].server_url.assign(serverUrl, urlLen);
+    items[0].json_body = WideToUtf8(std::wstring(jsonBody, jsonLen).c_str());
+    items[0].expect_response = true;
+    items[0].timestamp = time(nullptr);
+    items[0].response_ttl = responseTtlSeconds > 0 ? responseTtlSeconds : 0;
+
+    if (!AdmitRequest(items[0].json_body.size())) {
+        HandleEvent(L"QUEUE_ADD_REJECTED", L"Очередь переполнена, запрос отклонен", false, false);
+        return kQueueRejected;
+    }
+
+    // Срок хранения ответа сохраняется вместе с запросом, поэтому запрос минует буфер в памяти
+    bool result = UseStorage()->AddToQueueBatch(items) == 1;
+
+    if (result) {
+        WakeQueueWorkers();
+        std::wstring message = L"Запрос добавлен в очередь, ответ хранится " + std::to_wstring(responseTtlSeconds) + L" с";
+        HandleEvent(L"QUEUE_ADD_SUCCESS", message.c_str(), false, false);
+    }
+    else {
+        HandleEvent(L"QUEUE_ADD_FAILED", L"Ошибка добавления в очередь", false, false);
+    }
+
+    return result ? 0 : 1;
+}
+
+extern "C" __declspec(dllexport) int __stdcall SendHttpRequestQueueDeadline(const wchar_t* serverUrl, const wchar_t* jsonBody, bool expectResponse, int deadlineSeconds)
+{
+    if (!serverUrl || !jsonBody || deadlineSeconds <= 0) {
+        HandleEvent(L"QUEUE_ADD_FAILED", L"Неверные параметры", false, false);
+        return 1;
+    }
+
+    size_t urlLen = std::min(wcslen(serverUrl), size_t(2048));
+    size_t jsonLen = std::min(wcslen(jsonBody), size_t(8192));
+
+    std::vector<QueueItem> items(1);
+    items[0].id = 0;
+    items[0].server_url.assign(serverUrl, urlLen);
+    items[0].json_body = WideToUtf8(std::wstring(jsonBody, jsonLen).c_str());
+    items[0].expect_response = expectResponse;
+    items[0].timestamp = time(nullptr);
+    items[0].deadline = items[0].timestamp + deadlineSeconds;
+
+    if (!AdmitRequest(items[0].json_body.size())) {
+        HandleEvent(L"QUEUE_ADD_REJECTED", L"Очередь переполнена, запрос отклонен", false, false);
+        return kQueueRejected;
+    }
+
+    // Срок сохраняется вместе с запросом, поэтому запрос минует буфер в памяти
+    bool result = UseStorage()->AddToQueueBatch(items) == 1;
+
+    if (result) {
+        WakeQueueWorkers();
+        std::wstring message = L"Запрос добавлен в очередь, срок доставки " + std::to_wstring(deadlineSeconds) + L" с";
+        HandleEvent(L"QUEUE_ADD_SUCCESS", message.c_str(), false, false);
+    }
+    else {
+        HandleEvent(L"QUEUE_ADD_FAILED", L"Ошибка добавления в очередь", false, false);
+    }
+
+    return result ? 0 : 1;
+}
+
+extern "C" __declspec(dllexport) int __stdcall SendHttpRequestQueueDelayed(const wchar_t* serverUrl, const wchar_t* jsonBody, bool expectResponse, int delayMs)
+{
+    if (!serverUrl || !jsonBody || delayMs < 0) {
+        HandleEvent(L"QUEUE_ADD_FAILED", L"Неверные параметры", false, false);
+        return 1;
+    }
+
+    size_t urlLen = std::min(wcslen(serverUrl), size_t(2048));
+    size_t jsonLen = std::min(wcslen(jsonBody), size_t(8192));
+
+    std::vector<QueueItem> items(1);
+    items[0].id = 0;
+    items[0].server_url.assign(serverUrl, urlLen);
+    items[0].json_body = WideToUtf8(std::wstring(jsonBody, jsonLen).c_str());
+    items[0].expect_response = expectResponse;
+    items[0].timestamp = time(nullptr);
+    items[0].next_attempt_ms = delayMs > 0 ? TimingWheel::NowMs() + delayMs : 0;
+
+    if (!AdmitRequest(items[0].json_body.size())) {
+        HandleEvent(L"QUEUE_ADD_REJECTED", L"Очередь переполнена, запрос отклонен", false, false);
+        return kQueueRejected;
+    }
+
+    // Время отправки сохраняется вместе с запросом, поэтому запрос минует буфер в памяти.
+    // Обработчики будит расписание, когда наступит срок
+    bool result = UseStorage()->AddToQueueBatch(items) == 1;
+
+    if (result) {
+        if (delayMs == 0)
+            WakeQueueWorkers();
+        std::wstring message = L"Запрос добавлен в очередь, отправка через " + std::to_wstring(delayMs) + L" мс";
+        HandleEvent(L"QUEUE_ADD_SUCCESS", message.c_str(), false, false);
+    }
+    else {
+        HandleEvent(L"QUEUE_ADD_FAILED", L"Ошибка добавления в очередь", false, false);
+    }
+
+    return result ? 0 : 1;
+}
+
+extern "C" __declspec(dllexport) int __stdcall SetHttpResponseTtl(const wchar_t* serverUrl, int ttlSeconds)
+{
+    std::wstring serverUrlW = serverUrl ? std::wstring(serverUrl, std::min(wcslen(serverUrl), size_t(2048))) : std::wstring();
+    g_queue.SetResponseTtl(serverUrlW, ttlSeconds);
+
+    std::wstring message = L"Время хранения ответов " + (serverUrlW.empty() ? std::wstring(L"по умолчанию") : serverUrlW) +
+        L": " + (ttlSeconds > 0 ? std::to_wstring(ttlSeconds) + L" с" : std::wstring(L"без ограничения"));
+    HandleEvent(L"RESPONSE_TTL", message.c_str(), false, false);
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall SetHttpResponseLimit(int maxResponses)
+{
+    g_queue.SetResponseLimit(maxResponses);
+
+    std::wstring message = maxResponses > 0 ?
+        L"Хранится не больше " + std::to_wstring(maxResponses) + L" ответов" :
+        std::wstring(L"Количество ответов не ограничено");
+    HandleEvent(L"RESPONSE_LIMIT", message.c_str(), false, false);
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall SetHttpQueueDeduplication(bool enabled)
+{
+    g_queue.SetDeduplication(enabled);
+
+    HandleEvent(L"QUEUE_DEDUPLICATION", enabled ?
+        L"Повторяющиеся запросы не добавляются в очередь" :
+        L"Повторяющиеся запросы добавляются в очередь", false, false);
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall SetHttpQueueMaxAttempts(int maxAttempts)
+{
+    g_maxSendAttempts = maxAttempts > 0 ? maxAttempts : 0;
+
+    std::wstring message = g_maxSendAttempts > 0 ?
+        L"Запрос переносится в недоставленные после " + std::to_wstring(g_maxSendAttempts) + L" попыток или ошибки 4xx" :
+        std::wstring(L"Количество попыток отправки не ограничено");
+    HandleEvent(L"QUEUE_MAX_ATTEMPTS", message.c_str(), false, false);
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall SetHttpRetryBackoff(int baseMs, int maxMs)
+{
+    g_retryBaseMs = baseMs > 0 ? baseMs : 0;
+    g_queue.SetRetryBackoff(g_retryBaseMs, maxMs > 0 ? maxMs : g_retryBaseMs);
+
+    std::wstring message = g_retryBaseMs > 0 ?
+        L"Повтор неудачной отправки через " + std::to_wstring(g_retryBaseMs) + L" мс, пауза удваивается до " +
+        std::to_wstring(std::max(g_retryBaseMs, maxMs)) + L" мс" :
+        std::wstring(L"Неудачная отправка повторяется при следующем проходе очереди");
+    HandleEvent(L"QUEUE_RETRY_BACKOFF", message.c_str(), false, false);
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall GetHttpRetryScheduleStats(long long* values, int maxValues)
+{
+    TimingWheelStats stats;
+    g_retryWheel.GetStats(stats);
+
+    const long long fields[] = {
+        stats.scheduled, stats.next_due_ms, stats.expired, stats.loaded
+    };
+    const int fieldCount = sizeof(fields) / sizeof(fields[0]);
+
+    if (!values || maxValues <= 0)
+        return fieldCount;
+
+    int count = std::min(maxValues, fieldCount);
+    for (int i = 0; i < count; ++i)
+        values[i] = fields[i];
+
+    return count;
+}
+
+extern "C" __declspec(dllexport) int __stdcall ReplayHttpDeadLetters(int httpStatus, int maxItems)
+{
+    int replayed = g_queue.ReplayDeadLetters(httpStatus, maxItems);
+    if (replayed > 0)
+        WakeQueueWorkers();
+
+    std::wstring message = L"В очередь возвращено недоставленных запросов: " + std::to_wstring(replayed);
+    HandleEvent(L"DEAD_LETTER_REPLAY", message.c_str(), false, false);
+
+    return replayed;
+}
+
+extern "C" __declspec(dllexport) int __stdcall PurgeHttpDeadLetters(int httpStatus, int hoursOld)
+{
+    int purged = g_queue.PurgeDeadLetters(httpStatus, hoursOld);
+
+    std::wstring message = L"Удалено недоставленных запросов: " + std::to_wstring(purged);
+    HandleEvent(L"DEAD_LETTER_PURGE", message.c_str(), false, false);
+
+    return purged;
+}
+
+extern "C" __declspec(dllexport) int __stdcall GetHttpDeadLetterCount()
+{
+    return (int)g_queue.GetDeadLetterCount();
+}
+
+extern "C" __declspec(dllexport) int __stdcall SetHttpStorageOptions(long long mmapSize, int cacheSizeKb, int pageSize, int tempStore)
+{
+    StorageOptions options;
+    options.mmap_size = mmapSize;
+    options.cache_size_kb = cacheSizeKb;
+    options.page_size = pageSize;
+    options.temp_store = tempStore;
+
+    bool applied = g_queue.SetStorageOptions(options);
+    ReportStorageErrors();
+    if (!applied) {
+        HandleEvent(L"STORAGE_OPTIONS_FAILED", L"Ошибка применения параметров базы", false, false);
+        return 1;
+    }
+
+    std::wstring message = L"Параметры базы: mmap_size " + std::to_wstring(mmapSize) +
+        L", cache_size " + std::to_wstring(cacheSizeKb) + L" КБ, page_size " + std::to_wstring(pageSize) +
+        L", temp_store " + std::to_wstring(tempStore);
+    HandleEvent(L"STORAGE_OPTIONS", message.c_str(), false, false);
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall SetHttpStorageInstance(const wchar_t* instanceName)
+{
+    // В имени файла оставляем только латиницу, цифры, '_' и '-'
+    std::string instance;
+    for (const wchar_t* p = instanceName; p && *p; ++p) {
+        wchar_t c = *p;
+        if ((c >= L'A' && c <= L'Z') || (c >= L'a' && c <= L'z') || (c >= L'0' && c <= L'9') || c == L'_' || c == L'-')
+            instance += (char)c;
+    }
+
+    std::string path = instance.empty() ? "c:\\gcore\\data.db" : "c:\\gcore\\data_" + instance + ".db";
+    if (path == g_queue.GetDatabasePath())
+        return 0;
+
+    bool reopened = g_queue.Reopen(path);
+    ReportStorageErrors();
+    if (!reopened) {
+        HandleEvent(L"STORAGE_INSTANCE_FAILED", L"Ошибка открытия базы экземпляра", false, false);
+        return 1;
+    }
+
+    std::wstring message = L"База очереди: " + std::wstring(path.begin(), path.end());
+    HandleEvent(L"STORAGE_INSTANCE", message.c_str(), false, false);
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall SetHttpQueueBackend(int backend)
+{
+    if (backend != QUEUE_BACKEND_SQLITE && backend != QUEUE_BACKEND_SEGMENT_LOG) {
+        HandleEvent(L"QUEUE_BACKEND_FAILED", L"Неизвестное хранилище очереди", false, false);
+        return 1;
+    }
+
+    // Смена хранилища после первого добавления, отправки или запуска обработчиков,
+    // разбора и буфера оставила бы их запросы в прежнем хранилище
+    EnterCriticalSection(&g_storageCs);
+    bool current = (backend == QUEUE_BACKEND_SQLITE) == (g_storage == &g_queue);
+    if (!current && g_storageInUse) {
+        LeaveCriticalSection(&g_storageCs);
+        HandleEvent(L"QUEUE_BACKEND_FAILED", L"Хранилище очереди уже используется, выберите его при старте", false, false);
+        return 1;
+    }
+
+    if (!current && backend == QUEUE_BACKEND_SEGMENT_LOG) {
+        if (!g_logQueue)
+            g_logQueue = new SegmentLogQueue();
+
+        if (!g_logQueue->IsOpen()) {
+            delete g_logQueue;
+            g_logQueue = NULL;
+            LeaveCriticalSection(&g_storageCs);
+            HandleEvent(L"QUEUE_BACKEND_FAILED", L"Ошибка открытия журнала очереди", false, false);
+            return 1;
+        }
+    }
+
+    if (!current)
+        g_storage = backend == QUEUE_BACKEND_SQLITE ? static_cast<QueueStorage*>(&g_queue) : g_logQueue;
+    LeaveCriticalSection(&g_storageCs);
+
+    HandleEvent(L"QUEUE_BACKEND", backend == QUEUE_BACKEND_SQLITE ?
+        L"Очередь запросов хранится в SQLite" : L"Очередь запросов хранится в журнале c:\\gcore\\log", false, false);
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall SetHttpQueueWriteBehind(bool enabled, int flushIntervalMs, int capacity)
+{
+    g_flushIntervalMs = flushIntervalMs > 0 ? flushIntervalMs : 1000;
+
+    if (!enabled) {
+        StopFlushThread();
+        // Запросы, добавленные во время остановки потока
+        FlushWriteBehind(true);
+
+        HandleEvent(L"WRITE_BEHIND_STOP", L"Запись очереди в хранилище снова синхронная", false, false);
+        return 0;
+    }
+
+    UseStorage();
+    g_writeBehind.Enable(capacity > 0 ? (size_t)capacity : 4096);
+
+    // Повторный вызов только обновляет интервал сброса. Поток, остановленный
+    // ShutdownGCore по таймауту, дожидается здесь и запускается заново
+    if (g_flushThread) {
+        if (WaitForSingleObject(g_flushStop, 0) == WAIT_TIMEOUT)
+            return 0;
+        StopFlushThread();
+    }
+
+    g_flushStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+    g_flushWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+    g_flushThread = (g_flushStop && g_flushWake) ? StartBackgroundThread(FlushThread) : NULL;
+
+    if (!g_flushThread) {
+        g_writeBehind.Disable();
+        if (g_flushStop) CloseHandle(g_flushStop);
+        if (g_flushWake) CloseHandle(g_flushWake);
+        g_flushStop = NULL;
+        g_flushWake = NULL;
+        FlushWriteBehind(true);
+        HandleEvent(L"WRITE_BEHIND_FAILED", L"Ошибка запуска потока записи очереди", false, false);
+        return 1;
+    }
+
+    std::wstring message = L"Буфер очереди включен, емкость " + std::to_wstring(g_writeBehind.GetCapacity()) +
+        L", сброс каждые " + std::to_wstring(g_flushIntervalMs) + L" мс";
+    HandleEvent(L"WRITE_BEHIND_START", message.c_str(), false, false);
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall FlushHttpQueue()
+{
+    return FlushWriteBehind(true);
+}
+
+extern "C" __declspec(dllexport) int __stdcall DrainHttpQueue()
+{
+    // Разбор уже идет: новые запросы он подхватит сам, так как идет по возрастанию id
+    if (g_drainThread && WaitForSingleObject(g_drainThread, 0) == WAIT_TIMEOUT)
+        return 0;
+
+    if (g_drainThread) {
+        CloseHandle(g_drainThread);
+        g_drainThread = NULL;
+    }
+
+    if (!g_drainStop)
+        g_drainStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (g_drainStop) {
+        ResetEvent(g_drainStop);
+        GetWorkPool();
+        g_drainThread = StartBackgroundThread(DrainQueueThread);
+    }
+
+    if (!g_drainThread) {
+        HandleEvent(L"QUEUE_DRAIN_FAILED", L"Ошибка запуска разбора очереди", false, false);
+        return 1;
+    }
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall StopHttpQueueDrain()
+{
+    if (!g_drainThread)
+        return 0;
+
+    SetEvent(g_drainStop);
+    WaitForSingleObject(g_drainThread, INFINITE);
+    CloseHandle(g_drainThread);
+    g_drainThread = NULL;
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall SetHttpQueueConcurrency(int maxInFlight, int maxPerHost)
+{
+    if (!g_dispatcher) {
+        g_dispatcher = new QueueDispatcher();
+        g_dispatcher->SetAdaptive(&g_adaptive);
+    }
+
+    if (!g_dispatcher->Configure(maxInFlight, maxPerHost)) {
+        HandleEvent(L"QUEUE_CONCURRENCY_FAILED", L"Ошибка запуска потоков отправки, запросы отправляются по одному", false, false);
+        return 1;
+    }
+
+    std::wstring message = L"Одновременных отправок из очереди: " + std::to_wstring(g_dispatcher->GetMaxInFlight());
+    HandleEvent(L"QUEUE_CONCURRENCY_SET", message.c_str(), false, false);
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall SetHttpAdaptiveConcurrency(bool enabled)
+{
+    g_adaptive.SetEnabled(enabled);
+
+    std::wstring message = !enabled ?
+        std::wstring(L"Лимит одновременных отправок на хост постоянный") :
+        g_dispatcher && g_dispatcher->GetMaxInFlight() > 1 ?
+        std::wstring(L"Лимит одновременных отправок на хост подстраивается по времени ответа и ошибкам") :
+        std::wstring(L"Лимит на хост будет подстраиваться после SetHttpQueueConcurrency больше 1");
+    HandleEvent(L"QUEUE_ADAPTIVE_CONCURRENCY", message.c_str(), false, false);
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall GetHttpConcurrencyStats(int index, wchar_t* host, int hostSize, long long* values, int maxValues)
+{
+    std::vector<HostConcurrencyStats> stats;
+    g_adaptive.GetStats(stats);
+
+    if (index < 0 || index >= (int)stats.size())
+        return (int)stats.size();
+
+    const HostConcurrencyStats& item = stats[index];
+    if (host && hostSize > 0)
+        wcsncpy_s(host, hostSize, item.host.c_str(), _TRUNCATE);
+
+    const long long fields[] = {
+        item.limit, item.rtt_us, item.min_rtt_us, item.successes, item.failures, item.overloads, item.decreases
+    };
+    const int fieldCount = sizeof(fields) / sizeof(fields[0]);
+
+    if (values && maxValues > 0) {
+        int count = std::min(maxValues, fieldCount);
+        for (int i = 0; i < count; ++i)
+            values[i] = fields[i];
+    }
+
+    return (int)stats.size();
+}
+
+extern "C" __declspec(dllexport) int __stdcall SetHttpQueueBatching(const wchar_t* serverUrl, int format, int maxItems, int maxBytes)
+{
+    if (format != ENVELOPE_NONE && format != ENVELOPE_JSON_ARRAY && format != ENVELOPE_NDJSON) {
+        HandleEvent(L"QUEUE_BATCHING_FAILED", L"Неизвестный формат объединения запросов", false, false);
+        return 1;
+    }
+
+    std::wstring serverUrlW = serverUrl ? std::wstring(serverUrl, std::min(wcslen(serverUrl), size_t(2048))) : std::wstring();
+    g_envelopes.Set(serverUrlW, format, maxItems, maxBytes);
+
+    std::wstring target = serverUrlW.empty() ? std::wstring(L"по умолчанию") : serverUrlW;
+    std::wstring message = format == ENVELOPE_NONE ?
+        L"Запросы " + target + L" отправляются по одному" :
+        L"Запросы " + target + L" объединяются в " + (format == ENVELOPE_JSON_ARRAY ? L"JSON-массив" : L"NDJSON") +
+        L": до " + std::to_wstring(maxItems > 0 ? maxItems : EnvelopeSettings::kDefaultMaxItems) + L" запросов, до " +
+        std::to_wstring(maxBytes > 0 ? maxBytes : EnvelopeSettings::kDefaultMaxBytes) + L" байт";
+    HandleEvent(L"QUEUE_BATCHING_SET", message.c_str(), false, false);
+
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall SetHttpRateLimit(const wchar_t* host, double requestsPerSecond, int burst)
+{
+    std::wstring hostW = host ? host : L"";
+    g_rateLimiter.SetLimit(hostW, requestsPerSecond, burst);
+
+    wchar_t rate[32];
+    swprintf(rate, _countof(rate), L"%g", requestsPerSecond);
+
+    std::wstring target = hostW.empty() ? std::wstring(L"по умолчанию") : L"для " + hostW;
+    std::wstring message = requestsPerSecond > 0 ?
+        L"Лимит отправки " + target + L": " + rate + L" запросов/с, подряд " + std::to_wstring(std::max(burst, 1)) :
+        L"Лимит отправки " + target + L" снят";
+    HandleEvent(L"RATE_LIMIT_SET", message.c_str(), false, false);
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall StopQueueWorkers()
+{
+    if (g_workerThreads.empty())
+        return 0;
+
+    SetEvent(g_workerStop);
+    // WaitForMultipleObjects ограничен MAXIMUM_WAIT_OBJECTS, ждем потоки по одному
+    for (size_t i = 0; i < g_workerThreads.size(); ++i) {
+        WaitForSingleObject(g_workerThreads[i], INFINITE);
+        CloseHandle(g_workerThreads[i]);
+    }
+    g_workerThreads.clear();
+
+    g_retryWheel.SetWakeEvent(NULL);
+    CloseHandle(g_workerStop);
+    CloseHandle(g_workerWake);
+    g_workerStop = NULL;
+    g_workerWake = NULL;
+
+    HandleEvent(L"QUEUE_WORKERS_STOP", L"Обработчики очереди остановлены", false, false);
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall StartQueueWorkers(int workerCount)
+{
+    workerCount = std::max(1, std::min(workerCount, 16));
+
+    // Повторный вызов с тем же количеством ничего не меняет. Обработчики,
+    // остановленные ShutdownGCore по таймауту, дожидаются здесь и запускаются заново
+    if ((int)g_workerThreads.size() == workerCount && WaitForSingleObject(g_workerStop, 0) == WAIT_TIMEOUT)
+        return 0;
+    StopQueueWorkers();
+    UseStorage();
+    // Ответы на отправленные запросы сохраняет пул, обработчики сразу берут следующие
+    GetWorkPool();
+
+    g_workerStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+    g_workerWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (g_workerStop && g_workerWake) {
+        // Расписание восстанавливается из базы: отложенные до перезапуска запросы
+        // отправляются в свое время без опроса базы
+        g_retryWheel.SetWakeEvent(g_workerWake);
+        g_queue.SetRetryWheel(&g_retryWheel);
+
+        for (int i = 0; i < workerCount; ++i) {
+            HANDLE thread = StartBackgroundThread(QueueWorkerThread);
+            if (!thread)
+                break;
+            g_workerThreads.push_back(thread);
+        }
+    }
+
+    if ((int)g_workerThreads.size() != workerCount) {
+        if (g_workerThreads.empty()) {
+            g_retryWheel.SetWakeEvent(NULL);
+            if (g_workerStop) CloseHandle(g_workerStop);
+            if (g_workerWake) CloseHandle(g_workerWake);
+            g_workerStop = NULL;
+            g_workerWake = NULL;
+        }
+        else {
+            StopQueueWorkers();
+        }
+        HandleEvent(L"QUEUE_WORKERS_FAILED", L"Ошибка запуска обработчиков очереди", false, false);
+        return 1;
+    }
+
+    // Запросы, накопленные до запуска, обрабатываются сразу
+    SetEvent(g_workerWake);
+
+    std::wstring message = L"Запущено обработчиков очереди: " + std::to_wstring(workerCount);
+    HandleEvent(L"QUEUE_WORKERS_START", message.c_str(), false, false);
+    return 0;
+}
+
+extern "C" __declspec(dllexport) long long __stdcall GetHttpStorageBytes(bool responses)
+{
+    return g_queue.GetStoredBytes(responses);
+}
+
+extern "C" __declspec(dllexport) int __stdcall GetHttpStorageStats(long long* values, int maxValues, bool reset)
+{
+    StorageStats stats;
+    g_queue.GetStorageStats(stats, reset);
+
+    const long long fields[] = {
+        stats.write_commands, stats.write_groups, stats.write_wait_us, stats.write_wait_max_us,
+        stats.write_queue_max, stats.write_queue_length,
+        stats.read_commands, stats.read_wait_us, stats.read_wait_max_us, stats.reader_connections,
+        stats.coalesced_requests, stats.duplicate_requests, stats.busy_waits,
+        stats.expired_responses, stats.evicted_responses,
+        stats.deadline_on_time, stats.deadline_late, stats.deadline_expired
+    };
+    const int fieldCount = sizeof(fields) / sizeof(fields[0]);
+
+    if (!values || maxValues <= 0)
+        return fieldCount;
+
+    int count = std::min(maxValues, fieldCount);
+    for (int i = 0; i < count; ++i)
+        values[i] = fields[i];
+
+    return count;
+}
+
+extern "C" __declspec(dllexport) long long __stdcall ExportHttpQueue(const wchar_t* filePath, bool includeResponses)
+{
+    if (!filePath || !*filePath)
+        return -1;
+
+    // Запросы из буфера в памяти тоже попадают в выгрузку
+    if (g_storage == &g_queue)
+        FlushWriteBehind(true);
+
+    long long exported = g_queue.ExportArchive(filePath, includeResponses);
+    if (exported < 0) {
+        HandleEvent(L"QUEUE_EXPORT_FAILED", (std::wstring(L"Ошибка выгрузки очереди в ") + filePath).c_str(), false, false);
+        return -1;
+    }
+
+    std::wstring message = L"Выгружено записей: " + std::to_wstring(exported) + L" в " + filePath;
+    HandleEvent(L"QUEUE_EXPORT", message.c_str(), false, false);
+
+    return exported;
+}
+
+extern "C" __declspec(dllexport) long long __stdcall ImportHttpQueue(const wchar_t* filePath)
+{
+    if (!filePath || !*filePath)
+        return -1;
+
+    long long imported = g_queue.ImportArchive(filePath);
+    if (imported < 0) {
+        HandleEvent(L"QUEUE_IMPORT_FAILED", (std::wstring(L"Ошибка загрузки очереди из ") + filePath).c_str(), false, false);
+        return -1;
+    }
+    if (imported > 0)
+        WakeQueueWorkers();
+
+    std::wstring message = L"Загружено записей: " + std::to_wstring(imported) + L" из " + filePath;
+    HandleEvent(L"QUEUE_IMPORT", message.c_str(), false, false);
+
+    return imported;
+}
+
+extern "C" __declspec(dllexport) int __stdcall SetHttpQueueBackpressure(int policy, int highItems, int lowItems, int highMb, int lowMb, int blockTimeoutMs)
+{
+    if (policy < BACKPRESSURE_NONE || policy > BACKPRESSURE_BLOCK) {
+        HandleEvent(L"QUEUE_BACKPRESSURE_FAILED", L"Неизвестная политика переполнения очереди", false, false);
+        return 1;
+    }
+
+    // Средний размер тела для оценки объема берется из хранилища один раз
+    long long depth = g_storage->GetQueueDepth();
+    long long bytes = policy != BACKPRESSURE_NONE && highMb > 0 && g_storage == &g_queue ? g_queue.GetStoredBytes(false) : 0;
+    g_backpressure.Configure(policy, std::max(0, highItems), std::max(0, lowItems),
+                             std::max(0, highMb) * 1024LL * 1024LL, std::max(0, lowMb) * 1024LL * 1024LL,
+                             (DWORD)std::max(0, blockTimeoutMs), depth, bytes);
+
+    std::wstring message = policy == BACKPRESSURE_NONE ? std::wstring(L"Очередь не ограничена") :
+        L"Граница очереди " + std::to_wstring(highItems) + L" запросов, " + std::to_wstring(highMb) +
+        L" МБ, политика " + std::to_wstring(policy);
+    HandleEvent(L"QUEUE_BACKPRESSURE_SET", message.c_str(), false, false);
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall GetHttpBackpressureStats(long long* values, int maxValues)
+{
+    BackpressureStats stats;
+    g_backpressure.GetStats(stats);
+
+    const long long fields[] = {
+        stats.overloaded ? 1 : 0, stats.depth, stats.bytes,
+        stats.rejected, stats.dropped, stats.blocked, stats.block_timeouts
+    };
+    const int fieldCount = sizeof(fields) / sizeof(fields[0]);
+
+    if (!values || maxValues <= 0)
+        return fieldCount;
+
+    int count = std::min(maxValues, fieldCount);
+    for (int i = 0; i < count; ++i)
+        values[i] = fields[i];
+
+    return count;
+}
+
+extern "C" __declspec(dllexport) int __stdcall SetWorkPoolOptions(int threads, long long affinityMask, int priority)
+{
+    if (priority < THREAD_PRIORITY_IDLE || priority > THREAD_PRIORITY_TIME_CRITICAL) {
+        HandleEvent(L"WORK_POOL_FAILED", L"Недопустимый приоритет потоков пула", false, false);
+        return 1;
+    }
+
+    // Перезапуск дожидается задач, уже поставленных в пул
+    WorkStealingPool* pool = GetWorkPool();
+    if (!pool->Start(threads, (DWORD_PTR)affinityMask, priority)) {
+        HandleEvent(L"WORK_POOL_FAILED", L"Ошибка запуска потоков пула", false, false);
+        return 1;
+    }
+
+    std::wstring message = L"Потоков в пуле: " + std::to_wstring(pool->GetThreadCount());
+    HandleEvent(L"WORK_POOL_SET", message.c_str(), false, false);
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall GetWorkPoolStats(long long* values, int maxValues)
+{
+    WorkPoolStats stats = { 0, 0, 0, 0, 0 };
+    if (g_workPool)
+        g_workPool->GetStats(stats);
+
+    const long long fields[] = {
+        stats.threads, stats.submitted, stats.executed, stats.stolen, stats.inline_executed
+    };
+    const int fieldCount = sizeof(fields) / sizeof(fields[0]);
+
+    if (!values || maxValues <= 0)
+        return fieldCount;
+
+    int count = std::min(maxValues, fieldCount);
+    for (int i = 0; i < count; ++i)
+        values[i] = fields[i];
+
+    return count;
+}
+
+extern "C" __declspec(dllexport) int __stdcall StartHttpRetention(int maxAgeHours, int maxSizeMb, int intervalSeconds)
+{
+    g_retentionPolicy.maxAgeHours = maxAgeHours > 0 ? maxAgeHours : 24;
+    g_retentionPolicy.maxSizeBytes = (maxSizeMb > 0 ? maxSizeMb : 100) * 1024LL * 1024LL;
+    g_retentionPolicy.intervalSeconds = intervalSeconds > 0 ? intervalSeconds : 60;
+
+    // Повторный вызов только обновляет параметры работающего потока. Поток,
+    // остановленный ShutdownGCore по таймауту, дожидается здесь и запускается заново
+    if (g_retentionThread) {
+        if (WaitForSingleObject(g_retentionStop, 0) == WAIT_TIMEOUT)
+            return 0;
+        StopHttpRetention();
+    }
+
+    GetWorkPool();
+    g_retentionStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+    g_retentionThread = g_retentionStop ? StartBackgroundThread(RetentionThread) : NULL;
+
+    if (!g_retentionThread) {
+        if (g_retentionStop) {
+            CloseHandle(g_retentionStop);
+            g_retentionStop = NULL;
+        }
+        HandleEvent(L"RETENTION_FAILED", L"Ошибка запуска потока очистки", false, false);
+        return 1;
+    }
+
+    HandleEvent(L"RETENTION_START", L"Фоновая очистка базы запущена", false, false);
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall StopHttpRetention()
+{
+    if (!g_retentionThread)
+        return 0;
+
+    SetEvent(g_retentionStop);
+    WaitForSingleObject(g_retentionThread, INFINITE);
+    CloseHandle(g_retentionThread);
+    CloseHandle(g_retentionStop);
+    g_retentionThread = NULL;
+    g_retentionStop = NULL;
+
+    HandleEvent(L"RETENTION_STOP", L"Фоновая очистка базы остановлена", false, false);
+    return 0;
+}
+
+extern "C" __declspec(dllexport) int __stdcall EnableHttpIncrementalVacuum()
+{
+    bool enabled = g_queue.EnableIncrementalVacuum();
+    ReportStorageErrors();
+
+    HandleEvent(enabled ? L"STORAGE_VACUUM_MODE" : L"STORAGE_VACUUM_MODE_FAILED",
+        enabled ? L"База переведена в режим auto_vacuum = INCREMENTAL" : L"Ошибка перевода базы в режим auto_vacuum = INCREMENTAL",
+        false, false);
+    return enabled ? 0 : 1;
+}
+
+extern "C" __declspec(dllexport) int __stdcall ShutdownGCore(int timeoutMs)
+{
+    DWORD timeout = timeoutMs > 0 ? (DWORD)timeoutMs : 0;
+
+    // Все фоновые потоки останавливаются между запросами; то, что не отправлено,
+    // остается в очереди или возвращается в нее
+    SetEvent(g_shutdownStop);
+    if (g_workerStop) SetEvent(g_workerStop);
+    if (g_drainStop) SetEvent(g_drainStop);
+    if (g_retentionStop) SetEvent(g_retentionStop);
+    if (g_flushStop) SetEvent(g_flushStop);
+
+    bool stopped = WaitForSingleObject(g_backgroundIdle, timeout) == WAIT_OBJECT_0;
+    int cancelled = 0;
+    if (!stopped) {
+        // Запросы в полете прерываются: их записи не удаляются из очереди и будут
+        // отправлены при следующем запуске
+        cancelled = CancelHttpRequests(true);
+        stopped = WaitForSingleObject(g_backgroundIdle, kShutdownCancelGraceMs) == WAIT_OBJECT_0;
+    }
+
+    int flushed = FlushWriteBehind(true);
+
+    if (stopped) {
+        // Потоки уже вышли: остается закрыть их описатели
+        StopFlushThread();
+        StopQueueWorkers();
+        StopHttpQueueDrain();
+        StopHttpRetention();
+
+        // Потоки, ожидающие работы внутри библиотеки: их тоже никто больше не использует
+        if (g_dispatcher)
+            g_dispatcher->Stop();
+        if (g_workPool)
+            g_workPool->Suspend();
+        g_queue.StopWriter();
+    }
+
+    // Оставшиеся потоки уже получили сигнал остановки своих циклов; разовые проходы
+    // очереди завершат текущую пачку, а запросы снова можно отправлять
+    CancelHttpRequests(false);
+    ResetEvent(g_shutdownStop);
+
+    std::wstring message = (stopped ? L"Фоновые потоки остановлены" : L"Фоновые потоки не остановились за отведенное время") +
+        std::wstring(L". Прервано запросов: ") + std::to_wstring(cancelled) + L", сохранено из буфера: " + std::to_wstring(flushed);
+    HandleEvent(L"GCORE_SHUTDOWN", message.c_str(), false, false);
+    return stopped ? 0 : 1;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Точка входа DLL
 ///////////////////////////////////////////////////////////////////////////////
@@ -435,9 +2171,34 @@ BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserv
     {
     case DLL_PROCESS_ATTACH:
         InitializeEventsSystem();
+        InitializeCriticalSection(&g_inFlightCs);
+        InitializeCriticalSection(&g_storageCs);
+        InitializeCriticalSection(&g_backgroundCs);
+        g_backgroundIdle = CreateEvent(NULL, TRUE, TRUE, NULL);
+        g_shutdownStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (!g_backgroundIdle || !g_shutdownStop)
+            return FALSE;
         break;
     case DLL_PROCESS_DETACH:
+        // Каждый поток библиотеки держит ссылку на модуль (CreateModuleThread), поэтому
+        // FreeLibrary выгружает DLL, только когда все ее потоки вышли; при завершении
+        // процесса потоки могут еще работать. Под loader lock потоки ждать нельзя
+        // (поток при выходе ждет loader lock): сигнализируем об остановке, а буфер,
+        // не сохраненный ShutdownGCore или FlushHttpQueue, сохраняем без потока записи и пула
+        g_writeBehind.Disable();
+        FlushWriteBehindOnDetach();
+        if (g_retentionStop)
+            SetEvent(g_retentionStop);
+        if (g_flushStop)
+            SetEvent(g_flushStop);
+        if (g_workerStop)
+            SetEvent(g_workerStop);
+        if (g_drainStop)
+            SetEvent(g_drainStop);
+        SetEvent(g_shutdownStop);
         DeleteCriticalSection(&g_eventsCs);
+        delete g_events;
+        g_events = NULL;
         break;
     case DLL_THREAD_ATTACH:
     case DLL_THREAD_DETACH:
@@ -6,86 +6,167 @@ extern "C" {
 #endif
 
 	//-----------------------------------------------------------------------------
-	//    
+	// Основные функции отправки запросов
 	//-----------------------------------------------------------------------------
 
 	/**
-	 * @brief  HTTP POST    
-	 * @param serverUrl URL     (UTF-16)
-	 * @param jsonBody JSON   (UTF-16)
-	 * @return 0  , 1  
+	 * @brief Отправляет HTTP POST запрос без ожидания ответа
+	 * @param serverUrl URL сервера для отправки запроса (UTF-16)
+	 * @param jsonBody JSON тело запроса (UTF-16)
+	 * @return 0 при успехе, 1 при ошибке
 	 */
 	__declspec(dllimport) int __stdcall SendHttpRequest(const wchar_t* serverUrl, const wchar_t* jsonBody);
 
 	/**
-	 * @brief  HTTP POST     
-	 * @param serverUrl URL     (UTF-16)
-	 * @param jsonBody JSON   (UTF-16)
-	 * @return      (UTF-16)    
+	 * @brief Отправляет HTTP POST запрос и возвращает ответ сервера
+	 * @param serverUrl URL сервера для отправки запроса (UTF-16)
+	 * @param jsonBody JSON тело запроса (UTF-16)
+	 * @return Ответ сервера в виде строки (UTF-16) или сообщение об ошибке
 	 */
 	__declspec(dllimport) const wchar_t* __stdcall SendHttpRequestResponse(const wchar_t* serverUrl, const wchar_t* jsonBody);
 
 	//-----------------------------------------------------------------------------
-	//     
+	// Функции работы с очередью запросов
 	//-----------------------------------------------------------------------------
 
 	/**
-	 * @brief       
-	 * @param serverUrl URL     (UTF-16)
-	 * @param jsonBody JSON   (UTF-16)
-	 * @param expectResponse      (true -  )
-	 * @return 0     , 1  
+	 * @brief Добавляет запрос в очередь для последующей отправки
+	 * @param serverUrl URL сервера для отправки запроса (UTF-16)
+	 * @param jsonBody JSON тело запроса (UTF-16)
+	 * @param expectResponse Флаг ожидания ответа от сервера (true - ждем ответ)
+	 * @return 0 при успешном добавлении в очередь, 1 при ошибке
 	 */
 	__declspec(dllimport) int __stdcall SendHttpRequestQueue(const wchar_t* serverUrl, const wchar_t* jsonBody, bool expectResponse);
 
 	/**
-	 * @brief     
-	 * @return 0    , 1  
+	 * @brief Запускает фоновую обработку очереди запросов
+	 * @return 0 при успешном запуске потока, 1 при ошибке
 	 */
 	__declspec(dllimport) int __stdcall ProcessHttpQueue();
 
 	/**
-	 * @brief         
-	 * @param serverUrl URL     (UTF-16)
-	 * @param jsonBody JSON     (UTF-16)
-	 * @return       (UTF-16)
+	 * @brief Получает ответ из базы данных и удаляет соответствующие записи
+	 * @param serverUrl URL сервера для поиска ответа (UTF-16)
+	 * @param jsonBody JSON тело запроса для поиска (UTF-16)
+	 * @return Найденный ответ или сообщение об ошибке (UTF-16)
 	 */
 	__declspec(dllimport) const wchar_t* __stdcall GetHttpResponse(const wchar_t* serverUrl, const wchar_t* jsonBody);
 
 	//-----------------------------------------------------------------------------
-	//    
+	// Функции управления базой данных
 	//-----------------------------------------------------------------------------
 
 	/**
-	 * @brief      
-	 * @param hoursOld      
-	 * @param cleanResponses     (true)    (false)
-	 * @return   
+	 * @brief Очищает старые записи из базы данных
+	 * @param hoursOld Возраст записей в часах для удаления
+	 * @param cleanResponses Флаг очистки таблицы ответов (true) или только очереди (false)
+	 * @return Количество удаленных записей
 	 */
 	__declspec(dllimport) int __stdcall CleanOldHttpItems(int hoursOld, bool cleanResponses);
 
 	/**
-	 * @brief       
-	 * @param hoursOld      
-	 * @param checkResponses     (true)    (false)
-	 * @return   
+	 * @brief Возвращает количество старых записей в базе данных
+	 * @param hoursOld Возраст записей в часах для проверки
+	 * @param checkResponses Флаг проверки таблицы ответов (true) или только очереди (false)
+	 * @return Количество найденных записей
 	 */
 	__declspec(dllimport) int __stdcall GetOldHttpItemsCount(int hoursOld, bool checkResponses);
 
+	/**
+	 * @brief Возвращает текущее количество записей без обращения к базе данных
+	 * @param responses true - таблица ответов, false - очередь запросов
+	 * @return Количество записей
+	 */
+	__declspec(dllimport) int __stdcall GetHttpQueueDepth(bool responses);
+
+	/**
+	 * @brief Заполняет гистограмму возраста записей по часам
+	 * @param responses true - таблица ответов, false - очередь запросов
+	 * @param counts Массив: counts[i] - количество записей возрастом i часов, последний элемент - все более старые
+	 * @param maxBuckets Размер массива counts
+	 * @return Общее количество записей
+	 */
+	__declspec(dllimport) int __stdcall GetHttpQueueAgeHistogram(bool responses, int* counts, int maxBuckets);
+
+	/**
+	 * @brief Запускает постоянные обработчики очереди
+	 * @param workerCount Количество потоков (1-16)
+	 * @return 0 при успехе, 1 при ошибке запуска потоков
+	 */
+	__declspec(dllimport) int __stdcall StartQueueWorkers(int workerCount);
+
+	/**
+	 * @brief Останавливает постоянные обработчики очереди
+	 * @return 0
+	 */
+	__declspec(dllimport) int __stdcall StopQueueWorkers();
+
+	/**
+	 * @brief Останавливает фоновые потоки библиотеки с ограничением по времени
+	 * @param timeoutMs Сколько ждать потоки, мс, затем запросы в полете прерываются
+	 * @return 0, если все потоки остановлены, 1, если часть потоков еще работает
+	 */
+	__declspec(dllimport) int __stdcall ShutdownGCore(int timeoutMs);
+
+	/**
+	 * @brief Ограничивает рост очереди: policy 0 - нет, 1 - отклонять, 2 - удалять старые,
+	 *        3 - удалять старые без ожидания ответа, 4 - ждать до blockTimeoutMs
+	 * @return 0 при успехе, 1 при неизвестной политике
+	 */
+	__declspec(dllimport) int __stdcall SetHttpQueueBackpressure(int policy, int highItems, int lowItems, int highMb, int lowMb, int blockTimeoutMs);
+
+	/**
+	 * @brief Состояние ограничения очереди (3 - отклонено, 5 - ожиданий, 6 - по таймауту)
+	 * @return Количество заполненных значений
+	 */
+	__declspec(dllimport) int __stdcall GetHttpBackpressureStats(long long* values, int maxValues);
+	__declspec(dllimport) int __stdcall SetWorkPoolOptions(int threads, long long affinityMask, int priority);
+	__declspec(dllimport) int __stdcall GetWorkPoolStats(long long* values, int maxValues);
+	__declspec(dllimport) int __stdcall SendHttpRequestQueueDelayed(const wchar_t* serverUrl, const wchar_t* jsonBody, bool expectResponse, int delayMs);
+	__declspec(dllimport) int __stdcall GetHttpRetryScheduleStats(long long* values, int maxValues);
+
+	/**
+	 * @brief Расширенное добавление в очередь; useQueueEvent - публиковать события в очередь событий
+	 * @return 0 при успехе, 1 при ошибке (в том числе при serverUrl == NULL)
+	 */
+	__declspec(dllimport) int __stdcall SendHttpRequestQueueEx(const wchar_t* serverUrl, const wchar_t* jsonBody, bool expectResponse, bool useSendEvent, bool useQueueEvent);
+	__declspec(dllimport) int __stdcall GetNextEvent(wchar_t* eventType, int typeSize, wchar_t* eventData, int dataSize);
+	__declspec(dllimport) int __stdcall ClearEvents();
+
+	/**
+	 * @brief Счетчики очереди событий (0 - в очереди, 1 - емкость, 2 - добавлено, 3 - отброшено)
+	 * @return Количество заполненных значений
+	 */
+	__declspec(dllimport) int __stdcall GetEventQueueStats(long long* values, int maxValues);
+
+	/**
+	 * @brief Добавляет запрос в очередь со сроком доставки
+	 * @param deadlineSeconds Срок доставки от текущего момента, секунд (> 0)
+	 * @return 0 при успехе, 1 при ошибке
+	 */
+	__declspec(dllimport) int __stdcall SendHttpRequestQueueDeadline(const wchar_t* serverUrl, const wchar_t* jsonBody, bool expectResponse, int deadlineSeconds);
+
+	/**
+	 * @brief Возвращает счетчики хранилища (15 - доставлено в срок, 16 - после срока,
+	 *        17 - удалено с истекшим сроком)
+	 * @return Количество заполненных значений
+	 */
+	__declspec(dllimport) int __stdcall GetHttpStorageStats(long long* values, int maxValues, bool reset);
+
 	//-----------------------------------------------------------------------------
-	//  callback-
+	// Функции callback-событий
 	//-----------------------------------------------------------------------------
 
 	/**
-	 * @brief  callback-     DLL
-	 * @param event_type   (UTF-16)
-	 * @param data   (UTF-16)
+	 * @brief Тип callback-функции для получения событий от DLL
+	 * @param event_type Тип события (UTF-16)
+	 * @param data Данные события (UTF-16)
 	 */
 	typedef void(__stdcall* EventCallback)(const wchar_t* event_type, const wchar_t* data);
 
 	/**
-	 * @brief  callback-     DLL
-	 * @param callback   callback-
+	 * @brief Устанавливает callback-функцию для получения событий от DLL
+	 * @param callback Указатель на callback-функцию
 	 */
 	__declspec(dllimport) void __stdcall SetEventCallback(EventCallback callback);
 
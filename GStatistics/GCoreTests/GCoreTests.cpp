@@ -1,4 +1,5 @@
-﻿#include <windows.h>
+﻿#include <winsock2.h>
+#include <windows.h>
 #include <io.h>
 #include <fcntl.h>
 #include <iostream>
@@ -8,6 +9,21 @@
 #include <algorithm>
 #include <map>
 #include "GCore.h"
+#include "../GCore/Compression.h"
+#include "../GCore/SQLiteQueue.h"
+#include "../GCore/SegmentLogQueue.h"
+#include "../GCore/WriteBehindQueue.h"
+#include "../GCore/RateLimiter.h"
+#include "../GCore/QueuePipeline.h"
+#include "../GCore/QueueDispatcher.h"
+#include "../GCore/QueueEnvelope.h"
+#include "../GCore/QueueBackpressure.h"
+#include "../GCore/WorkStealingPool.h"
+#include "../GCore/TimingWheel.h"
+#include "../GCore/MpscRing.h"
+
+#pragma comment(lib, "winhttp.lib")
+#pragma comment(lib, "ws2_32.lib")
 
 // Forward declarations
 void TestSendHttpRequest(const wchar_t* urlW);
@@ -21,6 +37,32 @@ void TestAllMethods(const wchar_t* urlW);
 void TestResponseWorkflow(const wchar_t* urlW);
 void TestDetailedResponseAnalysis(const wchar_t* urlW);
 void TestCallbackEvents();
+void BenchmarkCompression();
+void BenchmarkQueueStats();
+void BenchmarkQueueBackends();
+void BenchmarkWriteBehind();
+void BenchmarkStorageConcurrency();
+void BenchmarkQueueCoalescing();
+void TestDeadLetters();
+void BenchmarkStorageOptions();
+void BenchmarkPendingBatch();
+int RunEnqueueWorker(const wchar_t* dbPathW, int count);
+void BenchmarkMultiProcess();
+void BenchmarkQueueArchive();
+void TestResponseExpiry();
+void TestQueueWorkers(const wchar_t* urlW);
+void BenchmarkRateLimit();
+void BenchmarkPipelinedDrain();
+void BenchmarkConcurrentDispatch();
+void BenchmarkQueueBatching();
+void BenchmarkAdaptiveConcurrency();
+void TestDeadlineScheduling(const wchar_t* urlW);
+void TestBoundedShutdown();
+void TestQueueBackpressure();
+void BenchmarkWorkStealingPool();
+void TestRetrySchedule();
+void BenchmarkEventQueue();
+void TestSegmentLogAcks();
 void PrintMenu();
 int ReadMenuOption();
 
@@ -350,6 +392,2102 @@ void TestAllMethods(const wchar_t* urlW)
     std::wcout << L"\n=== Все тесты завершены ===\n";
 }
 
+// Формирует JSON статистики счета с заданным количеством ордеров
+std::string MakeStatisticsJson(int seed, int orders)
+{
+    std::string json = "{\"DateTime\":\"2024-01-01 12:00:" + std::to_string(10 + seed % 50) +
+        "\",\"AccountID\":\"1550256932\",\"BrokerName\":\"OnFin Ltd\",\"Balance\":" +
+        std::to_string(10000 + seed * 7 % 5000) + ".25,\"Equity\":" + std::to_string(9800 + seed * 13 % 5000) +
+        ".75,\"Orders\":[";
+
+    for (int i = 0; i < orders; ++i) {
+        if (i > 0) json += ",";
+        json += "{\"Ticket\":" + std::to_string(100000 + seed * 31 + i) +
+            ",\"Symbol\":\"" + (i % 3 == 0 ? "EURUSD" : (i % 3 == 1 ? "GBPUSD" : "XAUUSD")) +
+            "\",\"Type\":" + std::to_string(i % 2) + ",\"Lots\":0." + std::to_string(1 + i % 9) +
+            ",\"OpenPrice\":1.0" + std::to_string(8000 + (seed + i) * 17 % 1000) +
+            ",\"Profit\":" + std::to_string((seed + i) * 11 % 300) + ".5}";
+    }
+
+    return json + "]}";
+}
+
+void BenchmarkCompression()
+{
+    std::wcout << L"\n=== Бенчмарк сжатия тел запросов ===\n";
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+
+    const int iterations = 2000;
+    const int orderCounts[] = { 0, 5, 20, 100 };
+
+    for (int orders : orderCounts) {
+        std::vector<std::string> bodies;
+        for (int i = 0; i < iterations; ++i)
+            bodies.push_back(MakeStatisticsJson(i, orders));
+
+        std::vector<std::string> packed(bodies.size());
+        size_t rawBytes = 0, packedBytes = 0;
+
+        LARGE_INTEGER t0, t1, t2;
+        QueryPerformanceCounter(&t0);
+        for (size_t i = 0; i < bodies.size(); ++i) {
+            if (!CompressBody(bodies[i], packed[i]))
+                packed[i] = bodies[i];
+            rawBytes += bodies[i].size();
+            packedBytes += packed[i].size();
+        }
+        QueryPerformanceCounter(&t1);
+
+        int mismatches = 0;
+        for (size_t i = 0; i < packed.size(); ++i) {
+            std::string restored;
+            if (!DecompressBody(packed[i].data(), packed[i].size(), restored))
+                restored = packed[i];
+            if (restored != bodies[i]) mismatches++;
+        }
+        QueryPerformanceCounter(&t2);
+
+        double compressUs = (t1.QuadPart - t0.QuadPart) * 1000000.0 / freq.QuadPart / iterations;
+        double decompressUs = (t2.QuadPart - t1.QuadPart) * 1000000.0 / freq.QuadPart / iterations;
+
+        std::wcout << L"Ордеров: " << orders
+            << L" | средний размер: " << rawBytes / iterations << L" -> " << packedBytes / iterations << L" байт"
+            << L" (" << (rawBytes ? packedBytes * 100 / rawBytes : 0) << L"%)"
+            << L" | сжатие: " << compressUs << L" мкс"
+            << L" | распаковка: " << decompressUs << L" мкс"
+            << (mismatches ? L" | ❌ ошибок: " + std::to_wstring(mismatches) : L" | ✅") << L"\n";
+    }
+}
+
+void BenchmarkQueueStats()
+{
+    std::wcout << L"\n=== Счетчики глубины и возраста очереди ===\n";
+
+    const int maxBuckets = 25;
+    int counts[maxBuckets];
+
+    for (int responses = 0; responses < 2; ++responses) {
+        int total = GetHttpQueueAgeHistogram(responses != 0, counts, maxBuckets);
+        std::wcout << (responses ? L"Ответов: " : L"Записей в очереди: ") << total
+            << L" (GetHttpQueueDepth: " << GetHttpQueueDepth(responses != 0) << L")\n";
+        for (int i = 0; i < maxBuckets; ++i) {
+            if (counts[i] > 0)
+                std::wcout << L"  возраст " << i << (i == maxBuckets - 1 ? L"+ ч: " : L" ч: ") << counts[i] << L"\n";
+        }
+    }
+
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+
+    const int calls = 10000;
+    QueryPerformanceCounter(&t0);
+    for (int i = 0; i < calls; ++i)
+        GetOldHttpItemsCount(1 + i % 48, (i & 1) != 0);
+    QueryPerformanceCounter(&t1);
+
+    std::wcout << L"GetOldHttpItemsCount: " << (t1.QuadPart - t0.QuadPart) * 1000000.0 / freq.QuadPart / calls
+        << L" мкс на вызов (" << calls << L" вызовов)\n";
+}
+
+// Удаляет файлы временного хранилища бенчмарка
+void DeleteBenchmarkStorage(const std::string& dbPath, const std::string& logDir)
+{
+    const char* suffixes[] = { "", "-journal", "-wal", "-shm" };
+    for (const char* suffix : suffixes)
+        DeleteFileA((dbPath + suffix).c_str());
+
+    WIN32_FIND_DATAA findData;
+    HANDLE find = FindFirstFileA((logDir + "\\*").c_str(), &findData);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+                DeleteFileA((logDir + "\\" + findData.cFileName).c_str());
+        } while (FindNextFileA(find, &findData));
+        FindClose(find);
+    }
+    RemoveDirectoryA(logDir.c_str());
+}
+
+// Добавление, выборка пачками по 50 и подтверждение - как в ProcessQueueThread
+void RunQueueBackendBenchmark(const wchar_t* name, QueueStorage& storage, const std::vector<std::string>& bodies)
+{
+    LARGE_INTEGER freq, t0, t1, t2;
+    QueryPerformanceFrequency(&freq);
+
+    const std::wstring url = L"http://localhost:8080/statistics";
+    int added = 0, fetched = 0, removed = 0;
+
+    QueryPerformanceCounter(&t0);
+    for (const std::string& body : bodies) {
+        if (storage.AddToQueue(url, body, false)) added++;
+    }
+    QueryPerformanceCounter(&t1);
+
+    int removedInBatch = 0;
+    do {
+        std::vector<QueueItem> items = storage.GetPendingItems(50);
+        fetched += (int)items.size();
+        removedInBatch = 0;
+        for (const QueueItem& item : items) {
+            if (storage.RemoveFromQueue(item.id)) removedInBatch++;
+        }
+        removed += removedInBatch;
+    } while (removedInBatch > 0);
+    QueryPerformanceCounter(&t2);
+
+    double addSeconds = (t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart;
+    double drainSeconds = (t2.QuadPart - t1.QuadPart) / (double)freq.QuadPart;
+
+    std::wcout << name
+        << L" | добавление: " << (addSeconds > 0 ? (long long)(added / addSeconds) : 0) << L" запр/с"
+        << L" | выборка и подтверждение: " << (drainSeconds > 0 ? (long long)(removed / drainSeconds) : 0) << L" запр/с"
+        << L" | осталось: " << storage.GetQueueDepth()
+        << (added == (int)bodies.size() && removed == added ? L" | ✅" : L" | ❌ добавлено " +
+            std::to_wstring(added) + L", выбрано " + std::to_wstring(fetched) + L", удалено " + std::to_wstring(removed))
+        << L"\n";
+}
+
+// Количество сегментов в каталоге журнала
+int CountLogSegments(const std::string& logDir)
+{
+    int count = 0;
+    WIN32_FIND_DATAA findData;
+    HANDLE find = FindFirstFileA((logDir + "\\segment_*.log").c_str(), &findData);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            count++;
+        } while (FindNextFileA(find, &findData));
+        FindClose(find);
+    }
+    return count;
+}
+
+void TestSegmentLogAcks()
+{
+    std::wcout << L"\n=== Журнал очереди: подтверждения не по порядку и перезапуск ===\n";
+
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string logDir = std::string(tempPath) + "gcore_acks_log";
+    DeleteBenchmarkStorage(std::string(tempPath) + "gcore_acks.db", logDir);
+
+    // Первый запрос не отправляется, остальные подтверждаются вразнобой: все четные и вся
+    // вторая половина, от конца к началу
+    const int count = 3000;
+    int segmentsBefore = 0, segmentsAfter = 0;
+    long long expected = 0;
+    {
+        SegmentLogQueue logQueue(logDir, 4096);
+        if (!logQueue.IsOpen()) {
+            std::wcout << L"❌ Не удалось открыть " << Utf8ToWide(logDir.c_str()) << L"\n";
+            return;
+        }
+        for (int i = 0; i < count; ++i)
+            logQueue.AddToQueue(L"http://localhost:8080/statistics", MakeStatisticsJson(i, 1), false);
+        segmentsBefore = CountLogSegments(logDir);
+
+        for (int id = count; id >= 2; --id) {
+            if (id % 2 == 0 || id > count / 2)
+                logQueue.RemoveFromQueue(id);
+        }
+        expected = logQueue.GetQueueDepth();
+        segmentsAfter = CountLogSegments(logDir);
+    }
+
+    std::wcout << L"Сегментов: " << segmentsBefore << L", после подтверждений: " << segmentsAfter
+        << (segmentsAfter < segmentsBefore ? L" ✅" : L" ❌ неотправленный запрос держит сегменты") << L"\n";
+
+    // После перезапуска в очереди только неподтвержденные запросы
+    {
+        SegmentLogQueue logQueue(logDir, 4096);
+        std::vector<QueueItem> items = logQueue.GetPendingItems(count);
+        int resent = 0;
+        for (const QueueItem& item : items) {
+            if (item.id != 1 && (item.id % 2 == 0 || item.id > count / 2))
+                resent++;
+        }
+        std::wcout << L"После перезапуска: в очереди " << items.size() << L" из " << expected
+            << L", подтвержденных " << resent
+            << ((long long)items.size() == expected && resent == 0 ? L" ✅" : L" ❌") << L"\n";
+
+        for (const QueueItem& item : items)
+            logQueue.RemoveFromQueue(item.id);
+    }
+    {
+        SegmentLogQueue logQueue(logDir, 4096);
+        std::wcout << L"Все подтверждены: в очереди " << logQueue.GetQueueDepth() << L", сегментов "
+            << CountLogSegments(logDir) << (logQueue.GetQueueDepth() == 0 ? L" ✅" : L" ❌") << L"\n";
+    }
+
+    DeleteBenchmarkStorage(std::string(tempPath) + "gcore_acks.db", logDir);
+}
+
+void BenchmarkQueueBackends()
+{
+    std::wcout << L"\n=== Бенчмарк хранилищ очереди: SQLite и сегментированный журнал ===\n";
+
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string dbPath = std::string(tempPath) + "gcore_bench.db";
+    std::string logDir = std::string(tempPath) + "gcore_bench_log";
+
+    const int counts[] = { 1000, 10000 };
+    for (int count : counts) {
+        std::vector<std::string> bodies;
+        for (int i = 0; i < count; ++i)
+            bodies.push_back(MakeStatisticsJson(i, 5));
+
+        std::wcout << L"Запросов: " << count << L", средний размер: " << bodies[0].size() << L" байт\n";
+
+        DeleteBenchmarkStorage(dbPath, logDir);
+        {
+            SQLiteQueue sqliteQueue(dbPath);
+            RunQueueBackendBenchmark(L"  SQLite ", sqliteQueue, bodies);
+        }
+        {
+            SegmentLogQueue logQueue(logDir, 1024 * 1024);
+            if (logQueue.IsOpen())
+                RunQueueBackendBenchmark(L"  Журнал ", logQueue, bodies);
+            else
+                std::wcout << L"  Журнал | ❌ не удалось открыть " << Utf8ToWide(logDir.c_str()) << L"\n";
+        }
+        DeleteBenchmarkStorage(dbPath, logDir);
+    }
+}
+
+// Параметры потока-писателя для бенчмарка буфера
+struct WriteBehindProducer {
+    WriteBehindQueue* buffer;
+    const std::vector<std::string>* bodies;
+    int pushed;
+};
+
+DWORD WINAPI WriteBehindProducerThread(LPVOID lpParam)
+{
+    WriteBehindProducer* producer = static_cast<WriteBehindProducer*>(lpParam);
+    for (const std::string& body : *producer->bodies) {
+        if (producer->buffer->Push(L"http://localhost:8080/statistics", body, false))
+            producer->pushed++;
+    }
+    return 0;
+}
+
+void BenchmarkWriteBehind()
+{
+    std::wcout << L"\n=== Бенчмарк буфера очереди в памяти ===\n";
+
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string dbPath = std::string(tempPath) + "gcore_bench.db";
+    std::string logDir = std::string(tempPath) + "gcore_bench_log";
+
+    LARGE_INTEGER freq, t0, t1, t2;
+    QueryPerformanceFrequency(&freq);
+
+    const int count = 5000;
+    std::vector<std::string> bodies;
+    for (int i = 0; i < count; ++i)
+        bodies.push_back(MakeStatisticsJson(i, 5));
+
+    DeleteBenchmarkStorage(dbPath, logDir);
+    {
+        SQLiteQueue sqliteQueue(dbPath);
+        const std::wstring url = L"http://localhost:8080/statistics";
+
+        // Синхронная вставка: каждый вызов - отдельная транзакция SQLite
+        QueryPerformanceCounter(&t0);
+        for (const std::string& body : bodies)
+            sqliteQueue.AddToQueue(url, body, false);
+        QueryPerformanceCounter(&t1);
+        double syncUs = (t1.QuadPart - t0.QuadPart) * 1000000.0 / freq.QuadPart / count;
+
+        // Буфер: вызывающий поток только копирует запрос, сохранение - пачками по 500
+        WriteBehindQueue buffer;
+        buffer.Enable(count);
+
+        QueryPerformanceCounter(&t0);
+        for (const std::string& body : bodies)
+            buffer.Push(url, body, false);
+        QueryPerformanceCounter(&t1);
+
+        std::vector<QueueItem> batch;
+        int flushed = 0;
+        while (buffer.TakeBatch(batch, 500) > 0)
+            flushed += sqliteQueue.AddToQueueBatch(batch);
+        QueryPerformanceCounter(&t2);
+
+        double pushUs = (t1.QuadPart - t0.QuadPart) * 1000000.0 / freq.QuadPart / count;
+        double flushUs = (t2.QuadPart - t1.QuadPart) * 1000000.0 / freq.QuadPart / count;
+
+        std::wcout << L"Запросов: " << count << L"\n"
+            << L"  синхронная вставка: " << syncUs << L" мкс на вызов\n"
+            << L"  добавление в буфер: " << pushUs << L" мкс на вызов\n"
+            << L"  сохранение пачками: " << flushUs << L" мкс на запрос (сохранено " << flushed << L")\n";
+
+        // Несколько писателей одновременно: ни один запрос не должен потеряться
+        const int producers = 4;
+        WriteBehindProducer params[producers];
+        HANDLE threads[producers];
+        QueryPerformanceCounter(&t0);
+        for (int i = 0; i < producers; ++i) {
+            params[i].buffer = &buffer;
+            params[i].bodies = &bodies;
+            params[i].pushed = 0;
+            threads[i] = CreateThread(NULL, 0, WriteBehindProducerThread, &params[i], 0, NULL);
+        }
+
+        int drained = 0;
+        DWORD waitResult;
+        do {
+            waitResult = WaitForMultipleObjects(producers, threads, TRUE, 1);
+            drained += buffer.TakeBatch(batch, 500);
+        } while (waitResult == WAIT_TIMEOUT);
+        while (buffer.TakeBatch(batch, 500) > 0)
+            drained += (int)batch.size();
+        QueryPerformanceCounter(&t1);
+
+        int pushed = 0;
+        for (int i = 0; i < producers; ++i) {
+            pushed += params[i].pushed;
+            CloseHandle(threads[i]);
+        }
+
+        std::wcout << L"  " << producers << L" писателя: принято " << pushed << L" из " << producers * count
+            << L", извлечено " << drained << L" за " << (t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart << L" мс"
+            << (pushed == drained ? L" ✅" : L" ❌") << L"\n";
+    }
+    DeleteBenchmarkStorage(dbPath, logDir);
+}
+
+// Параметры потока нагрузки для бенчмарка конкуренции
+struct StorageLoadWorker {
+    SQLiteQueue* queue;
+    bool writer;
+    int operations;
+    int completed;
+};
+
+DWORD WINAPI StorageLoadThread(LPVOID lpParam)
+{
+    StorageLoadWorker* worker = static_cast<StorageLoadWorker*>(lpParam);
+    for (int i = 0; i < worker->operations; ++i) {
+        bool ok = worker->writer ?
+            worker->queue->AddToQueue(L"http://localhost:8080/statistics", MakeStatisticsJson(i, 5), false) :
+            !worker->queue->GetPendingItems(50).empty() || worker->queue->GetItemsCount(false) == 0;
+        if (ok) worker->completed++;
+    }
+    return 0;
+}
+
+void BenchmarkStorageConcurrency()
+{
+    std::wcout << L"\n=== Конкуренция за базу: поток записи и пул читателей ===\n";
+
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string dbPath = std::string(tempPath) + "gcore_bench.db";
+    std::string logDir = std::string(tempPath) + "gcore_bench_log";
+
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+
+    const int writerCounts[] = { 1, 4, 8 };
+    const int readers = 4;
+    const int operations = 500;
+
+    for (int writers : writerCounts) {
+        DeleteBenchmarkStorage(dbPath, logDir);
+        {
+            SQLiteQueue queue(dbPath);
+            std::vector<StorageLoadWorker> workers(writers + readers);
+            std::vector<HANDLE> threads;
+
+            QueryPerformanceCounter(&t0);
+            for (size_t i = 0; i < workers.size(); ++i) {
+                workers[i].queue = &queue;
+                workers[i].writer = (int)i < writers;
+                workers[i].operations = operations;
+                workers[i].completed = 0;
+                threads.push_back(CreateThread(NULL, 0, StorageLoadThread, &workers[i], 0, NULL));
+            }
+            WaitForMultipleObjects((DWORD)threads.size(), threads.data(), TRUE, INFINITE);
+            QueryPerformanceCounter(&t1);
+
+            int written = 0, read = 0;
+            for (size_t i = 0; i < workers.size(); ++i) {
+                (workers[i].writer ? written : read) += workers[i].completed;
+                CloseHandle(threads[i]);
+            }
+
+            StorageStats stats;
+            queue.GetStorageStats(stats, true);
+            double seconds = (t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart;
+
+            std::wcout << L"Писателей: " << writers << L", читателей: " << readers
+                << L" | записей: " << written << L" (" << (long long)(written / seconds) << L"/с)"
+                << L" | чтений: " << read << L" (" << (long long)(read / seconds) << L"/с)\n"
+                << L"  команд на транзакцию: " << (stats.write_groups ? (double)stats.write_commands / stats.write_groups : 0)
+                << L" | запись ср/макс: " << (stats.write_commands ? stats.write_wait_us / stats.write_commands : 0)
+                << L"/" << stats.write_wait_max_us << L" мкс"
+                << L" | очередь макс: " << stats.write_queue_max
+                << L" | ожидание читателя ср/макс: " << (stats.read_commands ? stats.read_wait_us / stats.read_commands : 0)
+                << L"/" << stats.read_wait_max_us << L" мкс\n";
+        }
+        DeleteBenchmarkStorage(dbPath, logDir);
+    }
+}
+
+void BenchmarkQueueCoalescing()
+{
+    std::wcout << L"\n=== Объединение запросов по ключу и отбрасывание повторов ===\n";
+
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string dbPath = std::string(tempPath) + "gcore_bench.db";
+    std::string logDir = std::string(tempPath) + "gcore_bench_log";
+
+    const std::wstring url = L"http://localhost:8080/statistics";
+    const int accounts = 10;
+    const int snapshots = 100;
+
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+
+    DeleteBenchmarkStorage(dbPath, logDir);
+    {
+        SQLiteQueue queue(dbPath);
+        queue.SetDeduplication(true);
+
+        // Каждый снимок счета отправляется с ключом AccountID, каждый третий повторяется
+        QueryPerformanceCounter(&t0);
+        for (int i = 0; i < snapshots; ++i) {
+            for (int account = 0; account < accounts; ++account) {
+                std::string body = MakeStatisticsJson(i * accounts + account, 5);
+                std::string key = "account-" + std::to_string(account);
+                queue.AddToQueueCoalesced(url, body, false, key);
+                if (i % 3 == 0)
+                    queue.AddToQueueCoalesced(url, body, false, key);
+            }
+        }
+        QueryPerformanceCounter(&t1);
+
+        StorageStats stats;
+        queue.GetStorageStats(stats, true);
+        long long depth = queue.GetQueueDepth();
+        int total = accounts * snapshots + accounts * ((snapshots + 2) / 3);
+
+        std::wcout << L"Добавлено: " << total << L" | в очереди: " << depth
+            << L" | заменено по ключу: " << stats.coalesced_requests
+            << L" | отброшено повторов: " << stats.duplicate_requests
+            << L" | " << (t1.QuadPart - t0.QuadPart) * 1000000.0 / freq.QuadPart / total << L" мкс на запрос\n";
+
+        std::wcout << (depth == accounts ? L"✅" : L"❌")
+            << L" Ожидается " << accounts << L" запросов: последний снимок каждого счета\n";
+    }
+    DeleteBenchmarkStorage(dbPath, logDir);
+}
+
+void TestDeadLetters()
+{
+    std::wcout << L"\n=== Недоставленные запросы: лимит попыток, возврат и удаление ===\n";
+
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string dbPath = std::string(tempPath) + "gcore_bench.db";
+    std::string logDir = std::string(tempPath) + "gcore_bench_log";
+
+    const std::wstring url = L"http://localhost:8080/statistics";
+    const int maxAttempts = 3;
+    const int retryable = 10;
+    const int rejected = 5;
+
+    DeleteBenchmarkStorage(dbPath, logDir);
+    {
+        SQLiteQueue queue(dbPath);
+        for (int i = 0; i < retryable + rejected; ++i)
+            queue.AddToQueue(url, MakeStatisticsJson(i, 1), false);
+
+        // Первые запросы получают 503 (повторяются), остальные 400 (переносятся сразу)
+        SendFailure unavailable = { 503, "ERROR: HTTP 503", 15 };
+        SendFailure badRequest = { 400, "ERROR: HTTP 400", 5 };
+        for (int attempt = 1; attempt <= maxAttempts; ++attempt) {
+            std::vector<QueueItem> items = queue.GetPendingItems(100);
+            for (size_t i = 0; i < items.size(); ++i) {
+                bool permanent = (int)i >= (int)items.size() - rejected && attempt == 1;
+                queue.RecordSendFailure(items[i].id, permanent ? badRequest : unavailable, maxAttempts, permanent);
+            }
+            std::wcout << L"Попытка " << attempt << L": в очереди " << queue.GetQueueDepth()
+                << L", недоставленных " << queue.GetDeadLetterCount() << L"\n";
+        }
+
+        bool moved = queue.GetQueueDepth() == 0 && queue.GetDeadLetterCount() == retryable + rejected;
+        std::wcout << (moved ? L"✅" : L"❌") << L" Все запросы перенесены в http_dead_letters\n";
+
+        int replayed = queue.ReplayDeadLetters(503, 0);
+        std::wcout << (replayed == retryable ? L"✅" : L"❌") << L" Возвращено в очередь (HTTP 503): " << replayed
+            << L", в очереди " << queue.GetQueueDepth() << L"\n";
+
+        int purged = queue.PurgeDeadLetters(400, 0);
+        std::wcout << (purged == rejected ? L"✅" : L"❌") << L" Удалено (HTTP 400): " << purged
+            << L", недоставленных " << queue.GetDeadLetterCount() << L"\n";
+    }
+    DeleteBenchmarkStorage(dbPath, logDir);
+}
+
+void BenchmarkStorageOptions()
+{
+    std::wcout << L"\n=== Подбор параметров базы: mmap_size, cache_size, page_size, temp_store ===\n";
+
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string dbPath = std::string(tempPath) + "gcore_bench.db";
+    std::string logDir = std::string(tempPath) + "gcore_bench_log";
+
+    const std::wstring url = L"http://localhost:8080/statistics";
+    const int requests = 1000;
+    const int responses = 200;
+
+    std::vector<std::string> bodies;
+    for (int i = 0; i < requests; ++i)
+        bodies.push_back(MakeStatisticsJson(i, 5));
+
+    const long long mmapSizes[] = { 0, 256LL * 1024 * 1024 };
+    const int cacheSizes[] = { 0, 16384 };
+    const int pageSizes[] = { 4096, 16384 };
+    const int tempStores[] = { 0, 2 };
+
+    LARGE_INTEGER freq, t0, t1, t2, t3;
+    QueryPerformanceFrequency(&freq);
+
+    std::wcout << L"Запросов: " << requests << L", ответов: " << responses << L", время в мкс на операцию\n";
+    std::wcout << L"mmap МБ | кэш КБ | страница | temp | добавление | поиск ответа | выборка и удаление | размер КБ\n";
+
+    for (long long mmapSize : mmapSizes) {
+        for (int cacheSize : cacheSizes) {
+            for (int pageSize : pageSizes) {
+                for (int tempStore : tempStores) {
+                    StorageOptions options;
+                    options.mmap_size = mmapSize;
+                    options.cache_size_kb = cacheSize;
+                    options.page_size = pageSize;
+                    options.temp_store = tempStore;
+
+                    DeleteBenchmarkStorage(dbPath, logDir);
+                    SQLiteQueue queue(dbPath, &options);
+
+                    for (int i = 0; i < responses; ++i)
+                        queue.AddResponse(url, bodies[i], "{\"status\":\"ok\"}");
+
+                    QueryPerformanceCounter(&t0);
+                    for (const std::string& body : bodies)
+                        queue.AddToQueue(url, body, false);
+                    QueryPerformanceCounter(&t1);
+
+                    for (int i = 0; i < requests; ++i)
+                        queue.GetResponse(url, bodies[i % responses]);
+                    QueryPerformanceCounter(&t2);
+
+                    long long size = queue.GetDatabaseSize(false);
+                    for (;;) {
+                        std::vector<QueueItem> items = queue.GetPendingItems(100);
+                        int removed = 0;
+                        for (const QueueItem& item : items)
+                            removed += queue.RemoveFromQueue(item.id) ? 1 : 0;
+                        if (removed == 0) break;
+                    }
+                    QueryPerformanceCounter(&t3);
+
+                    double usPerTick = 1000000.0 / freq.QuadPart;
+                    std::wcout << mmapSize / (1024 * 1024) << L" | " << (cacheSize ? std::to_wstring(cacheSize) : L"-")
+                        << L" | " << pageSize << L" | " << (tempStore ? L"память" : L"-")
+                        << L" | " << (t1.QuadPart - t0.QuadPart) * usPerTick / requests
+                        << L" | " << (t2.QuadPart - t1.QuadPart) * usPerTick / requests
+                        << L" | " << (t3.QuadPart - t2.QuadPart) * usPerTick / requests
+                        << L" | " << size / 1024 << L"\n";
+                }
+            }
+        }
+    }
+    DeleteBenchmarkStorage(dbPath, logDir);
+}
+
+void BenchmarkPendingBatch()
+{
+    std::wcout << L"\n=== Выборка очереди: GetPendingItems и GetPendingBatch ===\n";
+
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string dbPath = std::string(tempPath) + "gcore_bench.db";
+    std::string logDir = std::string(tempPath) + "gcore_bench_log";
+
+    const int requests = 5000;
+    const int batchSize = 100;
+    const int rounds = 200;
+
+    std::vector<QueueItem> items(requests);
+    for (int i = 0; i < requests; ++i) {
+        items[i].id = 0;
+        items[i].server_url = i % 2 ? L"http://localhost:8080/statistics" : L"http://localhost:8080/orders";
+        items[i].json_body = MakeStatisticsJson(i, 5);
+        items[i].expect_response = false;
+        items[i].timestamp = time(nullptr);
+    }
+
+    LARGE_INTEGER freq, t0, t1, t2;
+    QueryPerformanceFrequency(&freq);
+
+    DeleteBenchmarkStorage(dbPath, logDir);
+    {
+        SQLiteQueue queue(dbPath);
+        queue.AddToQueueBatch(items);
+
+        // Одинаковая работа над результатом: суммируем длины тел
+        size_t itemsBytes = 0, batchBytes = 0;
+
+        QueryPerformanceCounter(&t0);
+        for (int round = 0; round < rounds; ++round) {
+            std::vector<QueueItem> pending = queue.GetPendingItems(batchSize);
+            for (const QueueItem& item : pending)
+                itemsBytes += item.json_body.size();
+        }
+        QueryPerformanceCounter(&t1);
+
+        QueueBatch batch;
+        for (int round = 0; round < rounds; ++round) {
+            queue.GetPendingBatch(batch, batchSize);
+            for (size_t i = 0; i < batch.Size(); ++i)
+                batchBytes += batch[i].body_size;
+        }
+        QueryPerformanceCounter(&t2);
+
+        double itemsUs = (t1.QuadPart - t0.QuadPart) * 1000000.0 / freq.QuadPart / rounds;
+        double batchUs = (t2.QuadPart - t1.QuadPart) * 1000000.0 / freq.QuadPart / rounds;
+
+        std::wcout << L"Пачка из " << batchSize << L" запросов, " << rounds << L" выборок\n";
+        std::wcout << L"  GetPendingItems: " << itemsUs << L" мкс на пачку\n";
+        std::wcout << L"  GetPendingBatch: " << batchUs << L" мкс на пачку (адресов в таблице: "
+            << EndpointTable::Instance().Size() << L")\n";
+        std::wcout << (itemsBytes == batchBytes ? L"✅" : L"❌") << L" Выбраны одинаковые данные\n";
+    }
+    DeleteBenchmarkStorage(dbPath, logDir);
+}
+
+int RunEnqueueWorker(const wchar_t* dbPathW, int count)
+{
+    // Путь передается так же, как его получили из GetTempPathA
+    char dbPath[MAX_PATH] = {0};
+    WideCharToMultiByte(CP_ACP, 0, dbPathW, -1, dbPath, MAX_PATH, NULL, NULL);
+
+    SQLiteQueue queue(dbPath);
+    int failures = 0;
+
+    // По одному запросу на транзакцию, как при вызовах SendHttpRequestQueue из советника
+    for (int i = 0; i < count; ++i) {
+        if (!queue.AddToQueue(L"http://localhost:8080/statistics", MakeStatisticsJson(i, 5), false))
+            failures++;
+    }
+
+    return failures;
+}
+
+void BenchmarkMultiProcess()
+{
+    std::wcout << L"\n=== Несколько процессов: общая база и база на процесс ===\n";
+
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string dbPath = std::string(tempPath) + "gcore_bench.db";
+    std::string logDir = std::string(tempPath) + "gcore_bench_log";
+
+    wchar_t exePath[MAX_PATH];
+    GetModuleFileNameW(NULL, exePath, MAX_PATH);
+
+    const int perProcess = 2000;
+    const int processCounts[] = { 1, 2, 4, 8 };
+
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+
+    for (int sharded = 0; sharded < 2; ++sharded) {
+        std::wcout << (sharded ? L"База на процесс:\n" : L"Общая база:\n");
+
+        for (int processes : processCounts) {
+            std::vector<std::string> paths;
+            for (int p = 0; p < processes; ++p)
+                paths.push_back(sharded ? dbPath + "." + std::to_string(p) : dbPath);
+            for (int p = 0; p < (sharded ? processes : 1); ++p)
+                DeleteBenchmarkStorage(paths[p], logDir);
+
+            std::vector<HANDLE> handles;
+            QueryPerformanceCounter(&t0);
+            for (int p = 0; p < processes; ++p) {
+                std::wstring commandLine = L"\"" + std::wstring(exePath) + L"\" --enqueue-worker \"" +
+                    std::wstring(paths[p].begin(), paths[p].end()) + L"\" " + std::to_wstring(perProcess);
+
+                STARTUPINFOW startup = { sizeof(startup) };
+                PROCESS_INFORMATION info;
+                if (CreateProcessW(NULL, &commandLine[0], NULL, NULL, FALSE, CREATE_NO_WINDOW, NULL, NULL, &startup, &info)) {
+                    CloseHandle(info.hThread);
+                    handles.push_back(info.hProcess);
+                }
+            }
+            WaitForMultipleObjects((DWORD)handles.size(), handles.data(), TRUE, INFINITE);
+            QueryPerformanceCounter(&t1);
+
+            long long failures = 0;
+            for (HANDLE process : handles) {
+                DWORD exitCode = 0;
+                GetExitCodeProcess(process, &exitCode);
+                failures += exitCode;
+                CloseHandle(process);
+            }
+
+            long long stored = 0;
+            for (int p = 0; p < (sharded ? processes : 1); ++p) {
+                SQLiteQueue queue(paths[p]);
+                stored += queue.GetQueueDepth();
+            }
+            for (int p = 0; p < (sharded ? processes : 1); ++p)
+                DeleteBenchmarkStorage(paths[p], logDir);
+
+            long long expected = (long long)handles.size() * perProcess;
+            double seconds = (t1.QuadPart - t0.QuadPart) / (double)freq.QuadPart;
+
+            std::wcout << L"  " << processes << L" проц. (запущено " << handles.size() << L"): "
+                << seconds * 1000.0 << L" мс, " << (long long)(expected / seconds) << L" запросов/с, ошибок "
+                << failures << L", потеряно " << (expected - failures - stored) << L"\n";
+        }
+    }
+
+    std::wcout << L"Время включает запуск процессов; каждый процесс добавляет " << perProcess
+        << L" запросов по одному на транзакцию\n";
+}
+
+void BenchmarkQueueArchive()
+{
+    std::wcout << L"\n=== Выгрузка и загрузка очереди (сжатый NDJSON) ===\n";
+
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string dbPath = std::string(tempPath) + "gcore_bench.db";
+    std::string importPath = std::string(tempPath) + "gcore_bench_import.db";
+    std::string logDir = std::string(tempPath) + "gcore_bench_log";
+    std::wstring archivePath = std::wstring(dbPath.begin(), dbPath.end()) + L".ndjson.gcq";
+
+    const int requests = 20000;
+    const int responses = 500;
+
+    std::vector<QueueItem> items(requests);
+    size_t sourceBytes = 0;
+    for (int i = 0; i < requests; ++i) {
+        items[i].id = 0;
+        items[i].server_url = i % 2 ? L"http://localhost:8080/statistics" : L"http://localhost:8080/orders";
+        items[i].json_body = MakeStatisticsJson(i, 5);
+        items[i].expect_response = i % 10 == 0;
+        items[i].timestamp = time(nullptr) - (requests - i);
+        sourceBytes += items[i].json_body.size();
+    }
+
+    LARGE_INTEGER freq, t0, t1, t2;
+    QueryPerformanceFrequency(&freq);
+
+    DeleteBenchmarkStorage(dbPath, logDir);
+    DeleteBenchmarkStorage(importPath, logDir);
+
+    long long exported = 0, imported = 0;
+    {
+        SQLiteQueue queue(dbPath);
+        queue.AddToQueueBatch(items);
+        // Тело с кавычками, переводами строк и управляющими символами должно вернуться без изменений
+        queue.AddToQueue(L"http://localhost:8080/statistics", "{\"comment\":\"строка 1\nстрока \\\"2\\\"\t\x01\"}", false);
+        for (int i = 0; i < responses; ++i)
+            queue.AddResponse(L"http://localhost:8080/orders", MakeStatisticsJson(i, 1), MakeStatisticsJson(i + 1, 3));
+
+        QueryPerformanceCounter(&t0);
+        exported = queue.ExportArchive(archivePath, true);
+        QueryPerformanceCounter(&t1);
+    }
+
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    long long archiveBytes = 0;
+    if (GetFileAttributesExW(archivePath.c_str(), GetFileExInfoStandard, &attributes))
+        archiveBytes = ((long long)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+
+    {
+        SQLiteQueue target(importPath);
+        imported = target.ImportArchive(archivePath);
+        QueryPerformanceCounter(&t2);
+
+        double exportMs = (t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart;
+        double importMs = (t2.QuadPart - t1.QuadPart) * 1000.0 / freq.QuadPart;
+
+        std::wcout << L"Выгрузка: " << exported << L" записей за " << exportMs << L" мс, файл "
+            << archiveBytes / 1024 << L" КБ (тела запросов " << sourceBytes / 1024 << L" КБ)\n";
+        std::wcout << L"Загрузка: " << imported << L" записей за " << importMs << L" мс\n";
+
+        bool sameCounts = target.GetItemsCount(false) == requests + 1 && target.GetItemsCount(true) == responses;
+        std::vector<QueueItem> restored = target.GetPendingItems(requests + 1);
+        bool sameBodies = restored.size() == (size_t)requests + 1 && restored[0].json_body == items[0].json_body &&
+            restored[0].timestamp == items[0].timestamp && restored[requests].json_body.find('\x01') != std::string::npos;
+
+        std::wcout << (sameCounts ? L"✅" : L"❌") << L" Количество запросов и ответов совпадает\n";
+        std::wcout << (sameBodies ? L"✅" : L"❌") << L" Тела и время постановки в очередь сохранены\n";
+    }
+
+    DeleteFileW(archivePath.c_str());
+    DeleteBenchmarkStorage(dbPath, logDir);
+    DeleteBenchmarkStorage(importPath, logDir);
+}
+
+void TestResponseExpiry()
+{
+    std::wcout << L"\n=== Время хранения ответов и вытеснение ===\n";
+
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string dbPath = std::string(tempPath) + "gcore_bench.db";
+    std::string logDir = std::string(tempPath) + "gcore_bench_log";
+
+    const std::wstring shortUrl = L"http://localhost:8080/quotes";
+    const std::wstring longUrl = L"http://localhost:8080/orders";
+    const int responses = 2000;
+    const int limit = 200;
+
+    DeleteBenchmarkStorage(dbPath, logDir);
+    {
+        SQLiteQueue queue(dbPath);
+
+        // Срок по адресу и срок, заданный при постановке запроса
+        queue.SetResponseTtl(shortUrl, 1);
+        queue.AddResponse(shortUrl, "{\"q\":1}", "{\"price\":1}");
+        queue.AddResponse(longUrl, "{\"o\":1}", "{\"order\":1}");
+        queue.AddResponse(longUrl, "{\"o\":2}", "{\"order\":2}", 1);
+
+        Sleep(2100);
+
+        bool lazy = queue.GetResponse(shortUrl, "{\"q\":1}").empty() && queue.GetResponse(longUrl, "{\"o\":2}").empty() &&
+            !queue.GetResponse(longUrl, "{\"o\":1}").empty();
+        std::wcout << (lazy ? L"✅" : L"❌") << L" Просроченные ответы не возвращаются до удаления\n";
+
+        int expired = queue.ExpireResponses();
+        std::wcout << (expired == 2 ? L"✅" : L"❌") << L" Удалено просроченных ответов: " << expired << L"\n";
+
+        // Вытеснение: читаем часть ответов, остальные должны уйти первыми
+        for (int i = 0; i < responses; ++i)
+            queue.AddResponse(longUrl, MakeStatisticsJson(i, 1), MakeStatisticsJson(i, 2));
+        Sleep(1100);
+        for (int i = 0; i < limit / 2; ++i)
+            queue.GetResponse(longUrl, MakeStatisticsJson(i * 7, 1));
+
+        LARGE_INTEGER freq, t0, t1;
+        QueryPerformanceFrequency(&freq);
+        QueryPerformanceCounter(&t0);
+        queue.SetResponseLimit(limit);
+        int evicted = queue.ExpireResponses();
+        QueryPerformanceCounter(&t1);
+
+        int kept = 0;
+        for (int i = 0; i < limit / 2; ++i)
+            if (!queue.GetResponse(longUrl, MakeStatisticsJson(i * 7, 1)).empty()) kept++;
+
+        std::wcout << L"Вытеснено " << evicted << L" ответов за " << (t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart
+            << L" мс, осталось " << queue.GetItemsCount(true) << L"\n";
+        std::wcout << (queue.GetItemsCount(true) == limit ? L"✅" : L"❌") << L" Количество ответов не превышает предел\n";
+        std::wcout << (kept == limit / 2 ? L"✅" : L"❌") << L" Недавно прочитанные ответы сохранены: " << kept << L"\n";
+    }
+    DeleteBenchmarkStorage(dbPath, logDir);
+}
+
+void TestQueueWorkers(const wchar_t* urlW)
+{
+    EnsureCallbackRegistered();
+
+    std::wcout << L"\n=== Постоянные обработчики очереди ===\n";
+
+    const int workers = 4;
+    const int samples = 10;
+    const int burst = 200;
+    const DWORD timeoutMs = 10000;
+
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+
+    if (StartQueueWorkers(workers) != 0) {
+        std::wcout << L"❌ Обработчики не запущены\n";
+        return;
+    }
+    std::wcout << L"Запущено обработчиков: " << workers << L"\n";
+
+    // Задержка от добавления до отправки одиночного запроса: ожидаем, пока глубина
+    // очереди вернется к исходной
+    double totalMs = 0, maxMs = 0;
+    int delivered = 0;
+    for (int i = 0; i < samples; ++i) {
+        int depth = GetHttpQueueDepth(false);
+        std::wstring body = Utf8ToWide(MakeStatisticsJson(i, 1).c_str());
+
+        QueryPerformanceCounter(&t0);
+        if (SendHttpRequestQueue(urlW, body.c_str(), false) != 0)
+            continue;
+
+        bool sent = false;
+        do {
+            Sleep(1);
+            QueryPerformanceCounter(&t1);
+            sent = GetHttpQueueDepth(false) <= depth;
+        } while (!sent && (t1.QuadPart - t0.QuadPart) * 1000 / freq.QuadPart < timeoutMs);
+
+        if (sent) {
+            double ms = (t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart;
+            totalMs += ms;
+            maxMs = std::max(maxMs, ms);
+            delivered++;
+        }
+        Sleep(200);
+    }
+
+    std::wcout << L"Одиночные запросы: отправлено " << delivered << L" из " << samples;
+    if (delivered > 0)
+        std::wcout << L", задержка средняя " << totalMs / delivered << L" мс, максимальная " << maxMs << L" мс";
+    std::wcout << (delivered == samples ? L" ✅\n" : L" ❌\n");
+
+    // Пачка запросов: обработчики подключаются по мере заполнения пачек
+    int depth = GetHttpQueueDepth(false);
+    QueryPerformanceCounter(&t0);
+    for (int i = 0; i < burst; ++i)
+        SendHttpRequestQueue(urlW, Utf8ToWide(MakeStatisticsJson(i, 3).c_str()).c_str(), false);
+
+    bool drained = false;
+    do {
+        Sleep(5);
+        QueryPerformanceCounter(&t1);
+        drained = GetHttpQueueDepth(false) <= depth;
+    } while (!drained && (t1.QuadPart - t0.QuadPart) * 1000 / freq.QuadPart < timeoutMs * 3);
+
+    double burstMs = (t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart;
+    std::wcout << L"Пачка из " << burst << L" запросов " << (drained ? L"отправлена за " : L"не отправлена за ")
+        << burstMs << L" мс" << (drained ? L" ✅\n" : L" ❌\n");
+
+    StopQueueWorkers();
+    std::wcout << L"Обработчики остановлены\n";
+}
+
+// Локальный HTTP сервер для бенчмарков отправки: отвечает 200 на каждый POST,
+// каждое соединение обслуживается в своем потоке с задержкой latencyMs
+struct LocalHttpServer {
+    SOCKET listener;
+    HANDLE thread;
+    int port;
+    DWORD latencyMs;
+    bool echo;                      // ответ - тело запроса, иначе "{}"
+    LONG capacity;                  // запросов без замедления (0 - без ограничения)
+    volatile LONG active;           // запросов в обработке
+    volatile LONG rejected;         // ответов 503 при перегрузке
+    volatile LONG requests;
+    volatile LONG connections;      // соединения, которые еще обслуживаются
+};
+
+struct LocalHttpConnection {
+    LocalHttpServer* server;
+    SOCKET client;
+};
+
+DWORD WINAPI LocalHttpConnectionThread(LPVOID lpParam)
+{
+    LocalHttpConnection* connection = static_cast<LocalHttpConnection*>(lpParam);
+    LocalHttpServer* server = connection->server;
+    SOCKET client = connection->client;
+    delete connection;
+
+
+    // Заголовки, затем тело длиной Content-Length
+    std::string request;
+    char buffer[4096];
+    size_t headerEnd = std::string::npos;
+    size_t expected = 0;
+    for (;;) {
+        int received = recv(client, buffer, sizeof(buffer), 0);
+        if (received <= 0) break;
+        request.append(buffer, received);
+
+        if (headerEnd == std::string::npos) {
+            headerEnd = request.find("\r\n\r\n");
+            if (headerEnd == std::string::npos) continue;
+            size_t length = request.find("Content-Length:");
+            expected = headerEnd + 4 + (length != std::string::npos && length < headerEnd ?
+                (size_t)strtoul(request.c_str() + length + 15, NULL, 10) : 0);
+        }
+        if (request.size() >= expected) {
+            // Сверх capacity запросы ждут в очереди сервера (задержка растет),
+            // сверх 4 * capacity сервер отвечает 503
+            LONG active = InterlockedIncrement(&server->active);
+            if (server->capacity > 0 && active > server->capacity * 4) {
+                InterlockedDecrement(&server->active);
+                InterlockedIncrement(&server->rejected);
+                static const char overloaded[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+                send(client, overloaded, sizeof(overloaded) - 1, 0);
+                break;
+            }
+
+            DWORD latency = server->latencyMs;
+            if (server->capacity > 0 && active > server->capacity)
+                latency = latency * active / server->capacity;
+            if (latency > 0)
+                Sleep(latency);
+            InterlockedDecrement(&server->active);
+            InterlockedIncrement(&server->requests);
+
+            std::string body = server->echo ? request.substr(headerEnd + 4) : std::string("{}");
+            std::string response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " +
+                std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+            send(client, response.data(), (int)response.size(), 0);
+            break;
+        }
+    }
+    shutdown(client, SD_BOTH);
+    closesocket(client);
+
+    InterlockedDecrement(&server->connections);
+    return 0;
+}
+
+DWORD WINAPI LocalHttpServerThread(LPVOID lpParam)
+{
+    LocalHttpServer* server = static_cast<LocalHttpServer*>(lpParam);
+
+    for (;;) {
+        SOCKET client = accept(server->listener, NULL, NULL);
+        if (client == INVALID_SOCKET)
+            break;  // сокет закрыт в StopLocalHttpServer
+
+        LocalHttpConnection* connection = new LocalHttpConnection();
+        connection->server = server;
+        connection->client = client;
+
+        InterlockedIncrement(&server->connections);
+        HANDLE thread = CreateThread(NULL, 0, LocalHttpConnectionThread, connection, 0, NULL);
+        if (thread) {
+            CloseHandle(thread);
+        }
+        else {
+            InterlockedDecrement(&server->connections);
+            closesocket(client);
+            delete connection;
+        }
+    }
+    return 0;
+}
+
+bool StartLocalHttpServer(LocalHttpServer& server, DWORD latencyMs = 0, bool echo = false, LONG capacity = 0)
+{
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+        return false;
+
+    server.requests = 0;
+    server.connections = 0;
+    server.latencyMs = latencyMs;
+    server.echo = echo;
+    server.capacity = capacity;
+    server.active = 0;
+    server.rejected = 0;
+    server.thread = NULL;
+    server.listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;   // порт выбирает система
+    int addressSize = sizeof(address);
+
+    if (server.listener == INVALID_SOCKET ||
+        bind(server.listener, (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR ||
+        listen(server.listener, SOMAXCONN) == SOCKET_ERROR ||
+        getsockname(server.listener, (sockaddr*)&address, &addressSize) == SOCKET_ERROR) {
+        if (server.listener != INVALID_SOCKET)
+            closesocket(server.listener);
+        WSACleanup();
+        return false;
+    }
+
+    server.port = ntohs(address.sin_port);
+    server.thread = CreateThread(NULL, 0, LocalHttpServerThread, &server, 0, NULL);
+    if (!server.thread) {
+        closesocket(server.listener);
+        WSACleanup();
+        return false;
+    }
+    return true;
+}
+
+void StopLocalHttpServer(LocalHttpServer& server)
+{
+    closesocket(server.listener);
+    WaitForSingleObject(server.thread, INFINITE);
+    CloseHandle(server.thread);
+    while (server.connections > 0)
+        Sleep(10);
+    WSACleanup();
+}
+
+void BenchmarkRateLimit()
+{
+    std::wcout << L"\n=== Лимит частоты отправки: разбор очереди на локальный сервер ===\n";
+
+    LocalHttpServer server;
+    if (!StartLocalHttpServer(server)) {
+        std::wcout << L"❌ Не удалось запустить локальный сервер\n";
+        return;
+    }
+    const std::wstring url = L"http://127.0.0.1:" + std::to_wstring(server.port) + L"/statistics";
+    std::wcout << L"Локальный сервер: " << url << L"\n";
+
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string dbPath = std::string(tempPath) + "gcore_bench.db";
+    std::string logDir = std::string(tempPath) + "gcore_bench_log";
+
+    // Режимы: прежняя пауза 100 мс, лимиты корзины токенов и отправка без ограничения
+    struct Scenario {
+        const wchar_t* name;
+        DWORD fixedPauseMs;
+        double rate;
+        int burst;
+        int requests;
+    };
+    const Scenario scenarios[] = {
+        { L"Sleep(100) после запроса", 100, 0, 0, 30 },
+        { L"10 запросов/с, подряд 1", 0, 10, 1, 30 },
+        { L"100 запросов/с, подряд 10", 0, 100, 10, 300 },
+        { L"500 запросов/с, подряд 50", 0, 500, 50, 1000 },
+        { L"без ограничения", 0, 0, 0, 1000 },
+    };
+
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+
+    for (const Scenario& scenario : scenarios) {
+        DeleteBenchmarkStorage(dbPath, logDir);
+        {
+            SQLiteQueue queue(dbPath);
+            std::vector<QueueItem> items(scenario.requests);
+            for (int i = 0; i < scenario.requests; ++i) {
+                items[i].id = 0;
+                items[i].server_url = url;
+                items[i].json_body = MakeStatisticsJson(i, 3);
+                items[i].expect_response = false;
+                items[i].timestamp = time(nullptr);
+            }
+            queue.AddToQueueBatch(items);
+
+            HostRateLimiter limiter;
+            limiter.SetLimit(L"127.0.0.1", scenario.rate, scenario.burst);
+            LONG receivedBefore = server.requests;
+            int sent = 0;
+
+            QueryPerformanceCounter(&t0);
+            QueueBatch batch;
+            while (queue.GetPendingBatch(batch, 50) > 0) {
+                int sentBefore = sent;
+                for (size_t i = 0; i < batch.Size(); ++i) {
+                    if (scenario.fixedPauseMs == 0)
+                        limiter.Acquire(url, NULL);
+                    if (queue.ProcessQueueItem(batch, i)) {
+                        queue.RemoveFromQueue(batch[i].id);
+                        sent++;
+                    }
+                    if (scenario.fixedPauseMs > 0)
+                        Sleep(scenario.fixedPauseMs);
+                }
+                if (sent == sentBefore)
+                    break;  // сервер недоступен, не зацикливаемся
+            }
+            QueryPerformanceCounter(&t1);
+
+            long long waits = 0, waitUs = 0;
+            limiter.GetWaitStats(waits, waitUs);
+            double seconds = (double)(t1.QuadPart - t0.QuadPart) / freq.QuadPart;
+
+            std::wcout << L"  " << scenario.name << L": " << sent << L" из " << scenario.requests << L" за "
+                << seconds << L" с, " << (seconds > 0 ? sent / seconds : 0) << L" запросов/с, ожиданий лимита "
+                << waits << L" (" << waitUs / 1000 << L" мс)"
+                << (server.requests - receivedBefore == sent ? L" ✅\n" : L" ❌\n");
+        }
+    }
+    DeleteBenchmarkStorage(dbPath, logDir);
+
+    StopLocalHttpServer(server);
+}
+
+void BenchmarkPipelinedDrain()
+{
+    std::wcout << L"\n=== Разбор очереди: чтение и отправка по очереди и конвейером ===\n";
+
+    LocalHttpServer server;
+    if (!StartLocalHttpServer(server)) {
+        std::wcout << L"❌ Не удалось запустить локальный сервер\n";
+        return;
+    }
+    const std::wstring url = L"http://127.0.0.1:" + std::to_wstring(server.port) + L"/statistics";
+
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string dbPath = std::string(tempPath) + "gcore_bench.db";
+    std::string logDir = std::string(tempPath) + "gcore_bench_log";
+
+    const int requests = 3000;
+    std::vector<QueueItem> items(requests);
+    for (int i = 0; i < requests; ++i) {
+        items[i].id = 0;
+        items[i].server_url = url;
+        items[i].json_body = MakeStatisticsJson(i, 20);
+        items[i].expect_response = false;
+        items[i].timestamp = time(nullptr);
+    }
+
+    LARGE_INTEGER freq, t0, t1, t2;
+    QueryPerformanceFrequency(&freq);
+
+    // Прежняя схема: пачка 50 по времени, затем отправка, затем следующая пачка
+    double serialSeconds = 0, serialFetchMs = 0;
+    int serialSent = 0;
+    DeleteBenchmarkStorage(dbPath, logDir);
+    {
+        SQLiteQueue queue(dbPath);
+        queue.AddToQueueBatch(items);
+
+        QueueBatch batch;
+        QueryPerformanceCounter(&t0);
+        for (;;) {
+            QueryPerformanceCounter(&t1);
+            int fetched = queue.GetPendingBatch(batch, 50);
+            QueryPerformanceCounter(&t2);
+            serialFetchMs += (t2.QuadPart - t1.QuadPart) * 1000.0 / freq.QuadPart;
+            if (fetched == 0)
+                break;
+
+            int sentBefore = serialSent;
+            for (size_t i = 0; i < batch.Size(); ++i) {
+                if (queue.ProcessQueueItem(batch, i)) {
+                    queue.RemoveFromQueue(batch[i].id);
+                    serialSent++;
+                }
+            }
+            if (serialSent == sentBefore)
+                break;
+        }
+        QueryPerformanceCounter(&t1);
+        serialSeconds = (double)(t1.QuadPart - t0.QuadPart) / freq.QuadPart;
+    }
+
+    // Конвейер: страницы по id, следующая читается во время отправки текущей
+    double pipelineSeconds = 0, stallMs = 0;
+    int pipelineSent = 0, batches = 0;
+    AdaptiveBatchSize batchSize(10, 500, 500);
+    DeleteBenchmarkStorage(dbPath, logDir);
+    {
+        SQLiteQueue queue(dbPath);
+        queue.AddToQueueBatch(items);
+
+        Prefetcher prefetcher;
+        prefetcher.Start();
+        QueueBatch pages[2];
+        int current = 0;
+
+        QueryPerformanceCounter(&t0);
+        queue.GetPendingBatchAfter(pages[current], 0, batchSize.Get());
+        while (!pages[current].Empty()) {
+            QueueBatch& batch = pages[current];
+            QueueBatch& next = pages[1 - current];
+            int afterId = batch[batch.Size() - 1].id;
+            int size = batchSize.Get();
+            prefetcher.Begin([&queue, &next, afterId, size]() { queue.GetPendingBatchAfter(next, afterId, size); });
+
+            QueryPerformanceCounter(&t1);
+            for (size_t i = 0; i < batch.Size(); ++i) {
+                if (queue.ProcessQueueItem(batch, i)) {
+                    queue.RemoveFromQueue(batch[i].id);
+                    pipelineSent++;
+                }
+            }
+            QueryPerformanceCounter(&t2);
+            batchSize.Record((int)batch.Size(), (t2.QuadPart - t1.QuadPart) * 1000000 / freq.QuadPart);
+
+            prefetcher.Wait();
+            QueryPerformanceCounter(&t1);
+            stallMs += (t1.QuadPart - t2.QuadPart) * 1000.0 / freq.QuadPart;
+            batches++;
+            current = 1 - current;
+        }
+        QueryPerformanceCounter(&t1);
+        pipelineSeconds = (double)(t1.QuadPart - t0.QuadPart) / freq.QuadPart;
+    }
+    DeleteBenchmarkStorage(dbPath, logDir);
+    StopLocalHttpServer(server);
+
+    std::wcout << L"Запросов: " << requests << L", локальный сервер получил " << server.requests << L"\n";
+    std::wcout << L"  по очереди: " << serialSent << L" за " << serialSeconds << L" с ("
+        << (serialSeconds > 0 ? serialSent / serialSeconds : 0) << L" запросов/с), чтение базы " << serialFetchMs << L" мс\n";
+    std::wcout << L"  конвейер:   " << pipelineSent << L" за " << pipelineSeconds << L" с ("
+        << (pipelineSeconds > 0 ? pipelineSent / pipelineSeconds : 0) << L" запросов/с), ожидание чтения " << stallMs
+        << L" мс, пачек " << batches << L", размер пачки " << batchSize.Get() << L" (" << batchSize.GetItemUs()
+        << L" мкс на запрос)\n";
+    std::wcout << (serialSent == requests && pipelineSent == requests ? L"✅" : L"❌") << L" Все запросы отправлены\n";
+}
+
+// Разбор очереди с заданным числом одновременных отправок; подтверждения пачками по 100
+double DrainWithDispatcher(SQLiteQueue& queue, int maxInFlight, int limit, int& sent, AdaptiveConcurrency* adaptive = NULL)
+{
+    QueueDispatcher dispatcher;
+    dispatcher.SetAdaptive(adaptive);
+    dispatcher.Configure(maxInFlight, 0);
+
+    QueueDispatcher::SendFunction send = [&queue](const QueueBatch& batch, size_t i, SendFailure* failure) {
+        return queue.ProcessQueueItem(batch, i, failure);
+    };
+    QueueDispatcher::AcquireFunction acquire = [](size_t) { return true; };
+
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t0);
+
+    QueueBatch batch;
+    std::vector<int> confirmed;
+    std::vector<char> dispatched;
+    int afterId = 0;
+    sent = 0;
+    while (sent < limit && queue.GetPendingBatchAfter(batch, afterId, std::min(500, limit - sent)) > 0) {
+        afterId = batch[batch.Size() - 1].id;
+        dispatcher.Dispatch(batch, send, acquire, [&](size_t i, bool success, const SendFailure&) {
+            if (!success) return;
+            sent++;
+            confirmed.push_back(batch[i].id);
+            if (confirmed.size() >= 100) {
+                queue.RemoveFromQueueBatch(confirmed);
+                confirmed.clear();
+            }
+        }, dispatched);
+    }
+    queue.RemoveFromQueueBatch(confirmed);
+
+    QueryPerformanceCounter(&t1);
+    return (double)(t1.QuadPart - t0.QuadPart) / freq.QuadPart;
+}
+
+void BenchmarkConcurrentDispatch()
+{
+    std::wcout << L"\n=== Одновременная отправка: 10000 запросов, задержка сервера 50 мс ===\n";
+
+    const DWORD latencyMs = 50;
+    LocalHttpServer server;
+    if (!StartLocalHttpServer(server, latencyMs)) {
+        std::wcout << L"❌ Не удалось запустить локальный сервер\n";
+        return;
+    }
+    const std::wstring url = L"http://127.0.0.1:" + std::to_wstring(server.port) + L"/statistics";
+
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string dbPath = std::string(tempPath) + "gcore_bench.db";
+    std::string logDir = std::string(tempPath) + "gcore_bench_log";
+
+    const int requests = 10000;
+    std::vector<QueueItem> items(requests);
+    for (int i = 0; i < requests; ++i) {
+        items[i].id = 0;
+        items[i].server_url = url;
+        items[i].json_body = MakeStatisticsJson(i, 3);
+        items[i].expect_response = false;
+        items[i].timestamp = time(nullptr);
+    }
+
+    // По одному запросу 10000 x 50 мс заняли бы больше 8 минут: меряем 200 и пересчитываем
+    const int serialSample = 200;
+    const int levels[] = { 1, 16, 64 };
+
+    for (int maxInFlight : levels) {
+        DeleteBenchmarkStorage(dbPath, logDir);
+        SQLiteQueue queue(dbPath);
+        queue.AddToQueueBatch(items);
+
+        int limit = maxInFlight == 1 ? serialSample : requests;
+        int sent = 0;
+        double seconds = DrainWithDispatcher(queue, maxInFlight, limit, sent);
+        double total = limit < requests && sent > 0 ? seconds * requests / sent : seconds;
+
+        std::wcout << L"  в полете до " << maxInFlight << L": отправлено " << sent << L" за " << seconds << L" с, "
+            << (seconds > 0 ? sent / seconds : 0) << L" запросов/с"
+            << (limit < requests ? L", 10000 запросов - около " : L"") ;
+        if (limit < requests)
+            std::wcout << total << L" с";
+        std::wcout << L", осталось в очереди " << queue.GetQueueDepth() << (sent == limit ? L" ✅\n" : L" ❌\n");
+    }
+    DeleteBenchmarkStorage(dbPath, logDir);
+
+    StopLocalHttpServer(server);
+}
+
+void BenchmarkQueueBatching()
+{
+    std::wcout << L"\n=== Объединение запросов в один POST: 2000 запросов, задержка сервера 5 мс ===\n";
+
+    // Сервер возвращает тело запроса: ответ на общий POST - массив тел, и после
+    // разбиения каждый запрос должен получить собственное тело
+    LocalHttpServer server;
+    if (!StartLocalHttpServer(server, 5, true)) {
+        std::wcout << L"❌ Не удалось запустить локальный сервер\n";
+        return;
+    }
+    const std::wstring url = L"http://127.0.0.1:" + std::to_wstring(server.port) + L"/statistics";
+
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string dbPath = std::string(tempPath) + "gcore_bench.db";
+    std::string logDir = std::string(tempPath) + "gcore_bench_log";
+
+    const int requests = 2000;
+    std::vector<QueueItem> items(requests);
+    for (int i = 0; i < requests; ++i) {
+        items[i].id = 0;
+        items[i].server_url = url;
+        items[i].json_body = MakeStatisticsJson(i, 3);
+        items[i].expect_response = i % 10 == 0;
+        items[i].timestamp = time(nullptr);
+    }
+
+    struct Mode {
+        const wchar_t* name;
+        int format;
+        int maxItems;
+    };
+    const Mode modes[] = {
+        { L"по одному", ENVELOPE_NONE, 0 },
+        { L"JSON-массив по 20", ENVELOPE_JSON_ARRAY, 20 },
+        { L"JSON-массив по 100", ENVELOPE_JSON_ARRAY, 100 },
+        { L"NDJSON по 100", ENVELOPE_NDJSON, 100 },
+    };
+
+    for (const Mode& mode : modes) {
+        DeleteBenchmarkStorage(dbPath, logDir);
+        SQLiteQueue queue(dbPath);
+        queue.AddToQueueBatch(items);
+
+        EnvelopeSettings envelopes;
+        envelopes.Set(L"", mode.format, mode.maxItems, 0);
+        LONG requestsBefore = server.requests;
+
+        LARGE_INTEGER freq, t0, t1;
+        QueryPerformanceFrequency(&freq);
+        QueryPerformanceCounter(&t0);
+
+        QueueBatch batch;
+        std::vector<EnvelopeGroup> groups;
+        std::vector<int> confirmed;
+        int afterId = 0;
+        int sent = 0;
+        while (queue.GetPendingBatchAfter(batch, afterId, 500) > 0) {
+            afterId = batch[batch.Size() - 1].id;
+            if (!envelopes.Group(batch, groups)) {
+                groups.clear();
+                for (size_t i = 0; i < batch.Size(); ++i) {
+                    EnvelopeGroup single = { ENVELOPE_NONE, std::vector<size_t>(1, i) };
+                    groups.push_back(single);
+                }
+            }
+
+            confirmed.clear();
+            for (const EnvelopeGroup& group : groups) {
+                bool ok = group.members.size() == 1 ?
+                    queue.ProcessQueueItem(batch, group.members[0]) :
+                    queue.ProcessEnvelope(batch, group.members, group.format);
+                if (!ok) continue;
+                for (size_t index : group.members)
+                    confirmed.push_back(batch[index].id);
+            }
+            sent += queue.RemoveFromQueueBatch(confirmed);
+        }
+
+        QueryPerformanceCounter(&t1);
+        double seconds = (double)(t1.QuadPart - t0.QuadPart) / freq.QuadPart;
+
+        // Каждый запрос с ожиданием ответа получил свой ответ: свое тело
+        int matched = 0, expected = 0;
+        for (int i = 0; i < requests; i += 10) {
+            expected++;
+            if (queue.GetResponse(url, items[i].json_body) == items[i].json_body)
+                matched++;
+        }
+
+        std::wcout << L"  " << mode.name << L": отправлено " << sent << L" за " << seconds << L" с, POST: "
+            << (server.requests - requestsBefore) << L", ответов разобрано " << matched << L"/" << expected
+            << (sent == requests && matched == expected ? L" ✅\n" : L" ❌\n");
+    }
+    DeleteBenchmarkStorage(dbPath, logDir);
+
+    StopLocalHttpServer(server);
+}
+
+void BenchmarkAdaptiveConcurrency()
+{
+    std::wcout << L"\n=== Подстройка лимита отправок: сервер на 8 запросов по 20 мс, 3000 запросов ===\n";
+
+    LocalHttpServer server;
+    if (!StartLocalHttpServer(server, 20, false, 8)) {
+        std::wcout << L"❌ Не удалось запустить локальный сервер\n";
+        return;
+    }
+    const std::wstring url = L"http://127.0.0.1:" + std::to_wstring(server.port) + L"/statistics";
+
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string dbPath = std::string(tempPath) + "gcore_bench.db";
+    std::string logDir = std::string(tempPath) + "gcore_bench_log";
+
+    const int requests = 3000;
+    std::vector<QueueItem> items(requests);
+    for (int i = 0; i < requests; ++i) {
+        items[i].id = 0;
+        items[i].server_url = url;
+        items[i].json_body = MakeStatisticsJson(i, 3);
+        items[i].expect_response = false;
+        items[i].timestamp = time(nullptr);
+    }
+
+    struct Mode {
+        const wchar_t* name;
+        int maxInFlight;
+        bool adaptive;
+    };
+    const Mode modes[] = {
+        { L"постоянно 4", 4, false },
+        { L"постоянно 64", 64, false },
+        { L"подстройка до 64", 64, true },
+    };
+
+    for (const Mode& mode : modes) {
+        DeleteBenchmarkStorage(dbPath, logDir);
+        SQLiteQueue queue(dbPath);
+        queue.AddToQueueBatch(items);
+
+        AdaptiveConcurrency adaptive;
+        adaptive.SetEnabled(mode.adaptive);
+        LONG rejectedBefore = server.rejected;
+
+        // Отклоненные запросы остаются в очереди: проходы повторяются, пока она не опустеет
+        double seconds = 0;
+        int total = 0, passes = 0;
+        while (queue.GetQueueDepth() > 0 && passes < 10) {
+            int sent = 0;
+            seconds += DrainWithDispatcher(queue, mode.maxInFlight, requests, sent, mode.adaptive ? &adaptive : NULL);
+            total += sent;
+            passes++;
+        }
+
+        std::wcout << L"  " << mode.name << L": " << total << L" за " << seconds << L" с ("
+            << (seconds > 0 ? total / seconds : 0) << L" запросов/с), проходов " << passes
+            << L", ответов 503: " << (server.rejected - rejectedBefore);
+
+        std::vector<HostConcurrencyStats> stats;
+        adaptive.GetStats(stats);
+        if (mode.adaptive && !stats.empty())
+            std::wcout << L", лимит " << stats[0].limit << L", время ответа " << stats[0].rtt_us / 1000
+                << L" мс (минимум " << stats[0].min_rtt_us / 1000 << L" мс), уменьшений " << stats[0].decreases;
+        std::wcout << (total == requests ? L" ✅\n" : L" ❌\n");
+    }
+    DeleteBenchmarkStorage(dbPath, logDir);
+
+    StopLocalHttpServer(server);
+}
+
+void TestDeadlineScheduling(const wchar_t* urlW)
+{
+    EnsureCallbackRegistered();
+
+    std::wcout << L"\n=== Сроки доставки (EDF) ===\n";
+
+    // Порядок выборки на временной базе: сначала по сроку, затем без срока от старых
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string dbPath = std::string(tempPath) + "gcore_bench.db";
+    std::string logDir = std::string(tempPath) + "gcore_bench_log";
+    DeleteBenchmarkStorage(dbPath, logDir);
+    {
+        SQLiteQueue queue(dbPath);
+        time_t now = time(nullptr);
+        std::vector<QueueItem> items(200);
+        for (int i = 0; i < 200; ++i) {
+            items[i].id = 0;
+            items[i].server_url = L"http://127.0.0.1/statistics";
+            items[i].json_body = MakeStatisticsJson(i, 1);
+            items[i].expect_response = false;
+            items[i].timestamp = now - 1000 + i;
+            // Каждый второй запрос со сроком, сроки идут в обратном порядке добавления
+            items[i].deadline = i % 2 ? now + 600 - i : 0;
+        }
+        queue.AddToQueueBatch(items);
+
+        QueueBatch batch;
+        queue.GetPendingBatch(batch, 150);
+        bool ordered = batch.Size() == 150;
+        for (size_t i = 1; ordered && i < batch.Size(); ++i) {
+            const QueueItemView& prev = batch[i - 1];
+            const QueueItemView& item = batch[i];
+            if (i < 100)
+                ordered = item.deadline > 0 && prev.deadline <= item.deadline;
+            else if (i == 100)
+                ordered = item.deadline == 0;
+            else
+                ordered = item.deadline == 0 && prev.timestamp <= item.timestamp;
+        }
+        std::wcout << L"Порядок выборки: 100 запросов по сроку, затем 50 без срока от старых"
+            << (ordered ? L" ✅\n" : L" ❌\n");
+    }
+    DeleteBenchmarkStorage(dbPath, logDir);
+
+    // Запросы с истекшим сроком удаляются без отправки
+    long long before[18] = {}, after[18] = {};
+    GetHttpStorageStats(before, 18, false);
+    int depth = GetHttpQueueDepth(false);
+
+    const int expiring = 20, onTime = 20;
+    for (int i = 0; i < expiring; ++i)
+        SendHttpRequestQueueDeadline(urlW, Utf8ToWide(MakeStatisticsJson(i, 1).c_str()).c_str(), false, 1);
+    std::wcout << L"Добавлено " << expiring << L" запросов со сроком 1 с, ждем 2 с...\n";
+    Sleep(2000);
+    for (int i = 0; i < onTime; ++i)
+        SendHttpRequestQueueDeadline(urlW, Utf8ToWide(MakeStatisticsJson(1000 + i, 1).c_str()).c_str(), false, 60);
+
+    ProcessHttpQueue();
+    for (int i = 0; i < 100 && GetHttpQueueDepth(false) > depth; ++i)
+        Sleep(100);
+
+    GetHttpStorageStats(after, 18, false);
+    long long expired = after[17] - before[17];
+    std::wcout << L"Удалено с истекшим сроком: " << expired << L" из " << expiring << (expired == expiring ? L" ✅\n" : L" ❌\n");
+    std::wcout << L"Доставлено в срок: " << after[15] - before[15] << L" из " << onTime
+        << L", после срока: " << after[16] - before[16] << L"\n";
+}
+
+void TestBoundedShutdown()
+{
+    EnsureCallbackRegistered();
+
+    std::wcout << L"\n=== Завершение с таймаутом: сервер отвечает за 5 с ===\n";
+
+    LocalHttpServer server;
+    if (!StartLocalHttpServer(server, 5000)) {
+        std::wcout << L"❌ Не удалось запустить локальный сервер\n";
+        return;
+    }
+    const std::wstring url = L"http://127.0.0.1:" + std::to_wstring(server.port) + L"/statistics";
+
+    int depth = GetHttpQueueDepth(false);
+    const int requests = 20;
+    for (int i = 0; i < requests; ++i)
+        SendHttpRequestQueue(url.c_str(), Utf8ToWide(MakeStatisticsJson(i, 1).c_str()).c_str(), false);
+
+    // Запросы в полете у постоянных обработчиков и у разового потока ProcessHttpQueue
+    StartQueueWorkers(2);
+    ProcessHttpQueue();
+    Sleep(500);
+
+    const int timeoutMs = 300;
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t0);
+    int result = ShutdownGCore(timeoutMs);
+    QueryPerformanceCounter(&t1);
+    double ms = (t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart;
+
+    // Таймаут и 0,5 с на прерванные запросы, с запасом на планировщик. Запрос, который
+    // уже ждет ответа, может дождаться его: тогда результат 1 и поток выйдет позже
+    std::wcout << L"ShutdownGCore(" << timeoutMs << L"): " << result << L" за " << ms << L" мс"
+        << (ms < timeoutMs + 1000 ? L" ✅\n" : L" ❌\n");
+    if (result != 0) {
+        result = ShutdownGCore(10000);
+        std::wcout << L"Повторный ShutdownGCore: " << result << (result == 0 ? L" ✅\n" : L" ❌\n");
+    }
+
+    // Прерванные запросы не подтверждены, даже если ответ пришел после отмены, и остаются в очереди
+    int remaining = GetHttpQueueDepth(false) - depth;
+    std::wcout << L"Осталось в очереди: " << remaining << L" из " << requests
+        << (remaining == requests ? L" ✅\n" : L" ❌\n");
+
+    // Оставшиеся запросы доставляются без задержки: после завершения отправка снова разрешена
+    server.latencyMs = 0;
+    ProcessHttpQueue();
+    for (int i = 0; i < 50 && GetHttpQueueDepth(false) > depth; ++i)
+        Sleep(100);
+    std::wcout << L"Доставлено после завершения"
+        << (GetHttpQueueDepth(false) <= depth ? L" ✅\n" : L" ❌\n");
+
+    StopLocalHttpServer(server);
+}
+
+void TestQueueBackpressure()
+{
+    EnsureCallbackRegistered();
+
+    std::wcout << L"\n=== Ограничение очереди при недоступном сервере ===\n";
+
+    // Вытеснение проверяется на временной базе, чтобы не удалить запросы рабочей очереди
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string dbPath = std::string(tempPath) + "gcore_bench.db";
+    std::string logDir = std::string(tempPath) + "gcore_bench_log";
+    DeleteBenchmarkStorage(dbPath, logDir);
+    {
+        SQLiteQueue queue(dbPath);
+        auto depth = [&]() { return queue.GetQueueDepth(); };
+        auto drop = [&](int count, bool lowestPriority) {
+            int removed = lowestPriority ? queue.DropOldestQueueItems(count, true) : 0;
+            if (removed < count)
+                removed += queue.DropOldestQueueItems(count - removed, false);
+            return removed;
+        };
+
+        const int policies[] = { BACKPRESSURE_DROP_OLDEST, BACKPRESSURE_DROP_LOWEST_PRIORITY };
+        for (int policy : policies) {
+            queue.DropOldestQueueItems(1000000, false);
+            QueueBackpressure backpressure;
+            backpressure.Configure(policy, 1000, 800, 0, 0, 0, 0, 0);
+
+            // Каждый десятый запрос ждет ответа
+            for (int i = 0; i < 5000; ++i) {
+                std::string body = MakeStatisticsJson(i, 1);
+                if (backpressure.Admit(body.size(), depth, drop))
+                    queue.AddToQueue(L"http://127.0.0.1/statistics", body, i % 10 == 0);
+            }
+
+            std::vector<QueueItem> items = queue.GetPendingItems(2000);
+            int withResponse = 0;
+            for (const QueueItem& item : items)
+                withResponse += item.expect_response ? 1 : 0;
+
+            BackpressureStats stats;
+            backpressure.GetStats(stats);
+            std::wcout << (policy == BACKPRESSURE_DROP_OLDEST ? L"Удаление старых: " : L"Удаление по приоритету: ")
+                << L"в очереди " << items.size() << L" (ждут ответа " << withResponse << L"), удалено " << stats.dropped
+                << (items.size() <= 1000 && stats.dropped + items.size() == 5000 ? L" ✅\n" : L" ❌\n");
+        }
+    }
+    DeleteBenchmarkStorage(dbPath, logDir);
+
+    // Отклонение и ожидание через DLL: сервер не разбирает очередь, пока не вызван ProcessHttpQueue
+    LocalHttpServer server;
+    if (!StartLocalHttpServer(server)) {
+        std::wcout << L"❌ Не удалось запустить локальный сервер\n";
+        return;
+    }
+    const std::wstring url = L"http://127.0.0.1:" + std::to_wstring(server.port) + L"/statistics";
+
+    int depth = GetHttpQueueDepth(false);
+    SetHttpQueueBackpressure(1, depth + 50, depth + 40, 0, 0, 0);
+
+    int accepted = 0, rejected = 0;
+    for (int i = 0; i < 100; ++i) {
+        int result = SendHttpRequestQueue(url.c_str(), Utf8ToWide(MakeStatisticsJson(i, 1).c_str()).c_str(), false);
+        if (result == 0) accepted++;
+        else if (result == 2) rejected++;
+    }
+    std::wcout << L"Отклонение: принято " << accepted << L", отклонено (код 2) " << rejected
+        << (accepted == 50 && rejected == 50 ? L" ✅\n" : L" ❌\n");
+
+    // Ожидание: по таймауту, затем до разбора очереди ниже нижней границы
+    SetHttpQueueBackpressure(4, depth + 50, depth + 10, 0, 0, 300);
+    DWORD start = GetTickCount();
+    int timedOut = SendHttpRequestQueue(url.c_str(), L"{}", false);
+    DWORD waited = GetTickCount() - start;
+    std::wcout << L"Ожидание без разбора: код " << timedOut << L" через " << waited << L" мс"
+        << (timedOut == 2 && waited >= 250 ? L" ✅\n" : L" ❌\n");
+
+    SetHttpQueueBackpressure(4, depth + 50, depth + 10, 0, 0, 5000);
+    ProcessHttpQueue();
+    start = GetTickCount();
+    int unblocked = SendHttpRequestQueue(url.c_str(), L"{}", false);
+    waited = GetTickCount() - start;
+    std::wcout << L"Ожидание с разбором: код " << unblocked << L" через " << waited << L" мс"
+        << (unblocked == 0 && waited < 5000 ? L" ✅\n" : L" ❌\n");
+
+    long long values[7] = {};
+    GetHttpBackpressureStats(values, 7);
+    std::wcout << L"Счетчики: отклонено " << values[3] << L", ожиданий " << values[5] << L", по таймауту " << values[6] << L"\n";
+
+    SetHttpQueueBackpressure(0, 0, 0, 0, 0, 0);
+    ProcessHttpQueue();
+    for (int i = 0; i < 50 && GetHttpQueueDepth(false) > depth; ++i)
+        Sleep(100);
+
+    StopLocalHttpServer(server);
+}
+
+void BenchmarkWorkStealingPool()
+{
+    std::wcout << L"\n=== Общий пул потоков ===\n";
+
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+
+    WorkStealingPool pool;
+    pool.Start(0, 0, THREAD_PRIORITY_BELOW_NORMAL);
+    std::wcout << L"Потоков: " << pool.GetThreadCount() << L"\n";
+
+    // Неравномерная нагрузка: каждая задача порождает вложенные задачи в своей очереди,
+    // свободные потоки должны забрать их у занятого
+    volatile LONGLONG sum = 0;
+    HANDLE done = CreateEvent(NULL, TRUE, FALSE, NULL);
+    volatile LONG pending = 64 * 33;
+    for (int i = 0; i < 64; ++i) {
+        pool.Submit([&pool, &sum, &pending, done, i]() {
+            for (int j = 0; j < 32; ++j) {
+                pool.Submit([&sum, &pending, done, i, j]() {
+                    std::string packed;
+                    CompressBody(MakeStatisticsJson(i * 32 + j, 20), packed);
+                    InterlockedExchangeAdd64(&sum, i * 32 + j);
+                    if (InterlockedDecrement(&pending) == 0) SetEvent(done);
+                });
+            }
+            if (InterlockedDecrement(&pending) == 0) SetEvent(done);
+        });
+    }
+    bool finished = WaitForSingleObject(done, 30000) == WAIT_OBJECT_0;
+    CloseHandle(done);
+
+    WorkPoolStats stats;
+    pool.GetStats(stats);
+    const long long expected = 64LL * 32 * (64 * 32 - 1) / 2;
+    std::wcout << L"Вложенные задачи: выполнено " << stats.executed << L", взято у других потоков " << stats.stolen
+        << (finished && sum == expected ? L" ✅\n" : L" ❌\n");
+
+    // Сжатие пачки перед записью: в потоке вызова и в пуле
+    char tempPath[MAX_PATH];
+    GetTempPathA(MAX_PATH, tempPath);
+    std::string dbPath = std::string(tempPath) + "gcore_bench.db";
+    std::string logDir = std::string(tempPath) + "gcore_bench_log";
+
+    std::vector<QueueItem> items(2000);
+    for (size_t i = 0; i < items.size(); ++i) {
+        items[i].server_url = L"http://127.0.0.1/statistics";
+        items[i].json_body = MakeStatisticsJson((int)i, 100);
+        items[i].expect_response = false;
+        items[i].timestamp = time(nullptr);
+    }
+
+    for (int parallel = 0; parallel < 2; ++parallel) {
+        DeleteBenchmarkStorage(dbPath, logDir);
+        {
+            SQLiteQueue queue(dbPath);
+            queue.SetCompression(true, 256);
+            if (parallel)
+                queue.SetWorkPool(&pool);
+
+            QueryPerformanceCounter(&t0);
+            for (size_t first = 0; first < items.size(); first += 500) {
+                std::vector<QueueItem> batch(items.begin() + first, items.begin() + std::min(items.size(), first + 500));
+                queue.AddToQueueBatch(batch);
+            }
+            QueryPerformanceCounter(&t1);
+
+            std::vector<QueueItem> stored = queue.GetPendingItems((int)items.size());
+            bool same = stored.size() == items.size();
+            for (size_t i = 0; same && i < stored.size(); ++i)
+                same = stored[i].json_body == items[i].json_body;
+
+            std::wcout << (parallel ? L"Пачки со сжатием в пуле: " : L"Пачки со сжатием в потоке вызова: ")
+                << (t1.QuadPart - t0.QuadPart) * 1000 / freq.QuadPart << L" мс на " << items.size() << L" запросов"
+                << (same ? L" ✅\n" : L" ❌\n");
+        }
+    }
+    DeleteBenchmarkStorage(dbPath, logDir);
+    pool.Stop();
+
+    // Пул DLL: настройка и счетчики
+    int result = SetWorkPoolOptions(0, 0, THREAD_PRIORITY_BELOW_NORMAL);
+    long long values[5] = {};
+    GetWorkPoolStats(values, 5);
+    std::wcout << L"Пул DLL: код " << result << L", потоков " << values[0] << L", задач " << values[1]
+        << L", взято у других потоков " << values[3] << (result == 0 && values[0] > 0 ? L" ✅\n" : L" ❌\n");
+}
+
+void TestRetrySchedule()
+{
+    EnsureCallbackRegistered();
+
+    std::wcout << L"\n=== Отложенные запросы и расписание повторов ===\n";
+
+    LARGE_INTEGER freq, t0, t1, t2;
+    QueryPerformanceFrequency(&freq);
+
+    // Колесо на модельном времени: каждый срок должен наступить на своем шаге, не раньше
+    const int count = 100000;
+    std::vector<long long> dues(count);
+    TimingWheel wheel;
+    long long start = TimingWheel::NowMs();
+    srand(1);
+    for (int i = 0; i < count; ++i)
+        dues[i] = start + 1000 + (long long)rand() * rand() % (3599 * 1000);
+
+    QueryPerformanceCounter(&t0);
+    for (int i = 0; i < count; ++i)
+        wheel.Schedule(i, dues[i]);
+    QueryPerformanceCounter(&t1);
+
+    std::sort(dues.begin(), dues.end());
+    int fired = 0, mismatches = 0;
+    size_t next = 0;
+    for (long long now = start; now <= start + 3600 * 1000; now += 250) {
+        fired += wheel.Advance(now);
+        while (next < dues.size() && dues[next] <= now - now % TimingWheel::kTickMs)
+            next++;
+        if ((size_t)fired != next)
+            mismatches++;
+    }
+    QueryPerformanceCounter(&t2);
+
+    std::wcout << L"Колесо: " << count << L" сроков за час, добавление "
+        << (t1.QuadPart - t0.QuadPart) * 1000000000.0 / freq.QuadPart / count << L" нс, продвижение на час "
+        << (t2.QuadPart - t1.QuadPart) * 1000 / freq.QuadPart << L" мс, наступило " << fired
+        << (fired == count && mismatches == 0 ? L" ✅\n" : L" ❌\n");
+
+    // Обработчик очереди просыпается к сроку отложенного запроса
+    LocalHttpServer server;
+    if (!StartLocalHttpServer(server)) {
+        std::wcout << L"❌ Не удалось запустить локальный сервер\n";
+        return;
+    }
+    const std::wstring url = L"http://127.0.0.1:" + std::to_wstring(server.port) + L"/statistics";
+
+    if (StartQueueWorkers(1) != 0) {
+        std::wcout << L"❌ Не удалось запустить обработчик очереди\n";
+        StopLocalHttpServer(server);
+        return;
+    }
+    Sleep(200);
+
+    const int delays[] = { 300, 1500, 2500 };
+    for (int delay : delays) {
+        LONG before = server.requests;
+        DWORD sent = GetTickCount();
+        SendHttpRequestQueueDelayed(url.c_str(), L"{\"delayed\":true}", false, delay);
+        while (server.requests == before && GetTickCount() - sent < (DWORD)delay + 3000)
+            Sleep(1);
+        DWORD elapsed = GetTickCount() - sent;
+        // Без расписания обработчик заметил бы запрос только при опросе раз в секунду
+        std::wcout << L"Отложен на " << delay << L" мс, отправлен через " << elapsed << L" мс"
+            << (server.requests > before && elapsed >= (DWORD)delay && elapsed < (DWORD)delay + 100 ? L" ✅\n" : L" ❌\n");
+    }
+
+    long long values[4] = {};
+    GetHttpRetryScheduleStats(values, 4);
+    std::wcout << L"Расписание: в нем " << values[0] << L", наступило " << values[2]
+        << L", загружено из базы " << values[3] << L"\n";
+
+    StopQueueWorkers();
+    StopLocalHttpServer(server);
+}
+
+// Поток, порождающий события в DLL: добавление без URL только публикует QUEUE_ADD_FAILED
+DWORD WINAPI EventProducerThread(LPVOID lpParam)
+{
+    int count = *static_cast<int*>(lpParam);
+    for (int i = 0; i < count; ++i)
+        SendHttpRequestQueueEx(NULL, NULL, false, false, true);
+    return 0;
+}
+
+void BenchmarkEventQueue()
+{
+    std::wcout << L"\n=== Очередь событий ===\n";
+
+    LARGE_INTEGER freq, t0, t1;
+    QueryPerformanceFrequency(&freq);
+
+    // Разбор накопившихся событий: удаление из начала вектора сдвигает весь остаток
+    const int backlog = 16384;
+    const std::wstring type = L"QUEUE_ADD_SUCCESS";
+    const std::wstring data = L"Запрос добавлен в очередь без ожидания ответа";
+
+    std::vector<std::pair<std::wstring, std::wstring>> vectorEvents;
+    CRITICAL_SECTION cs;
+    InitializeCriticalSection(&cs);
+    for (int i = 0; i < backlog; ++i)
+        vectorEvents.push_back(std::make_pair(type, data));
+
+    QueryPerformanceCounter(&t0);
+    int vectorTaken = 0;
+    for (;;) {
+        EnterCriticalSection(&cs);
+        if (vectorEvents.empty()) {
+            LeaveCriticalSection(&cs);
+            break;
+        }
+        std::pair<std::wstring, std::wstring> event = vectorEvents.front();
+        vectorEvents.erase(vectorEvents.begin());
+        LeaveCriticalSection(&cs);
+        vectorTaken++;
+    }
+    QueryPerformanceCounter(&t1);
+    double vectorMs = (t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart;
+    DeleteCriticalSection(&cs);
+
+    MpscRing<std::pair<std::wstring, std::wstring>> ring(backlog);
+    for (int i = 0; i < backlog; ++i)
+        ring.TryPush(std::make_pair(type, data));
+
+    QueryPerformanceCounter(&t0);
+    int ringTaken = 0;
+    std::pair<std::wstring, std::wstring> event;
+    while (ring.TryPop(event))
+        ringTaken++;
+    QueryPerformanceCounter(&t1);
+    double ringMs = (t1.QuadPart - t0.QuadPart) * 1000.0 / freq.QuadPart;
+
+    std::wcout << L"Разбор " << backlog << L" накопившихся событий:\n"
+        << L"  вектор с удалением из начала: " << vectorMs << L" мс (" << vectorTaken << L")\n"
+        << L"  кольцевой буфер: " << ringMs << L" мс (" << ringTaken << L")\n";
+
+    // Несколько потоков DLL публикуют события, пока читатель разбирает их через GetNextEvent
+    const int producers = 4;
+    int perProducer = 50000;
+    ClearEvents();
+    long long before[4] = {};
+    GetEventQueueStats(before, 4);
+
+    HANDLE threads[producers];
+    QueryPerformanceCounter(&t0);
+    for (int i = 0; i < producers; ++i)
+        threads[i] = CreateThread(NULL, 0, EventProducerThread, &perProducer, 0, NULL);
+
+    wchar_t eventType[64];
+    wchar_t eventData[256];
+    long long received = 0;
+    DWORD waitResult;
+    do {
+        waitResult = WaitForMultipleObjects(producers, threads, TRUE, 0);
+        while (GetNextEvent(eventType, 64, eventData, 256))
+            received++;
+    } while (waitResult == WAIT_TIMEOUT);
+    while (GetNextEvent(eventType, 64, eventData, 256))
+        received++;
+    QueryPerformanceCounter(&t1);
+
+    for (int i = 0; i < producers; ++i)
+        CloseHandle(threads[i]);
+
+    long long after[4] = {};
+    GetEventQueueStats(after, 4);
+    long long queued = after[2] - before[2];
+    long long dropped = after[3] - before[3];
+    double seconds = (double)(t1.QuadPart - t0.QuadPart) / freq.QuadPart;
+
+    std::wcout << producers << L" потока по " << perProducer << L" событий, емкость очереди " << after[1] << L":\n"
+        << L"  получено " << received << L", отброшено при заполнении " << dropped << L"\n"
+        << L"  " << (long long)(received / seconds) << L" событий в секунду"
+        << (received == queued && queued + dropped == (long long)producers * perProducer ? L" ✅\n" : L" ❌\n");
+}
+
 void PrintMenu()
 {
     std::wcout << L"\n=== Тестер GCore DLL ===\n";
@@ -365,8 +2503,33 @@ void PrintMenu()
     std::wcout << L"10. Детальный анализ ответов\n";
     std::wcout << L"11. Тест callback-событий\n";
     std::wcout << L"12. Показать статистику событий\n";
+    std::wcout << L"13. Бенчмарк сжатия тел\n";
+    std::wcout << L"14. Счетчики глубины и возраста очереди\n";
+    std::wcout << L"15. Бенчмарк хранилищ очереди\n";
+    std::wcout << L"16. Бенчмарк буфера очереди в памяти\n";
+    std::wcout << L"17. Конкуренция за базу: запись и чтение из потоков\n";
+    std::wcout << L"18. Объединение запросов по ключу\n";
+    std::wcout << L"19. Недоставленные запросы\n";
+    std::wcout << L"20. Подбор параметров базы (mmap, кэш, страница)\n";
+    std::wcout << L"21. Бенчмарк выборки очереди пачкой\n";
+    std::wcout << L"22. Несколько процессов: общая и отдельные базы\n";
+    std::wcout << L"23. Выгрузка и загрузка очереди\n";
+    std::wcout << L"24. Время хранения ответов и вытеснение\n";
+    std::wcout << L"25. Постоянные обработчики очереди\n";
+    std::wcout << L"26. Лимит частоты отправки на локальный сервер\n";
+    std::wcout << L"27. Разбор очереди конвейером с предвыборкой\n";
+    std::wcout << L"28. Одновременная отправка: 10000 запросов с задержкой 50 мс\n";
+    std::wcout << L"29. Объединение запросов в один POST\n";
+    std::wcout << L"30. Подстройка лимита одновременных отправок\n";
+    std::wcout << L"31. Сроки доставки запросов (EDF)\n";
+    std::wcout << L"32. Завершение с таймаутом и прерыванием запросов\n";
+    std::wcout << L"33. Ограничение очереди при переполнении\n";
+    std::wcout << L"34. Общий пул потоков: похищение задач и сжатие пачек\n";
+    std::wcout << L"35. Отложенные запросы и расписание повторов\n";
+    std::wcout << L"36. Очередь событий: несколько потоков и разбор\n";
+    std::wcout << L"37. Журнал очереди: подтверждения не по порядку и перезапуск\n";
     std::wcout << L"0. Выход\n";
-    std::wcout << L"Выберите опцию (0-12): ";
+    std::wcout << L"Выберите опцию (0-37): ";
 }
 
 int ReadMenuOption()
@@ -406,6 +2569,10 @@ int wmain(int argc, wchar_t* argv[])
     _setmode(_fileno(stdout), _O_U16TEXT);
     _setmode(_fileno(stdin), _O_U16TEXT);
 
+    // Дочерний процесс бенчмарка пункта 22
+    if (argc >= 4 && std::wstring(argv[1]) == L"--enqueue-worker")
+        return RunEnqueueWorker(argv[2], _wtoi(argv[3]));
+
     if (argc < 2) {
         std::wcout << L"Использование: Tester.exe <serverUrl>\n";
         std::wcout << L"Пример: Tester.exe http://site.ru/base/hs/name/proc/\n";
@@ -446,6 +2613,31 @@ int wmain(int argc, wchar_t* argv[])
                 std::wcout << L"  Нет событий\n";
             }
             break;
+        case 13: BenchmarkCompression(); break;
+        case 14: BenchmarkQueueStats(); break;
+        case 15: BenchmarkQueueBackends(); break;
+        case 16: BenchmarkWriteBehind(); break;
+        case 17: BenchmarkStorageConcurrency(); break;
+        case 18: BenchmarkQueueCoalescing(); break;
+        case 19: TestDeadLetters(); break;
+        case 20: BenchmarkStorageOptions(); break;
+        case 21: BenchmarkPendingBatch(); break;
+        case 22: BenchmarkMultiProcess(); break;
+        case 23: BenchmarkQueueArchive(); break;
+        case 24: TestResponseExpiry(); break;
+        case 25: TestQueueWorkers(urlW); break;
+        case 26: BenchmarkRateLimit(); break;
+        case 27: BenchmarkPipelinedDrain(); break;
+        case 28: BenchmarkConcurrentDispatch(); break;
+        case 29: BenchmarkQueueBatching(); break;
+        case 30: BenchmarkAdaptiveConcurrency(); break;
+        case 31: TestDeadlineScheduling(urlW); break;
+        case 32: TestBoundedShutdown(); break;
+        case 33: TestQueueBackpressure(); break;
+        case 34: BenchmarkWorkStealingPool(); break;
+        case 35: TestRetrySchedule(); break;
+        case 36: BenchmarkEventQueue(); break;
+        case 37: TestSegmentLogAcks(); break;
         default: std::wcout << L"\n❌ Неизвестная опция\n"; break;
         }
 